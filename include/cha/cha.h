@@ -0,0 +1,68 @@
+#ifndef CHA_CHA_H
+#define CHA_CHA_H
+
+/*
+ * C interface to cha::Compiler, for programs that compile cha sources at
+ * run time without going through files. Strings returned by a result stay
+ * valid until the result is destroyed.
+ */
+
+#include <stddef.h>
+
+#include "cha/export.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum cha_format {
+  CHA_FORMAT_LLVM_IR = 0,
+  CHA_FORMAT_ASSEMBLY = 1,
+  CHA_FORMAT_OBJECT = 2,
+  CHA_FORMAT_AST = 3,
+  CHA_FORMAT_BITCODE = 4,
+} cha_format;
+
+typedef struct cha_compiler cha_compiler;
+typedef struct cha_result cha_result;
+
+/* Version of the compiler, e.g. "0.0.1" */
+CHA_API const char *cha_version(void);
+
+/* Create a compile session, NULL when out of memory */
+CHA_API cha_compiler *cha_compiler_create(void);
+CHA_API void cha_compiler_destroy(cha_compiler *compiler);
+
+/* Directory searched for the .chai interfaces of imported modules */
+CHA_API void cha_compiler_add_import_path(cha_compiler *compiler,
+                                          const char *path);
+
+/* Compile size bytes of source text. name is used in diagnostics and to
+ * find imports next to it, it may be NULL. Returns NULL when out of
+ * memory. */
+CHA_API cha_result *cha_compile(cha_compiler *compiler, const char *source,
+                                size_t size, const char *name,
+                                cha_format format);
+CHA_API void cha_result_destroy(cha_result *result);
+
+/* 1 when the source compiled, 0 when there are diagnostics */
+CHA_API int cha_result_success(const cha_result *result);
+
+/* The output, size set to its length in bytes */
+CHA_API const char *cha_result_output(const cha_result *result, size_t *size);
+
+CHA_API size_t cha_result_diagnostic_count(const cha_result *result);
+CHA_API const char *cha_result_diagnostic_file(const cha_result *result,
+                                               size_t index);
+/* 1 based, 0 when the diagnostic has no location */
+CHA_API int cha_result_diagnostic_line(const cha_result *result, size_t index);
+CHA_API int cha_result_diagnostic_column(const cha_result *result,
+                                         size_t index);
+CHA_API const char *cha_result_diagnostic_message(const cha_result *result,
+                                                  size_t index);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CHA_CHA_H */
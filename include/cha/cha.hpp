@@ -1,6 +1,11 @@
 #pragma once
 
+#include "cha/export.h"
+
+#include <cstddef>
+#include <memory>
 #include <string>
+#include <vector>
 
 namespace cha {
 
@@ -9,9 +14,197 @@ enum class CompileFormat {
   ASSEMBLY_FILE,
   OBJECT_FILE,
   BINARY_FILE,
+  AST_FILE,
+  BITCODE,
+};
+
+enum class DebugInfo {
+  NONE,
+  // DWARF line tables only, enough to map machine code back to cha lines
+  LINE_TABLES_ONLY,
+  // Line tables plus function signatures, arguments and local variables
+  FULL,
+};
+
+struct CompileOptions {
+  // Read the input as a binary AST written by AST_FILE, skipping parse and
+  // validation
+  bool load_ast = false;
+
+  // Instrument the program to write a raw profile to this file when it exits
+  // (the LLVM_PROFILE_FILE environment variable overrides it at run time)
+  std::string profile_generate;
+
+  // Indexed profile (.profdata) used to annotate branch weights and function
+  // entry counts before optimization
+  std::string profile_use;
+
+  // Sample profile (LLVM text or extbinary format, e.g. converted from perf
+  // LBR data) matched to functions through DWARF line tables
+  std::string sample_profile;
+
+  DebugInfo debug_info = DebugInfo::NONE;
+
+  // Keep the frame pointer in every function so profilers can unwind the
+  // stack without DWARF call frame information
+  bool frame_pointers = false;
+
+  // Generate code as fast as possible, e.g. for debug builds: value names
+  // are discarded, the module is not verified, and the backend runs its -O0
+  // pipeline with the fast instruction selector (FastISel, or GlobalISel on
+  // targets where it is the -O0 default)
+  bool fast_compile = false;
+
+  // Compile a source module while it is parsed: each top-level declaration
+  // is validated and generated as soon as the names it uses are known, then
+  // its AST is dropped, so the whole tree of a huge source is never held in
+  // memory. Declarations using names declared further down wait for the end
+  // of the file. Modules whose constants call functions, binary ASTs and
+  // AST_FILE outputs are compiled as a whole.
+  bool streaming = false;
+
+  // Parse only the signatures of a module's functions at first, skipping
+  // their bodies at the speed of the scanner, then the bodies of the
+  // functions reached by calls from main, the exported functions and the
+  // constants. The others are never parsed, validated nor generated, so
+  // errors in their bodies are not reported. Linked programs of several
+  // modules are parsed whole. Takes precedence over streaming.
+  bool lazy_bodies = false;
+
+  // Let interpret() compile functions called at least jit_threshold times
+  // to native code on a background thread
+  bool jit = false;
+  unsigned jit_threshold = 1000;
+
+  // Describe JIT-compiled functions to perf in /tmp/perf-<pid>.map and, when
+  // LLVM is built with perf support, a jitdump with line info from debug_info
+  bool jit_perf = false;
+
+  // Files compiled at once into an output directory, 0 for one per core.
+  // Under make, jobs beyond the first also wait for a jobserver token.
+  unsigned jobs = 0;
+
+  // Directories searched for the .chai interface of an imported module when
+  // it is not next to the importing file
+  std::vector<std::string> import_paths;
+
+  // Directory where ThinLTO keeps the machine code of each module between
+  // links, so relinking only compiles the modules that changed
+  std::string lto_cache;
 };
 
-int compile(const std::string &file, CompileFormat format,
-            const std::string &output_file);
+// Compile one module. Unless the format is BINARY_FILE, the interface of a
+// module with exports is also written next to output_file with the .chai
+// extension, for the modules importing it.
+CHA_API int compile(const std::string &file, CompileFormat format,
+                    const std::string &output_file,
+                    const CompileOptions &options = CompileOptions());
+
+// Compile one module into several formats at once, each written to output
+// with the extension of the format (.ll, .s, .o, .bc or .chast) and the
+// executable of BINARY_FILE to output itself. The module is parsed,
+// validated and optimized once, and the machine code formats are generated
+// in parallel from the same optimized module, so the outputs match.
+CHA_API int compile(const std::string &file,
+                    const std::vector<CompileFormat> &formats,
+                    const std::string &output,
+                    const CompileOptions &options = CompileOptions());
+
+// Compile several modules into one program. With more than one input (or any
+// .bc input) the modules are linked with ThinLTO, which requires BINARY_FILE.
+// When output_file is a directory (or ends with '/') each input is instead
+// compiled on its own into <output_file>/<stem>.<extension>, CompileOptions::
+// jobs at a time.
+CHA_API int compile(const std::vector<std::string> &files, CompileFormat format,
+                    const std::string &output_file,
+                    const CompileOptions &options = CompileOptions());
+
+// Parse and validate modules without generating code, reporting every error.
+// Several files are checked as the modules of one program, like compile()
+// links them. Also provided by the cha_frontend library, which does not
+// depend on LLVM.
+CHA_API int check(const std::vector<std::string> &files,
+                  const CompileOptions &options = CompileOptions());
+
+// Build the project described by a manifest (see build.hpp): compile its
+// modules to bitcode in import order on CompileOptions::jobs threads, skip
+// the modules whose source, options and imported interfaces did not change,
+// then link them with ThinLTO
+CHA_API int build(const std::string &manifest,
+                  const CompileOptions &options = CompileOptions());
+
+// Compile like compile(files, ...), then again each time one of the files
+// changes, until the process is stopped. A linked program stays in memory:
+// only the sources that changed are parsed, only the modules using
+// declarations that changed are validated again, code is only generated for
+// those, and the ThinLTO cache (<output_file>.lto-cache by default) keeps
+// the machine code of the others, module by module. The interfaces of
+// modules imported from outside of the files are watched too. Returns 1
+// when the files cannot be watched.
+CHA_API int watch(const std::vector<std::string> &files, CompileFormat format,
+                  const std::string &output_file,
+                  const CompileOptions &options = CompileOptions());
+
+// Build a project like build(), then again each time one of its sources or
+// its manifest changes
+CHA_API int watch_build(const std::string &manifest,
+                        const CompileOptions &options = CompileOptions());
+
+// Run a module's main with the bytecode interpreter. LLVM is only
+// initialized once a function gets hot with CompileOptions::jit. Returns
+// main's result, 0 for a void main or 1 on errors.
+CHA_API int interpret(const std::string &file,
+                      const CompileOptions &options = CompileOptions());
+
+// Merge the raw profiles written by instrumented programs into an indexed
+// profile for CompileOptions::profile_use
+CHA_API int merge_profiles(const std::vector<std::string> &input_files,
+                           const std::string &output_file);
+
+// An error found by Compiler, lines and columns start at 1 and are 0 when
+// the error has no location
+struct CompileDiagnostic {
+  std::string file;
+  int line = 0;
+  int column = 0;
+  std::string message;
+};
+
+struct CompileResult {
+  bool success = false;
+  // IR text, bitcode, object file, assembly or binary AST, empty on errors
+  std::string output;
+  std::vector<CompileDiagnostic> diagnostics;
+};
+
+// A compile session for programs embedding the compiler. Sources are
+// compiled from memory to memory, without temporary files. The target
+// machines of the calling thread are kept between compiles, and the LLVM
+// context for a few dozen compiles before it is replaced, so long sessions do
+// not accumulate its types and constants. A session compiles one source at a
+// time; use one per thread.
+class CHA_API Compiler {
+public:
+  explicit Compiler(const CompileOptions &options = CompileOptions());
+  ~Compiler();
+
+  Compiler(const Compiler &) = delete;
+  Compiler &operator=(const Compiler &) = delete;
+
+  // Compile source text, or a binary AST with CompileOptions::load_ast, to
+  // any format but BINARY_FILE. The name is used in diagnostics and debug
+  // info, and imports are searched next to it and in the import paths.
+  CompileResult compile(const char *data, size_t size, CompileFormat format,
+                        const std::string &name = "input.cha");
+  CompileResult compile(const std::string &source, CompileFormat format,
+                        const std::string &name = "input.cha");
+
+  // Options of the following compiles
+  CompileOptions &options();
+
+private:
+  struct Session;
+  std::unique_ptr<Session> session_;
+};
 
 } // namespace cha
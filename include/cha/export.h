@@ -0,0 +1,14 @@
+#ifndef CHA_EXPORT_H
+#define CHA_EXPORT_H
+
+/*
+ * libcha is built with hidden visibility, only the entry points of cha.h and
+ * cha.hpp marked with CHA_API are exported.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+#define CHA_API __attribute__((visibility("default")))
+#else
+#define CHA_API
+#endif
+
+#endif /* CHA_EXPORT_H */
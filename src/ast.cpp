@@ -26,6 +26,184 @@ AstNodeList clone_node_list(const AstNodeList &list) {
   return cloned;
 }
 
+namespace {
+
+// Builds the copy of a node from the copies of its children, given in the
+// order of child_nodes()
+class NodeCopier : public AstVisitor {
+public:
+  explicit NodeCopier(AstNodeList children) : children_(std::move(children)) {}
+
+  AstNodePtr copy;
+
+  // Leaves copy themselves
+  void visit(const ConstantIntegerNode &node) override { copy = node.clone(); }
+  void visit(const ConstantUnsignedIntegerNode &node) override {
+    copy = node.clone();
+  }
+  void visit(const ConstantFloatNode &node) override { copy = node.clone(); }
+  void visit(const ConstantBoolNode &node) override { copy = node.clone(); }
+  void visit(const VariableLookupNode &node) override { copy = node.clone(); }
+  void visit(const ArgumentNode &node) override { copy = node.clone(); }
+  void visit(const ImportNode &node) override { copy = node.clone(); }
+
+  void visit(const BinaryOpNode &node) override {
+    AstNodePtr left = take();
+    AstNodePtr right = take();
+    finish(node, std::make_unique<BinaryOpNode>(node.location(), node.op(),
+                                                std::move(left),
+                                                std::move(right)));
+  }
+  void visit(const UnaryOpNode &node) override {
+    finish(node,
+           std::make_unique<UnaryOpNode>(node.location(), node.op(), take()));
+  }
+  void visit(const VariableDeclarationNode &node) override {
+    finish(node, std::make_unique<VariableDeclarationNode>(
+                     node.location(), node.identifier(), node.type().clone(),
+                     node.value() ? take() : nullptr));
+  }
+  void visit(const VariableAssignmentNode &node) override {
+    finish(node, std::make_unique<VariableAssignmentNode>(
+                     node.location(), node.identifier(), take()));
+  }
+  void visit(const BlockNode &node) override {
+    finish(node, std::make_unique<BlockNode>(node.location(),
+                                             take(node.statements().size())));
+  }
+  void visit(const FunctionDeclarationNode &node) override {
+    AstNodeList arguments = take(node.arguments().size());
+    auto cloned = std::make_unique<FunctionDeclarationNode>(
+        node.location(), node.identifier(), node.return_type().clone(),
+        std::move(arguments), take(node.body().size()));
+    cloned->set_exported(node.exported());
+    cloned->skip_body(node.skipped_body());
+    finish(node, std::move(cloned));
+  }
+  void visit(const FunctionCallNode &node) override {
+    finish(node, std::make_unique<FunctionCallNode>(
+                     node.location(), node.identifier(),
+                     take(node.arguments().size())));
+  }
+  void visit(const FunctionReturnNode &node) override {
+    finish(node, std::make_unique<FunctionReturnNode>(
+                     node.location(), node.value() ? take() : nullptr));
+  }
+  void visit(const IfNode &node) override {
+    AstNodePtr condition = take();
+    AstNodeList then_block = take(node.then_block().size());
+    finish(node, std::make_unique<IfNode>(node.location(), std::move(condition),
+                                          std::move(then_block),
+                                          take(node.else_block().size())));
+  }
+  void visit(const ConstantDeclarationNode &node) override {
+    auto cloned = std::make_unique<ConstantDeclarationNode>(
+        node.location(), node.identifier(), take());
+    cloned->set_exported(node.exported());
+    finish(node, std::move(cloned));
+  }
+
+private:
+  AstNodeList children_;
+  size_t next_ = 0;
+
+  AstNodePtr take() { return std::move(children_[next_++]); }
+
+  AstNodeList take(size_t count) {
+    AstNodeList taken;
+    taken.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+      taken.push_back(take());
+    }
+    return taken;
+  }
+
+  void finish(const AstNode &node, AstNodePtr cloned) {
+    if (node.result_type()) {
+      cloned->set_result_type(node.result_type()->clone());
+    }
+    copy = std::move(cloned);
+  }
+};
+
+// Copies a tree with an explicit stack, the children of a node before it, so
+// that copying deeply nested nodes does not recurse
+AstNodePtr clone_tree(const AstNode &root) {
+  struct Open {
+    const AstNode *node;
+    std::vector<const AstNode *> children;
+    AstNodeList copies;
+  };
+  std::vector<Open> open;
+  open.push_back(Open{&root, child_nodes(root), {}});
+  while (true) {
+    Open &top = open.back();
+    if (top.copies.size() < top.children.size()) {
+      const AstNode *child = top.children[top.copies.size()];
+      open.push_back(Open{child, child_nodes(*child), {}});
+      continue;
+    }
+
+    NodeCopier copier(std::move(top.copies));
+    top.node->accept(copier);
+    open.pop_back();
+    if (open.empty()) {
+      return std::move(copier.copy);
+    }
+    open.back().copies.push_back(std::move(copier.copy));
+  }
+}
+
+} // namespace
+
+void AstNode::destroy_children() {
+  AstNodeList pending;
+  release_children(pending);
+  while (!pending.empty()) {
+    AstNodePtr node = std::move(pending.back());
+    pending.pop_back();
+    if (node) {
+      node->release_children(pending);
+    }
+  }
+}
+
+BinaryOpNode::~BinaryOpNode() { destroy_children(); }
+
+void BinaryOpNode::release_children(AstNodeList &children) {
+  children.push_back(std::move(left_));
+  children.push_back(std::move(right_));
+}
+
+UnaryOpNode::~UnaryOpNode() { destroy_children(); }
+
+void UnaryOpNode::release_children(AstNodeList &children) {
+  children.push_back(std::move(operand_));
+}
+
+FunctionCallNode::~FunctionCallNode() { destroy_children(); }
+
+void FunctionCallNode::release_children(AstNodeList &children) {
+  for (auto &argument : arguments_) {
+    children.push_back(std::move(argument));
+  }
+  arguments_.clear();
+}
+
+IfNode::~IfNode() { destroy_children(); }
+
+void IfNode::release_children(AstNodeList &children) {
+  children.push_back(std::move(condition_));
+  for (auto &statement : then_block_) {
+    children.push_back(std::move(statement));
+  }
+  for (auto &statement : else_block_) {
+    children.push_back(std::move(statement));
+  }
+  then_block_.clear();
+  else_block_.clear();
+}
+
 // Clone implementations for all node types
 AstNodePtr ConstantIntegerNode::clone() const {
   auto cloned = std::make_unique<ConstantIntegerNode>(location(), value_);
@@ -60,42 +238,13 @@ AstNodePtr ConstantBoolNode::clone() const {
   return std::move(cloned);
 }
 
-AstNodePtr BinaryOpNode::clone() const {
-  auto cloned = std::make_unique<BinaryOpNode>(location(), op_, left_->clone(),
-                                               right_->clone());
-  if (result_type()) {
-    cloned->set_result_type(result_type()->clone());
-  }
-  return std::move(cloned);
-}
+AstNodePtr BinaryOpNode::clone() const { return clone_tree(*this); }
 
-AstNodePtr UnaryOpNode::clone() const {
-  auto cloned =
-      std::make_unique<UnaryOpNode>(location(), op_, operand_->clone());
-  if (result_type()) {
-    cloned->set_result_type(result_type()->clone());
-  }
-  return std::move(cloned);
-}
+AstNodePtr UnaryOpNode::clone() const { return clone_tree(*this); }
 
-AstNodePtr VariableDeclarationNode::clone() const {
-  auto cloned = std::make_unique<VariableDeclarationNode>(
-      location(), identifier_, type_->clone(),
-      value_ ? value_->clone() : nullptr);
-  if (result_type()) {
-    cloned->set_result_type(result_type()->clone());
-  }
-  return std::move(cloned);
-}
+AstNodePtr VariableDeclarationNode::clone() const { return clone_tree(*this); }
 
-AstNodePtr VariableAssignmentNode::clone() const {
-  auto cloned = std::make_unique<VariableAssignmentNode>(
-      location(), identifier_, value_->clone());
-  if (result_type()) {
-    cloned->set_result_type(result_type()->clone());
-  }
-  return std::move(cloned);
-}
+AstNodePtr VariableAssignmentNode::clone() const { return clone_tree(*this); }
 
 AstNodePtr VariableLookupNode::clone() const {
   auto cloned = std::make_unique<VariableLookupNode>(location(), identifier_);
@@ -114,60 +263,20 @@ AstNodePtr ArgumentNode::clone() const {
   return std::move(cloned);
 }
 
-AstNodePtr BlockNode::clone() const {
-  auto cloned =
-      std::make_unique<BlockNode>(location(), clone_node_list(statements_));
-  if (result_type()) {
-    cloned->set_result_type(result_type()->clone());
-  }
-  return std::move(cloned);
-}
+AstNodePtr BlockNode::clone() const { return clone_tree(*this); }
 
-AstNodePtr FunctionDeclarationNode::clone() const {
-  auto cloned = std::make_unique<FunctionDeclarationNode>(
-      location(), identifier_, return_type_->clone(),
-      clone_node_list(arguments_), clone_node_list(body_));
-  if (result_type()) {
-    cloned->set_result_type(result_type()->clone());
-  }
-  return std::move(cloned);
-}
+AstNodePtr FunctionDeclarationNode::clone() const { return clone_tree(*this); }
 
-AstNodePtr FunctionCallNode::clone() const {
-  auto cloned = std::make_unique<FunctionCallNode>(location(), identifier_,
-                                                   clone_node_list(arguments_));
-  if (result_type()) {
-    cloned->set_result_type(result_type()->clone());
-  }
-  return std::move(cloned);
-}
+AstNodePtr FunctionCallNode::clone() const { return clone_tree(*this); }
 
-AstNodePtr FunctionReturnNode::clone() const {
-  auto cloned = std::make_unique<FunctionReturnNode>(
-      location(), value_ ? value_->clone() : nullptr);
-  if (result_type()) {
-    cloned->set_result_type(result_type()->clone());
-  }
-  return std::move(cloned);
-}
+AstNodePtr FunctionReturnNode::clone() const { return clone_tree(*this); }
 
-AstNodePtr IfNode::clone() const {
-  auto cloned = std::make_unique<IfNode>(location(), condition_->clone(),
-                                         clone_node_list(then_block_),
-                                         clone_node_list(else_block_));
-  if (result_type()) {
-    cloned->set_result_type(result_type()->clone());
-  }
-  return std::move(cloned);
-}
+AstNodePtr IfNode::clone() const { return clone_tree(*this); }
 
-AstNodePtr ConstantDeclarationNode::clone() const {
-  auto cloned = std::make_unique<ConstantDeclarationNode>(
-      location(), identifier_, value_->clone());
-  if (result_type()) {
-    cloned->set_result_type(result_type()->clone());
-  }
-  return std::move(cloned);
+AstNodePtr ConstantDeclarationNode::clone() const { return clone_tree(*this); }
+
+AstNodePtr ImportNode::clone() const {
+  return std::make_unique<ImportNode>(location(), module_);
 }
 
 // Constructor implementations with type setting
@@ -293,4 +402,72 @@ void ConstantDeclarationNode::accept(AstVisitor &visitor) {
   visitor.visit(*this);
 }
 
+void ImportNode::accept(AstVisitor &visitor) const { visitor.visit(*this); }
+
+void ImportNode::accept(AstVisitor &visitor) { visitor.visit(*this); }
+
+namespace {
+
+class ChildCollector : public AstVisitor {
+public:
+  std::vector<const AstNode *> nodes;
+
+  void visit(const ConstantIntegerNode &) override {}
+  void visit(const ConstantUnsignedIntegerNode &) override {}
+  void visit(const ConstantFloatNode &) override {}
+  void visit(const ConstantBoolNode &) override {}
+  void visit(const BinaryOpNode &node) override {
+    nodes.push_back(&node.left());
+    nodes.push_back(&node.right());
+  }
+  void visit(const UnaryOpNode &node) override {
+    nodes.push_back(&node.operand());
+  }
+  void visit(const VariableDeclarationNode &node) override {
+    if (node.value()) {
+      nodes.push_back(node.value());
+    }
+  }
+  void visit(const VariableAssignmentNode &node) override {
+    nodes.push_back(&node.value());
+  }
+  void visit(const VariableLookupNode &) override {}
+  void visit(const ArgumentNode &) override {}
+  void visit(const BlockNode &node) override { add(node.statements()); }
+  void visit(const FunctionDeclarationNode &node) override {
+    add(node.arguments());
+    add(node.body());
+  }
+  void visit(const FunctionCallNode &node) override { add(node.arguments()); }
+  void visit(const FunctionReturnNode &node) override {
+    if (node.value()) {
+      nodes.push_back(node.value());
+    }
+  }
+  void visit(const IfNode &node) override {
+    nodes.push_back(&node.condition());
+    add(node.then_block());
+    add(node.else_block());
+  }
+  void visit(const ConstantDeclarationNode &node) override {
+    nodes.push_back(&node.value());
+  }
+  void visit(const ImportNode &) override {}
+
+private:
+  void add(const AstNodeList &list) {
+    for (const auto &node : list) {
+      nodes.push_back(node.get());
+    }
+  }
+};
+
+} // namespace
+
+std::vector<const AstNode *> child_nodes(const AstNode &node) {
+  ChildCollector collector;
+  node.accept(collector);
+  return collector.nodes;
+}
+
 } // namespace cha
@@ -185,6 +185,7 @@ class FunctionCallNode;
 class FunctionReturnNode;
 class IfNode;
 class ConstantDeclarationNode;
+class ImportNode;
 
 // Generic visitor interface
 class AstVisitor {
@@ -208,6 +209,7 @@ public:
   virtual void visit(const FunctionReturnNode &node) = 0;
   virtual void visit(const IfNode &node) = 0;
   virtual void visit(const ConstantDeclarationNode &node) = 0;
+  virtual void visit(const ImportNode &node) = 0;
 
   // Non-const visitor methods (for validation that modifies AST with types)
   virtual void visit(ConstantIntegerNode &node) {
@@ -256,6 +258,9 @@ public:
   virtual void visit(ConstantDeclarationNode &node) {
     visit(const_cast<const ConstantDeclarationNode &>(node));
   }
+  virtual void visit(ImportNode &node) {
+    visit(const_cast<const ImportNode &>(node));
+  }
 };
 
 // AST Node base class
@@ -278,6 +283,12 @@ public:
 protected:
   explicit AstNode(AstLocation loc) : location_(std::move(loc)) {}
 
+  // Nodes that nest, e.g. in generated sources millions deep, destroy their
+  // children with an explicit stack: each node moves its children out with
+  // release_children() before it is deleted, so no destructor recurses
+  virtual void release_children(AstNodeList &) {}
+  void destroy_children();
+
 private:
   AstLocation location_;
   AstTypePtr result_type_;
@@ -342,6 +353,7 @@ public:
                AstNodePtr right)
       : AstNode(std::move(loc)), op_(op), left_(std::move(left)),
         right_(std::move(right)) {}
+  ~BinaryOpNode() override;
 
   BinaryOperator op() const { return op_; }
   const AstNode &left() const { return *left_; }
@@ -354,12 +366,15 @@ private:
   BinaryOperator op_;
   AstNodePtr left_;
   AstNodePtr right_;
+
+  void release_children(AstNodeList &children) override;
 };
 
 class UnaryOpNode : public AstNode {
 public:
   UnaryOpNode(AstLocation loc, UnaryOperator op, AstNodePtr operand)
       : AstNode(std::move(loc)), op_(op), operand_(std::move(operand)) {}
+  ~UnaryOpNode() override;
 
   UnaryOperator op() const { return op_; }
   const AstNode &operand() const { return *operand_; }
@@ -370,6 +385,8 @@ public:
 private:
   UnaryOperator op_;
   AstNodePtr operand_;
+
+  void release_children(AstNodeList &children) override;
 };
 
 class VariableDeclarationNode : public AstNode {
@@ -455,6 +472,15 @@ private:
   AstNodeList statements_;
 };
 
+// Where a function body is in its source: byte offset and size from the
+// opening to the closing brace, and the location of the opening brace
+struct SourceRange {
+  size_t offset = 0;
+  size_t size = 0;
+  int line = 0;
+  int column = 0;
+};
+
 class FunctionDeclarationNode : public AstNode {
 public:
   FunctionDeclarationNode(AstLocation loc, std::string identifier,
@@ -468,6 +494,21 @@ public:
   const AstType &return_type() const { return *return_type_; }
   const AstNodeList &arguments() const { return arguments_; }
   const AstNodeList &body() const { return body_; }
+
+  // Exported functions can be called from outside the program
+  bool exported() const { return exported_; }
+  void set_exported(bool exported) { exported_ = exported; }
+
+  // Functions parsed by parse_signatures() only have the range of their body
+  // in the source until parse_body() sets it
+  bool body_skipped() const { return skipped_body_.size > 0; }
+  const SourceRange &skipped_body() const { return skipped_body_; }
+  void skip_body(const SourceRange &range) { skipped_body_ = range; }
+  void set_body(AstNodeList body) {
+    body_ = std::move(body);
+    skipped_body_ = SourceRange();
+  }
+
   AstNodePtr clone() const override;
   void accept(AstVisitor &visitor) const override;
   void accept(AstVisitor &visitor) override;
@@ -477,6 +518,8 @@ private:
   AstTypePtr return_type_;
   AstNodeList arguments_;
   AstNodeList body_;
+  bool exported_ = false;
+  SourceRange skipped_body_;
 };
 
 class FunctionCallNode : public AstNode {
@@ -485,6 +528,7 @@ public:
                    AstNodeList arguments)
       : AstNode(std::move(loc)), identifier_(std::move(identifier)),
         arguments_(std::move(arguments)) {}
+  ~FunctionCallNode() override;
 
   const std::string &identifier() const { return identifier_; }
   const AstNodeList &arguments() const { return arguments_; }
@@ -495,6 +539,8 @@ public:
 private:
   std::string identifier_;
   AstNodeList arguments_;
+
+  void release_children(AstNodeList &children) override;
 };
 
 class FunctionReturnNode : public AstNode {
@@ -518,6 +564,7 @@ public:
       : AstNode(std::move(loc)), condition_(std::move(condition)),
         then_block_(std::move(then_block)), else_block_(std::move(else_block)) {
   }
+  ~IfNode() override;
 
   const AstNode &condition() const { return *condition_; }
   const AstNodeList &then_block() const { return then_block_; }
@@ -531,6 +578,8 @@ private:
   AstNodePtr condition_;
   AstNodeList then_block_;
   AstNodeList else_block_;
+
+  void release_children(AstNodeList &children) override;
 };
 
 class ConstantDeclarationNode : public AstNode {
@@ -542,6 +591,12 @@ public:
 
   const std::string &identifier() const { return identifier_; }
   const AstNode &value() const { return *value_; }
+  void set_value(AstNodePtr value) { value_ = std::move(value); }
+
+  // Exported constants are part of the module's interface
+  bool exported() const { return exported_; }
+  void set_exported(bool exported) { exported_ = exported; }
+
   AstNodePtr clone() const override;
   void accept(AstVisitor &visitor) const override;
   void accept(AstVisitor &visitor) override;
@@ -549,9 +604,30 @@ public:
 private:
   std::string identifier_;
   AstNodePtr value_;
+  bool exported_ = false;
+};
+
+// Makes the exported functions and constants of another module available,
+// through the interface file written when that module was compiled
+class ImportNode : public AstNode {
+public:
+  ImportNode(AstLocation loc, std::string module)
+      : AstNode(std::move(loc)), module_(std::move(module)) {}
+
+  const std::string &module() const { return module_; }
+  AstNodePtr clone() const override;
+  void accept(AstVisitor &visitor) const override;
+  void accept(AstVisitor &visitor) override;
+
+private:
+  std::string module_;
 };
 
 // Utility functions for cloning lists
 AstNodeList clone_node_list(const AstNodeList &list);
 
+// Children of a node in source order, for walks that keep their own stack of
+// pending nodes instead of recursing
+std::vector<const AstNode *> child_nodes(const AstNode &node);
+
 } // namespace cha
@@ -0,0 +1,448 @@
+#include "build.hpp"
+#include "exceptions.hpp"
+#include "interface.hpp"
+#include "jobserver.hpp"
+#include "log.hpp"
+#include "serialize.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+namespace cha {
+
+namespace {
+
+constexpr const char *STATE_FILE = ".cha-build";
+constexpr const char *STATE_HEADER = "cha-build 1";
+
+constexpr uint64_t FNV_OFFSET = 0xcbf29ce484222325ULL;
+constexpr uint64_t FNV_PRIME = 0x100000001b3ULL;
+
+uint64_t hash_bytes(const char *data, size_t size,
+                    uint64_t hash = FNV_OFFSET) {
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= static_cast<unsigned char>(data[i]);
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
+
+uint64_t hash_string(const std::string &text, uint64_t hash) {
+  // The size keeps "ab" + "c" apart from "a" + "bc"
+  uint64_t size = text.size();
+  hash = hash_bytes(reinterpret_cast<const char *>(&size), sizeof(size), hash);
+  return hash_bytes(text.data(), text.size(), hash);
+}
+
+uint64_t hash_value(uint64_t value, uint64_t hash) {
+  return hash_bytes(reinterpret_cast<const char *>(&value), sizeof(value),
+                    hash);
+}
+
+// Hash of what importers see of a module, 0 when it has no interface
+uint64_t hash_interface(const std::string &file) {
+  if (!std::filesystem::exists(file)) {
+    return 0;
+  }
+  try {
+    return hash_string(interface_signature(read_ast(file)), FNV_OFFSET);
+  } catch (const SerializationException &) {
+    // Importers will report it, make sure they are compiled again
+    return hash_file(file);
+  }
+}
+
+std::string trim(const std::string &text) {
+  size_t begin = text.find_first_not_of(" \t\r");
+  if (begin == std::string::npos) {
+    return "";
+  }
+  size_t end = text.find_last_not_of(" \t\r");
+  return text.substr(begin, end - begin + 1);
+}
+
+std::string join_path(const std::string &directory, const std::string &file) {
+  if (directory.empty() || file.empty() || file[0] == '/') {
+    return file;
+  }
+  return directory + "/" + file;
+}
+
+std::string parent_directory(const std::string &file) {
+  size_t slash = file.rfind('/');
+  return slash == std::string::npos ? "" : file.substr(0, slash);
+}
+
+// What the previous build knew about a module
+struct ModuleState {
+  uint64_t source_hash = 0;
+  uint64_t key = 0;
+  uint64_t interface_hash = 0;
+  std::vector<std::string> imports;
+};
+
+struct BuildState {
+  std::map<std::string, ModuleState> modules;
+  uint64_t link = 0;
+};
+
+// A missing or unreadable state only means everything is built again
+BuildState read_state(const std::string &file) {
+  BuildState state;
+  std::ifstream in(file);
+  std::string line;
+  if (!std::getline(in, line) || line != STATE_HEADER) {
+    return state;
+  }
+
+  while (std::getline(in, line)) {
+    std::istringstream fields(line);
+    std::string kind;
+    std::getline(fields, kind, '\t');
+    if (kind == "link") {
+      fields >> std::hex >> state.link;
+    } else if (kind == "module") {
+      std::string source, hashes, imports;
+      std::getline(fields, source, '\t');
+      std::getline(fields, hashes, '\t');
+      std::getline(fields, imports);
+
+      ModuleState module;
+      std::istringstream(hashes) >> std::hex >> module.source_hash >>
+          module.key >> module.interface_hash;
+      std::istringstream names(imports);
+      for (std::string name; names >> name;) {
+        module.imports.push_back(name);
+      }
+      state.modules[source] = std::move(module);
+    }
+  }
+  return state;
+}
+
+void write_state(const std::string &file, const BuildState &state) {
+  std::string temporary = file + ".tmp";
+  {
+    std::ofstream out(temporary, std::ios::trunc);
+    out << STATE_HEADER << "\n" << std::hex;
+    for (const auto &[source, module] : state.modules) {
+      out << "module\t" << source << "\t" << module.source_hash << " "
+          << module.key << " " << module.interface_hash << "\t";
+      for (const auto &name : module.imports) {
+        out << name << " ";
+      }
+      out << "\n";
+    }
+    out << "link\t" << state.link << "\n";
+    if (!out) {
+      log_warning(file + ": could not save the build state");
+      return;
+    }
+  }
+  std::rename(temporary.c_str(), file.c_str());
+}
+
+} // namespace
+
+uint64_t hash_string(const std::string &text) {
+  return hash_string(text, FNV_OFFSET);
+}
+
+uint64_t hash_file(const std::string &file) {
+  std::ifstream in(file, std::ios::binary);
+  if (!in) {
+    return 0;
+  }
+  uint64_t hash = FNV_OFFSET;
+  char buffer[65536];
+  while (in.read(buffer, sizeof(buffer)) || in.gcount() > 0) {
+    hash = hash_bytes(buffer, static_cast<size_t>(in.gcount()), hash);
+  }
+  return hash;
+}
+
+BuildManifest read_manifest(const std::string &file) {
+  std::ifstream in(file);
+  if (!in) {
+    throw BuildException(file, "could not open file");
+  }
+
+  BuildManifest manifest;
+  std::string base = parent_directory(file);
+  std::string line;
+  for (size_t number = 1; std::getline(in, line); ++number) {
+    line = trim(line.substr(0, line.find('#')));
+    if (line.empty()) {
+      continue;
+    }
+    size_t equals = line.find('=');
+    if (equals == std::string::npos) {
+      throw BuildException(file, "line " + std::to_string(number) +
+                                     ": expected 'key = value'");
+    }
+    std::string key = trim(line.substr(0, equals));
+    std::string value = trim(line.substr(equals + 1));
+
+    if (key == "output") {
+      manifest.output = join_path(base, value);
+    } else if (key == "build") {
+      manifest.build_directory = join_path(base, value);
+    } else if (key == "sources") {
+      std::istringstream sources(value);
+      for (std::string source; sources >> source;) {
+        manifest.sources.push_back(join_path(base, source));
+      }
+    } else {
+      throw BuildException(file, "line " + std::to_string(number) +
+                                     ": unknown key '" + key + "'");
+    }
+  }
+
+  if (manifest.output.empty()) {
+    throw BuildException(file, "no output");
+  }
+  if (manifest.sources.empty()) {
+    throw BuildException(file, "no sources");
+  }
+  if (manifest.build_directory.empty()) {
+    manifest.build_directory = join_path(base, "build");
+  }
+  return manifest;
+}
+
+BuildResult run_build(const BuildManifest &manifest,
+                      const std::string &fingerprint, unsigned jobs,
+                      const BuildActions &actions) {
+  BuildResult result;
+  std::error_code error;
+  std::filesystem::create_directories(manifest.build_directory, error);
+  if (error) {
+    log_error("Could not create " + manifest.build_directory + ": " +
+              error.message());
+    return result;
+  }
+
+  std::string state_file = join_path(manifest.build_directory, STATE_FILE);
+  BuildState previous = read_state(state_file);
+  BuildState state;
+
+  size_t count = manifest.sources.size();
+  std::vector<BuildModule> modules(count);
+  std::vector<ModuleState> current(count);
+  std::map<std::string, size_t> names;
+  for (size_t i = 0; i < count; ++i) {
+    BuildModule &module = modules[i];
+    module.source = manifest.sources[i];
+    module.name = module_name(module.source);
+    module.bitcode = join_path(manifest.build_directory, module.name + ".bc");
+    module.interface = join_path(manifest.build_directory,
+                                 module.name + INTERFACE_EXTENSION);
+    if (!names.emplace(module.name, i).second) {
+      log_error(module.source + ": another source is already named '" +
+                module.name + "'");
+      return result;
+    }
+
+    current[i].source_hash = hash_file(module.source);
+    if (current[i].source_hash == 0) {
+      log_error(module.source + ": could not read file");
+      return result;
+    }
+
+    // Only sources that changed are parsed to find their imports
+    auto known = previous.modules.find(module.source);
+    if (known != previous.modules.end() &&
+        known->second.source_hash == current[i].source_hash) {
+      current[i].imports = known->second.imports;
+    } else {
+      try {
+        current[i].imports = actions.imports(module.source);
+      } catch (const ChaException &e) {
+        log_error(e.message());
+        return result;
+      }
+    }
+  }
+
+  // Import graph: a module is compiled once all of its imports are
+  std::vector<size_t> pending(count);
+  std::vector<std::vector<size_t>> importers(count);
+  for (size_t i = 0; i < count; ++i) {
+    for (const auto &name : current[i].imports) {
+      auto imported = names.find(name);
+      if (imported == names.end()) {
+        log_error(modules[i].source + ": imported module '" + name +
+                  "' is not a source of the project");
+        return result;
+      }
+      std::vector<size_t> &imports = modules[i].imports;
+      if (std::find(imports.begin(), imports.end(), imported->second) ==
+          imports.end()) {
+        imports.push_back(imported->second);
+        importers[imported->second].push_back(i);
+      }
+    }
+    pending[i] = modules[i].imports.size();
+  }
+
+  std::deque<size_t> ready;
+  for (size_t i = 0; i < count; ++i) {
+    if (pending[i] == 0) {
+      ready.push_back(i);
+    }
+  }
+
+  // Modules never reached from the ones without imports form cycles
+  {
+    std::vector<size_t> remaining = pending;
+    std::deque<size_t> queue = ready;
+    size_t reached = 0;
+    while (!queue.empty()) {
+      size_t module = queue.front();
+      queue.pop_front();
+      ++reached;
+      for (size_t importer : importers[module]) {
+        if (--remaining[importer] == 0) {
+          queue.push_back(importer);
+        }
+      }
+    }
+    if (reached < count) {
+      std::string cycle;
+      for (size_t i = 0; i < count; ++i) {
+        if (remaining[i] > 0) {
+          cycle += (cycle.empty() ? "" : ", ") + modules[i].name;
+        }
+      }
+      log_error("import cycle between " + cycle);
+      return result;
+    }
+  }
+
+  uint64_t options_hash = hash_string(fingerprint);
+  std::vector<bool> failed(count, false);
+  size_t finished = 0;
+  std::mutex mutex;
+  std::condition_variable ready_changed;
+  std::unique_ptr<JobServer> jobserver = JobServer::from_environment();
+
+  auto worker = [&] {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+      ready_changed.wait(lock,
+                         [&] { return !ready.empty() || finished == count; });
+      if (ready.empty()) {
+        return;
+      }
+      size_t i = ready.front();
+      ready.pop_front();
+      const BuildModule &module = modules[i];
+
+      // The key covers everything the module's bitcode depends on
+      bool blocked = false;
+      uint64_t key = hash_value(current[i].source_hash, options_hash);
+      for (size_t imported : module.imports) {
+        blocked = blocked || failed[imported];
+        key = hash_value(current[imported].interface_hash,
+                         hash_string(modules[imported].name, key));
+      }
+      current[i].key = key;
+      lock.unlock();
+
+      bool ok = !blocked;
+      bool compiled = false;
+      uint64_t interface_hash = 0;
+      auto known = previous.modules.find(module.source);
+      if (ok && known != previous.modules.end() && known->second.key == key &&
+          std::filesystem::exists(module.bitcode) &&
+          hash_interface(module.interface) == known->second.interface_hash) {
+        interface_hash = known->second.interface_hash;
+      } else if (ok) {
+        // A module that stopped exporting must not leave its old interface
+        std::remove(module.interface.c_str());
+        JobSlot slot;
+        if (jobserver) {
+          slot = jobserver->acquire();
+        }
+        ok = actions.compile(module);
+        if (jobserver) {
+          jobserver->release(slot);
+        }
+        compiled = true;
+        interface_hash = hash_interface(module.interface);
+      }
+
+      lock.lock();
+      if (ok) {
+        current[i].interface_hash = interface_hash;
+        state.modules[module.source] = current[i];
+        if (compiled) {
+          ++result.compiled;
+        } else {
+          ++result.up_to_date;
+        }
+      } else {
+        failed[i] = true;
+      }
+      ++finished;
+      for (size_t importer : importers[i]) {
+        if (--pending[importer] == 0) {
+          ready.push_back(importer);
+        }
+      }
+      ready_changed.notify_all();
+    }
+  };
+
+  if (jobs == 0) {
+    jobs = std::max(1u, std::thread::hardware_concurrency());
+  }
+  jobs = static_cast<unsigned>(std::min<size_t>(jobs, count));
+
+  // The calling thread is one of the workers
+  std::vector<std::thread> threads;
+  for (unsigned i = 1; i < jobs; ++i) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  if (std::find(failed.begin(), failed.end(), true) != failed.end()) {
+    // Modules that did build are kept for the next run
+    write_state(state_file, state);
+    return result;
+  }
+
+  // Linking again is only needed when a module's bitcode changed
+  uint64_t link_key = hash_string(manifest.output, options_hash);
+  std::vector<std::string> bitcode;
+  for (size_t i = 0; i < count; ++i) {
+    link_key = hash_value(current[i].key, link_key);
+    bitcode.push_back(modules[i].bitcode);
+  }
+  if (previous.link != link_key ||
+      !std::filesystem::exists(manifest.output)) {
+    if (!actions.link(bitcode)) {
+      write_state(state_file, state);
+      return result;
+    }
+    result.linked = true;
+  }
+  state.link = link_key;
+  write_state(state_file, state);
+
+  result.success = true;
+  return result;
+}
+
+} // namespace cha
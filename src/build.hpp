@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace cha {
+
+// Default project manifest of `cha build`
+constexpr const char *DEFAULT_MANIFEST = "cha.build";
+
+// Project read from a manifest. Each line is `key = value`, `#` starts a
+// comment:
+//   output = bin/app
+//   build = build
+//   sources = src/main.cha src/geometry.cha
+// sources may be given on several lines. Paths are relative to the manifest.
+struct BuildManifest {
+  // Program linked from all modules
+  std::string output;
+  // Bitcode, interfaces and build state, "build" by default
+  std::string build_directory;
+  std::vector<std::string> sources;
+};
+
+// Throws BuildException
+BuildManifest read_manifest(const std::string &file);
+
+// A source of the project and its artifacts in the build directory
+struct BuildModule {
+  std::string source;
+  // File stem, the name other modules import
+  std::string name;
+  std::string bitcode;
+  std::string interface;
+  // Modules imported by this one
+  std::vector<size_t> imports;
+};
+
+// The steps of a build, called from several threads at once
+struct BuildActions {
+  // Names of the modules a source imports - throws ChaException
+  std::function<std::vector<std::string>(const std::string &source)> imports;
+  // Compile a module to its bitcode and interface, false on errors (already
+  // reported)
+  std::function<bool(const BuildModule &module)> compile;
+  // Link the bitcode of all modules into the output, false on errors
+  std::function<bool(const std::vector<std::string> &bitcode)> link;
+};
+
+struct BuildResult {
+  bool success = false;
+  size_t compiled = 0;
+  // Modules whose source, options and imported interfaces did not change
+  size_t up_to_date = 0;
+  bool linked = false;
+};
+
+// Build a project: compile its modules in import order, jobs at a time (0
+// for one per core), then link them. A module is only compiled again when
+// its source, the fingerprint of the compile options or the interface of a
+// module it imports changed, and the output is only linked again when a
+// module changed. The hashes are kept in the build directory.
+BuildResult run_build(const BuildManifest &manifest,
+                      const std::string &fingerprint, unsigned jobs,
+                      const BuildActions &actions);
+
+// FNV-1a hash of a string
+uint64_t hash_string(const std::string &text);
+
+// FNV-1a hash of a file's contents, 0 when it cannot be read
+uint64_t hash_file(const std::string &file);
+
+} // namespace cha
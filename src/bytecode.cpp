@@ -0,0 +1,593 @@
+#include "bytecode.hpp"
+#include "validate.hpp"
+
+#include <algorithm>
+
+namespace cha {
+
+namespace {
+
+PrimitiveType primitive_type(const AstType *type) {
+  if (!type || !type->is_primitive()) {
+    return PrimitiveType::UNDEF;
+  }
+  return type->as_primitive().type;
+}
+
+PrimitiveType primitive_type(const AstNode &node) {
+  return primitive_type(node.result_type());
+}
+
+// Bits above the width of an integer type
+uint8_t type_shift(PrimitiveType type) {
+  switch (type) {
+  case PrimitiveType::INT8:
+  case PrimitiveType::UINT8:
+    return 56;
+  case PrimitiveType::INT16:
+  case PrimitiveType::UINT16:
+    return 48;
+  case PrimitiveType::INT:
+  case PrimitiveType::INT32:
+  case PrimitiveType::UINT:
+  case PrimitiveType::UINT32:
+    return 32;
+  default:
+    return 0;
+  }
+}
+
+bool is_single_precision(PrimitiveType type) {
+  return type == PrimitiveType::FLOAT16 || type == PrimitiveType::FLOAT32;
+}
+
+// Integer value normalized to the width of its type
+Value integer_value(uint64_t bits, PrimitiveType type) {
+  uint8_t shift = type_shift(type);
+  Value value;
+  if (TypeUtils::is_unsigned_int(type)) {
+    value.u = (bits << shift) >> shift;
+  } else {
+    value.i = static_cast<int64_t>(bits << shift) >> shift;
+  }
+  return value;
+}
+
+} // namespace
+
+BytecodeProgram BytecodeCompiler::compile(const AstNodeList &ast) {
+  program_ = BytecodeProgram();
+  function_indexes_.clear();
+  declarations_.clear();
+  constants_.clear();
+  literals_.clear();
+  steps_.clear();
+  values_.clear();
+  branches_.clear();
+
+  // Constants and function indexes first, bodies can use any of them
+  for (const auto &node : ast) {
+    if (auto func = dynamic_cast<const FunctionDeclarationNode *>(node.get())) {
+      function_indexes_[func->identifier()] = declarations_.size();
+      declarations_.push_back(func);
+      program_.functions.emplace_back();
+      program_.functions.back().name = func->identifier();
+      if (func->identifier() == "main") {
+        program_.main = static_cast<int>(declarations_.size() - 1);
+      }
+    } else {
+      compile_node(*node);
+    }
+  }
+
+  for (const auto *declaration : declarations_) {
+    compile_node(*declaration);
+  }
+
+  return std::move(program_);
+}
+
+void BytecodeCompiler::compile_node(const AstNode &node) {
+  schedule(Step::ENTER, node);
+  while (!steps_.empty()) {
+    Step step = steps_.back();
+    steps_.pop_back();
+    run_step(step);
+  }
+  literals_.clear();
+}
+
+void BytecodeCompiler::schedule(Step::Kind kind, const AstNode &node,
+                                uint32_t reg) {
+  steps_.push_back(Step{kind, &node, reg});
+}
+
+void BytecodeCompiler::schedule_statements(const AstNodeList &statements) {
+  // The last step scheduled runs first
+  for (auto it = statements.rbegin(); it != statements.rend(); ++it) {
+    schedule(Step::END_STATEMENT, **it);
+    schedule(Step::ENTER, **it);
+  }
+}
+
+void BytecodeCompiler::run_step(const Step &step) {
+  const AstNode &node = *step.node;
+  switch (step.kind) {
+  case Step::ENTER:
+    node.accept(*this);
+    break;
+  case Step::END_STATEMENT:
+    // Temporaries die with the statement that created them, so does the
+    // value of an expression statement
+    values_.clear();
+    next_register_ = live_registers_;
+    break;
+  case Step::DECLARE_VARIABLE: {
+    const auto &declaration =
+        static_cast<const VariableDeclarationNode &>(node);
+    PrimitiveType type = declaration.type().as_primitive().type;
+    emit_move(step.reg, pop_value(), primitive_type(*declaration.value()),
+              type);
+    scopes_.back()[declaration.identifier()] = Variable{step.reg, type};
+    break;
+  }
+  case Step::ASSIGN: {
+    const auto &assignment = static_cast<const VariableAssignmentNode &>(node);
+    const Variable *variable = lookup(assignment.identifier());
+    emit_move(variable->reg, pop_value(), primitive_type(assignment.value()),
+              variable->type);
+    break;
+  }
+  case Step::BINARY_OP:
+    emit_binary_op(static_cast<const BinaryOpNode &>(node));
+    break;
+  case Step::UNARY_OP:
+    emit_unary_op(static_cast<const UnaryOpNode &>(node));
+    break;
+  case Step::CALL:
+    emit_call(static_cast<const FunctionCallNode &>(node));
+    break;
+  case Step::RETURN: {
+    const auto &ret = static_cast<const FunctionReturnNode &>(node);
+    emit(Opcode::RET,
+         convert(pop_value(), primitive_type(*ret.value()),
+                 primitive_type(&declaration_->return_type())));
+    break;
+  }
+  case Step::BRANCH:
+    emit_branch();
+    break;
+  case Step::ELSE:
+    emit_else(static_cast<const IfNode &>(node));
+    break;
+  case Step::END_IF:
+    end_if();
+    break;
+  case Step::CLOSE_SCOPE:
+    scopes_.pop_back();
+    live_registers_ = next_register_ = step.reg;
+    break;
+  case Step::END_FUNCTION:
+    end_function(static_cast<const FunctionDeclarationNode &>(node));
+    break;
+  }
+}
+
+uint32_t BytecodeCompiler::pop_value() {
+  uint32_t reg = values_.back();
+  values_.pop_back();
+  return reg;
+}
+
+uint32_t BytecodeCompiler::allocate_register() {
+  uint32_t reg = next_register_++;
+  function_->registers = std::max(function_->registers, next_register_);
+  return reg;
+}
+
+uint32_t BytecodeCompiler::add_constant(Value value) {
+  program_.constants.push_back(value);
+  return static_cast<uint32_t>(program_.constants.size() - 1);
+}
+
+uint32_t BytecodeCompiler::load_constant(Value value) {
+  uint32_t reg = allocate_register();
+  emit(Opcode::LOAD_CONST, reg, add_constant(value));
+  return reg;
+}
+
+const BytecodeCompiler::Variable *
+BytecodeCompiler::lookup(const std::string &name) const {
+  for (auto scope = scopes_.rbegin(); scope != scopes_.rend(); ++scope) {
+    auto it = scope->find(name);
+    if (it != scope->end()) {
+      return &it->second;
+    }
+  }
+  return nullptr;
+}
+
+size_t BytecodeCompiler::emit(Opcode op, uint32_t a, uint32_t b, uint32_t c,
+                              uint8_t shift) {
+  Instruction instruction;
+  instruction.op = op;
+  instruction.shift = shift;
+  instruction.a = a;
+  instruction.b = b;
+  instruction.c = c;
+  function_->code.push_back(instruction);
+  return function_->code.size() - 1;
+}
+
+void BytecodeCompiler::emit_trap(Opcode op, uint32_t a, uint32_t b,
+                                 uint32_t c, uint8_t shift,
+                                 const AstLocation &location) {
+  size_t index = emit(op, a, b, c, shift);
+  function_->trap_locations.emplace(index, location);
+}
+
+void BytecodeCompiler::emit_move(uint32_t destination, uint32_t source,
+                                 PrimitiveType from, PrimitiveType to) {
+  if (from != to && TypeUtils::is_signed_int(to) && type_shift(to)) {
+    emit(Opcode::SEXT, destination, source, 0, type_shift(to));
+  } else if (from != to && TypeUtils::is_unsigned_int(to) && type_shift(to)) {
+    emit(Opcode::ZEXT, destination, source, 0, type_shift(to));
+  } else if (from != to && is_single_precision(to)) {
+    emit(Opcode::FTRUNC, destination, source);
+  } else if (destination != source) {
+    emit(Opcode::MOVE, destination, source);
+  }
+}
+
+uint32_t BytecodeCompiler::convert(uint32_t source, PrimitiveType from,
+                                   PrimitiveType to) {
+  if (from == to || to == PrimitiveType::UNDEF) {
+    return source;
+  }
+  uint32_t destination = allocate_register();
+  emit_move(destination, source, from, to);
+  return destination;
+}
+
+void BytecodeCompiler::visit(const ConstantIntegerNode &node) {
+  PrimitiveType type = primitive_type(node);
+  values_.push_back(load_constant(
+      integer_value(static_cast<uint64_t>(node.value()), type)));
+}
+
+void BytecodeCompiler::visit(const ConstantUnsignedIntegerNode &node) {
+  PrimitiveType type = primitive_type(node);
+  values_.push_back(load_constant(integer_value(node.value(), type)));
+}
+
+void BytecodeCompiler::visit(const ConstantFloatNode &node) {
+  Value value;
+  value.f = node.value();
+  if (is_single_precision(primitive_type(node))) {
+    value.f = static_cast<float>(value.f);
+  }
+  values_.push_back(load_constant(value));
+}
+
+void BytecodeCompiler::visit(const ConstantBoolNode &node) {
+  Value value;
+  value.i = node.value();
+  values_.push_back(load_constant(value));
+}
+
+void BytecodeCompiler::visit(const BinaryOpNode &node) {
+  schedule(Step::BINARY_OP, node);
+  schedule(Step::ENTER, node.right());
+  schedule(Step::ENTER, node.left());
+}
+
+void BytecodeCompiler::emit_binary_op(const BinaryOpNode &node) {
+  uint32_t right = pop_value();
+  uint32_t left = pop_value();
+  PrimitiveType left_type = primitive_type(node.left());
+  PrimitiveType right_type = primitive_type(node.right());
+  PrimitiveType type = primitive_type(node);
+  uint32_t result;
+
+  switch (node.op()) {
+  case BinaryOperator::PLUS:
+  case BinaryOperator::MINUS:
+  case BinaryOperator::STAR:
+  case BinaryOperator::SLASH: {
+    static const Opcode signed_ops[] = {Opcode::ADD, Opcode::SUB, Opcode::MUL,
+                                        Opcode::SDIV};
+    static const Opcode unsigned_ops[] = {Opcode::UADD, Opcode::USUB,
+                                          Opcode::UMUL, Opcode::UDIV};
+    static const Opcode float_ops[] = {Opcode::FADD, Opcode::FSUB,
+                                       Opcode::FMUL, Opcode::FDIV};
+    size_t index = static_cast<size_t>(node.op()) -
+                   static_cast<size_t>(BinaryOperator::PLUS);
+
+    result = allocate_register();
+    if (TypeUtils::is_float(type)) {
+      emit(float_ops[index], result, left, right);
+      if (is_single_precision(type)) {
+        emit(Opcode::FTRUNC, result, result);
+      }
+    } else {
+      Opcode op = TypeUtils::is_unsigned_int(type) ? unsigned_ops[index]
+                                                   : signed_ops[index];
+      if (node.op() == BinaryOperator::SLASH) {
+        emit_trap(op, result, left, right, type_shift(type),
+                  node.location());
+      } else {
+        emit(op, result, left, right, type_shift(type));
+      }
+    }
+    values_.push_back(result);
+    return;
+  }
+  case BinaryOperator::AND:
+    result = allocate_register();
+    emit(Opcode::AND, result, left, right);
+    values_.push_back(result);
+    return;
+  case BinaryOperator::OR:
+    result = allocate_register();
+    emit(Opcode::OR, result, left, right);
+    values_.push_back(result);
+    return;
+  default:
+    break;
+  }
+
+  // Comparisons, in the order of BinaryOperator, for each operand domain
+  static const Opcode signed_ops[] = {Opcode::EQ,  Opcode::NE,  Opcode::SGT,
+                                      Opcode::SGE, Opcode::SLT, Opcode::SLE};
+  static const Opcode unsigned_ops[] = {Opcode::EQ,  Opcode::NE,
+                                        Opcode::UGT, Opcode::UGE,
+                                        Opcode::ULT, Opcode::ULE};
+  static const Opcode float_ops[] = {Opcode::FEQ, Opcode::FNE, Opcode::FGT,
+                                     Opcode::FGE, Opcode::FLT, Opcode::FLE};
+  size_t index = static_cast<size_t>(node.op()) -
+                 static_cast<size_t>(BinaryOperator::EQUALS_EQUALS);
+
+  Opcode op;
+  if (TypeUtils::is_float(left_type) || TypeUtils::is_float(right_type)) {
+    // An integer compared with a float is converted first
+    auto to_float = [this](uint32_t reg, PrimitiveType type) {
+      if (TypeUtils::is_float(type)) {
+        return reg;
+      }
+      uint32_t converted = allocate_register();
+      emit(TypeUtils::is_unsigned_int(type) ? Opcode::UITOF : Opcode::SITOF,
+           converted, reg);
+      return converted;
+    };
+    left = to_float(left, left_type);
+    right = to_float(right, right_type);
+    op = float_ops[index];
+  } else if (TypeUtils::is_unsigned_int(left_type) &&
+             TypeUtils::is_unsigned_int(right_type)) {
+    op = unsigned_ops[index];
+  } else {
+    op = signed_ops[index];
+  }
+
+  result = allocate_register();
+  emit(op, result, left, right);
+  values_.push_back(result);
+}
+
+void BytecodeCompiler::visit(const UnaryOpNode &node) {
+  schedule(Step::UNARY_OP, node);
+  schedule(Step::ENTER, node.operand());
+}
+
+void BytecodeCompiler::emit_unary_op(const UnaryOpNode &node) {
+  uint32_t operand = pop_value();
+  PrimitiveType type = primitive_type(node);
+
+  uint32_t result = allocate_register();
+  if (node.op() == UnaryOperator::NOT) {
+    emit(Opcode::NOT, result, operand);
+  } else if (TypeUtils::is_float(type)) {
+    emit(Opcode::FNEG, result, operand);
+  } else if (TypeUtils::is_unsigned_int(type)) {
+    emit(Opcode::UNEG, result, operand, 0, type_shift(type));
+  } else {
+    emit(Opcode::NEG, result, operand, 0, type_shift(type));
+  }
+  values_.push_back(result);
+}
+
+void BytecodeCompiler::visit(const VariableDeclarationNode &node) {
+  if (!node.type().is_primitive()) {
+    throw CodeGenerationException(node.location(),
+                                  "arrays are not supported by the "
+                                  "interpreter");
+  }
+  PrimitiveType type = node.type().as_primitive().type;
+
+  uint32_t reg = allocate_register();
+  live_registers_ = next_register_;
+
+  if (node.value()) {
+    schedule(Step::DECLARE_VARIABLE, node, reg);
+    schedule(Step::ENTER, *node.value());
+    return;
+  }
+
+  // Registers are reused, so variables are always initialized
+  Value zero;
+  zero.u = 0;
+  emit(Opcode::LOAD_CONST, reg, add_constant(zero));
+  scopes_.back()[node.identifier()] = Variable{reg, type};
+}
+
+void BytecodeCompiler::visit(const VariableAssignmentNode &node) {
+  if (!lookup(node.identifier())) {
+    throw CodeGenerationException(node.location(), "unknown variable name: " +
+                                                       node.identifier());
+  }
+
+  schedule(Step::ASSIGN, node);
+  schedule(Step::ENTER, node.value());
+}
+
+void BytecodeCompiler::visit(const VariableLookupNode &node) {
+  if (const Variable *variable = lookup(node.identifier())) {
+    values_.push_back(variable->reg);
+    return;
+  }
+
+  // Constants were folded to literals by the validator
+  auto constant = constants_.find(node.identifier());
+  if (constant != constants_.end() && node.result_type()) {
+    literals_.push_back(constant->second->clone());
+    literals_.back()->set_result_type(node.result_type()->clone());
+    schedule(Step::ENTER, *literals_.back());
+    return;
+  }
+
+  throw CodeGenerationException(node.location(),
+                                "unknown variable name: " + node.identifier());
+}
+
+void BytecodeCompiler::visit(const ArgumentNode &node) {
+  // Arguments arrive in the first registers of the frame, in order
+  uint32_t reg = allocate_register();
+  live_registers_ = next_register_;
+  scopes_.back()[node.identifier()] =
+      Variable{reg, primitive_type(&node.type())};
+}
+
+void BytecodeCompiler::visit(const BlockNode &node) {
+  scopes_.emplace_back();
+  schedule(Step::CLOSE_SCOPE, node, live_registers_);
+  schedule_statements(node.statements());
+}
+
+void BytecodeCompiler::visit(const FunctionDeclarationNode &node) {
+  function_ = &program_.functions[function_indexes_.at(node.identifier())];
+  declaration_ = &node;
+  scopes_.assign(1, {});
+  live_registers_ = next_register_ = 0;
+
+  for (const auto &arg : node.arguments()) {
+    arg->accept(*this);
+  }
+  function_->arguments = static_cast<uint32_t>(node.arguments().size());
+
+  schedule(Step::END_FUNCTION, node);
+  schedule_statements(node.body());
+}
+
+void BytecodeCompiler::end_function(const FunctionDeclarationNode &node) {
+  // Falling off the end returns zero, like the generated code
+  PrimitiveType return_type = primitive_type(&node.return_type());
+  if (return_type == PrimitiveType::UNDEF) {
+    emit(Opcode::RET_VOID);
+  } else {
+    Value zero;
+    zero.u = 0;
+    emit(Opcode::RET, load_constant(zero));
+  }
+
+  function_ = nullptr;
+  declaration_ = nullptr;
+}
+
+void BytecodeCompiler::visit(const FunctionCallNode &node) {
+  if (!function_indexes_.count(node.identifier())) {
+    throw CodeGenerationException(node.location(),
+                                  "unknown function: " + node.identifier());
+  }
+
+  schedule(Step::CALL, node);
+  const auto &arguments = node.arguments();
+  for (auto it = arguments.rbegin(); it != arguments.rend(); ++it) {
+    schedule(Step::ENTER, **it);
+  }
+}
+
+void BytecodeCompiler::emit_call(const FunctionCallNode &node) {
+  uint32_t index = function_indexes_.at(node.identifier());
+  const FunctionDeclarationNode &callee = *declarations_[index];
+
+  size_t count = node.arguments().size();
+  std::vector<uint32_t> values(values_.end() - count, values_.end());
+  values_.resize(values_.size() - count);
+
+  // Arguments are passed in consecutive registers
+  uint32_t first = next_register_;
+  for (size_t i = 0; i < values.size(); ++i) {
+    const auto &parameter =
+        static_cast<const ArgumentNode &>(*callee.arguments()[i]);
+    emit_move(allocate_register(), values[i],
+              primitive_type(*node.arguments()[i]),
+              primitive_type(&parameter.type()));
+  }
+  uint32_t result = allocate_register();
+  emit(Opcode::CALL, result, index, first);
+  values_.push_back(result);
+}
+
+void BytecodeCompiler::visit(const FunctionReturnNode &node) {
+  if (!node.value()) {
+    emit(Opcode::RET_VOID);
+    return;
+  }
+
+  schedule(Step::RETURN, node);
+  schedule(Step::ENTER, *node.value());
+}
+
+void BytecodeCompiler::visit(const IfNode &node) {
+  // Each branch gets its own scope, the else one reuses the then one
+  schedule(Step::END_IF, node);
+  if (node.has_else()) {
+    schedule_statements(node.else_block());
+  }
+  schedule(Step::ELSE, node);
+  schedule_statements(node.then_block());
+  schedule(Step::BRANCH, node);
+  schedule(Step::ENTER, node.condition());
+}
+
+void BytecodeCompiler::emit_branch() {
+  size_t jump_to_else = emit(Opcode::JUMP_IF_FALSE, pop_value());
+  next_register_ = live_registers_;
+  branches_.push_back(Branch{jump_to_else, live_registers_});
+  scopes_.emplace_back();
+}
+
+void BytecodeCompiler::emit_else(const IfNode &node) {
+  Branch &branch = branches_.back();
+  scopes_.back().clear();
+  live_registers_ = next_register_ = branch.live_registers;
+
+  size_t jump_to_else = branch.jump;
+  if (node.has_else()) {
+    // The then branch jumps over the else one
+    branch.jump = emit(Opcode::JUMP);
+  }
+  function_->code[jump_to_else].b =
+      static_cast<uint32_t>(function_->code.size());
+}
+
+void BytecodeCompiler::end_if() {
+  Branch branch = branches_.back();
+  branches_.pop_back();
+  scopes_.pop_back();
+  live_registers_ = next_register_ = branch.live_registers;
+  function_->code[branch.jump].b =
+      static_cast<uint32_t>(function_->code.size());
+}
+
+void BytecodeCompiler::visit(const ConstantDeclarationNode &node) {
+  constants_[node.identifier()] = &node.value();
+}
+
+void BytecodeCompiler::visit(const ImportNode &node) {
+  // Imported modules only provide their interface, not their code
+  throw CodeGenerationException("cannot interpret a module that imports '" +
+                                node.module() + "', compile it instead");
+}
+
+} // namespace cha
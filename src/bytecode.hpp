@@ -0,0 +1,215 @@
+#pragma once
+
+#include "ast.hpp"
+#include "exceptions.hpp"
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace cha {
+
+// Operations of the register machine. Operands a, b and c are register
+// numbers of the current frame unless noted otherwise. Integer results are
+// kept normalized to the width of their type: shift is 64 minus that width
+// and the result is sign extended (signed ops) or zero extended (unsigned
+// ops) from it.
+enum class Opcode : uint8_t {
+  LOAD_CONST, // a = constants[b]
+  MOVE,       // a = b
+  SEXT,       // a = b sign extended from 64 - shift bits
+  ZEXT,       // a = b zero extended from 64 - shift bits
+  FTRUNC,     // a = b rounded to single precision
+  SITOF,      // a = b as a float
+  UITOF,      // a = b as a float
+
+  ADD, // a = b + c
+  SUB,
+  MUL,
+  SDIV,
+  UADD,
+  USUB,
+  UMUL,
+  UDIV,
+  NEG, // a = -b
+  UNEG,
+  FADD,
+  FSUB,
+  FMUL,
+  FDIV,
+  FNEG,
+
+  EQ, // a = b == c
+  NE,
+  SLT,
+  SLE,
+  SGT,
+  SGE,
+  ULT,
+  ULE,
+  UGT,
+  UGE,
+  FEQ,
+  FNE,
+  FLT,
+  FLE,
+  FGT,
+  FGE,
+  AND, // a = b & c on bools
+  OR,
+  NOT, // a = !b
+
+  JUMP,          // continue at instruction b
+  JUMP_IF_FALSE, // continue at instruction b when a is false
+  CALL,          // a = functions[b](c, c + 1, ...)
+  RET,           // return a
+  RET_VOID,
+};
+
+struct Instruction {
+  Opcode op;
+  uint8_t shift = 0;
+  uint32_t a = 0;
+  uint32_t b = 0;
+  uint32_t c = 0;
+};
+
+union Value {
+  int64_t i;
+  uint64_t u;
+  double f;
+};
+
+struct BytecodeFunction {
+  std::string name;
+  uint32_t arguments = 0;
+  uint32_t registers = 0;
+  std::vector<Instruction> code;
+
+  // Source of the instructions that can fail at run time
+  std::map<size_t, AstLocation> trap_locations;
+};
+
+struct BytecodeProgram {
+  std::vector<Value> constants;
+  std::vector<BytecodeFunction> functions;
+
+  // Index of main in functions, or -1 when the module has no main
+  int main = -1;
+};
+
+// Compiles a validated AST into bytecode for the VirtualMachine. Arguments
+// and variables live in fixed registers of their function, temporaries are
+// allocated above them and released after each statement.
+class BytecodeCompiler : public AstVisitor {
+public:
+  // Throws CodeGenerationException on error
+  BytecodeProgram compile(const AstNodeList &ast);
+
+  // Visitor pattern implementation
+  void visit(const ConstantIntegerNode &node) override;
+  void visit(const ConstantUnsignedIntegerNode &node) override;
+  void visit(const ConstantFloatNode &node) override;
+  void visit(const ConstantBoolNode &node) override;
+  void visit(const BinaryOpNode &node) override;
+  void visit(const UnaryOpNode &node) override;
+  void visit(const VariableDeclarationNode &node) override;
+  void visit(const VariableAssignmentNode &node) override;
+  void visit(const VariableLookupNode &node) override;
+  void visit(const ArgumentNode &node) override;
+  void visit(const BlockNode &node) override;
+  void visit(const FunctionDeclarationNode &node) override;
+  void visit(const FunctionCallNode &node) override;
+  void visit(const FunctionReturnNode &node) override;
+  void visit(const IfNode &node) override;
+  void visit(const ConstantDeclarationNode &node) override;
+  void visit(const ImportNode &node) override;
+
+private:
+  struct Variable {
+    uint32_t reg;
+    PrimitiveType type;
+  };
+
+  // A step of compile_node(). Generated sources nest expressions and ifs
+  // arbitrarily deep, so nodes are walked with an explicit stack: entering a
+  // node schedules its children, then the instructions using their values.
+  struct Step {
+    enum Kind {
+      ENTER,
+      END_STATEMENT,
+      DECLARE_VARIABLE,
+      ASSIGN,
+      BINARY_OP,
+      UNARY_OP,
+      CALL,
+      RETURN,
+      BRANCH,
+      ELSE,
+      END_IF,
+      CLOSE_SCOPE,
+      END_FUNCTION,
+    };
+    Kind kind;
+    const AstNode *node;
+    // Register of DECLARE_VARIABLE, live registers restored by CLOSE_SCOPE
+    uint32_t reg;
+  };
+
+  // An if being compiled, its jump is patched once the target is known
+  struct Branch {
+    size_t jump;
+    uint32_t live_registers;
+  };
+
+  BytecodeProgram program_;
+  std::map<std::string, uint32_t> function_indexes_;
+  std::vector<const FunctionDeclarationNode *> declarations_;
+  std::map<std::string, const AstNode *> constants_;
+  // Typed copies of folded constants, alive until their steps ran
+  std::vector<AstNodePtr> literals_;
+
+  BytecodeFunction *function_ = nullptr;
+  const FunctionDeclarationNode *declaration_ = nullptr;
+
+  // Variables of the enclosing scopes, innermost last
+  std::vector<std::map<std::string, Variable>> scopes_;
+  // Registers below live_registers_ hold variables, the others temporaries
+  uint32_t live_registers_ = 0;
+  uint32_t next_register_ = 0;
+
+  std::vector<Step> steps_;
+  // Registers holding the values of the expressions compiled so far
+  std::vector<uint32_t> values_;
+  std::vector<Branch> branches_;
+
+  void compile_node(const AstNode &node);
+  void run_step(const Step &step);
+  void schedule(Step::Kind kind, const AstNode &node, uint32_t reg = 0);
+  void schedule_statements(const AstNodeList &statements);
+  uint32_t pop_value();
+
+  void emit_binary_op(const BinaryOpNode &node);
+  void emit_unary_op(const UnaryOpNode &node);
+  void emit_call(const FunctionCallNode &node);
+  void emit_branch();
+  void emit_else(const IfNode &node);
+  void end_if();
+  void end_function(const FunctionDeclarationNode &node);
+  uint32_t allocate_register();
+  uint32_t add_constant(Value value);
+  uint32_t load_constant(Value value);
+  const Variable *lookup(const std::string &name) const;
+  size_t emit(Opcode op, uint32_t a = 0, uint32_t b = 0, uint32_t c = 0,
+              uint8_t shift = 0);
+  void emit_trap(Opcode op, uint32_t a, uint32_t b, uint32_t c, uint8_t shift,
+                 const AstLocation &location);
+
+  // Copy a value into a register, converting it to the register's type
+  void emit_move(uint32_t destination, uint32_t source, PrimitiveType from,
+                 PrimitiveType to);
+  uint32_t convert(uint32_t source, PrimitiveType from, PrimitiveType to);
+};
+
+} // namespace cha
@@ -0,0 +1,246 @@
+#include "callgraph.hpp"
+#include "validate.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+namespace cha {
+
+CallGraph::CallGraph(const AstNodeList &ast) { add(ast); }
+
+void CallGraph::add(const AstNodeList &ast) {
+  std::set<std::string> added;
+  for (const auto &node : ast) {
+    if (auto func = dynamic_cast<const FunctionDeclarationNode *>(node.get())) {
+      added.insert(func->identifier());
+    }
+  }
+  walk(ast);
+  find_recursion(added);
+}
+
+bool CallGraph::contains(const std::string &function) const {
+  return functions_.count(function) > 0;
+}
+
+const std::set<std::string> &
+CallGraph::callees(const std::string &function) const {
+  static const std::set<std::string> none;
+  auto it = functions_.find(function);
+  return it == functions_.end() ? none : it->second.callees;
+}
+
+std::set<std::string>
+CallGraph::reachable_from(const std::set<std::string> &roots) const {
+  std::set<std::string> reached;
+  std::vector<std::string> pending(roots.begin(), roots.end());
+  while (!pending.empty()) {
+    std::string function = std::move(pending.back());
+    pending.pop_back();
+    if (!reached.insert(function).second) {
+      continue;
+    }
+    for (const auto &callee : callees(function)) {
+      if (!reached.count(callee)) {
+        pending.push_back(callee);
+      }
+    }
+  }
+  return reached;
+}
+
+bool CallGraph::is_recursive(const std::string &function) const {
+  auto it = functions_.find(function);
+  return it != functions_.end() && it->second.recursive;
+}
+
+bool CallGraph::may_not_return(const std::string &function) const {
+  auto it = functions_.find(function);
+  if (it == functions_.end() || it->second.recursive) {
+    return true;
+  }
+
+  auto memo = may_not_return_.find(function);
+  if (memo != may_not_return_.end()) {
+    return memo->second;
+  }
+
+  // Recursive functions are rejected above, so this walks a DAG
+  bool result = std::any_of(
+      it->second.callees.begin(), it->second.callees.end(),
+      [this](const std::string &callee) { return may_not_return(callee); });
+  may_not_return_[function] = result;
+  return result;
+}
+
+bool CallGraph::may_trap(const std::string &function) const {
+  auto it = functions_.find(function);
+  if (it == functions_.end() || it->second.recursive || it->second.traps) {
+    return true;
+  }
+
+  auto memo = may_trap_.find(function);
+  if (memo != may_trap_.end()) {
+    return memo->second;
+  }
+
+  bool result = std::any_of(
+      it->second.callees.begin(), it->second.callees.end(),
+      [this](const std::string &callee) { return may_trap(callee); });
+  may_trap_[function] = result;
+  return result;
+}
+
+void CallGraph::find_recursion(const std::set<std::string> &added) {
+  // Tarjan's strongly connected components: a function is recursive when its
+  // component has more than one function or it calls itself. Functions added
+  // before are never part of a new cycle, as they do not call the new ones.
+  std::map<std::string, int> index;
+  std::map<std::string, int> low;
+  std::set<std::string> on_stack;
+  std::vector<std::string> stack;
+  int next_index = 0;
+
+  std::function<void(const std::string &)> connect =
+      [&](const std::string &function) {
+        index[function] = low[function] = next_index++;
+        stack.push_back(function);
+        on_stack.insert(function);
+
+        for (const auto &callee : callees(function)) {
+          if (!added.count(callee)) {
+            continue;
+          }
+          if (!index.count(callee)) {
+            connect(callee);
+            low[function] = std::min(low[function], low[callee]);
+          } else if (on_stack.count(callee)) {
+            low[function] = std::min(low[function], index[callee]);
+          }
+        }
+
+        if (low[function] != index[function]) {
+          return;
+        }
+
+        std::vector<std::string> component;
+        std::string member;
+        do {
+          member = stack.back();
+          stack.pop_back();
+          on_stack.erase(member);
+          component.push_back(member);
+        } while (member != function);
+
+        for (const auto &name : component) {
+          functions_[name].recursive =
+              component.size() > 1 || functions_[name].callees.count(name);
+        }
+      };
+
+  for (const auto &function : added) {
+    if (!index.count(function)) {
+      connect(function);
+    }
+  }
+}
+
+void CallGraph::walk(const AstNodeList &nodes) {
+  // Visits only schedule the children, so deeply nested expressions and ifs
+  // do not recurse. The order calls are found in does not matter.
+  size_t base = pending_.size();
+  visit_list(nodes);
+  while (pending_.size() > base) {
+    const AstNode *node = pending_.back();
+    pending_.pop_back();
+    node->accept(*this);
+  }
+}
+
+void CallGraph::visit_list(const AstNodeList &nodes) {
+  for (const auto &node : nodes) {
+    pending_.push_back(node.get());
+  }
+}
+
+void CallGraph::visit(const ConstantIntegerNode &node) {}
+
+void CallGraph::visit(const ConstantUnsignedIntegerNode &node) {}
+
+void CallGraph::visit(const ConstantFloatNode &node) {}
+
+void CallGraph::visit(const ConstantBoolNode &node) {}
+
+void CallGraph::visit(const BinaryOpNode &node) {
+  pending_.push_back(&node.left());
+  pending_.push_back(&node.right());
+
+  // Integer division by zero (or of the minimum value by -1) is undefined,
+  // without a result type the operands may be integers
+  if (node.op() == BinaryOperator::SLASH && current_) {
+    const AstType *type = node.result_type();
+    if (!type || !type->is_primitive() ||
+        !TypeUtils::is_float(type->as_primitive().type)) {
+      current_->traps = true;
+    }
+  }
+}
+
+void CallGraph::visit(const UnaryOpNode &node) {
+  pending_.push_back(&node.operand());
+}
+
+void CallGraph::visit(const VariableDeclarationNode &node) {
+  if (node.value()) {
+    pending_.push_back(node.value());
+  }
+}
+
+void CallGraph::visit(const VariableAssignmentNode &node) {
+  pending_.push_back(&node.value());
+}
+
+void CallGraph::visit(const VariableLookupNode &node) {}
+
+void CallGraph::visit(const ArgumentNode &node) {}
+
+void CallGraph::visit(const BlockNode &node) { visit_list(node.statements()); }
+
+void CallGraph::visit(const FunctionDeclarationNode &node) {
+  if (node.identifier() == "main" || node.exported()) {
+    roots_.insert(node.identifier());
+  }
+  current_ = &functions_[node.identifier()];
+  walk(node.body());
+  current_ = nullptr;
+}
+
+void CallGraph::visit(const FunctionCallNode &node) {
+  if (current_) {
+    current_->callees.insert(node.identifier());
+  } else {
+    roots_.insert(node.identifier());
+  }
+  visit_list(node.arguments());
+}
+
+void CallGraph::visit(const FunctionReturnNode &node) {
+  if (node.value()) {
+    pending_.push_back(node.value());
+  }
+}
+
+void CallGraph::visit(const IfNode &node) {
+  pending_.push_back(&node.condition());
+  visit_list(node.then_block());
+  visit_list(node.else_block());
+}
+
+void CallGraph::visit(const ConstantDeclarationNode &node) {
+  pending_.push_back(&node.value());
+}
+
+void CallGraph::visit(const ImportNode &) {}
+
+} // namespace cha
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "ast.hpp"
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace cha {
+
+// Calls between the functions of a module, collected by walking the AST.
+// Functions that are only declared elsewhere are unknown to the graph.
+class CallGraph : public AstVisitor {
+public:
+  explicit CallGraph(const AstNodeList &ast);
+
+  // Add more functions of the module, e.g. while it is parsed. They may call
+  // each other and the functions already in the graph, which must not call
+  // them.
+  void add(const AstNodeList &ast);
+
+  // Whether the function is defined in the module
+  bool contains(const std::string &function) const;
+
+  // Functions called directly from the body of a function
+  const std::set<std::string> &callees(const std::string &function) const;
+
+  // Functions a whole program starts from: main, the exported functions and
+  // the functions called by the values of constants
+  const std::set<std::string> &roots() const { return roots_; }
+
+  // The roots and every function they call, directly or through others
+  std::set<std::string>
+  reachable_from(const std::set<std::string> &roots) const;
+
+  // Whether a function can call itself, directly or through other functions
+  bool is_recursive(const std::string &function) const;
+
+  // Whether a function, or anything it calls, may run forever (recursion) or
+  // calls a function outside of the module
+  bool may_not_return(const std::string &function) const;
+
+  // Whether a function, or anything it calls, has undefined behavior for
+  // some arguments, e.g. integer division by zero or unbounded recursion
+  bool may_trap(const std::string &function) const;
+
+  // Visitor pattern implementation
+  void visit(const ConstantIntegerNode &node) override;
+  void visit(const ConstantUnsignedIntegerNode &node) override;
+  void visit(const ConstantFloatNode &node) override;
+  void visit(const ConstantBoolNode &node) override;
+  void visit(const BinaryOpNode &node) override;
+  void visit(const UnaryOpNode &node) override;
+  void visit(const VariableDeclarationNode &node) override;
+  void visit(const VariableAssignmentNode &node) override;
+  void visit(const VariableLookupNode &node) override;
+  void visit(const ArgumentNode &node) override;
+  void visit(const BlockNode &node) override;
+  void visit(const FunctionDeclarationNode &node) override;
+  void visit(const FunctionCallNode &node) override;
+  void visit(const FunctionReturnNode &node) override;
+  void visit(const IfNode &node) override;
+  void visit(const ConstantDeclarationNode &node) override;
+  void visit(const ImportNode &node) override;
+
+private:
+  struct FunctionInfo {
+    std::set<std::string> callees;
+    bool traps = false;
+    bool recursive = false;
+  };
+
+  std::map<std::string, FunctionInfo> functions_;
+  std::set<std::string> roots_;
+  FunctionInfo *current_ = nullptr;
+  // Nodes waiting to be visited, in place of recursion
+  std::vector<const AstNode *> pending_;
+
+  // Memoized results of the transitive queries
+  mutable std::map<std::string, bool> may_not_return_;
+  mutable std::map<std::string, bool> may_trap_;
+
+  void walk(const AstNodeList &nodes);
+  void visit_list(const AstNodeList &nodes);
+  void find_recursion(const std::set<std::string> &added);
+};
+
+} // namespace cha
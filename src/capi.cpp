@@ -0,0 +1,155 @@
+#include "cha/cha.h"
+#include "cha/cha.hpp"
+
+#include <new>
+#include <string>
+
+struct cha_compiler {
+  cha::Compiler compiler;
+};
+
+struct cha_result {
+  cha::CompileResult result;
+};
+
+namespace {
+
+bool to_compile_format(cha_format format, cha::CompileFormat &result) {
+  switch (format) {
+  case CHA_FORMAT_LLVM_IR:
+    result = cha::CompileFormat::LLVM_IR;
+    return true;
+  case CHA_FORMAT_ASSEMBLY:
+    result = cha::CompileFormat::ASSEMBLY_FILE;
+    return true;
+  case CHA_FORMAT_OBJECT:
+    result = cha::CompileFormat::OBJECT_FILE;
+    return true;
+  case CHA_FORMAT_AST:
+    result = cha::CompileFormat::AST_FILE;
+    return true;
+  case CHA_FORMAT_BITCODE:
+    result = cha::CompileFormat::BITCODE;
+    return true;
+  }
+  return false;
+}
+
+const cha::CompileDiagnostic *diagnostic(const cha_result *result,
+                                         size_t index) {
+  if (!result || index >= result->result.diagnostics.size()) {
+    return nullptr;
+  }
+  return &result->result.diagnostics[index];
+}
+
+} // namespace
+
+// No exception may leave these functions, the callers are not C++
+extern "C" {
+
+const char *cha_version(void) { return CMAKE_PROJECT_VERSION; }
+
+cha_compiler *cha_compiler_create(void) {
+  try {
+    return new cha_compiler();
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+void cha_compiler_destroy(cha_compiler *compiler) { delete compiler; }
+
+void cha_compiler_add_import_path(cha_compiler *compiler, const char *path) {
+  if (!compiler || !path) {
+    return;
+  }
+  try {
+    compiler->compiler.options().import_paths.push_back(path);
+  } catch (...) {
+  }
+}
+
+cha_result *cha_compile(cha_compiler *compiler, const char *source,
+                        size_t size, const char *name, cha_format format) {
+  cha_result *result = new (std::nothrow) cha_result();
+  if (!result) {
+    return nullptr;
+  }
+
+  try {
+    std::string file = name ? name : "input.cha";
+    cha::CompileFormat compile_format;
+    if (!compiler || (!source && size > 0)) {
+      result->result.diagnostics.push_back({file, 0, 0, "invalid arguments"});
+    } else if (!to_compile_format(format, compile_format)) {
+      result->result.diagnostics.push_back(
+          {file, 0, 0, "unsupported output format"});
+    } else {
+      result->result =
+          compiler->compiler.compile(source, size, compile_format, file);
+    }
+  } catch (const std::exception &e) {
+    // Out of memory or an error of LLVM itself
+    try {
+      result->result = cha::CompileResult();
+      result->result.diagnostics.push_back(
+          {name ? name : "input.cha", 0, 0, e.what()});
+      return result;
+    } catch (...) {
+    }
+    delete result;
+    return nullptr;
+  } catch (...) {
+    delete result;
+    return nullptr;
+  }
+  return result;
+}
+
+void cha_result_destroy(cha_result *result) { delete result; }
+
+int cha_result_success(const cha_result *result) {
+  return result && result->result.success ? 1 : 0;
+}
+
+const char *cha_result_output(const cha_result *result, size_t *size) {
+  if (!result) {
+    if (size) {
+      *size = 0;
+    }
+    return nullptr;
+  }
+  if (size) {
+    *size = result->result.output.size();
+  }
+  return result->result.output.data();
+}
+
+size_t cha_result_diagnostic_count(const cha_result *result) {
+  return result ? result->result.diagnostics.size() : 0;
+}
+
+const char *cha_result_diagnostic_file(const cha_result *result,
+                                       size_t index) {
+  auto item = diagnostic(result, index);
+  return item ? item->file.c_str() : nullptr;
+}
+
+int cha_result_diagnostic_line(const cha_result *result, size_t index) {
+  auto item = diagnostic(result, index);
+  return item ? item->line : 0;
+}
+
+int cha_result_diagnostic_column(const cha_result *result, size_t index) {
+  auto item = diagnostic(result, index);
+  return item ? item->column : 0;
+}
+
+const char *cha_result_diagnostic_message(const cha_result *result,
+                                          size_t index) {
+  auto item = diagnostic(result, index);
+  return item ? item->message.c_str() : nullptr;
+}
+
+} // extern "C"
@@ -1,40 +1,1138 @@
 #include "cha/cha.hpp"
 #include "ast.hpp"
+#include "build.hpp"
+#include "bytecode.hpp"
 #include "codegen.hpp"
 #include "exceptions.hpp"
+#include "interface.hpp"
+#include "jit.hpp"
+#include "jobserver.hpp"
+#include "lazy.hpp"
 #include "log.hpp"
+#include "lto.hpp"
 #include "parser.hpp"
+#include "profile.hpp"
+#include "serialize.hpp"
+#include "stream.hpp"
 #include "validate.hpp"
+#include "vm.hpp"
+#include "watch.hpp"
+
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <set>
+#include <thread>
+#include <vector>
 
 namespace cha {
 
-int compile(const std::string &file, CompileFormat format,
-            const std::string &output_file) {
-  AstNodeList ast;
+namespace {
+
+bool is_bitcode_file(const std::string &file) {
+  return file.size() > 3 && file.compare(file.size() - 3, 3, ".bc") == 0;
+}
+
+// Parse a source file, or read it back when it is a binary AST. A lone
+// module may be parsed lazily, see CompileOptions::lazy_bodies.
+bool load_module(const std::string &file, const CompileOptions &options,
+                 AstNodeList &ast, bool lone_module = false) {
+  if (options.load_ast) {
+    // A binary AST has already been parsed and validated
+    try {
+      ast = read_ast(file);
+    } catch (const SerializationException &e) {
+      log_error(e.message());
+      return false;
+    }
+    return true;
+  }
 
   try {
-    ast = parse(file);
+    ast = lone_module && options.lazy_bodies ? parse_reachable(file)
+                                             : parse(file);
   } catch (const ParseException &e) {
     log_error(e.message());
-    return 1;
+    return false;
   }
+  return true;
+}
 
+// Read the interfaces of the modules imported by ast
+bool load_imports(const AstNodeList &ast, const CompileOptions &options,
+                  AstNodeList &interfaces) {
   try {
-    Validator validator;
-    validator.validate(ast);
+    interfaces = read_imports(ast, options.import_paths);
   } catch (const ValidationException &e) {
     log_error(e.message());
+    return false;
+  } catch (const SerializationException &e) {
+    log_error(e.message());
+    return false;
+  }
+  return true;
+}
+
+// Write the interface of a module with exports next to its output, so other
+// modules can import it
+bool write_module_interface(const AstNodeList &ast,
+                            const std::string &output_file) {
+  if (!has_exports(ast)) {
+    return true;
+  }
+  llvm::SmallString<256> path(output_file);
+  llvm::sys::path::replace_extension(path, INTERFACE_EXTENSION);
+  try {
+    write_interface(ast, std::string(path));
+  } catch (const SerializationException &e) {
+    log_error(e.message());
+    return false;
+  }
+  return true;
+}
+
+// Signatures of the functions of a module, every other module of a program
+// can call them
+std::string function_signatures(const AstNodeList &ast) {
+  AstNodeList functions;
+  for (const auto &node : ast) {
+    if (auto func = dynamic_cast<const FunctionDeclarationNode *>(node.get())) {
+      auto signature = std::make_unique<FunctionDeclarationNode>(
+          func->location(), func->identifier(), func->return_type().clone(),
+          clone_node_list(func->arguments()), AstNodeList{});
+      signature->set_exported(func->exported());
+      functions.push_back(std::move(signature));
+    }
+  }
+  return interface_signature(functions);
+}
+
+// Source text of the functions and constants of a parsed module, by name,
+// empty for names declared twice. Line tables make the line a function
+// starts on part of its code.
+std::map<std::string, std::string>
+declaration_sources(const std::string &file, const AstNodeList &ast,
+                    const CompileOptions &options) {
+  std::vector<std::string> lines;
+  std::ifstream in(file);
+  for (std::string line; std::getline(in, line);) {
+    lines.push_back(std::move(line));
+  }
+  bool line_tables =
+      options.debug_info != DebugInfo::NONE || !options.sample_profile.empty();
+
+  std::map<std::string, std::string> sources;
+  for (const auto &node : ast) {
+    const std::string *name = nullptr;
+    std::string source;
+    if (auto func = dynamic_cast<const FunctionDeclarationNode *>(node.get())) {
+      name = &func->identifier();
+      source = func->exported() ? "export " : "";
+      if (line_tables) {
+        source += std::to_string(node->location().line_begin) + ":";
+      }
+    } else if (auto constant = dynamic_cast<const ConstantDeclarationNode *>(
+                   node.get())) {
+      name = &constant->identifier();
+    } else {
+      continue;
+    }
+    const AstLocation &location = node->location();
+    for (int line = location.line_begin; line <= location.line_end; ++line) {
+      if (line < 1 || static_cast<size_t>(line) > lines.size()) {
+        source.clear();
+        break;
+      }
+      source += lines[line - 1] + "\n";
+    }
+    auto inserted = sources.emplace(*name, source);
+    if (!inserted.second) {
+      inserted.first->second.clear();
+    }
+  }
+  return sources;
+}
+
+// The modules of a program linked with ThinLTO. A watch keeps one alive
+// between builds: update() then only parses the sources that changed, and
+// the modules that use declarations that changed. Of their functions, only
+// those whose source or used declarations changed are validated again, and
+// in a watch only those are generated again: each function gets its own
+// bitcode there.
+class Program {
+public:
+  Program(const std::vector<std::string> &files,
+          const std::string &output_file, const CompileOptions &options,
+          bool watching = false)
+      : output_file_(output_file), options_(options), watching_(watching) {
+    for (const auto &file : files) {
+      if (is_bitcode_file(file)) {
+        bitcode_files_.push_back(file);
+      } else {
+        modules_.emplace_back();
+        modules_.back().file = file;
+      }
+    }
+    bitcode_hashes_.resize(bitcode_files_.size(), 0);
+    bitcode_inputs_.resize(bitcode_files_.size());
+  }
+
+  // Bring the output up to date with the files - false on errors, which are
+  // reported
+  bool update();
+
+  // Functions validated and generated by the last update, out of all
+  size_t validated() const { return validated_; }
+  size_t generated() const { return generated_; }
+  size_t functions() const;
+  // Interface files of the modules imported from outside of the program
+  const std::vector<std::string> &interface_files() const {
+    return interface_files_;
+  }
+
+private:
+  struct Function {
+    // What the function was validated from, see function_keys()
+    std::string key;
+    // In a watch, null until code is generated for the current key
+    std::unique_ptr<llvm::MemoryBuffer> bitcode;
+  };
+
+  struct Module {
+    std::string file;
+    // Of the source when it was loaded, 0 to load it again
+    uint64_t hash = 0;
+    AstNodeList ast;
+    // Parsed but not validated yet
+    bool stale = true;
+    // In-memory imports, the declarations of the imported interfaces and
+    // the exported declarations of the imported inputs
+    std::vector<size_t> dependencies;
+    AstNodeList interfaces;
+    AstNodeList imported;
+    // What other modules see of this one
+    std::string functions;
+    std::string exports;
+    bool exports_changed = false;
+    // Source of the declarations, see declaration_sources()
+    std::map<std::string, std::string> sources;
+    // The AST validated last, kept until the module is validated again so
+    // its unchanged functions can be reused
+    AstNodeList validated;
+    std::map<std::string, Function> compiled;
+    // Outside of a watch, null until code is generated for the current AST
+    std::unique_ptr<llvm::MemoryBuffer> bitcode;
+  };
+
+  std::string output_file_;
+  CompileOptions options_;
+  std::vector<std::string> bitcode_files_;
+  std::vector<uint64_t> bitcode_hashes_;
+  std::vector<std::unique_ptr<llvm::MemoryBuffer>> bitcode_inputs_;
+  std::vector<Module> modules_;
+  bool watching_;
+  bool has_main_ = false;
+  // In a watch, when no module defines main
+  std::unique_ptr<llvm::MemoryBuffer> main_wrapper_;
+  size_t validated_ = 0;
+  size_t generated_ = 0;
+  std::vector<std::string> interface_files_;
+
+  bool load(Module &module);
+  bool resolve_imports(ProgramImports &imports);
+  bool validate(const ProgramImports &imports);
+  std::map<std::string, std::string> function_keys(const Module &module);
+  bool validate_functions(Module &module,
+                          const std::map<std::string, std::string> &keys);
+  void keep_compiled(Module &module,
+                     const std::map<std::string, std::string> &keys);
+  std::unique_ptr<llvm::MemoryBuffer> generate_function(const Module &module,
+                                                        AstNodePtr &node);
+  bool generate_and_link();
+  bool fail();
+};
+
+size_t Program::functions() const {
+  size_t count = 0;
+  for (const auto &module : modules_) {
+    for (const auto &node : module.ast) {
+      if (dynamic_cast<const FunctionDeclarationNode *>(node.get())) {
+        ++count;
+      }
+    }
+  }
+  return count;
+}
+
+bool Program::load(Module &module) {
+  // The validated AST stays around until the new one is validated
+  if (!module.stale) {
+    module.validated = std::move(module.ast);
+  }
+  module.ast.clear();
+  module.stale = true;
+  module.bitcode.reset();
+  if (!load_module(module.file, options_, module.ast)) {
+    return false;
+  }
+  module.functions = function_signatures(module.ast);
+  module.sources.clear();
+  if (watching_ && !options_.load_ast) {
+    module.sources = declaration_sources(module.file, module.ast, options_);
+  }
+  return true;
+}
+
+bool Program::fail() {
+  // Modules left unvalidated are loaded again by the next update
+  for (auto &module : modules_) {
+    if (module.stale) {
+      module.hash = 0;
+    }
+  }
+  return false;
+}
+
+bool Program::update() {
+  validated_ = 0;
+  generated_ = 0;
+  bool changed = false;
+
+  for (size_t i = 0; i < bitcode_files_.size(); ++i) {
+    uint64_t hash = hash_file(bitcode_files_[i]);
+    if (hash != 0 && hash == bitcode_hashes_[i]) {
+      continue;
+    }
+    auto buffer = llvm::MemoryBuffer::getFile(bitcode_files_[i]);
+    if (!buffer) {
+      log_error(bitcode_files_[i] + ": " + buffer.getError().message());
+      return false;
+    }
+    bitcode_inputs_[i] = std::move(*buffer);
+    bitcode_hashes_[i] = hash;
+    changed = true;
+  }
+
+  // Only the sources that changed are parsed again
+  bool functions_changed = false;
+  for (auto &module : modules_) {
+    uint64_t hash = hash_file(module.file);
+    if (hash != 0 && hash == module.hash) {
+      continue;
+    }
+    changed = true;
+    std::string functions = module.functions;
+    if (!load(module)) {
+      return fail();
+    }
+    module.hash = hash;
+    functions_changed = functions_changed || module.functions != functions;
+  }
+  if (!changed) {
+    return true;
+  }
+
+  // Calls into a module whose functions changed have to be checked again
+  if (functions_changed) {
+    for (auto &module : modules_) {
+      if (!module.stale && !load(module)) {
+        return fail();
+      }
+    }
+  }
+
+  // All modules are linked together, so their function names are unique
+  std::vector<const AstNodeList *> asts;
+  for (const auto &module : modules_) {
+    asts.push_back(&module.ast);
+  }
+  ProgramImports imports;
+  if (!check_function_names(asts) || !resolve_imports(imports) ||
+      !validate(imports)) {
+    return fail();
+  }
+  return generate_and_link();
+}
+
+bool Program::resolve_imports(ProgramImports &imports) {
+  // Imports of another input are resolved in memory, the others through
+  // their interface files
+  std::vector<std::string> sources;
+  std::vector<const AstNodeList *> asts;
+  for (const auto &module : modules_) {
+    sources.push_back(module.file);
+    asts.push_back(&module.ast);
+  }
+  if (!resolve_program_imports(sources, asts, options_.import_paths,
+                               imports)) {
+    return false;
+  }
+  interface_files_ = imports.interface_files;
+
+  for (size_t i = 0; i < modules_.size(); ++i) {
+    Module &module = modules_[i];
+    // An interface file changed under a module that did not
+    if (!module.stale && interface_signature(imports.interfaces[i]) !=
+                             interface_signature(module.interfaces)) {
+      if (!load(module)) {
+        return false;
+      }
+    }
+    module.dependencies = imports.dependencies[i];
+    module.interfaces = std::move(imports.interfaces[i]);
+  }
+  return true;
+}
+
+bool Program::validate(const ProgramImports &imports) {
+  for (auto &module : modules_) {
+    module.exports_changed = false;
+  }
+  return validate_program(imports, [&](size_t i) {
+    Module &module = modules_[i];
+    for (size_t dependency : module.dependencies) {
+      if (!module.stale && modules_[dependency].exports_changed &&
+          !load(module)) {
+        return false;
+      }
+    }
+    if (!module.stale) {
+      return true;
+    }
+
+    // Imported inputs are validated first, so their interfaces hold the
+    // folded constants next to the exported functions
+    module.imported.clear();
+    for (size_t dependency : module.dependencies) {
+      for (auto &node : make_interface(modules_[dependency].ast)) {
+        module.imported.push_back(std::move(node));
+      }
+    }
+
+    std::map<std::string, std::string> keys = function_keys(module);
+    if (!options_.load_ast && !validate_functions(module, keys)) {
+      return false;
+    }
+    keep_compiled(module, keys);
+
+    std::string exports = interface_signature(make_interface(module.ast));
+    module.exports_changed = exports != module.exports;
+    module.exports = std::move(exports);
+    module.stale = false;
+    return true;
+  });
+}
+
+std::map<std::string, std::string>
+Program::function_keys(const Module &module) {
+  // A function is validated from its source and the declarations of the
+  // names it uses. Binary ASTs have no source, their functions are always
+  // validated again, and so are all functions outside of a watch.
+  std::map<std::string, std::string> keys;
+  if (module.sources.empty()) {
+    return keys;
+  }
+
+  // What the names of the module scope stand for. A name declared twice is
+  // an error, the functions using it are validated again to report it.
+  std::map<std::string, std::string> declarations;
+  std::set<std::string> duplicates;
+  auto declare = [&](const std::string &name, std::string declaration) {
+    if (!declarations.emplace(name, std::move(declaration)).second) {
+      duplicates.insert(name);
+    }
+  };
+  for (const AstNodeList *list : {&module.interfaces, &module.imported}) {
+    for (const auto &node : *list) {
+      if (auto func =
+              dynamic_cast<const FunctionDeclarationNode *>(node.get())) {
+        declare(func->identifier(), declaration_signature(*func));
+      } else if (auto constant = dynamic_cast<const ConstantDeclarationNode *>(
+                     node.get())) {
+        declare(constant->identifier(), declaration_signature(*constant));
+      }
+    }
+  }
+  auto source = [&](const std::string &name) {
+    auto found = module.sources.find(name);
+    return found != module.sources.end() ? found->second : std::string();
+  };
+  // The value of a constant calling functions depends on their bodies and
+  // those of the functions they call, in short on all of them
+  std::string bodies;
+  for (const auto &node : module.ast) {
+    if (auto func = dynamic_cast<const FunctionDeclarationNode *>(node.get())) {
+      declare(func->identifier(), declaration_signature(*func));
+      bodies += source(func->identifier());
+    }
+  }
+  bodies = std::to_string(hash_string(bodies));
+  std::map<std::string, UsedNames> constants;
+  for (const auto &node : module.ast) {
+    if (auto constant =
+            dynamic_cast<const ConstantDeclarationNode *>(node.get())) {
+      declare(constant->identifier(), "");
+      constants.emplace(constant->identifier(), used_names(*constant));
+    }
+  }
+
+  // A constant stands for its source and what the names it uses stand for,
+  // once the constants among them are known. Cycles are errors anyway.
+  std::set<std::string> entered;
+  for (const auto &constant : constants) {
+    std::vector<std::string> stack{constant.first};
+    while (!stack.empty()) {
+      std::string name = stack.back();
+      const UsedNames &used = constants.at(name);
+      if (entered.insert(name).second) {
+        for (const auto &use : used.values) {
+          if (constants.count(use) && !entered.count(use)) {
+            stack.push_back(use);
+          }
+        }
+        continue;
+      }
+      stack.pop_back();
+      if (!declarations[name].empty()) {
+        continue;
+      }
+      std::string text = source(name);
+      if (!used.functions.empty()) {
+        text += bodies;
+      }
+      for (const auto &use : used.values) {
+        text += use + " " + declarations[use] + "\n";
+      }
+      declarations[name] = std::to_string(hash_string(text));
+    }
+  }
+
+  for (const auto &node : module.ast) {
+    auto func = dynamic_cast<const FunctionDeclarationNode *>(node.get());
+    if (!func || duplicates.count(func->identifier())) {
+      continue;
+    }
+    std::string key = source(func->identifier());
+    UsedNames used = used_names(*func);
+    for (const std::set<std::string> *names : {&used.functions, &used.values}) {
+      for (const auto &use : *names) {
+        if (key.empty() || duplicates.count(use)) {
+          key.clear();
+          break;
+        }
+        auto declaration = declarations.find(use);
+        key += use + " " +
+               (declaration != declarations.end() ? declaration->second
+                                                  : std::string("?")) +
+               "\n";
+      }
+    }
+    keys[func->identifier()] = std::move(key);
+  }
+  return keys;
+}
+
+bool Program::validate_functions(
+    Module &module, const std::map<std::string, std::string> &keys) {
+  // Functions validated before from the same key are reused as they are
+  std::map<std::string, AstNodePtr> reusable;
+  for (auto &node : module.validated) {
+    auto func = dynamic_cast<const FunctionDeclarationNode *>(node.get());
+    if (!func) {
+      continue;
+    }
+    auto key = keys.find(func->identifier());
+    auto compiled = module.compiled.find(func->identifier());
+    if (key != keys.end() && !key->second.empty() &&
+        compiled != module.compiled.end() &&
+        compiled->second.key == key->second) {
+      reusable[func->identifier()] = std::move(node);
+    }
+  }
+
+  // The others are validated with the reused ones declared, along with
+  // their bodies when constants call functions
+  bool constants_call = std::any_of(
+      module.ast.begin(), module.ast.end(), [](const AstNodePtr &node) {
+        auto constant =
+            dynamic_cast<const ConstantDeclarationNode *>(node.get());
+        return constant && !used_names(*constant).functions.empty();
+      });
+  Validator validator;
+  declare_imports(validator, module.interfaces);
+  declare_imports(validator, module.imported);
+  AstNodeList checked;
+  std::set<const AstNode *> reused;
+  for (auto &node : module.ast) {
+    auto func = dynamic_cast<const FunctionDeclarationNode *>(node.get());
+    auto validated = func ? reusable.find(func->identifier()) : reusable.end();
+    if (validated != reusable.end() && validated->second) {
+      node = std::move(validated->second);
+      const auto &function =
+          static_cast<const FunctionDeclarationNode &>(*node);
+      if (constants_call) {
+        validator.declare_sibling(function);
+      } else {
+        validator.declare_external(function);
+      }
+      reused.insert(node.get());
+    } else {
+      if (func) {
+        ++validated_;
+      }
+      checked.push_back(std::move(node));
+    }
+  }
+  bool valid = validate_module(validator, checked);
+  auto next = checked.begin();
+  for (auto &node : module.ast) {
+    if (!node) {
+      node = std::move(*next++);
+    }
+  }
+  if (valid) {
+    module.validated.clear();
+    return true;
+  }
+
+  // The reused functions are still good for the next attempt
+  for (auto &node : module.ast) {
+    if (reused.count(node.get())) {
+      module.validated.push_back(std::move(node));
+    }
+  }
+  module.validated.erase(
+      std::remove(module.validated.begin(), module.validated.end(), nullptr),
+      module.validated.end());
+  module.ast.erase(std::remove(module.ast.begin(), module.ast.end(), nullptr),
+                   module.ast.end());
+  return false;
+}
+
+void Program::keep_compiled(Module &module,
+                            const std::map<std::string, std::string> &keys) {
+  // The code generated for a function stays good as long as its key
+  std::map<std::string, Function> compiled;
+  for (const auto &node : module.ast) {
+    auto func = dynamic_cast<const FunctionDeclarationNode *>(node.get());
+    if (!func) {
+      continue;
+    }
+    auto key = keys.find(func->identifier());
+    auto previous = module.compiled.find(func->identifier());
+    Function &function = compiled[func->identifier()];
+    if (key == keys.end() || key->second.empty()) {
+      continue;
+    }
+    if (previous != module.compiled.end() &&
+        previous->second.key == key->second) {
+      function = std::move(previous->second);
+    } else {
+      function.key = key->second;
+    }
+  }
+  module.compiled = std::move(compiled);
+}
+
+std::unique_ptr<llvm::MemoryBuffer>
+Program::generate_function(const Module &module, AstNodePtr &node) {
+  const auto &func = static_cast<const FunctionDeclarationNode &>(*node);
+  // ThinLTO tells modules apart by their name
+  CodeGenerator generator(module.file + ":" + func.identifier(), options_);
+  declare_imports(generator, module.interfaces);
+  declare_imports(generator, module.imported);
+  UsedNames used = used_names(func);
+  for (const auto &other : module.ast) {
+    if (auto sibling =
+            dynamic_cast<const FunctionDeclarationNode *>(other.get())) {
+      if (sibling != &func && used.functions.count(sibling->identifier())) {
+        generator.declare_external(*sibling);
+      }
+    } else if (auto constant = dynamic_cast<const ConstantDeclarationNode *>(
+                   other.get())) {
+      if (used.values.count(constant->identifier())) {
+        generator.declare_external(*constant);
+      }
+    }
+  }
+  generator.set_main_wrapper(false);
+  generator.set_internalize(false);
+
+  // The node is lent to a list of its own
+  AstNodeList ast;
+  ast.push_back(std::move(node));
+  std::unique_ptr<llvm::MemoryBuffer> bitcode;
+  try {
+    bitcode = generator.generate_bitcode(ast);
+  } catch (...) {
+    node = std::move(ast.front());
+    throw;
+  }
+  node = std::move(ast.front());
+  return bitcode;
+}
+
+bool Program::generate_and_link() {
+  bool has_main = false;
+  for (const auto &module : modules_) {
+    for (const auto &node : module.ast) {
+      auto func = dynamic_cast<const FunctionDeclarationNode *>(node.get());
+      if (func && func->identifier() == "main") {
+        has_main = true;
+      }
+    }
+  }
+  if (has_main != has_main_ && !modules_.empty()) {
+    // The first module carries the empty main wrapper
+    modules_[0].bitcode.reset();
+    main_wrapper_.reset();
+    has_main_ = has_main;
+  }
+  // Bitcode inputs may provide main, otherwise only one module gets the
+  // empty main wrapper
+  bool main_wrapper = !has_main && bitcode_files_.empty();
+
+  // Generate ThinLTO bitcode for what changed and link it all
+  try {
+    std::vector<std::unique_ptr<llvm::MemoryBuffer>> buffers;
+    auto add = [&](const llvm::MemoryBuffer &bitcode) {
+      buffers.push_back(
+          llvm::MemoryBuffer::getMemBuffer(bitcode.getMemBufferRef(), false));
+    };
+    for (const auto &input : bitcode_inputs_) {
+      add(*input);
+    }
+    for (size_t i = 0; i < modules_.size(); ++i) {
+      Module &module = modules_[i];
+      if (watching_) {
+        for (auto &node : module.ast) {
+          auto func = dynamic_cast<const FunctionDeclarationNode *>(node.get());
+          if (!func) {
+            continue;
+          }
+          Function &function = module.compiled[func->identifier()];
+          if (!function.bitcode) {
+            function.bitcode = generate_function(module, node);
+            ++generated_;
+          }
+          add(*function.bitcode);
+        }
+        continue;
+      }
+      if (!module.bitcode) {
+        CodeGenerator generator(module.file, options_);
+        declare_imports(generator, module.interfaces);
+        declare_imports(generator, module.imported);
+        generator.set_main_wrapper(main_wrapper && i == 0);
+        // Other modules call in, ThinLTO internalizes once all are linked
+        generator.set_internalize(false);
+        module.bitcode = generator.generate_bitcode(module.ast);
+        generated_ += module.compiled.size();
+      }
+      add(*module.bitcode);
+    }
+    if (watching_ && main_wrapper && !modules_.empty()) {
+      if (!main_wrapper_) {
+        CodeGenerator generator(modules_[0].file + ":main", options_);
+        main_wrapper_ = generator.generate_bitcode(AstNodeList());
+      }
+      add(*main_wrapper_);
+    }
+
+    link_thin_lto(buffers, output_file_, options_);
+  } catch (const CodeGenerationException &e) {
+    log_error("Code generation failed: " + e.message());
+    return false;
+  }
+  return true;
+}
+
+// Report a build of a watch
+void log_built(const std::string &output,
+               std::chrono::steady_clock::time_point start,
+               const Program &program) {
+  auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - start);
+  log_info("Built " + output + " in " + std::to_string(elapsed.count()) +
+           " ms, validated " + std::to_string(program.validated()) +
+           " and compiled " + std::to_string(program.generated()) + " of " +
+           std::to_string(program.functions()) + " functions");
+}
+
+bool is_directory_output(const std::string &output) {
+  return (!output.empty() && output.back() == '/') ||
+         llvm::sys::fs::is_directory(output);
+}
+
+std::string output_extension(CompileFormat format) {
+  switch (format) {
+  case CompileFormat::LLVM_IR:
+    return ".ll";
+  case CompileFormat::ASSEMBLY_FILE:
+    return ".s";
+  case CompileFormat::OBJECT_FILE:
+    return ".o";
+  case CompileFormat::AST_FILE:
+    return ".chast";
+  case CompileFormat::BITCODE:
+    return ".bc";
+  default:
+    return "";
+  }
+}
+
+// Compile each file on its own into the output directory on a pool of
+// threads. Every thread keeps its target machine for all of its files.
+int compile_each(const std::vector<std::string> &files, CompileFormat format,
+                 const std::string &output_directory,
+                 const CompileOptions &options) {
+  std::string extension = output_extension(format);
+  if (extension.empty()) {
+    log_error("binary output (-o) links all inputs into one file, it cannot "
+              "be written to a directory");
     return 1;
+  }
+
+  std::vector<std::string> outputs;
+  std::set<std::string> seen;
+  for (const auto &file : files) {
+    if (is_bitcode_file(file)) {
+      log_error(file + ": bitcode inputs can only be linked (-o)");
+      return 1;
+    }
+    llvm::SmallString<256> output(output_directory);
+    llvm::sys::path::append(output,
+                            llvm::sys::path::stem(file) + extension);
+    if (!seen.insert(std::string(output)).second) {
+      log_error("several inputs would be written to " + std::string(output));
+      return 1;
+    }
+    outputs.emplace_back(output);
+  }
+
+  if (auto error = llvm::sys::fs::create_directories(output_directory)) {
+    log_error("Could not create " + output_directory + ": " +
+              error.message());
+    return 1;
+  }
+
+  size_t jobs = options.jobs;
+  if (jobs == 0) {
+    jobs = std::max(1u, std::thread::hardware_concurrency());
+  }
+  jobs = std::min(jobs, files.size());
+  std::unique_ptr<JobServer> jobserver = JobServer::from_environment();
+
+  std::atomic<size_t> next{0};
+  std::atomic<bool> failed{false};
+  auto worker = [&] {
+    for (size_t i = next++; i < files.size(); i = next++) {
+      JobSlot slot;
+      if (jobserver) {
+        slot = jobserver->acquire();
+      }
+      if (compile(files[i], format, outputs[i], options) != 0) {
+        failed = true;
+      }
+      if (jobserver) {
+        jobserver->release(slot);
+      }
+    }
+  };
+
+  // The calling thread is one of the workers
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < jobs; ++i) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  return failed ? 1 : 0;
+}
+
+bool declare_function(Validator &validator,
+                      const FunctionDeclarationNode &node) {
+  try {
+    validator.declare_function(node);
+  } catch (const ValidationException &e) {
+    log_error(e.message());
+    return false;
+  }
+  return true;
+}
+
+bool validate_declaration(Validator &validator, AstNode &node) {
+  try {
+    validator.validate_declaration(node);
+  } catch (const ValidationException &e) {
+    log_error(e.message());
+    return false;
   } catch (const MultipleValidationException &e) {
     for (const auto &error : e.errors()) {
       log_error(error.message());
     }
+    return false;
+  }
+  return true;
+}
+
+enum class StreamResult { COMPILED, FAILED, NOT_STREAMABLE };
+
+// Compile a module while it is parsed, see CompileOptions::streaming. Errors
+// are reported as they are found, every declaration is still validated.
+StreamResult compile_streaming(const std::string &file,
+                               const std::vector<CompileOutput> &outputs,
+                               const CompileOptions &options) {
+  Validator validator;
+  CodeGenerator generator("cha_module", options);
+  generator.begin(file);
+  bool failed = false;
+  auto generate = [&](const AstNodeList &declarations) {
+    if (failed) {
+      return;
+    }
+    try {
+      generator.add(declarations);
+    } catch (const CodeGenerationException &e) {
+      log_error("Code generation failed: " + e.message());
+      failed = true;
+    }
+  };
+
+  // Names the next declarations can use: the functions generated so far,
+  // the constants and the imported declarations
+  std::set<std::string> functions;
+  std::set<std::string> values;
+  std::set<std::string> imports;
+  // Generated code refers to the constants, imported ones included
+  AstNodeList constants;
+  // Exported signatures and constants, for the interface
+  AstNodeList exports;
+  // Declarations using names that are not declared yet
+  AstNodeList waiting;
+
+  auto add_export = [&exports](const AstNode &node) {
+    if (auto func = dynamic_cast<const FunctionDeclarationNode *>(&node)) {
+      if (func->exported()) {
+        auto signature = std::make_unique<FunctionDeclarationNode>(
+            func->location(), func->identifier(), func->return_type().clone(),
+            clone_node_list(func->arguments()), AstNodeList{});
+        signature->set_exported(true);
+        exports.push_back(std::move(signature));
+      }
+    } else if (auto constant =
+                   dynamic_cast<const ConstantDeclarationNode *>(&node)) {
+      if (constant->exported()) {
+        exports.push_back(constant->clone());
+      }
+    }
+  };
+
+  try {
+    DeclarationStream stream(file);
+    while (AstNodePtr node = stream.next()) {
+      if (auto import = dynamic_cast<const ImportNode *>(node.get())) {
+        if (!imports.insert(import->module()).second) {
+          continue;
+        }
+        AstNodeList interface;
+        try {
+          interface = read_interface(*import, options.import_paths);
+          declare_imports(generator, interface);
+        } catch (const ChaException &e) {
+          log_error(e.message());
+          failed = true;
+          continue;
+        }
+        declare_imports(validator, interface);
+        for (auto &declaration : interface) {
+          if (auto imported = dynamic_cast<const FunctionDeclarationNode *>(
+                  declaration.get())) {
+            functions.insert(imported->identifier());
+          } else if (auto imported =
+                         dynamic_cast<const ConstantDeclarationNode *>(
+                             declaration.get())) {
+            values.insert(imported->identifier());
+            constants.push_back(std::move(declaration));
+          }
+        }
+        continue;
+      }
+
+      auto constant = dynamic_cast<ConstantDeclarationNode *>(node.get());
+      UsedNames used = used_names(*node);
+      if (constant && !used.functions.empty()) {
+        // Evaluating the constant needs the bodies of the functions it
+        // calls, the ones already generated are gone
+        return failed ? StreamResult::FAILED : StreamResult::NOT_STREAMABLE;
+      }
+
+      auto func = dynamic_cast<const FunctionDeclarationNode *>(node.get());
+      bool ready =
+          std::all_of(used.functions.begin(), used.functions.end(),
+                      [&](const std::string &name) {
+                        return functions.count(name) ||
+                               (func && name == func->identifier());
+                      }) &&
+          std::all_of(
+              used.values.begin(), used.values.end(),
+              [&](const std::string &name) { return values.count(name); });
+      if (!ready) {
+        waiting.push_back(std::move(node));
+        continue;
+      }
+
+      if (func) {
+        functions.insert(func->identifier());
+        failed |= !declare_function(validator, *func);
+      } else if (constant) {
+        values.insert(constant->identifier());
+      }
+      if (!validate_declaration(validator, *node)) {
+        failed = true;
+        continue;
+      }
+      add_export(*node);
+      AstNodeList declaration;
+      declaration.push_back(std::move(node));
+      generate(declaration);
+      if (constant) {
+        constants.push_back(std::move(declaration.front()));
+      }
+    }
+  } catch (const ParseException &e) {
+    log_error(e.message());
+    return StreamResult::FAILED;
+  }
+
+  // Every name is declared now, what waited is validated like a whole
+  // module: signatures, then constants, then functions
+  for (const auto &node : waiting) {
+    if (auto func = dynamic_cast<const FunctionDeclarationNode *>(node.get())) {
+      failed |= !declare_function(validator, *func);
+    }
+  }
+  for (bool constant_pass : {true, false}) {
+    for (const auto &node : waiting) {
+      bool is_constant =
+          dynamic_cast<const ConstantDeclarationNode *>(node.get()) != nullptr;
+      if (is_constant != constant_pass) {
+        continue;
+      }
+      if (validate_declaration(validator, *node)) {
+        add_export(*node);
+      } else {
+        failed = true;
+      }
+    }
+  }
+  generate(waiting);
+  if (failed) {
+    return StreamResult::FAILED;
+  }
+
+  bool executable = false;
+  for (const auto &output : outputs) {
+    executable |= output.format == CompileFormat::BINARY_FILE;
+  }
+  for (const auto &output : outputs) {
+    if (output.format != CompileFormat::BINARY_FILE) {
+      if (!write_module_interface(exports, output.file)) {
+        return StreamResult::FAILED;
+      }
+      break;
+    }
+  }
+
+  try {
+    generator.set_main_wrapper(executable || !has_exports(exports));
+    generator.finish(outputs);
+  } catch (const CodeGenerationException &e) {
+    log_error("Code generation failed: " + e.message());
+    return StreamResult::FAILED;
+  }
+  return StreamResult::COMPILED;
+}
+
+// Parse, validate and optimize one module once, then write it in each of
+// the outputs
+int compile_module(const std::string &file,
+                   const std::vector<CompileOutput> &outputs,
+                   const CompileOptions &options) {
+  auto is_ast = [](const CompileOutput &output) {
+    return output.format == CompileFormat::AST_FILE;
+  };
+  if (options.streaming && !options.lazy_bodies && !options.load_ast &&
+      std::none_of(outputs.begin(), outputs.end(), is_ast)) {
+    StreamResult result = compile_streaming(file, outputs, options);
+    if (result != StreamResult::NOT_STREAMABLE) {
+      return result == StreamResult::COMPILED ? 0 : 1;
+    }
+  }
+
+  AstNodeList ast;
+  if (!load_module(file, options, ast, true)) {
     return 1;
   }
 
+  // Imported modules are only known through their interfaces
+  AstNodeList interfaces;
+  if (!load_imports(ast, options, interfaces)) {
+    return 1;
+  }
+
+  if (!options.load_ast) {
+    Validator validator;
+    declare_imports(validator, interfaces);
+    if (!validate_module(validator, ast)) {
+      return 1;
+    }
+  }
+
+  // Written before code generation so importers can be compiled meanwhile
+  std::vector<CompileOutput> code_outputs;
+  bool interface_written = false;
+  bool executable = false;
+  for (const auto &output : outputs) {
+    if (output.format != CompileFormat::BINARY_FILE && !interface_written) {
+      if (!write_module_interface(ast, output.file)) {
+        return 1;
+      }
+      interface_written = true;
+    }
+
+    if (output.format == CompileFormat::AST_FILE) {
+      try {
+        write_ast(ast, output.file);
+      } catch (const SerializationException &e) {
+        log_error(e.message());
+        return 1;
+      }
+    } else {
+      executable |= output.format == CompileFormat::BINARY_FILE;
+      code_outputs.push_back(output);
+    }
+  }
+  if (code_outputs.empty()) {
+    return 0;
+  }
+
   // Generate code
   try {
-    generate_code(ast, format, output_file);
+    CodeGenerator generator("cha_module", options);
+    declare_imports(generator, interfaces);
+    // A module compiled for importers is linked with the importing program,
+    // which brings its own main
+    generator.set_main_wrapper(executable || !has_exports(ast));
+    generator.generate(ast, code_outputs);
   } catch (const CodeGenerationException &e) {
     log_error("Code generation failed: " + e.message());
     return 1;
@@ -43,4 +1141,334 @@ int compile(const std::string &file, CompileFormat format,
   return 0;
 }
 
-} // namespace cha
\ No newline at end of file
+// Options that change the generated code, modules built with other ones are
+// compiled again
+std::string build_fingerprint(const CompileOptions &options) {
+  std::string fingerprint = CMAKE_PROJECT_VERSION;
+  fingerprint += "|" + std::to_string(static_cast<int>(options.debug_info));
+  fingerprint += "|" + std::to_string(options.frame_pointers);
+  fingerprint += "|" + std::to_string(options.fast_compile);
+  fingerprint += "|" + options.profile_generate;
+  for (const auto &profile : {options.profile_use, options.sample_profile}) {
+    fingerprint +=
+        "|" + profile + ":" +
+        (profile.empty() ? std::string() : std::to_string(hash_file(profile)));
+  }
+  for (const auto &path : options.import_paths) {
+    fingerprint += "|" + path;
+  }
+  return fingerprint;
+}
+
+// Interface files of the modules the sources import from outside of them,
+// which a watch follows as well. Sources that do not load are left out,
+// their build reports them.
+std::vector<std::string>
+imported_interfaces(const std::vector<std::string> &sources,
+                    const CompileOptions &options) {
+  std::set<std::string> stems;
+  for (const auto &source : sources) {
+    stems.insert(module_name(source));
+  }
+
+  std::vector<std::string> interfaces;
+  for (const auto &source : sources) {
+    if (is_bitcode_file(source)) {
+      continue;
+    }
+    AstNodeList ast;
+    try {
+      ast = options.load_ast ? read_ast(source) : parse(source);
+    } catch (const ChaException &) {
+      continue;
+    }
+    for (const auto &node : ast) {
+      auto import = dynamic_cast<const ImportNode *>(node.get());
+      if (!import || stems.count(import->module())) {
+        continue;
+      }
+      try {
+        interfaces.push_back(find_interface(*import, options.import_paths));
+      } catch (const ValidationException &) {
+      }
+    }
+  }
+  return interfaces;
+}
+
+} // namespace
+
+int compile(const std::string &file, CompileFormat format,
+            const std::string &output_file, const CompileOptions &options) {
+  if (is_bitcode_file(file)) {
+    return compile(std::vector<std::string>{file}, format, output_file,
+                   options);
+  }
+  return compile_module(file, {{format, output_file}}, options);
+}
+
+int compile(const std::string &file, const std::vector<CompileFormat> &formats,
+            const std::string &output, const CompileOptions &options) {
+  if (is_bitcode_file(file)) {
+    log_error(file + ": bitcode inputs can only be linked (-o)");
+    return 1;
+  }
+
+  std::vector<CompileOutput> outputs;
+  std::set<CompileFormat> seen;
+  for (CompileFormat format : formats) {
+    if (seen.insert(format).second) {
+      outputs.push_back({format, output + output_extension(format)});
+    }
+  }
+  if (outputs.empty()) {
+    log_error("no output format");
+    return 1;
+  }
+  return compile_module(file, outputs, options);
+}
+
+int compile(const std::vector<std::string> &files, CompileFormat format,
+            const std::string &output_file, const CompileOptions &options) {
+  if (is_directory_output(output_file)) {
+    return compile_each(files, format, output_file, options);
+  }
+
+  bool has_bitcode = std::any_of(files.begin(), files.end(), is_bitcode_file);
+  if (files.size() == 1 && !has_bitcode) {
+    return compile(files[0], format, output_file, options);
+  }
+
+  if (format != CompileFormat::BINARY_FILE) {
+    log_error("multiple or bitcode input files require binary output (-o)");
+    return 1;
+  }
+
+  Program program(files, output_file, options);
+  return program.update() ? 0 : 1;
+}
+
+int build(const std::string &manifest_file, const CompileOptions &options) {
+  BuildManifest manifest;
+  try {
+    manifest = read_manifest(manifest_file);
+  } catch (const BuildException &e) {
+    log_error(e.message());
+    return 1;
+  }
+
+  // Modules find the interfaces of their imports in the build directory
+  CompileOptions module_options = options;
+  module_options.import_paths.push_back(manifest.build_directory);
+
+  BuildActions actions;
+  actions.imports = [](const std::string &source) {
+    std::vector<std::string> imports;
+    for (const auto &node : parse(source)) {
+      if (auto import = dynamic_cast<const ImportNode *>(node.get())) {
+        imports.push_back(import->module());
+      }
+    }
+    return imports;
+  };
+  actions.compile = [&](const BuildModule &module) {
+    return compile(module.source, CompileFormat::BITCODE, module.bitcode,
+                   module_options) == 0;
+  };
+  // Relinking after a change only runs the backends of changed modules
+  CompileOptions link_options = options;
+  if (link_options.lto_cache.empty()) {
+    link_options.lto_cache = manifest.build_directory + "/lto-cache";
+  }
+  actions.link = [&](const std::vector<std::string> &bitcode) {
+    return compile(bitcode, CompileFormat::BINARY_FILE, manifest.output,
+                   link_options) == 0;
+  };
+
+  BuildResult result = run_build(manifest, build_fingerprint(options),
+                                 options.jobs, actions);
+  if (!result.success) {
+    return 1;
+  }
+  log_info(std::to_string(result.compiled) + " compiled, " +
+           std::to_string(result.up_to_date) + " up to date" +
+           (result.linked ? ", linked " + manifest.output : ""));
+  return 0;
+}
+
+int watch(const std::vector<std::string> &files, CompileFormat format,
+          const std::string &output_file, const CompileOptions &options) {
+  std::unique_ptr<FileWatcher> watcher;
+  try {
+    watcher = std::make_unique<FileWatcher>(files);
+  } catch (const ChaException &e) {
+    log_error(e.message());
+    return 1;
+  }
+
+  // Other outputs are produced by a single module, compile them again
+  std::unique_ptr<Program> program;
+  if (format == CompileFormat::BINARY_FILE &&
+      !is_directory_output(output_file)) {
+    CompileOptions program_options = options;
+    if (program_options.lto_cache.empty()) {
+      program_options.lto_cache = output_file + ".lto-cache";
+    }
+    program =
+        std::make_unique<Program>(files, output_file, program_options, true);
+  }
+
+  for (;;) {
+    auto start = std::chrono::steady_clock::now();
+    bool built = program ? program->update()
+                         : compile(files, format, output_file, options) == 0;
+    if (built && program) {
+      log_built(output_file, start, *program);
+    } else if (built) {
+      auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::steady_clock::now() - start);
+      log_info("Built " + output_file + " in " +
+               std::to_string(elapsed.count()) + " ms");
+    }
+
+    // Imported interfaces change when their modules are compiled again
+    try {
+      watcher->add(program ? program->interface_files()
+                           : imported_interfaces(files, options));
+    } catch (const ChaException &e) {
+      log_error(e.message());
+      return 1;
+    }
+    if (!watcher->wait()) {
+      log_error("Watching the inputs failed");
+      return 1;
+    }
+  }
+}
+
+int watch_build(const std::string &manifest_file,
+                const CompileOptions &options) {
+  BuildManifest manifest;
+  try {
+    manifest = read_manifest(manifest_file);
+  } catch (const BuildException &e) {
+    log_error(e.message());
+    return 1;
+  }
+
+  std::vector<std::string> files = manifest.sources;
+  files.push_back(manifest_file);
+  std::unique_ptr<FileWatcher> watcher;
+  try {
+    watcher = std::make_unique<FileWatcher>(files);
+  } catch (const ChaException &e) {
+    log_error(e.message());
+    return 1;
+  }
+
+  // The modules stay in memory like in a watch of the inputs, so a change
+  // only validates and generates the functions it affects. The build
+  // directory keeps the ThinLTO cache.
+  std::unique_ptr<Program> program;
+  uint64_t manifest_hash = hash_file(manifest_file);
+  for (;;) {
+    if (!program) {
+      CompileOptions program_options = options;
+      if (program_options.lto_cache.empty()) {
+        program_options.lto_cache = manifest.build_directory + "/lto-cache";
+      }
+      program = std::make_unique<Program>(manifest.sources, manifest.output,
+                                          program_options, true);
+    }
+    auto start = std::chrono::steady_clock::now();
+    if (program->update()) {
+      log_built(manifest.output, start, *program);
+    }
+
+    try {
+      watcher->add(program->interface_files());
+    } catch (const ChaException &e) {
+      log_error(e.message());
+      return 1;
+    }
+    if (!watcher->wait()) {
+      log_error("Watching the sources failed");
+      return 1;
+    }
+
+    // Another manifest starts over from its sources
+    uint64_t hash = hash_file(manifest_file);
+    if (hash == manifest_hash) {
+      continue;
+    }
+    manifest_hash = hash;
+    try {
+      manifest = read_manifest(manifest_file);
+      watcher->add(manifest.sources);
+    } catch (const ChaException &e) {
+      log_error(e.message());
+      continue;
+    }
+    program.reset();
+  }
+}
+
+int interpret(const std::string &file, const CompileOptions &options) {
+  AstNodeList ast;
+  if (!load_module(file, options, ast, true)) {
+    return 1;
+  }
+
+  // The interpreter runs a single module, imported code only exists compiled
+  for (const auto &node : ast) {
+    if (auto import = dynamic_cast<const ImportNode *>(node.get())) {
+      log_error(CodeGenerationException(import->location(),
+                                        "cannot interpret a module that "
+                                        "imports '" +
+                                            import->module() +
+                                            "', compile it instead")
+                    .message());
+      return 1;
+    }
+  }
+
+  if (!options.load_ast) {
+    Validator validator;
+    if (!validate_module(validator, ast)) {
+      return 1;
+    }
+  }
+
+  try {
+    BytecodeProgram program = BytecodeCompiler().compile(ast);
+    if (program.main < 0) {
+      // Same as the empty main added to compiled programs
+      return 0;
+    }
+    VirtualMachine vm(program);
+    std::unique_ptr<TieredCompiler> tiered;
+    if (options.jit) {
+      tiered = std::make_unique<TieredCompiler>(ast, program, vm, options);
+      vm.set_tier_up(tiered.get(), std::max(options.jit_threshold, 1u));
+    }
+    return static_cast<int>(vm.run(program.main).i);
+  } catch (const CodeGenerationException &e) {
+    log_error("Code generation failed: " + e.message());
+  } catch (const InterpreterException &e) {
+    log_error(e.message());
+  }
+  return 1;
+}
+
+int merge_profiles(const std::vector<std::string> &input_files,
+                   const std::string &output_file) {
+  try {
+    write_indexed_profile(input_files, output_file);
+  } catch (const ProfileException &e) {
+    log_error(e.message());
+    return 1;
+  }
+  return 0;
+}
+
+} // namespace cha
@@ -0,0 +1,72 @@
+#include "cha/cha.hpp"
+#include "exceptions.hpp"
+#include "interface.hpp"
+#include "log.hpp"
+#include "parser.hpp"
+#include "serialize.hpp"
+#include "validate.hpp"
+
+// Only uses the frontend: check() is also part of the cha_frontend library,
+// which does not link LLVM
+
+namespace cha {
+
+namespace {
+
+bool load(const std::string &file, const CompileOptions &options,
+          AstNodeList &ast) {
+  try {
+    ast = options.load_ast ? read_ast(file) : parse(file);
+  } catch (const ChaException &e) {
+    log_error(e.message());
+    return false;
+  }
+  return true;
+}
+
+} // namespace
+
+int check(const std::vector<std::string> &files,
+          const CompileOptions &options) {
+  // Every file is parsed so all syntax errors are reported at once
+  std::vector<AstNodeList> modules(files.size());
+  bool loaded = true;
+  for (size_t i = 0; i < files.size(); ++i) {
+    loaded = load(files[i], options, modules[i]) && loaded;
+  }
+  if (!loaded) {
+    return 1;
+  }
+  std::vector<const AstNodeList *> asts;
+  for (const auto &module : modules) {
+    asts.push_back(&module);
+  }
+  if (!check_function_names(asts)) {
+    return 1;
+  }
+
+  // Imports of another input are resolved in memory, the others through
+  // their interface files
+  ProgramImports imports;
+  if (!resolve_program_imports(files, asts, options.import_paths, imports)) {
+    return 1;
+  }
+  if (options.load_ast) {
+    // A binary AST has already been validated
+    return 0;
+  }
+
+  // Imported inputs are validated first, so their interfaces hold the
+  // folded constants next to the exported functions
+  bool valid = validate_program(imports, [&](size_t i) {
+    Validator validator;
+    declare_imports(validator, imports.interfaces[i]);
+    for (size_t dependency : imports.dependencies[i]) {
+      declare_imports(validator, make_interface(modules[dependency]));
+    }
+    return validate_module(validator, modules[i]);
+  });
+  return valid ? 0 : 1;
+}
+
+} // namespace cha
@@ -1,58 +1,597 @@
 #include "codegen.hpp"
 #include "exceptions.hpp"
+#include "validate.hpp"
+#include "vm.hpp"
 
-#include <cstdio>  // for std::rename, std::remove
-#include <cstdlib> // for std::system
+#include <cstdio>  // for std::remove
+#include <llvm/Analysis/ModuleSummaryAnalysis.h>
+#include <llvm/BinaryFormat/Dwarf.h>
+#include <llvm/Bitcode/BitcodeReader.h>
 #include <llvm/Bitcode/BitcodeWriter.h>
 #include <llvm/CodeGen/TargetPassConfig.h>
 #include <llvm/IR/LegacyPassManager.h>
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/IR/ModuleSummaryIndex.h>
 #include <llvm/MC/TargetRegistry.h>
+#include <llvm/Passes/PassBuilder.h>
 #include <llvm/Support/FileSystem.h>
+#include <llvm/Support/PGOOptions.h>
+#include <llvm/Support/Path.h>
 #include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/VirtualFileSystem.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Target/TargetMachine.h>
 #include <llvm/TargetParser/Host.h>
 #include <llvm/TargetParser/Triple.h>
+#include <llvm/Transforms/IPO/HotColdSplitting.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <algorithm>
+#include <cerrno>
+#include <exception>
 #include <optional>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <thread>
+
+extern char **environ;
 
 namespace cha {
 
-CodeGenerator::CodeGenerator()
-    : context_(std::make_unique<llvm::LLVMContext>()),
-      module_(std::make_unique<llvm::Module>("cha_module", *context_)),
-      builder_(std::make_unique<llvm::IRBuilder<>>(*context_)) {
+namespace {
+
+struct HostTarget {
+  std::string triple;
+  const llvm::Target *target = nullptr;
+  std::string error;
+};
+
+// Targets are only registered once code is generated, so runs stopping at a
+// diagnostic never pay for it. The lookup is shared by the target machines
+// of every thread.
+const HostTarget &host_target() {
+  // Registering targets is not thread safe, modules may be generated on
+  // several threads
+  static const HostTarget host = [] {
+    // Initialize only the targets we have linked
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+    llvm::InitializeNativeTargetAsmParser();
+    HostTarget host;
+    host.triple = llvm::sys::getDefaultTargetTriple();
+    host.target = llvm::TargetRegistry::lookupTarget(host.triple, host.error);
+    return host;
+  }();
+  return host;
+}
+
+// Run the backend of target_machine on module
+void run_backend(llvm::Module &module, llvm::TargetMachine &target_machine,
+                 llvm::CodeGenFileType file_type,
+                 llvm::raw_pwrite_stream &dest) {
+  llvm::legacy::PassManager pass;
+  if (target_machine.addPassesToEmitFile(pass, dest, nullptr, file_type)) {
+    throw CodeGenerationException(
+        "Target machine can't emit a file of this type");
+  }
+  pass.run(module);
+  dest.flush();
+}
+
+std::unique_ptr<llvm::raw_fd_ostream> open_output(const std::string &file) {
+  std::error_code ec;
+  auto dest = std::make_unique<llvm::raw_fd_ostream>(file, ec,
+                                                     llvm::sys::fs::OF_None);
+  if (ec) {
+    throw CodeGenerationException("Could not open file: " + ec.message());
+  }
+  return dest;
+}
 
-  // Initialize only the targets we have linked
-  llvm::InitializeNativeTarget();
-  llvm::InitializeNativeTargetAsmPrinter();
-  llvm::InitializeNativeTargetAsmParser();
+} // namespace
+
+void initialize_native_target() { host_target(); }
+
+llvm::TargetMachine &host_target_machine(bool function_sections, bool fast) {
+  // Creating a target machine costs more than generating a small module, so
+  // each thread keeps one per configuration. They are not shared because
+  // code generation may change a target machine's options.
+  thread_local std::unique_ptr<llvm::TargetMachine> target_machines[2][2];
+  std::unique_ptr<llvm::TargetMachine> &target_machine =
+      target_machines[function_sections][fast];
+  if (target_machine) {
+    return *target_machine;
+  }
+
+  const HostTarget &host = host_target();
+  if (!host.target) {
+    throw CodeGenerationException("Target lookup failed: " + host.error);
+  }
+
+  auto cpu = "generic";
+  auto features = "";
+
+  llvm::TargetOptions opt;
+  if (function_sections) {
+    opt.FunctionSections = true;
+    opt.EnableMachineFunctionSplitter = true;
+  }
+  // At -O0 the instruction selector is the target's fast one and register
+  // allocation is local
+  llvm::CodeGenOptLevel opt_level = llvm::CodeGenOptLevel::Default;
+  if (fast) {
+    opt.EnableFastISel = true;
+    opt_level = llvm::CodeGenOptLevel::None;
+  }
+  std::optional<llvm::Reloc::Model> reloc_model;
+  target_machine.reset(host.target->createTargetMachine(
+      llvm::Triple(host.triple), cpu, features, opt, reloc_model,
+      std::nullopt, opt_level));
+  return *target_machine;
+}
+
+void warm_up_code_generator() {
+  host_target_machine(false);
+  host_target_machine(true);
+  host_target_machine(false, true);
+}
+
+CodeGenerator::CodeGenerator(const std::string &module_name,
+                             const CompileOptions &options)
+    : owned_context_(std::make_unique<llvm::LLVMContext>()),
+      context_(owned_context_.get()),
+      module_(std::make_unique<llvm::Module>(module_name, *context_)),
+      builder_(std::make_unique<llvm::IRBuilder<>>(*context_)),
+      options_(options) {
+  // Names only make the IR readable, creating them takes time
+  context_->setDiscardValueNames(options.fast_compile);
+}
+
+CodeGenerator::CodeGenerator(llvm::LLVMContext &context,
+                             const std::string &module_name,
+                             const CompileOptions &options)
+    : context_(&context),
+      module_(std::make_unique<llvm::Module>(module_name, *context_)),
+      builder_(std::make_unique<llvm::IRBuilder<>>(*context_)),
+      options_(options) {
+  // Names only make the IR readable, creating them takes time
+  context_->setDiscardValueNames(options.fast_compile);
+}
+
+void CodeGenerator::declare_external(const FunctionDeclarationNode &node) {
+  llvm::Type *return_type = get_llvm_type(node.return_type());
+
+  std::vector<llvm::Type *> arg_types;
+  for (const auto &arg : node.arguments()) {
+    arg_types.push_back(
+        get_llvm_type(static_cast<const ArgumentNode &>(*arg).type()));
+  }
+
+  // The definition lives in another module, only emit the declaration
+  llvm::FunctionType *func_type =
+      llvm::FunctionType::get(return_type, arg_types, false);
+  llvm::Function *function =
+      llvm::Function::Create(func_type, llvm::Function::ExternalLinkage,
+                             node.identifier(), module_.get());
+  infer_function_attributes(node, function, false);
+  functions_[node.identifier()] = function;
+}
+
+void CodeGenerator::declare_external(const ConstantDeclarationNode &node) {
+  constants_[node.identifier()] = &node.value();
 }
 
 void CodeGenerator::generate(const AstNodeList &ast, CompileFormat format,
                              const std::string &output_file) {
-  // Visit all top-level nodes
-  for (const auto &node : ast) {
+  generate(ast, {{format, output_file}});
+}
+
+void CodeGenerator::generate(const AstNodeList &ast,
+                             const std::vector<CompileOutput> &outputs) {
+  build_module(ast);
+  write_outputs(outputs);
+}
+
+void CodeGenerator::begin(const std::string &source_file) {
+  // Sample profiles are matched to functions through line tables
+  if (options_.debug_info != DebugInfo::NONE ||
+      !options_.sample_profile.empty()) {
+    create_debug_info(source_file);
+  }
+
+  call_graph_ = std::make_unique<CallGraph>(AstNodeList());
+}
+
+void CodeGenerator::add(const AstNodeList &declarations) {
+  call_graph_->add(declarations);
+  add_declarations(declarations);
+}
+
+void CodeGenerator::add_declarations(const AstNodeList &declarations) {
+  // Constants first, functions may use constants declared after them
+  for (const auto &node : declarations) {
+    if (dynamic_cast<const ConstantDeclarationNode *>(node.get())) {
+      visit_node(*node);
+    }
+  }
+
+  // Visit all other top-level nodes, but functions nothing runs
+  for (const auto &node : declarations) {
+    if (dynamic_cast<const ConstantDeclarationNode *>(node.get())) {
+      continue;
+    }
+    auto function = dynamic_cast<const FunctionDeclarationNode *>(node.get());
+    if (function && live_functions_ &&
+        !live_functions_->count(function->identifier())) {
+      continue;
+    }
     visit_node(*node);
   }
+}
+
+void CodeGenerator::finish(const std::vector<CompileOutput> &outputs) {
+  end_module();
+  write_outputs(outputs);
+}
+
+void CodeGenerator::write_outputs(const std::vector<CompileOutput> &outputs) {
+  auto is_bitcode = [](const CompileOutput &output) {
+    return output.format == CompileFormat::BITCODE;
+  };
+  bool only_bitcode = std::all_of(outputs.begin(), outputs.end(), is_bitcode);
+
+  // Bitcode is optimized to be linked with ThinLTO, the other formats for
+  // the backend. The pipelines only differ when there is a profile.
+  std::unique_ptr<llvm::Module> pre_link;
+  bool profile = !options_.profile_generate.empty() || uses_profile();
+  if (profile && !only_bitcode &&
+      std::any_of(outputs.begin(), outputs.end(), is_bitcode)) {
+    pre_link = llvm::CloneModule(*module_);
+    std::swap(module_, pre_link);
+    optimize(true);
+    std::swap(module_, pre_link);
+  }
+  optimize(only_bitcode);
+
+  // Written before the backends run, they change the module
+  for (const auto &output : outputs) {
+    if (output.format == CompileFormat::LLVM_IR) {
+      emit(output.format, *open_output(output.file));
+    } else if (output.format == CompileFormat::BITCODE) {
+      auto dest = open_output(output.file);
+      if (pre_link) {
+        std::swap(module_, pre_link);
+        write_bitcode(*dest);
+        std::swap(module_, pre_link);
+      } else {
+        write_bitcode(*dest);
+      }
+    }
+  }
+
+  emit_machine_code(outputs);
+}
+
+void CodeGenerator::generate(const AstNodeList &ast, CompileFormat format,
+                             llvm::raw_pwrite_stream &dest) {
+  if (format == CompileFormat::BINARY_FILE) {
+    throw CodeGenerationException("Executables can only be written to files");
+  }
+  build_module(ast);
+  optimize(format == CompileFormat::BITCODE);
+  emit(format, dest);
+}
+
+std::unique_ptr<llvm::MemoryBuffer>
+CodeGenerator::generate_bitcode(const AstNodeList &ast) {
+  build_module(ast);
+  optimize(true);
+
+  llvm::SmallVector<char, 0> buffer;
+  llvm::raw_svector_ostream stream(buffer);
+  write_bitcode(stream);
+  return llvm::MemoryBuffer::getMemBufferCopy(
+      llvm::StringRef(buffer.data(), buffer.size()),
+      module_->getModuleIdentifier());
+}
+
+llvm::orc::ThreadSafeModule
+CodeGenerator::generate_jit_module(const AstNodeList &ast,
+                                   const FunctionDeclarationNode &function,
+                                   const std::string &entry) {
+  if (!owned_context_) {
+    throw CodeGenerationException("JIT modules need their own context");
+  }
+  main_wrapper_ = false;
+  jit_checks_ = true;
+  std::set<std::string> roots{function.identifier()};
+  build_module(ast, &roots);
+  create_jit_entry(function, entry);
+
+  // Everything but the entry can be inlined into it and dropped
+  for (auto &definition : *module_) {
+    if (!definition.isDeclaration() && definition.getName() != entry) {
+      definition.setLinkage(llvm::Function::InternalLinkage);
+    }
+  }
+  optimize(false, true);
+
+  return llvm::orc::ThreadSafeModule(std::move(module_),
+                                     std::move(owned_context_));
+}
+
+void CodeGenerator::build_module(const AstNodeList &ast,
+                                 const std::set<std::string> *roots) {
+  begin(ast.empty() ? module_->getModuleIdentifier()
+                    : ast.front()->location().file);
+  call_graph_->add(ast);
+
+  // Dead functions of a whole program never reach the optimizer, roots
+  // default to main, the exported functions and those used by constants
+  if (internalize_) {
+    live_functions_ =
+        call_graph_->reachable_from(roots ? *roots : call_graph_->roots());
+  }
+  add_declarations(ast);
+  live_functions_.reset();
+  end_module();
+}
+
+void CodeGenerator::end_module() {
+  if (di_builder_) {
+    di_builder_->finalize();
+  }
 
   // Create main wrapper if we don't have a main function
-  if (functions_.find("main") == functions_.end()) {
+  if (main_wrapper_ && functions_.find("main") == functions_.end()) {
     create_main_wrapper();
   }
 
-  // Verify the module
+  // Verify the module, a fast compile trusts the generator
+  if (options_.fast_compile) {
+    return;
+  }
   std::string error_str;
   llvm::raw_string_ostream error_stream(error_str);
   if (llvm::verifyModule(*module_, &error_stream)) {
     throw CodeGenerationException("LLVM module verification failed: " +
                                   error_str);
   }
+}
 
-  // Write output
-  write_output(format, output_file);
+void CodeGenerator::visit_node(const AstNode &node) {
+  // Steps left by an enclosing call, e.g. for a function body, stay below
+  size_t base = steps_.size();
+  size_t operands_base = operands_.size();
+  schedule(Step::ENTER, node);
+  try {
+    while (steps_.size() > base) {
+      Step step = steps_.back();
+      steps_.pop_back();
+      run_step(step);
+    }
+  } catch (...) {
+    steps_.resize(base);
+    operands_.resize(operands_base);
+    throw;
+  }
 }
 
-void CodeGenerator::visit_node(const AstNode &node) { node.accept(*this); }
+void CodeGenerator::schedule(Step::Kind kind, const AstNode &node,
+                             llvm::Value *value, llvm::BasicBlock *block,
+                             llvm::BasicBlock *merge) {
+  steps_.push_back(Step{kind, &node, value, block, merge, llvm::DebugLoc()});
+}
+
+void CodeGenerator::schedule_list(const AstNodeList &nodes) {
+  // The last step scheduled runs first
+  for (auto it = nodes.rbegin(); it != nodes.rend(); ++it) {
+    schedule(Step::ENTER, **it);
+  }
+}
+
+void CodeGenerator::run_step(const Step &step) {
+  const AstNode &node = *step.node;
+  switch (step.kind) {
+  case Step::ENTER:
+    if (current_subprogram_) {
+      // Instructions get the location of the innermost node that created
+      // them, the parent's is restored once the node's steps are done
+      Step restore = step;
+      restore.kind = Step::RESTORE_LOCATION;
+      restore.location = builder_->getCurrentDebugLocation();
+      steps_.push_back(restore);
+      emit_location(node.location());
+    }
+    node.accept(*this);
+    break;
+  case Step::RESTORE_LOCATION:
+    builder_->SetCurrentDebugLocation(step.location);
+    break;
+  case Step::SAVE_VALUE:
+    operands_.push_back(current_value_);
+    break;
+  case Step::BINARY_OP: {
+    llvm::Value *left_val = operands_.back();
+    operands_.pop_back();
+    emit_binary_op(static_cast<const BinaryOpNode &>(node), left_val,
+                   current_value_);
+    break;
+  }
+  case Step::UNARY_OP:
+    emit_unary_op(static_cast<const UnaryOpNode &>(node));
+    break;
+  case Step::STORE_VARIABLE:
+    store_variable(static_cast<const VariableDeclarationNode &>(node),
+                   llvm::cast<llvm::AllocaInst>(step.value));
+    break;
+  case Step::ASSIGN:
+    emit_assignment(static_cast<const VariableAssignmentNode &>(node));
+    break;
+  case Step::CALL:
+    emit_call(static_cast<const FunctionCallNode &>(node));
+    break;
+  case Step::RETURN:
+    emit_return(static_cast<const FunctionReturnNode &>(node));
+    break;
+  case Step::IF_BRANCH:
+    emit_if_branch(static_cast<const IfNode &>(node));
+    break;
+  case Step::END_BRANCH:
+    end_branch(step.block, step.merge);
+    break;
+  }
+}
+
+void CodeGenerator::create_debug_info(const std::string &source) {
+  llvm::StringRef directory = llvm::sys::path::parent_path(source);
+
+  di_builder_ = std::make_unique<llvm::DIBuilder>(*module_);
+  di_file_ = di_builder_->createFile(llvm::sys::path::filename(source),
+                                     directory.empty() ? "." : directory);
+  bool optimized = uses_profile() || !options_.profile_generate.empty();
+  auto emission_kind = options_.debug_info == DebugInfo::FULL
+                           ? llvm::DICompileUnit::FullDebug
+                           : llvm::DICompileUnit::LineTablesOnly;
+  di_builder_->createCompileUnit(llvm::dwarf::DW_LANG_C, di_file_, "cha",
+                                 optimized, "", 0, "", emission_kind, 0, true,
+                                 !options_.sample_profile.empty());
+
+  module_->addModuleFlag(llvm::Module::Warning, "Debug Info Version",
+                         llvm::DEBUG_METADATA_VERSION);
+  module_->addModuleFlag(llvm::Module::Warning, "Dwarf Version", 4);
+}
+
+void CodeGenerator::create_subprogram(const FunctionDeclarationNode &node,
+                                      llvm::Function *function) {
+  unsigned line = node.location().line_begin;
+
+  // Line tables do not need the signature
+  std::vector<llvm::Metadata *> signature;
+  if (options_.debug_info == DebugInfo::FULL) {
+    signature.push_back(get_debug_type(node.return_type()));
+    for (const auto &arg : node.arguments()) {
+      signature.push_back(
+          get_debug_type(static_cast<const ArgumentNode &>(*arg).type()));
+    }
+  }
+  llvm::DISubroutineType *type = di_builder_->createSubroutineType(
+      di_builder_->getOrCreateTypeArray(signature));
+
+  llvm::DISubprogram *subprogram = di_builder_->createFunction(
+      di_file_, node.identifier(), llvm::StringRef(), di_file_, line, type,
+      line, llvm::DINode::FlagPrototyped,
+      llvm::DISubprogram::SPFlagDefinition);
+  function->setSubprogram(subprogram);
+  current_subprogram_ = subprogram;
+}
+
+void CodeGenerator::emit_location(const AstLocation &location) {
+  builder_->SetCurrentDebugLocation(
+      llvm::DILocation::get(*context_, location.line_begin,
+                            location.column_begin, current_subprogram_));
+}
+
+llvm::DIType *CodeGenerator::get_debug_type(const AstType &type) {
+  if (type.is_array()) {
+    const auto &array = type.as_array();
+    llvm::DIType *element_type = get_debug_type(*array.element_type);
+    llvm::Metadata *subscript = di_builder_->getOrCreateSubrange(0, array.size);
+    return di_builder_->createArrayType(
+        element_type->getSizeInBits() * array.size, 0, element_type,
+        di_builder_->getOrCreateArray(subscript));
+  }
+
+  PrimitiveType primitive = type.as_primitive().type;
+  if (primitive == PrimitiveType::UNDEF) {
+    // void
+    return nullptr;
+  }
+
+  unsigned encoding = llvm::dwarf::DW_ATE_signed;
+  if (primitive == PrimitiveType::BOOL) {
+    encoding = llvm::dwarf::DW_ATE_boolean;
+  } else if (TypeUtils::is_unsigned_int(primitive)) {
+    encoding = llvm::dwarf::DW_ATE_unsigned;
+  } else if (TypeUtils::is_float(primitive)) {
+    encoding = llvm::dwarf::DW_ATE_float;
+  }
+
+  // bool is an i1 but takes a whole byte in memory
+  uint64_t size = std::max<uint64_t>(
+      primitive_to_llvm_type(primitive)->getPrimitiveSizeInBits(), 8);
+  return di_builder_->createBasicType(TypeUtils::type_to_string(primitive),
+                                      size, encoding);
+}
+
+void CodeGenerator::declare_variable(llvm::AllocaInst *alloca,
+                                     const std::string &name,
+                                     const AstType &type,
+                                     const AstLocation &location,
+                                     unsigned arg_number) {
+  if (!current_subprogram_ || options_.debug_info != DebugInfo::FULL) {
+    return;
+  }
+
+  llvm::DILocalVariable *variable =
+      arg_number > 0
+          ? di_builder_->createParameterVariable(
+                current_subprogram_, name, arg_number, di_file_,
+                location.line_begin, get_debug_type(type), true)
+          : di_builder_->createAutoVariable(current_subprogram_, name,
+                                            di_file_, location.line_begin,
+                                            get_debug_type(type), true);
+  di_builder_->insertDeclare(
+      alloca, variable, di_builder_->createExpression(),
+      llvm::DILocation::get(*context_, location.line_begin,
+                            location.column_begin, current_subprogram_),
+      builder_->GetInsertBlock());
+}
+
+void CodeGenerator::set_function_attributes(llvm::Function *function) {
+  if (options_.frame_pointers) {
+    function->addFnAttr("frame-pointer", "all");
+  }
+}
+
+void CodeGenerator::infer_function_attributes(
+    const FunctionDeclarationNode &node, llvm::Function *function,
+    bool definition) {
+  const std::string &name = node.identifier();
+
+  // Only main and exported functions are called from outside of cha code,
+  // everything else can use the faster calling convention and, when this
+  // module is the whole program, be dropped once inlined
+  if (name != "main" && !node.exported()) {
+    function->setCallingConv(llvm::CallingConv::Fast);
+    if (internalize_ && definition) {
+      function->setLinkage(llvm::Function::InternalLinkage);
+    }
+  }
+
+  // cha has no exceptions and functions only touch their own stack frame, so
+  // calls with the same arguments give the same result. Instrumented
+  // functions write their counters though, and JIT functions their call
+  // depth and traps.
+  function->setDoesNotThrow();
+  bool pure = options_.profile_generate.empty() && !jit_checks_;
+  if (pure) {
+    function->setDoesNotAccessMemory();
+  }
+
+  // Without recursion every call returns, declarations from other modules
+  // are unknown
+  if (!call_graph_ || !call_graph_->contains(name) ||
+      call_graph_->may_not_return(name)) {
+    return;
+  }
+  function->setWillReturn();
+  function->setDoesNotRecurse();
+
+  // Safe to execute speculatively, e.g. hoisted out of a branch
+  if (pure && !call_graph_->may_trap(name)) {
+    function->addFnAttr(llvm::Attribute::Speculatable);
+  }
+}
 
 llvm::Type *CodeGenerator::get_llvm_type(const AstType &type) {
   if (type.is_primitive()) {
@@ -107,92 +646,240 @@ llvm::Type *CodeGenerator::primitive_to_llvm_type(PrimitiveType prim_type) {
   }
 }
 
-void CodeGenerator::write_output(CompileFormat format,
-                                 const std::string &output_file) {
-  std::error_code ec;
+llvm::TargetMachine &CodeGenerator::target_machine() {
+  // A section per function lets the linker group hot and unlikely code, and
+  // cold blocks are split out of hot functions
+  llvm::TargetMachine &target_machine =
+      host_target_machine(uses_profile(), options_.fast_compile);
 
-  switch (format) {
-  case CompileFormat::LLVM_IR: {
-    llvm::raw_fd_ostream dest(output_file, ec, llvm::sys::fs::OF_None);
-    if (ec) {
-      throw CodeGenerationException("Could not open file: " + ec.message());
-    }
-    module_->print(dest, nullptr);
-    break;
-  }
+  module_->setDataLayout(target_machine.createDataLayout());
+  module_->setTargetTriple(target_machine.getTargetTriple());
+  return target_machine;
+}
 
-  case CompileFormat::ASSEMBLY_FILE:
-  case CompileFormat::OBJECT_FILE:
-  case CompileFormat::BINARY_FILE: {
-    // Initialize target
-    auto target_triple = llvm::sys::getDefaultTargetTriple();
-    std::string error;
-    auto target = llvm::TargetRegistry::lookupTarget(target_triple, error);
+void CodeGenerator::optimize(bool thin_lto_pre_link, bool required) {
+  // Without a profile the module is handed to the backend as generated
+  std::optional<llvm::PGOOptions> pgo;
+  auto fs = llvm::vfs::getRealFileSystem();
+  if (!options_.profile_generate.empty()) {
+    pgo = llvm::PGOOptions(options_.profile_generate, "", "", "", fs,
+                           llvm::PGOOptions::IRInstr);
+  } else if (!options_.profile_use.empty()) {
+    pgo = llvm::PGOOptions(options_.profile_use, "", "", "", fs,
+                           llvm::PGOOptions::IRUse);
+  } else if (!options_.sample_profile.empty()) {
+    pgo = llvm::PGOOptions(options_.sample_profile, "", "", "", fs,
+                           llvm::PGOOptions::SampleUse,
+                           llvm::PGOOptions::NoCSAction,
+                           llvm::PGOOptions::ColdFuncOpt::Default, true);
+  } else if (!required) {
+    return;
+  }
 
-    if (!target) {
-      throw CodeGenerationException("Target lookup failed: " + error);
-    }
+  // A missing profile would only be reported as an LLVM diagnostic
+  if (uses_profile() && !llvm::sys::fs::exists(pgo->ProfileFile)) {
+    throw CodeGenerationException("Could not open profile: " +
+                                  pgo->ProfileFile);
+  }
 
-    auto cpu = "generic";
-    auto features = "";
+  llvm::TargetMachine &target_machine = this->target_machine();
+
+  llvm::LoopAnalysisManager lam;
+  llvm::FunctionAnalysisManager fam;
+  llvm::CGSCCAnalysisManager cgam;
+  llvm::ModuleAnalysisManager mam;
+
+  // The PGO passes run first in the pipeline, so counters and branch weights
+  // are placed before inlining and block layout
+  llvm::PassBuilder pass_builder(&target_machine,
+                                 llvm::PipelineTuningOptions(), pgo);
+  pass_builder.registerModuleAnalyses(mam);
+  pass_builder.registerCGSCCAnalyses(cgam);
+  pass_builder.registerFunctionAnalyses(fam);
+  pass_builder.registerLoopAnalyses(lam);
+  pass_builder.crossRegisterProxies(lam, fam, cgam, mam);
+
+  llvm::ModulePassManager pass_manager =
+      thin_lto_pre_link ? pass_builder.buildThinLTOPreLinkDefaultPipeline(
+                              llvm::OptimizationLevel::O2)
+                        : pass_builder.buildPerModuleDefaultPipeline(
+                              llvm::OptimizationLevel::O2);
+
+  // Outline cold regions of hot functions. With ThinLTO the backends only
+  // split cold blocks with the machine function splitter
+  if (uses_profile() && !thin_lto_pre_link) {
+    pass_manager.addPass(llvm::HotColdSplittingPass());
+  }
+  pass_manager.run(*module_, mam);
 
-    llvm::TargetOptions opt;
-    std::optional<llvm::Reloc::Model> reloc_model;
-    auto target_machine = target->createTargetMachine(
-        llvm::Triple(target_triple), cpu, features, opt, reloc_model);
+  if (uses_profile() && !thin_lto_pre_link) {
+    order_functions_by_profile();
+  }
+}
 
-    module_->setDataLayout(target_machine->createDataLayout());
-    module_->setTargetTriple(llvm::Triple(target_triple));
+bool CodeGenerator::uses_profile() const {
+  return !options_.profile_use.empty() || !options_.sample_profile.empty();
+}
 
-    llvm::raw_fd_ostream dest(output_file, ec, llvm::sys::fs::OF_None);
-    if (ec) {
-      throw CodeGenerationException("Could not open file: " + ec.message());
+void CodeGenerator::order_functions_by_profile() {
+  // Emit the hottest functions first so they share pages and cache lines
+  std::vector<llvm::Function *> order;
+  for (auto &function : *module_) {
+    if (!function.isDeclaration()) {
+      order.push_back(&function);
     }
+  }
 
-    llvm::legacy::PassManager pass;
-    auto file_type = (format == CompileFormat::ASSEMBLY_FILE)
-                         ? llvm::CodeGenFileType::AssemblyFile
-                         : llvm::CodeGenFileType::ObjectFile;
+  auto entry_count = [](const llvm::Function *function) -> uint64_t {
+    auto count = function->getEntryCount();
+    return count ? count->getCount() : 0;
+  };
+  std::stable_sort(order.begin(), order.end(),
+                   [&](const llvm::Function *a, const llvm::Function *b) {
+                     return entry_count(a) > entry_count(b);
+                   });
+
+  auto &functions = module_->getFunctionList();
+  for (auto *function : order) {
+    functions.splice(functions.end(), functions, function->getIterator());
+  }
+}
 
-    if (target_machine->addPassesToEmitFile(pass, dest, nullptr, file_type)) {
-      throw CodeGenerationException(
-          "Target machine can't emit a file of this type");
+void CodeGenerator::emit_machine_code(
+    const std::vector<CompileOutput> &outputs) {
+  struct Job {
+    llvm::CodeGenFileType file_type;
+    std::string file;
+  };
+  std::vector<Job> jobs;
+  std::string object_file;
+  std::string executable;
+  for (const auto &output : outputs) {
+    if (output.format == CompileFormat::ASSEMBLY_FILE) {
+      jobs.push_back({llvm::CodeGenFileType::AssemblyFile, output.file});
+    } else if (output.format == CompileFormat::OBJECT_FILE) {
+      jobs.push_back({llvm::CodeGenFileType::ObjectFile, output.file});
+      object_file = output.file;
+    } else if (output.format == CompileFormat::BINARY_FILE) {
+      executable = output.file;
+    } else if (output.format != CompileFormat::LLVM_IR &&
+               output.format != CompileFormat::BITCODE) {
+      throw CodeGenerationException("Unsupported output format");
     }
+  }
 
-    pass.run(*module_);
-    dest.flush();
+  // For binary files the object is linked into the final output afterwards
+  bool temporary_object = !executable.empty() && object_file.empty();
+  if (temporary_object) {
+    object_file = executable + ".o";
+    jobs.push_back({llvm::CodeGenFileType::ObjectFile, object_file});
+  }
+  if (jobs.empty()) {
+    return;
+  }
 
-    // For binary files, add a linker step
-    if (format == CompileFormat::BINARY_FILE) {
-      dest.close(); // Close the object file first
+  llvm::TargetMachine &target_machine = this->target_machine();
 
-      // Create temporary object file name
-      std::string obj_file = output_file + ".o";
+  // A backend changes the module it runs on, so the other backends get
+  // copies of the optimized module, each in its own context on its own
+  // thread with the thread's target machine
+  llvm::SmallVector<char, 0> bitcode;
+  if (jobs.size() > 1) {
+    llvm::raw_svector_ostream stream(bitcode);
+    llvm::WriteBitcodeToFile(*module_, stream);
+  }
+  std::string module_name = module_->getModuleIdentifier();
+  std::vector<std::exception_ptr> errors(jobs.size());
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < jobs.size(); ++i) {
+    threads.emplace_back([&, i] {
+      try {
+        llvm::LLVMContext context;
+        auto module = llvm::parseBitcodeFile(
+            llvm::MemoryBufferRef(
+                llvm::StringRef(bitcode.data(), bitcode.size()), module_name),
+            context);
+        if (!module) {
+          throw CodeGenerationException(
+              "Could not copy the module: " +
+              llvm::toString(module.takeError()));
+        }
+        run_backend(**module,
+                    host_target_machine(uses_profile(), options_.fast_compile),
+                    jobs[i].file_type, *open_output(jobs[i].file));
+      } catch (...) {
+        errors[i] = std::current_exception();
+      }
+    });
+  }
+  try {
+    run_backend(*module_, target_machine, jobs[0].file_type,
+                *open_output(jobs[0].file));
+  } catch (...) {
+    errors[0] = std::current_exception();
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
 
-      // Rename the output to .o extension temporarily
-      if (std::rename(output_file.c_str(), obj_file.c_str()) != 0) {
-        throw CodeGenerationException("Failed to create temporary object file");
+  try {
+    for (const auto &error : errors) {
+      if (error) {
+        std::rethrow_exception(error);
       }
+    }
+    // For binary files, add a linker step
+    if (!executable.empty()) {
+      link_executable({object_file}, executable, options_);
+    }
+  } catch (...) {
+    if (temporary_object) {
+      std::remove(object_file.c_str());
+    }
+    throw;
+  }
 
-      // Link with cc
-      std::string link_cmd = "cc -o " + output_file + " " + obj_file;
-      int result = std::system(link_cmd.c_str());
+  // Clean up temporary object file
+  if (temporary_object) {
+    std::remove(object_file.c_str());
+  }
+}
 
-      // Clean up temporary object file
-      std::remove(obj_file.c_str());
+void CodeGenerator::emit(CompileFormat format, llvm::raw_pwrite_stream &dest) {
+  switch (format) {
+  case CompileFormat::LLVM_IR:
+    module_->print(dest, nullptr);
+    break;
 
-      if (result != 0) {
-        throw CodeGenerationException("Linking failed - is 'cc' available?");
-      }
-    }
+  case CompileFormat::BITCODE:
+    write_bitcode(dest);
+    break;
+
+  case CompileFormat::ASSEMBLY_FILE:
+    run_backend(*module_, target_machine(),
+                llvm::CodeGenFileType::AssemblyFile, dest);
+    break;
+
+  case CompileFormat::OBJECT_FILE:
+    run_backend(*module_, target_machine(), llvm::CodeGenFileType::ObjectFile,
+                dest);
     break;
-  }
 
   default:
     throw CodeGenerationException("Unsupported output format");
   }
 }
 
+void CodeGenerator::write_bitcode(llvm::raw_ostream &dest) {
+  // Bitcode carries the target so it can be code generated later on
+  target_machine();
+
+  // The summary lets ThinLTO import functions across modules
+  llvm::ModuleSummaryIndex index =
+      llvm::buildModuleSummaryIndex(*module_, nullptr, nullptr);
+  llvm::WriteBitcodeToFile(*module_, dest, false, &index);
+}
+
 void CodeGenerator::create_main_wrapper() {
   // Create a simple main function that returns 0
   llvm::FunctionType *main_type =
@@ -200,6 +887,7 @@ void CodeGenerator::create_main_wrapper() {
 
   llvm::Function *main_func = llvm::Function::Create(
       main_type, llvm::Function::ExternalLinkage, "main", module_.get());
+  set_function_attributes(main_func);
 
   llvm::BasicBlock *bb =
       llvm::BasicBlock::Create(*context_, "entry", main_func);
@@ -212,6 +900,111 @@ void CodeGenerator::create_main_wrapper() {
   functions_["main"] = main_func;
 }
 
+void CodeGenerator::create_jit_entry(const FunctionDeclarationNode &node,
+                                     const std::string &entry) {
+  llvm::Function *callee = functions_.at(node.identifier());
+  llvm::Type *i64 = llvm::Type::getInt64Ty(*context_);
+  llvm::Type *f64 = llvm::Type::getDoubleTy(*context_);
+
+  llvm::Type *i32 = llvm::Type::getInt32Ty(*context_);
+  llvm::Type *ptr = llvm::PointerType::get(*context_, 0);
+
+  llvm::FunctionType *entry_type =
+      llvm::FunctionType::get(i64, {ptr, ptr}, false);
+  llvm::Function *entry_func = llvm::Function::Create(
+      entry_type, llvm::Function::ExternalLinkage, entry, module_.get());
+  set_function_attributes(entry_func);
+  entry_func->setDoesNotThrow();
+
+  llvm::BasicBlock *bb =
+      llvm::BasicBlock::Create(*context_, "entry", entry_func);
+  builder_->SetInsertPoint(bb);
+
+  // Profilers attribute the inlined body to the function's source lines
+  if (di_builder_) {
+    create_subprogram(node, entry_func);
+    emit_location(node.location());
+  }
+
+  // Registers hold integers widened to 64 bits and floats as doubles
+  std::vector<llvm::Value *> args;
+  llvm::Value *registers = entry_func->getArg(0);
+  for (auto &arg : callee->args()) {
+    llvm::Value *slot = builder_->CreateConstInBoundsGEP1_64(
+        i64, registers, arg.getArgNo());
+    llvm::Value *value = builder_->CreateLoad(i64, slot);
+    llvm::Type *type = arg.getType();
+    if (type->isFloatingPointTy()) {
+      value = builder_->CreateBitCast(value, f64);
+      value = builder_->CreateFPTrunc(value, type);
+    } else {
+      value = builder_->CreateTrunc(value, type);
+    }
+    args.push_back(value);
+  }
+
+  // The call continues the interpreter's depth (see NativeCall), its trap
+  // goes back to the interpreter
+  llvm::StructType *call_type = llvm::StructType::get(i64, i32);
+  llvm::Value *native_call = entry_func->getArg(1);
+  llvm::Value *depth_slot = builder_->CreateStructGEP(call_type, native_call, 0);
+  llvm::Value *trap_slot = builder_->CreateStructGEP(call_type, native_call, 1);
+  llvm::Value *depth = builder_->CreateLoad(i64, depth_slot);
+  llvm::BasicBlock *overflow_bb =
+      llvm::BasicBlock::Create(*context_, "overflow", entry_func);
+  llvm::BasicBlock *call_bb =
+      llvm::BasicBlock::Create(*context_, "call", entry_func);
+  builder_->CreateCondBr(
+      builder_->CreateICmpUGE(depth, builder_->getInt64(VM_MAX_CALL_DEPTH)),
+      overflow_bb, call_bb, unlikely());
+
+  builder_->SetInsertPoint(overflow_bb);
+  builder_->CreateStore(builder_->getInt32(NativeCall::STACK_OVERFLOW),
+                        trap_slot);
+  builder_->CreateRet(llvm::ConstantInt::get(i64, 0));
+
+  builder_->SetInsertPoint(call_bb);
+  builder_->CreateStore(builder_->CreateAdd(depth, builder_->getInt64(1)),
+                        jit_global(JIT_DEPTH, i64));
+  builder_->CreateStore(builder_->getInt32(NativeCall::NONE),
+                        jit_global(JIT_TRAP, i32));
+  llvm::CallInst *call = builder_->CreateCall(callee, args);
+  call->setCallingConv(callee->getCallingConv());
+  builder_->CreateStore(builder_->CreateLoad(i32, jit_global(JIT_TRAP, i32)),
+                        trap_slot);
+
+  PrimitiveType return_type = PrimitiveType::UNDEF;
+  if (node.return_type().is_primitive()) {
+    return_type = node.return_type().as_primitive().type;
+  }
+  llvm::Value *result = call;
+  if (call->getType()->isVoidTy()) {
+    result = llvm::ConstantInt::get(i64, 0);
+  } else if (call->getType()->isFloatingPointTy()) {
+    result = builder_->CreateFPExt(result, f64);
+    result = builder_->CreateBitCast(result, i64);
+  } else if (TypeUtils::is_unsigned_int(return_type) ||
+             return_type == PrimitiveType::BOOL) {
+    result = builder_->CreateZExt(result, i64);
+  } else {
+    result = builder_->CreateSExt(result, i64);
+  }
+  builder_->CreateRet(result);
+
+  if (di_builder_) {
+    di_builder_->finalizeSubprogram(current_subprogram_);
+    current_subprogram_ = nullptr;
+    builder_->SetCurrentDebugLocation(llvm::DebugLoc());
+  }
+
+  std::string error_str;
+  llvm::raw_string_ostream error_stream(error_str);
+  if (llvm::verifyFunction(*entry_func, &error_stream)) {
+    throw CodeGenerationException("LLVM module verification failed: " +
+                                  error_str);
+  }
+}
+
 // Visitor implementations
 void CodeGenerator::visit(const ConstantIntegerNode &node) {
   // Use the numeric value directly
@@ -329,14 +1122,16 @@ void CodeGenerator::visit(const ConstantBoolNode &node) {
 }
 
 void CodeGenerator::visit(const BinaryOpNode &node) {
-  // Generate code for left operand
-  visit_node(node.left());
-  llvm::Value *left_val = current_value_;
-
-  // Generate code for right operand
-  visit_node(node.right());
-  llvm::Value *right_val = current_value_;
+  // Left operand, kept aside while the right one is generated
+  schedule(Step::BINARY_OP, node);
+  schedule(Step::ENTER, node.right());
+  schedule(Step::SAVE_VALUE, node);
+  schedule(Step::ENTER, node.left());
+}
 
+void CodeGenerator::emit_binary_op(const BinaryOpNode &node,
+                                   llvm::Value *left_val,
+                                   llvm::Value *right_val) {
   if (!left_val || !right_val) {
     throw CodeGenerationException(
         "Failed to generate operands for binary operation");
@@ -369,7 +1164,9 @@ void CodeGenerator::visit(const BinaryOpNode &node) {
     break;
 
   case BinaryOperator::SLASH:
-    if (left_val->getType()->isIntegerTy()) {
+    if (left_val->getType()->isIntegerTy() && jit_checks_) {
+      current_value_ = emit_checked_division(node, left_val, right_val);
+    } else if (left_val->getType()->isIntegerTy()) {
       current_value_ = builder_->CreateSDiv(left_val, right_val, "divtmp");
     } else {
       current_value_ = builder_->CreateFDiv(left_val, right_val, "divtmp");
@@ -438,8 +1235,11 @@ void CodeGenerator::visit(const BinaryOpNode &node) {
 }
 
 void CodeGenerator::visit(const UnaryOpNode &node) {
-  // Generate code for operand
-  visit_node(node.operand());
+  schedule(Step::UNARY_OP, node);
+  schedule(Step::ENTER, node.operand());
+}
+
+void CodeGenerator::emit_unary_op(const UnaryOpNode &node) {
   llvm::Value *operand_val = current_value_;
 
   if (!operand_val) {
@@ -473,11 +1273,18 @@ void CodeGenerator::visit(const VariableDeclarationNode &node) {
   // Create alloca instruction for the variable
   llvm::AllocaInst *alloca =
       builder_->CreateAlloca(var_type, nullptr, node.identifier());
+  declare_variable(alloca, node.identifier(), node.type(), node.location());
 
-  // Store initial value if provided
+  schedule(Step::STORE_VARIABLE, node, alloca);
   if (node.value()) {
-    visit_node(*node.value());
+    schedule(Step::ENTER, *node.value());
+  }
+}
 
+void CodeGenerator::store_variable(const VariableDeclarationNode &node,
+                                   llvm::AllocaInst *alloca) {
+  // Store initial value if provided
+  if (node.value()) {
     if (!current_value_) {
       throw CodeGenerationException(
           "Failed to generate initial value for variable: " +
@@ -493,6 +1300,11 @@ void CodeGenerator::visit(const VariableDeclarationNode &node) {
 }
 
 void CodeGenerator::visit(const VariableAssignmentNode &node) {
+  schedule(Step::ASSIGN, node);
+  schedule(Step::ENTER, node.value());
+}
+
+void CodeGenerator::emit_assignment(const VariableAssignmentNode &node) {
   // Look up the variable
   auto it = named_values_.find(node.identifier());
   if (it == named_values_.end()) {
@@ -500,9 +1312,6 @@ void CodeGenerator::visit(const VariableAssignmentNode &node) {
                                   node.identifier());
   }
 
-  // Generate code for the value
-  visit_node(node.value());
-
   if (!current_value_) {
     throw CodeGenerationException(
         "Failed to generate value for assignment to: " + node.identifier());
@@ -516,6 +1325,13 @@ void CodeGenerator::visit(const VariableLookupNode &node) {
   // Look up the variable
   auto it = named_values_.find(node.identifier());
   if (it == named_values_.end()) {
+    auto constant = constants_.find(node.identifier());
+    if (constant != constants_.end() && node.result_type()) {
+      AstNodePtr literal = constant->second->clone();
+      literal->set_result_type(node.result_type()->clone());
+      visit_node(*literal);
+      return;
+    }
     throw CodeGenerationException("Unknown variable name: " +
                                   node.identifier());
   }
@@ -535,9 +1351,7 @@ void CodeGenerator::visit(const ArgumentNode &node) {
 
 void CodeGenerator::visit(const BlockNode &node) {
   // Visit all statements in the block
-  for (const auto &stmt : node.statements()) {
-    visit_node(*stmt);
-  }
+  schedule_list(node.statements());
 }
 
 void CodeGenerator::visit(const FunctionDeclarationNode &node) {
@@ -573,6 +1387,17 @@ void CodeGenerator::visit(const FunctionDeclarationNode &node) {
       llvm::Function::Create(func_type, llvm::Function::ExternalLinkage,
                              node.identifier(), module_.get());
 
+  // Register before the body so recursive calls resolve
+  functions_[node.identifier()] = function;
+  set_function_attributes(function);
+  infer_function_attributes(node, function, true);
+
+  llvm::DISubprogram *prev_subprogram = current_subprogram_;
+  if (di_builder_) {
+    create_subprogram(node, function);
+    emit_location(node.location());
+  }
+
   // Set argument names
   unsigned idx = 0;
   for (auto &arg : function->args()) {
@@ -601,6 +1426,8 @@ void CodeGenerator::visit(const FunctionDeclarationNode &node) {
     llvm::AllocaInst *alloca =
         builder_->CreateAlloca(arg.getType(), nullptr, arg_node->identifier());
     builder_->CreateStore(&arg, alloca);
+    declare_variable(alloca, arg_node->identifier(), arg_node->type(),
+                     arg_node->location(), idx + 1);
     named_values_[arg_node->identifier()] = alloca;
     idx++;
   }
@@ -624,12 +1451,30 @@ void CodeGenerator::visit(const FunctionDeclarationNode &node) {
   current_function_ = prev_function;
   named_values_ = prev_named_values;
 
-  // Store function in symbol table
-  functions_[node.identifier()] = function;
+  if (di_builder_) {
+    di_builder_->finalizeSubprogram(current_subprogram_);
+    current_subprogram_ = prev_subprogram;
+    builder_->SetCurrentDebugLocation(llvm::DebugLoc());
+  }
+
   current_value_ = function;
 }
 
 void CodeGenerator::visit(const FunctionCallNode &node) {
+  // Arguments are kept aside until the call
+  schedule(Step::CALL, node);
+  const AstNodeList &args = node.arguments();
+  for (auto it = args.rbegin(); it != args.rend(); ++it) {
+    schedule(Step::SAVE_VALUE, node);
+    schedule(Step::ENTER, **it);
+  }
+}
+
+void CodeGenerator::emit_call(const FunctionCallNode &node) {
+  size_t count = node.arguments().size();
+  std::vector<llvm::Value *> args(operands_.end() - count, operands_.end());
+  operands_.resize(operands_.size() - count);
+
   // Look up the function
   auto it = functions_.find(node.identifier());
   if (it == functions_.end()) {
@@ -644,29 +1489,122 @@ void CodeGenerator::visit(const FunctionCallNode &node) {
         "Incorrect number of arguments for function: " + node.identifier());
   }
 
-  // Generate code for arguments
-  std::vector<llvm::Value *> args;
-  for (const auto &arg : node.arguments()) {
-    visit_node(*arg);
-
-    if (!current_value_) {
+  for (llvm::Value *arg : args) {
+    if (!arg) {
       throw CodeGenerationException(
           "Failed to generate argument for function call: " +
           node.identifier());
     }
+  }
 
-    args.push_back(current_value_);
+  if (!jit_checks_) {
+    llvm::CallInst *call = builder_->CreateCall(callee, args, "calltmp");
+    call->setCallingConv(callee->getCallingConv());
+    current_value_ = call;
+    return;
   }
 
-  // Create function call
-  current_value_ = builder_->CreateCall(callee, args, "calltmp");
+  // Native code stops at the interpreter's call depth limit, and returns at
+  // once when the callee trapped
+  llvm::Type *i64 = builder_->getInt64Ty();
+  llvm::GlobalVariable *depth_global = jit_global(JIT_DEPTH, i64);
+  llvm::Value *depth = builder_->CreateLoad(i64, depth_global);
+  emit_trap_if(
+      builder_->CreateICmpUGE(depth, builder_->getInt64(VM_MAX_CALL_DEPTH)),
+      NativeCall::STACK_OVERFLOW);
+  builder_->CreateStore(builder_->CreateAdd(depth, builder_->getInt64(1)),
+                        depth_global);
+  llvm::CallInst *call = builder_->CreateCall(callee, args, "calltmp");
+  call->setCallingConv(callee->getCallingConv());
+  builder_->CreateStore(depth, depth_global);
+  llvm::Value *trap = builder_->CreateLoad(
+      builder_->getInt32Ty(), jit_global(JIT_TRAP, builder_->getInt32Ty()));
+  emit_trap_if(builder_->CreateICmpNE(trap, builder_->getInt32(0)),
+               NativeCall::NONE);
+  current_value_ = call;
+}
+
+llvm::GlobalVariable *CodeGenerator::jit_global(const char *name,
+                                                llvm::Type *type) {
+  if (llvm::GlobalVariable *global = module_->getNamedGlobal(name)) {
+    return global;
+  }
+  return new llvm::GlobalVariable(*module_, type, false,
+                                  llvm::GlobalValue::InternalLinkage,
+                                  llvm::Constant::getNullValue(type), name);
+}
+
+llvm::MDNode *CodeGenerator::unlikely() {
+  return llvm::MDBuilder(*context_).createBranchWeights(1, 1 << 20);
+}
+
+void CodeGenerator::emit_trap_if(llvm::Value *condition, uint32_t trap) {
+  // The function returns at once, leaving the trap for the JIT entry to
+  // report, and so do its callers
+  llvm::Function *function = builder_->GetInsertBlock()->getParent();
+  llvm::BasicBlock *trap_bb =
+      llvm::BasicBlock::Create(*context_, "trap", function);
+  llvm::BasicBlock *continue_bb =
+      llvm::BasicBlock::Create(*context_, "notrap", function);
+  builder_->CreateCondBr(condition, trap_bb, continue_bb, unlikely());
+
+  builder_->SetInsertPoint(trap_bb);
+  if (trap != NativeCall::NONE) {
+    builder_->CreateStore(builder_->getInt32(trap),
+                          jit_global(JIT_TRAP, builder_->getInt32Ty()));
+  }
+  llvm::Type *return_type = function->getReturnType();
+  if (return_type->isVoidTy()) {
+    builder_->CreateRetVoid();
+  } else {
+    builder_->CreateRet(llvm::Constant::getNullValue(return_type));
+  }
+  builder_->SetInsertPoint(continue_bb);
+}
+
+llvm::Value *CodeGenerator::emit_checked_division(const BinaryOpNode &node,
+                                                  llvm::Value *left_val,
+                                                  llvm::Value *right_val) {
+  // Native code traps like the interpreter instead of raising SIGFPE
+  llvm::Type *type = left_val->getType();
+  emit_trap_if(
+      builder_->CreateICmpEQ(right_val, llvm::ConstantInt::get(type, 0)),
+      NativeCall::DIVISION_BY_ZERO);
+
+  const AstType *result_type = node.result_type();
+  if (result_type && result_type->is_primitive() &&
+      TypeUtils::is_unsigned_int(result_type->as_primitive().type)) {
+    return builder_->CreateUDiv(left_val, right_val, "divtmp");
+  }
+
+  // The interpreter divides 64-bit registers: only the 64-bit minimum
+  // divided by -1 overflows, narrower quotients wrap
+  unsigned bits = type->getIntegerBitWidth();
+  llvm::Value *minus_one = builder_->CreateICmpEQ(
+      right_val, llvm::ConstantInt::getSigned(type, -1));
+  if (bits == 64) {
+    llvm::Value *minimum = builder_->CreateICmpEQ(
+        left_val,
+        llvm::ConstantInt::get(type, llvm::APInt::getSignedMinValue(bits)));
+    emit_trap_if(builder_->CreateAnd(minimum, minus_one),
+                 NativeCall::DIVISION_OVERFLOW);
+  }
+  llvm::Value *divisor = builder_->CreateSelect(
+      minus_one, llvm::ConstantInt::get(type, 1), right_val);
+  llvm::Value *quotient = builder_->CreateSDiv(left_val, divisor, "divtmp");
+  return builder_->CreateSelect(minus_one, builder_->CreateNeg(left_val),
+                                quotient);
 }
 
 void CodeGenerator::visit(const FunctionReturnNode &node) {
+  schedule(Step::RETURN, node);
   if (node.value()) {
-    // Generate code for return value
-    visit_node(*node.value());
+    schedule(Step::ENTER, *node.value());
+  }
+}
 
+void CodeGenerator::emit_return(const FunctionReturnNode &node) {
+  if (node.value()) {
     if (!current_value_) {
       throw CodeGenerationException("Failed to generate return value");
     }
@@ -679,9 +1617,11 @@ void CodeGenerator::visit(const FunctionReturnNode &node) {
 }
 
 void CodeGenerator::visit(const IfNode &node) {
-  // Generate condition
-  visit_node(node.condition());
+  schedule(Step::IF_BRANCH, node);
+  schedule(Step::ENTER, node.condition());
+}
 
+void CodeGenerator::emit_if_branch(const IfNode &node) {
   if (!current_value_) {
     throw CodeGenerationException(
         "Failed to generate condition for if statement");
@@ -717,65 +1657,85 @@ void CodeGenerator::visit(const IfNode &node) {
     builder_->CreateCondBr(cond_val, then_bb, merge_bb);
   }
 
-  // Generate then block
+  // Generate the then block, then the else block if present, each followed
+  // by the branch to the merge block
   builder_->SetInsertPoint(then_bb);
-  for (const auto &stmt : node.then_block()) {
-    visit_node(*stmt);
+  if (node.has_else()) {
+    schedule(Step::END_BRANCH, node, nullptr, merge_bb, merge_bb);
+    schedule_list(node.else_block());
   }
+  schedule(Step::END_BRANCH, node, nullptr, else_bb ? else_bb : merge_bb,
+           merge_bb);
+  schedule_list(node.then_block());
+}
 
+void CodeGenerator::end_branch(llvm::BasicBlock *next,
+                               llvm::BasicBlock *merge) {
   // Add branch to merge block if no terminator
   if (!builder_->GetInsertBlock()->getTerminator()) {
-    builder_->CreateBr(merge_bb);
+    builder_->CreateBr(merge);
   }
 
-  // Generate else block if present
-  if (node.has_else()) {
-    function->insert(function->end(), else_bb);
-    builder_->SetInsertPoint(else_bb);
-
-    for (const auto &stmt : node.else_block()) {
-      visit_node(*stmt);
-    }
-
-    // Add branch to merge block if no terminator
-    if (!builder_->GetInsertBlock()->getTerminator()) {
-      builder_->CreateBr(merge_bb);
-    }
-  }
-
-  // Continue with merge block
-  function->insert(function->end(), merge_bb);
-  builder_->SetInsertPoint(merge_bb);
+  // Continue with the else block or the merge block
+  llvm::Function *function = builder_->GetInsertBlock()->getParent();
+  function->insert(function->end(), next);
+  builder_->SetInsertPoint(next);
 }
 
 void CodeGenerator::visit(const ConstantDeclarationNode &node) {
-  // Generate code for the constant value
-  visit_node(node.value());
+  // The validator folded the value into a literal, each lookup emits it as
+  // an immediate of the type the lookup needs
+  constants_[node.identifier()] = &node.value();
+}
 
-  if (!current_value_) {
-    throw CodeGenerationException("Failed to generate constant value: " +
-                                  node.identifier());
-  }
+void CodeGenerator::visit(const ImportNode &) {
+  // Imported declarations are added with declare_external
+}
 
-  // For constants, we can store the computed value directly
-  // Create a global constant
-  llvm::Constant *const_val = llvm::dyn_cast<llvm::Constant>(current_value_);
-  if (!const_val) {
-    throw CodeGenerationException(
-        "Constant declaration requires a constant value: " + node.identifier());
+void link_executable(const std::vector<std::string> &object_files,
+                     const std::string &output_file,
+                     const CompileOptions &options) {
+  // Link with cc, run without a shell so paths are passed as they are
+  std::vector<std::string> args = {"cc", "-o", output_file};
+  args.insert(args.end(), object_files.begin(), object_files.end());
+
+  // The compiler-rt profile runtime writes the .profraw file at exit
+  if (!options.profile_generate.empty()) {
+#ifdef CHA_PROFILE_RUNTIME
+#ifndef __APPLE__
+    // ELF objects do not reference the runtime, it is requested at link time
+    args.push_back("-u");
+    args.push_back("__llvm_profile_runtime");
+#endif
+    args.push_back(CHA_PROFILE_RUNTIME);
+#else
+    // Only works when cc is clang
+    args.push_back("-fprofile-instr-generate");
+#endif
   }
 
-  // Create global variable for the constant
-  llvm::GlobalVariable *global_const = new llvm::GlobalVariable(
-      *module_, const_val->getType(), true, llvm::GlobalValue::InternalLinkage,
-      const_val, node.identifier());
+  std::vector<char *> argv;
+  for (auto &arg : args) {
+    argv.push_back(&arg[0]);
+  }
+  argv.push_back(nullptr);
 
-  named_values_[node.identifier()] = global_const;
+  pid_t linker;
+  int status = -1;
+  if (posix_spawnp(&linker, "cc", nullptr, nullptr, argv.data(), environ) ==
+      0) {
+    while (waitpid(linker, &status, 0) < 0 && errno == EINTR) {
+    }
+  }
+  if (status == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    throw CodeGenerationException("Linking failed - is 'cc' available?");
+  }
 }
 
 void generate_code(const AstNodeList &ast, CompileFormat format,
-                   const std::string &output_file) {
-  CodeGenerator generator;
+                   const std::string &output_file,
+                   const CompileOptions &options) {
+  CodeGenerator generator("cha_module", options);
   generator.generate(ast, format, output_file);
 }
 
@@ -1,11 +1,14 @@
 #pragma once
 
 #include "ast.hpp"
+#include "callgraph.hpp"
 #include "cha/cha.hpp"
 #include "exceptions.hpp"
 
 #include <llvm/CodeGen/CommandFlags.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
 #include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/DIBuilder.h>
 #include <llvm/IR/Function.h>
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/LLVMContext.h>
@@ -16,6 +19,7 @@
 #include <llvm/IR/Verifier.h>
 #include <llvm/MC/TargetRegistry.h>
 #include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
 #include <llvm/Support/TargetSelect.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Target/TargetMachine.h>
@@ -27,19 +31,85 @@
 
 #include <map>
 #include <memory>
+#include <optional>
+#include <set>
+#include <string>
+#include <vector>
 
 namespace cha {
 
+// A file written by CodeGenerator::generate
+struct CompileOutput {
+  CompileFormat format;
+  std::string file;
+};
+
 // Code generation class that implements visitor pattern
 class CodeGenerator : public AstVisitor {
 public:
-  CodeGenerator();
+  explicit CodeGenerator(const std::string &module_name = "cha_module",
+                         const CompileOptions &options = CompileOptions());
+  // Generate the module in a context kept by the caller, e.g. across the
+  // compiles of a session. The context must outlive the generator.
+  CodeGenerator(llvm::LLVMContext &context,
+                const std::string &module_name = "cha_module",
+                const CompileOptions &options = CompileOptions());
   ~CodeGenerator() = default;
 
+  // Declare a function defined in another module of the same program
+  void declare_external(const FunctionDeclarationNode &node);
+
+  // Make a folded constant of another module usable, node must outlive the
+  // generator
+  void declare_external(const ConstantDeclarationNode &node);
+
+  // Whether to add an empty main when the module does not define one
+  void set_main_wrapper(bool enabled) { main_wrapper_ = enabled; }
+
+  // Whether functions other than main and exported ones get internal
+  // linkage. Only valid when the module is the whole program.
+  void set_internalize(bool enabled) { internalize_ = enabled; }
+
   // Generate code from AST - throws CodeGenerationException on error
   void generate(const AstNodeList &ast, CompileFormat format,
                 const std::string &output_file);
 
+  // Generate code once and write it in several formats. The machine code
+  // formats are generated in parallel from copies of the same optimized
+  // module, an executable is linked from the object file when one is
+  // requested. Throws CodeGenerationException on error.
+  void generate(const AstNodeList &ast,
+                const std::vector<CompileOutput> &outputs);
+
+  // Build the module one batch of top-level declarations at a time instead,
+  // e.g. while the source is parsed: begin() with the source file, add()
+  // each batch, then write the outputs like generate() with finish().
+  // Functions of a batch can call each other and the functions of earlier
+  // batches, which must not call them. Only constants must outlive the
+  // generator. Throws CodeGenerationException on error.
+  void begin(const std::string &source_file);
+  void add(const AstNodeList &declarations);
+  void finish(const std::vector<CompileOutput> &outputs);
+
+  // Generate code into a stream, in any format but BINARY_FILE - throws
+  // CodeGenerationException on error
+  void generate(const AstNodeList &ast, CompileFormat format,
+                llvm::raw_pwrite_stream &dest);
+
+  // Generate bitcode with a ThinLTO summary into memory - throws
+  // CodeGenerationException on error
+  std::unique_ptr<llvm::MemoryBuffer> generate_bitcode(const AstNodeList &ast);
+
+  // Generate an optimized module for the JIT whose only external function
+  // is entry, a NativeFunction: it runs function with the arguments taken
+  // from an array of interpreter registers and returns the result as a
+  // register. The module takes the generator's own context. Throws
+  // CodeGenerationException on error.
+  llvm::orc::ThreadSafeModule
+  generate_jit_module(const AstNodeList &ast,
+                      const FunctionDeclarationNode &function,
+                      const std::string &entry);
+
   // Visitor pattern implementation
   void visit(const ConstantIntegerNode &node) override;
   void visit(const ConstantUnsignedIntegerNode &node) override;
@@ -57,33 +127,160 @@ public:
   void visit(const FunctionReturnNode &node) override;
   void visit(const IfNode &node) override;
   void visit(const ConstantDeclarationNode &node) override;
+  void visit(const ImportNode &node) override;
 
 private:
-  // LLVM components
-  std::unique_ptr<llvm::LLVMContext> context_;
+  // A step of visit_node(). Like the validator, nodes are generated with an
+  // explicit stack so deeply nested expressions and ifs do not overflow the
+  // native one: entering a node schedules its children, then the
+  // instructions using their values.
+  struct Step {
+    enum Kind {
+      ENTER,
+      RESTORE_LOCATION,
+      SAVE_VALUE,
+      BINARY_OP,
+      UNARY_OP,
+      STORE_VARIABLE,
+      ASSIGN,
+      CALL,
+      RETURN,
+      IF_BRANCH,
+      END_BRANCH,
+    };
+    Kind kind;
+    const AstNode *node;
+    // Alloca of STORE_VARIABLE
+    llvm::Value *value;
+    // Block END_BRANCH continues at and the merge block of its if
+    llvm::BasicBlock *block;
+    llvm::BasicBlock *merge;
+    // Location RESTORE_LOCATION gives back to the parent node
+    llvm::DebugLoc location;
+  };
+
+  // LLVM components, the context is only owned when the caller gave none
+  std::unique_ptr<llvm::LLVMContext> owned_context_;
+  llvm::LLVMContext *context_;
   std::unique_ptr<llvm::Module> module_;
   std::unique_ptr<llvm::IRBuilder<>> builder_;
 
   // Symbol table for variables and functions
   std::map<std::string, llvm::Value *> named_values_;
   std::map<std::string, llvm::Function *> functions_;
+  std::map<std::string, const AstNode *> constants_;
+
+  CompileOptions options_;
+
+  // Debug info, only created when line tables are requested
+  std::unique_ptr<llvm::DIBuilder> di_builder_;
+  llvm::DIFile *di_file_ = nullptr;
+  llvm::DISubprogram *current_subprogram_ = nullptr;
 
   // Current function being built
   llvm::Function *current_function_ = nullptr;
 
+  bool main_wrapper_ = true;
+  bool internalize_ = true;
+
+  // Set for JIT modules, whose native code runs on the interpreter's behalf:
+  // calls count the interpreter's call depth and divisions check their
+  // operands, both return to it with a trap (see NativeCall) in place of
+  // overflowing the stack or raising SIGFPE
+  bool jit_checks_ = false;
+  static constexpr const char *JIT_DEPTH = "__cha_depth";
+  static constexpr const char *JIT_TRAP = "__cha_trap";
+
+  // Calls between the functions being generated, used to infer attributes
+  std::unique_ptr<CallGraph> call_graph_;
+
+  // Functions generated from a whole program, those reachable from its
+  // roots. Every function is generated when other modules may call in.
+  std::optional<std::set<std::string>> live_functions_;
+
   // Stack of values from expression evaluation
   llvm::Value *current_value_ = nullptr;
+  // Operands kept aside by SAVE_VALUE until the step using them
+  std::vector<llvm::Value *> operands_;
+  std::vector<Step> steps_;
 
   // Helper methods
   void visit_node(const AstNode &node);
+  void run_step(const Step &step);
+  void schedule(Step::Kind kind, const AstNode &node,
+                llvm::Value *value = nullptr, llvm::BasicBlock *block = nullptr,
+                llvm::BasicBlock *merge = nullptr);
+  void schedule_list(const AstNodeList &nodes);
+  void emit_binary_op(const BinaryOpNode &node, llvm::Value *left_val,
+                      llvm::Value *right_val);
+  void emit_unary_op(const UnaryOpNode &node);
+  void store_variable(const VariableDeclarationNode &node,
+                      llvm::AllocaInst *alloca);
+  void emit_assignment(const VariableAssignmentNode &node);
+  void emit_call(const FunctionCallNode &node);
+  void emit_return(const FunctionReturnNode &node);
+  void emit_if_branch(const IfNode &node);
+  void end_branch(llvm::BasicBlock *next, llvm::BasicBlock *merge);
+  llvm::GlobalVariable *jit_global(const char *name, llvm::Type *type);
+  llvm::MDNode *unlikely();
+  void emit_trap_if(llvm::Value *condition, uint32_t trap);
+  llvm::Value *emit_checked_division(const BinaryOpNode &node,
+                                     llvm::Value *left_val,
+                                     llvm::Value *right_val);
+  void build_module(const AstNodeList &ast,
+                    const std::set<std::string> *roots = nullptr);
+  void add_declarations(const AstNodeList &declarations);
+  void end_module();
+  void write_outputs(const std::vector<CompileOutput> &outputs);
   llvm::Type *get_llvm_type(const AstType &type);
   llvm::Type *primitive_to_llvm_type(PrimitiveType prim_type);
-  void write_output(CompileFormat format, const std::string &output_file);
+  llvm::TargetMachine &target_machine();
+  bool uses_profile() const;
+  void optimize(bool thin_lto_pre_link, bool required = false);
+  void order_functions_by_profile();
+  void create_debug_info(const std::string &source);
+  void create_subprogram(const FunctionDeclarationNode &node,
+                         llvm::Function *function);
+  void emit_location(const AstLocation &location);
+  llvm::DIType *get_debug_type(const AstType &type);
+  void declare_variable(llvm::AllocaInst *alloca, const std::string &name,
+                        const AstType &type, const AstLocation &location,
+                        unsigned arg_number = 0);
+  void set_function_attributes(llvm::Function *function);
+  void infer_function_attributes(const FunctionDeclarationNode &node,
+                                 llvm::Function *function, bool definition);
+  void emit(CompileFormat format, llvm::raw_pwrite_stream &dest);
+  void emit_machine_code(const std::vector<CompileOutput> &outputs);
+  void write_bitcode(llvm::raw_ostream &dest);
   void create_main_wrapper();
+  void create_jit_entry(const FunctionDeclarationNode &node,
+                        const std::string &entry);
 };
 
+// Register the host target with LLVM, once per process. Code generation
+// does it when it first needs a target machine.
+void initialize_native_target();
+
+// Target machine for the host, created once per thread and configuration.
+// A fast one runs the -O0 backend pipeline. Throws CodeGenerationException
+// when the target is not available.
+llvm::TargetMachine &host_target_machine(bool function_sections,
+                                         bool fast = false);
+
+// Initialize LLVM and create the target machines ahead of the first module,
+// e.g. before a compile server forks its workers
+void warm_up_code_generator();
+
+// Link object files into an executable with the system C compiler, adding
+// the profile runtime for instrumented programs - throws
+// CodeGenerationException on error
+void link_executable(const std::vector<std::string> &object_files,
+                     const std::string &output_file,
+                     const CompileOptions &options = CompileOptions());
+
 // Convenience function - throws CodeGenerationException on error
 void generate_code(const AstNodeList &ast, CompileFormat format,
-                   const std::string &output_file);
+                   const std::string &output_file,
+                   const CompileOptions &options = CompileOptions());
 
 } // namespace cha
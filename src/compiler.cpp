@@ -0,0 +1,122 @@
+#include "cha/cha.hpp"
+#include "codegen.hpp"
+#include "exceptions.hpp"
+#include "interface.hpp"
+#include "lazy.hpp"
+#include "parser.hpp"
+#include "serialize.hpp"
+#include "validate.hpp"
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/Support/raw_ostream.h>
+
+namespace cha {
+
+namespace {
+
+CompileDiagnostic make_diagnostic(const AstLocation &location,
+                                  const std::string &message) {
+  return {location.file, location.line_begin, location.column_begin,
+          bare_message(message)};
+}
+
+// Compiles sharing one LLVM context. The context keeps every type, constant
+// and metadata node its modules created, so it is replaced before a long
+// running session grows without bound.
+constexpr unsigned CONTEXT_COMPILES = 64;
+
+} // namespace
+
+struct Compiler::Session {
+  CompileOptions options;
+  // Types and constants are created once and shared by the modules of the
+  // next CONTEXT_COMPILES compiles
+  std::unique_ptr<llvm::LLVMContext> context;
+  unsigned compiles = 0;
+
+  llvm::LLVMContext &next_context() {
+    if (!context || compiles == CONTEXT_COMPILES) {
+      context = std::make_unique<llvm::LLVMContext>();
+      compiles = 0;
+    }
+    ++compiles;
+    return *context;
+  }
+};
+
+Compiler::Compiler(const CompileOptions &options)
+    : session_(std::make_unique<Session>()) {
+  session_->options = options;
+  // Otherwise the first compile pays for creating the target machines
+  warm_up_code_generator();
+}
+
+Compiler::~Compiler() = default;
+
+CompileOptions &Compiler::options() { return session_->options; }
+
+CompileResult Compiler::compile(const std::string &source,
+                                CompileFormat format,
+                                const std::string &name) {
+  return compile(source.data(), source.size(), format, name);
+}
+
+CompileResult Compiler::compile(const char *data, size_t size,
+                                CompileFormat format,
+                                const std::string &name) {
+  const CompileOptions &options = session_->options;
+  CompileResult result;
+
+  try {
+    AstNodeList ast =
+        options.load_ast      ? deserialize_ast(data, size, name)
+        : options.lazy_bodies ? parse_reachable_text(std::string(data, size),
+                                                     name)
+                              : parse_text(std::string(data, size), name);
+
+    // Imported modules are only known through their interfaces
+    AstNodeList interfaces = read_imports(ast, options.import_paths);
+    if (!options.load_ast) {
+      Validator validator;
+      declare_imports(validator, interfaces);
+      validator.validate(ast);
+    }
+
+    if (format == CompileFormat::AST_FILE) {
+      std::vector<char> buffer = serialize_ast(ast);
+      result.output.assign(buffer.data(), buffer.size());
+    } else {
+      CodeGenerator generator(session_->next_context(), name, options);
+      declare_imports(generator, interfaces);
+      generator.set_main_wrapper(!has_exports(ast));
+
+      llvm::SmallVector<char, 0> buffer;
+      llvm::raw_svector_ostream stream(buffer);
+      generator.generate(ast, format, stream);
+      result.output.assign(buffer.data(), buffer.size());
+    }
+    result.success = true;
+  } catch (const ParseException &e) {
+    result.diagnostics.push_back(make_diagnostic(e.location(), e.message()));
+  } catch (const ValidationException &e) {
+    result.diagnostics.push_back(make_diagnostic(e.location(), e.message()));
+  } catch (const MultipleValidationException &e) {
+    for (const auto &error : e.errors()) {
+      result.diagnostics.push_back(
+          make_diagnostic(error.location(), error.message()));
+    }
+  } catch (const CodeGenerationException &e) {
+    if (e.location()) {
+      result.diagnostics.push_back(
+          make_diagnostic(*e.location(), e.message()));
+    } else {
+      result.diagnostics.push_back({name, 0, 0, bare_message(e.message())});
+    }
+  } catch (const ChaException &e) {
+    result.diagnostics.push_back({name, 0, 0, bare_message(e.message())});
+  }
+  return result;
+}
+
+} // namespace cha
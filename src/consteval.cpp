@@ -0,0 +1,669 @@
+#include "consteval.hpp"
+#include "validate.hpp"
+
+#include <limits>
+
+namespace cha {
+
+namespace {
+
+unsigned bit_width(PrimitiveType type) {
+  switch (type) {
+  case PrimitiveType::INT8:
+  case PrimitiveType::UINT8:
+    return 8;
+  case PrimitiveType::INT16:
+  case PrimitiveType::UINT16:
+    return 16;
+  case PrimitiveType::INT:
+  case PrimitiveType::INT32:
+  case PrimitiveType::UINT:
+  case PrimitiveType::UINT32:
+    return 32;
+  default:
+    return 64;
+  }
+}
+
+bool fits_signed(int64_t value, PrimitiveType type) {
+  unsigned width = bit_width(type);
+  if (width == 64) {
+    return true;
+  }
+  int64_t max = (int64_t(1) << (width - 1)) - 1;
+  return value >= -max - 1 && value <= max;
+}
+
+bool fits_unsigned(uint64_t value, PrimitiveType type) {
+  unsigned width = bit_width(type);
+  return width == 64 || value < (uint64_t(1) << width);
+}
+
+std::string value_to_string(const ConstValue &value) {
+  if (TypeUtils::is_signed_int(value.type)) {
+    return std::to_string(value.int_value);
+  }
+  if (TypeUtils::is_unsigned_int(value.type)) {
+    return std::to_string(value.uint_value);
+  }
+  if (TypeUtils::is_float(value.type)) {
+    return std::to_string(value.float_value);
+  }
+  return value.bool_value ? "true" : "false";
+}
+
+[[noreturn]] void overflow(const AstLocation &location, PrimitiveType type) {
+  throw ValidationException(location, "overflow in constant evaluation of '" +
+                                          TypeUtils::type_to_string(type) +
+                                          "'");
+}
+
+PrimitiveType primitive_type(const AstNode &node) {
+  const AstType *type = node.result_type();
+  if (!type || !type->is_primitive()) {
+    throw ValidationException(node.location(),
+                              "expression cannot be evaluated at compile time");
+  }
+  return type->as_primitive().type;
+}
+
+// Marks a constant as being evaluated until the evaluation ends, also when
+// it throws
+class InProgress {
+public:
+  InProgress(std::set<std::string> &names, const std::string &name)
+      : names_(names), name_(name) {}
+  ~InProgress() { names_.erase(name_); }
+
+  InProgress(const InProgress &) = delete;
+  InProgress &operator=(const InProgress &) = delete;
+
+private:
+  std::set<std::string> &names_;
+  std::string name_;
+};
+
+// One more call deep until the call returns or throws
+class CallDepth {
+public:
+  explicit CallDepth(unsigned &depth) : depth_(depth) { ++depth_; }
+  ~CallDepth() { --depth_; }
+
+  CallDepth(const CallDepth &) = delete;
+  CallDepth &operator=(const CallDepth &) = delete;
+
+private:
+  unsigned &depth_;
+};
+
+} // namespace
+
+ConstValue convert_const(const ConstValue &value, PrimitiveType type,
+                         const AstLocation &location) {
+  if (value.type == type || type == PrimitiveType::UNDEF) {
+    return value;
+  }
+
+  ConstValue result;
+  result.type = type;
+
+  if (TypeUtils::is_float(type)) {
+    if (TypeUtils::is_signed_int(value.type)) {
+      result.float_value = static_cast<double>(value.int_value);
+    } else if (TypeUtils::is_unsigned_int(value.type)) {
+      result.float_value = static_cast<double>(value.uint_value);
+    } else if (TypeUtils::is_float(value.type)) {
+      result.float_value = value.float_value;
+    } else {
+      throw ValidationException(location, "cannot convert '" +
+                                              value_to_string(value) +
+                                              "' to a float");
+    }
+    if (type == PrimitiveType::FLOAT32) {
+      result.float_value = static_cast<float>(result.float_value);
+    }
+    return result;
+  }
+
+  if (TypeUtils::is_signed_int(type)) {
+    if (TypeUtils::is_signed_int(value.type)) {
+      result.int_value = value.int_value;
+    } else if (TypeUtils::is_unsigned_int(value.type)) {
+      if (value.uint_value >
+          static_cast<uint64_t>(std::numeric_limits<int64_t>::max())) {
+        overflow(location, type);
+      }
+      result.int_value = static_cast<int64_t>(value.uint_value);
+    } else {
+      throw ValidationException(location, "cannot convert '" +
+                                              value_to_string(value) +
+                                              "' to an integer");
+    }
+    if (!fits_signed(result.int_value, type)) {
+      overflow(location, type);
+    }
+    return result;
+  }
+
+  if (TypeUtils::is_unsigned_int(type)) {
+    if (TypeUtils::is_unsigned_int(value.type)) {
+      result.uint_value = value.uint_value;
+    } else if (TypeUtils::is_signed_int(value.type)) {
+      if (value.int_value < 0) {
+        overflow(location, type);
+      }
+      result.uint_value = static_cast<uint64_t>(value.int_value);
+    } else {
+      throw ValidationException(location, "cannot convert '" +
+                                              value_to_string(value) +
+                                              "' to an unsigned integer");
+    }
+    if (!fits_unsigned(result.uint_value, type)) {
+      overflow(location, type);
+    }
+    return result;
+  }
+
+  if (type == PrimitiveType::BOOL && value.type == PrimitiveType::BOOL) {
+    return value;
+  }
+  throw ValidationException(location, "cannot convert '" +
+                                          value_to_string(value) + "' to '" +
+                                          TypeUtils::type_to_string(type) +
+                                          "'");
+}
+
+ConstEvaluator::ConstEvaluator(const AstNodeList &ast,
+                               const AstNodeList &externals) {
+  for (const auto &node : externals) {
+    if (auto constant =
+            dynamic_cast<const ConstantDeclarationNode *>(node.get())) {
+      constants_[constant->identifier()] = constant;
+    } else if (auto func =
+                   dynamic_cast<const FunctionDeclarationNode *>(node.get())) {
+      // Imported functions are only signatures
+      if (!func->body().empty()) {
+        functions_[func->identifier()] = func;
+      }
+    }
+  }
+  for (const auto &node : ast) {
+    if (auto func = dynamic_cast<const FunctionDeclarationNode *>(node.get())) {
+      functions_[func->identifier()] = func;
+    } else if (auto constant =
+                   dynamic_cast<const ConstantDeclarationNode *>(node.get())) {
+      constants_[constant->identifier()] = constant;
+    }
+  }
+}
+
+void ConstEvaluator::declare(const ConstantDeclarationNode &node) {
+  constants_[node.identifier()] = &node;
+}
+
+ConstValue ConstEvaluator::evaluate_constant(const std::string &name) {
+  auto value = values_.find(name);
+  if (value != values_.end()) {
+    return value->second;
+  }
+
+  const ConstantDeclarationNode &node = *constants_.at(name);
+
+  // Limits apply to each constant that is not needed by another one
+  if (in_progress_.empty()) {
+    depth_ = 0;
+    steps_ = 0;
+  }
+
+  if (!in_progress_.insert(name).second) {
+    throw ValidationException(node.location(),
+                              "constant '" + name + "' depends on itself");
+  }
+  InProgress in_progress(in_progress_, name);
+
+  Variables variables;
+  ConstValue result = evaluate(node.value(), variables);
+  values_[name] = result;
+  return result;
+}
+
+AstNodePtr ConstEvaluator::make_literal(const ConstValue &value,
+                                        const AstLocation &location) {
+  AstNodePtr literal;
+  if (TypeUtils::is_signed_int(value.type)) {
+    literal = std::make_unique<ConstantIntegerNode>(location, value.int_value);
+  } else if (TypeUtils::is_unsigned_int(value.type)) {
+    literal = std::make_unique<ConstantUnsignedIntegerNode>(location,
+                                                            value.uint_value);
+  } else if (TypeUtils::is_float(value.type)) {
+    literal = std::make_unique<ConstantFloatNode>(location, value.float_value);
+  } else if (value.type == PrimitiveType::BOOL) {
+    literal = std::make_unique<ConstantBoolNode>(location, value.bool_value);
+  } else {
+    throw ValidationException(location, "constant has no value");
+  }
+
+  literal->set_result_type(
+      std::make_unique<AstType>(location, AstType::Primitive(value.type)));
+  return literal;
+}
+
+void ConstEvaluator::step(const AstLocation &location) {
+  if (++steps_ > CONST_EVAL_MAX_STEPS) {
+    throw ValidationException(location,
+                              "constant evaluation exceeded " +
+                                  std::to_string(CONST_EVAL_MAX_STEPS) +
+                                  " steps");
+  }
+}
+
+ConstValue ConstEvaluator::evaluate(const AstNode &node,
+                                    Variables &variables) {
+  // Operators run once the values of their operands are on the stack
+  struct Pending {
+    const AstNode *node;
+    bool entered;
+  };
+  std::vector<Pending> pending{Pending{&node, false}};
+  std::vector<ConstValue> values;
+  auto pop = [&values] {
+    ConstValue value = values.back();
+    values.pop_back();
+    return value;
+  };
+
+  while (!pending.empty()) {
+    Pending current = pending.back();
+    pending.pop_back();
+    const AstNode &next = *current.node;
+
+    if (auto binary = dynamic_cast<const BinaryOpNode *>(&next)) {
+      if (!current.entered) {
+        step(next.location());
+        pending.push_back(Pending{&next, true});
+        pending.push_back(Pending{&binary->right(), false});
+        pending.push_back(Pending{&binary->left(), false});
+        continue;
+      }
+      ConstValue right = pop();
+      ConstValue left = pop();
+      values.push_back(evaluate_binary_op(*binary, left, right));
+    } else if (auto unary = dynamic_cast<const UnaryOpNode *>(&next)) {
+      if (!current.entered) {
+        step(next.location());
+        pending.push_back(Pending{&next, true});
+        pending.push_back(Pending{&unary->operand(), false});
+        continue;
+      }
+      values.push_back(evaluate_unary_op(*unary, pop()));
+    } else if (auto call_node = dynamic_cast<const FunctionCallNode *>(&next)) {
+      // Arguments are evaluated in the caller and passed by value
+      if (!current.entered) {
+        step(next.location());
+        size_t count = callee(*call_node).arguments().size();
+        pending.push_back(Pending{&next, true});
+        for (size_t i = count; i-- > 0;) {
+          pending.push_back(Pending{call_node->arguments()[i].get(), false});
+        }
+        continue;
+      }
+      size_t count = callee(*call_node).arguments().size();
+      std::vector<ConstValue> arguments(values.end() - count, values.end());
+      values.resize(values.size() - count);
+      values.push_back(call(*call_node, arguments));
+    } else {
+      step(next.location());
+      values.push_back(evaluate_leaf(next, variables));
+    }
+  }
+  return values.back();
+}
+
+ConstValue ConstEvaluator::evaluate_leaf(const AstNode &node,
+                                         Variables &variables) {
+  ConstValue value;
+  if (auto integer = dynamic_cast<const ConstantIntegerNode *>(&node)) {
+    value.type = PrimitiveType::CONST_INT;
+    value.int_value = integer->value();
+  } else if (auto uinteger =
+                 dynamic_cast<const ConstantUnsignedIntegerNode *>(&node)) {
+    value.type = PrimitiveType::CONST_UINT;
+    value.uint_value = uinteger->value();
+  } else if (auto floating = dynamic_cast<const ConstantFloatNode *>(&node)) {
+    value.type = PrimitiveType::CONST_FLOAT;
+    value.float_value = floating->value();
+  } else if (auto boolean = dynamic_cast<const ConstantBoolNode *>(&node)) {
+    value.type = PrimitiveType::BOOL;
+    value.bool_value = boolean->value();
+  } else if (auto lookup = dynamic_cast<const VariableLookupNode *>(&node)) {
+    auto variable = variables.find(lookup->identifier());
+    if (variable != variables.end()) {
+      value = variable->second;
+    } else if (constants_.count(lookup->identifier())) {
+      value = evaluate_constant(lookup->identifier());
+    } else {
+      throw ValidationException(node.location(),
+                                "'" + lookup->identifier() +
+                                    "' is not a constant");
+    }
+  } else {
+    throw ValidationException(node.location(),
+                              "expression cannot be evaluated at compile time");
+  }
+
+  // Literals and lookups take the type inferred for them
+  return convert_const(value, primitive_type(node), node.location());
+}
+
+ConstValue ConstEvaluator::evaluate_binary_op(const BinaryOpNode &node,
+                                              ConstValue left,
+                                              ConstValue right) {
+  PrimitiveType type = primitive_type(node);
+
+  ConstValue result;
+  result.type = type;
+
+  switch (node.op()) {
+  case BinaryOperator::AND:
+    result.bool_value = left.bool_value && right.bool_value;
+    return result;
+  case BinaryOperator::OR:
+    result.bool_value = left.bool_value || right.bool_value;
+    return result;
+
+  case BinaryOperator::EQUALS_EQUALS:
+  case BinaryOperator::NOT_EQUALS:
+  case BinaryOperator::GREATER_THAN:
+  case BinaryOperator::GREATER_THAN_OR_EQUALS:
+  case BinaryOperator::LESS_THAN:
+  case BinaryOperator::LESS_THAN_OR_EQUALS: {
+    // Compare in a domain that holds both operands: -1 for less, 0 for equal
+    // and 1 for greater
+    int order;
+    if (left.type == PrimitiveType::BOOL) {
+      order = int(left.bool_value) - int(right.bool_value);
+    } else if (TypeUtils::is_float(left.type) ||
+               TypeUtils::is_float(right.type)) {
+      double l = convert_const(left, PrimitiveType::FLOAT64, node.location())
+                     .float_value;
+      double r = convert_const(right, PrimitiveType::FLOAT64, node.location())
+                     .float_value;
+      order = (l > r) - (l < r);
+    } else if (TypeUtils::is_signed_int(left.type) &&
+               TypeUtils::is_signed_int(right.type)) {
+      order = (left.int_value > right.int_value) -
+              (left.int_value < right.int_value);
+    } else if (TypeUtils::is_signed_int(left.type) && left.int_value < 0) {
+      order = -1;
+    } else if (TypeUtils::is_signed_int(right.type) && right.int_value < 0) {
+      order = 1;
+    } else {
+      uint64_t l = TypeUtils::is_signed_int(left.type) ? left.int_value
+                                                       : left.uint_value;
+      uint64_t r = TypeUtils::is_signed_int(right.type) ? right.int_value
+                                                        : right.uint_value;
+      order = (l > r) - (l < r);
+    }
+
+    switch (node.op()) {
+    case BinaryOperator::EQUALS_EQUALS:
+      result.bool_value = order == 0;
+      break;
+    case BinaryOperator::NOT_EQUALS:
+      result.bool_value = order != 0;
+      break;
+    case BinaryOperator::GREATER_THAN:
+      result.bool_value = order > 0;
+      break;
+    case BinaryOperator::GREATER_THAN_OR_EQUALS:
+      result.bool_value = order >= 0;
+      break;
+    case BinaryOperator::LESS_THAN:
+      result.bool_value = order < 0;
+      break;
+    default:
+      result.bool_value = order <= 0;
+      break;
+    }
+    return result;
+  }
+
+  default:
+    break;
+  }
+
+  // Arithmetic runs in the result type, like the generated code
+  left = convert_const(left, type, node.left().location());
+  right = convert_const(right, type, node.right().location());
+
+  if (TypeUtils::is_float(type)) {
+    switch (node.op()) {
+    case BinaryOperator::PLUS:
+      result.float_value = left.float_value + right.float_value;
+      break;
+    case BinaryOperator::MINUS:
+      result.float_value = left.float_value - right.float_value;
+      break;
+    case BinaryOperator::STAR:
+      result.float_value = left.float_value * right.float_value;
+      break;
+    default:
+      result.float_value = left.float_value / right.float_value;
+      break;
+    }
+    return convert_const(result, type, node.location());
+  }
+
+  bool overflowed = false;
+  if (TypeUtils::is_signed_int(type)) {
+    int64_t l = left.int_value;
+    int64_t r = right.int_value;
+    switch (node.op()) {
+    case BinaryOperator::PLUS:
+      overflowed = __builtin_add_overflow(l, r, &result.int_value);
+      break;
+    case BinaryOperator::MINUS:
+      overflowed = __builtin_sub_overflow(l, r, &result.int_value);
+      break;
+    case BinaryOperator::STAR:
+      overflowed = __builtin_mul_overflow(l, r, &result.int_value);
+      break;
+    default:
+      if (r == 0) {
+        throw ValidationException(node.location(),
+                                  "division by zero in constant evaluation");
+      }
+      overflowed = l == std::numeric_limits<int64_t>::min() && r == -1;
+      result.int_value = overflowed ? 0 : l / r;
+      break;
+    }
+    if (overflowed || !fits_signed(result.int_value, type)) {
+      overflow(node.location(), type);
+    }
+    return result;
+  }
+
+  uint64_t l = left.uint_value;
+  uint64_t r = right.uint_value;
+  switch (node.op()) {
+  case BinaryOperator::PLUS:
+    overflowed = __builtin_add_overflow(l, r, &result.uint_value);
+    break;
+  case BinaryOperator::MINUS:
+    overflowed = __builtin_sub_overflow(l, r, &result.uint_value);
+    break;
+  case BinaryOperator::STAR:
+    overflowed = __builtin_mul_overflow(l, r, &result.uint_value);
+    break;
+  default:
+    if (r == 0) {
+      throw ValidationException(node.location(),
+                                "division by zero in constant evaluation");
+    }
+    result.uint_value = l / r;
+    break;
+  }
+  if (overflowed || !fits_unsigned(result.uint_value, type)) {
+    overflow(node.location(), type);
+  }
+  return result;
+}
+
+ConstValue ConstEvaluator::evaluate_unary_op(const UnaryOpNode &node,
+                                             ConstValue operand) {
+  PrimitiveType type = primitive_type(node);
+  operand = convert_const(operand, type, node.location());
+
+  ConstValue result = operand;
+  if (node.op() == UnaryOperator::NOT) {
+    result.bool_value = !operand.bool_value;
+  } else if (TypeUtils::is_float(type)) {
+    result.float_value = -operand.float_value;
+  } else if (TypeUtils::is_signed_int(type)) {
+    if (operand.int_value == std::numeric_limits<int64_t>::min() ||
+        !fits_signed(-operand.int_value, type)) {
+      overflow(node.location(), type);
+    }
+    result.int_value = -operand.int_value;
+  } else if (operand.uint_value != 0) {
+    overflow(node.location(), type);
+  }
+  return result;
+}
+
+const FunctionDeclarationNode &
+ConstEvaluator::callee(const FunctionCallNode &node) {
+  auto it = functions_.find(node.identifier());
+  if (it == functions_.end()) {
+    throw ValidationException(node.location(),
+                              "'" + node.identifier() +
+                                  "' cannot be evaluated at compile time");
+  }
+
+  if (depth_ >= CONST_EVAL_MAX_DEPTH) {
+    throw ValidationException(node.location(),
+                              "constant evaluation exceeded the call depth "
+                              "limit of " +
+                                  std::to_string(CONST_EVAL_MAX_DEPTH));
+  }
+  return *it->second;
+}
+
+ConstValue ConstEvaluator::call(const FunctionCallNode &node,
+                                const std::vector<ConstValue> &values) {
+  const FunctionDeclarationNode &function = callee(node);
+
+  Variables arguments;
+  for (size_t i = 0; i < function.arguments().size(); ++i) {
+    const auto &arg =
+        static_cast<const ArgumentNode &>(*function.arguments()[i]);
+    arguments[arg.identifier()] =
+        convert_const(values[i], arg.type().as_primitive().type,
+                      node.arguments()[i]->location());
+  }
+
+  ConstValue result;
+  bool returned;
+  {
+    CallDepth depth(depth_);
+    returned = execute(function.body(), arguments, result);
+  }
+
+  const AstType &return_type = function.return_type();
+  if (!return_type.is_primitive()) {
+    throw ValidationException(node.location(),
+                              "'" + node.identifier() +
+                                  "' cannot be evaluated at compile time");
+  }
+
+  // Falling off the end returns zero, like the generated code
+  PrimitiveType type = return_type.as_primitive().type;
+  if (!returned) {
+    result = ConstValue();
+    result.type = type;
+  }
+  return convert_const(result, type, node.location());
+}
+
+bool ConstEvaluator::execute(const AstNodeList &statements,
+                             Variables &variables, ConstValue &result) {
+  // Blocks of ifs run on a stack of their own
+  struct Block {
+    const AstNodeList *statements;
+    size_t next;
+    Shadowed shadowed;
+  };
+  std::vector<Block> blocks;
+  blocks.push_back(Block{&statements, 0, {}});
+
+  while (!blocks.empty()) {
+    Block &block = blocks.back();
+    if (block.next == block.statements->size()) {
+      // Variables declared in the block go out of scope at its end,
+      // uncovering the outer variables they shadowed. Assignments to outer
+      // variables stay.
+      for (const auto &variable : block.shadowed) {
+        if (variable.second) {
+          variables[variable.first] = *variable.second;
+        } else {
+          variables.erase(variable.first);
+        }
+      }
+      blocks.pop_back();
+      continue;
+    }
+    const AstNode *statement = (*block.statements)[block.next++].get();
+    step(statement->location());
+
+    if (auto declaration =
+            dynamic_cast<const VariableDeclarationNode *>(statement)) {
+      if (!declaration->type().is_primitive()) {
+        throw ValidationException(
+            declaration->location(),
+            "arrays cannot be evaluated at compile time");
+      }
+      PrimitiveType type = declaration->type().as_primitive().type;
+      ConstValue value;
+      value.type = type;
+      if (declaration->value()) {
+        value = convert_const(evaluate(*declaration->value(), variables), type,
+                              declaration->location());
+      }
+      if (!block.shadowed.count(declaration->identifier())) {
+        auto outer = variables.find(declaration->identifier());
+        block.shadowed.emplace(declaration->identifier(),
+                               outer == variables.end()
+                                   ? std::nullopt
+                                   : std::optional<ConstValue>(outer->second));
+      }
+      variables[declaration->identifier()] = value;
+    } else if (auto assignment =
+                   dynamic_cast<const VariableAssignmentNode *>(statement)) {
+      auto variable = variables.find(assignment->identifier());
+      if (variable == variables.end()) {
+        throw ValidationException(assignment->location(),
+                                  "'" + assignment->identifier() +
+                                      "' is not a variable");
+      }
+      variable->second =
+          convert_const(evaluate(assignment->value(), variables),
+                        variable->second.type, assignment->location());
+    } else if (auto ret = dynamic_cast<const FunctionReturnNode *>(statement)) {
+      result = ret->value() ? evaluate(*ret->value(), variables) : ConstValue();
+      return true;
+    } else if (auto if_node = dynamic_cast<const IfNode *>(statement)) {
+      bool condition = evaluate(if_node->condition(), variables).bool_value;
+      blocks.push_back(Block{condition ? &if_node->then_block()
+                                       : &if_node->else_block(),
+                             0,
+                             {}});
+    } else if (auto nested = dynamic_cast<const BlockNode *>(statement)) {
+      blocks.push_back(Block{&nested->statements(), 0, {}});
+    } else {
+      evaluate(*statement, variables);
+    }
+  }
+  return false;
+}
+
+} // namespace cha
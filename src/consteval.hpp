@@ -0,0 +1,86 @@
+#pragma once
+
+#include "ast.hpp"
+#include "exceptions.hpp"
+
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace cha {
+
+// Limits that keep compile time evaluation from hanging the compiler
+constexpr unsigned CONST_EVAL_MAX_DEPTH = 512;
+constexpr uint64_t CONST_EVAL_MAX_STEPS = 1000000;
+
+// A value computed at compile time. Signed integers use int_value, unsigned
+// integers uint_value, floats float_value and bools bool_value.
+struct ConstValue {
+  PrimitiveType type = PrimitiveType::UNDEF;
+  int64_t int_value = 0;
+  uint64_t uint_value = 0;
+  double float_value = 0;
+  bool bool_value = false;
+};
+
+// Interprets constant expressions and calls to cha functions of a validated
+// module, checking every result against the range of its type
+class ConstEvaluator {
+public:
+  // Constants among externals (imported from other modules, already folded)
+  // can be used too, and so can the functions that come with a body
+  explicit ConstEvaluator(const AstNodeList &ast,
+                          const AstNodeList &externals = AstNodeList());
+
+  // Make one more constant usable, e.g. one validated after the evaluator
+  // was created. The node must outlive the evaluator.
+  void declare(const ConstantDeclarationNode &node);
+
+  // Value of a constant declared in the module - throws ValidationException
+  ConstValue evaluate_constant(const std::string &name);
+
+  // Literal node holding a value, typed like the value
+  static AstNodePtr make_literal(const ConstValue &value,
+                                 const AstLocation &location);
+
+private:
+  using Variables = std::map<std::string, ConstValue>;
+  // Outer value of each variable a block declares, none when the block
+  // introduces the name
+  using Shadowed = std::map<std::string, std::optional<ConstValue>>;
+
+  std::map<std::string, const FunctionDeclarationNode *> functions_;
+  std::map<std::string, const ConstantDeclarationNode *> constants_;
+  std::map<std::string, ConstValue> values_;
+  std::set<std::string> in_progress_;
+  unsigned depth_ = 0;
+  uint64_t steps_ = 0;
+
+  // Expressions and blocks nest arbitrarily deep in generated sources, so
+  // both are walked with an explicit stack. Only calls recurse, up to
+  // CONST_EVAL_MAX_DEPTH.
+  ConstValue evaluate(const AstNode &node, Variables &variables);
+  ConstValue evaluate_leaf(const AstNode &node, Variables &variables);
+  ConstValue evaluate_binary_op(const BinaryOpNode &node, ConstValue left,
+                                ConstValue right);
+  ConstValue evaluate_unary_op(const UnaryOpNode &node, ConstValue operand);
+  const FunctionDeclarationNode &callee(const FunctionCallNode &node);
+  ConstValue call(const FunctionCallNode &node,
+                  const std::vector<ConstValue> &values);
+
+  // Runs statements until a ret, returns whether one was reached
+  bool execute(const AstNodeList &statements, Variables &variables,
+               ConstValue &result);
+
+  void step(const AstLocation &location);
+};
+
+// Convert a value to another type - throws ValidationException when it does
+// not fit
+ConstValue convert_const(const ConstValue &value, PrimitiveType type,
+                         const AstLocation &location);
+
+} // namespace cha
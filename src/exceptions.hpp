@@ -19,6 +19,12 @@ protected:
   std::string message_;
 };
 
+// Message of an exception without the location and kind it starts with
+inline std::string bare_message(const std::string &message) {
+  size_t error = message.find(" error: ");
+  return error == std::string::npos ? message : message.substr(error + 8);
+}
+
 // Exception class for validation errors
 class ValidationException : public ChaException {
 public:
@@ -81,6 +87,48 @@ private:
   }
 };
 
+// Exception class for binary AST serialization errors
+class SerializationException : public ChaException {
+public:
+  SerializationException(const std::string &file, const std::string &message)
+      : ChaException(file + ": ast error: " + message) {}
+};
+
+// Exception class for execution profile errors
+class ProfileException : public ChaException {
+public:
+  ProfileException(const std::string &file, const std::string &message)
+      : ChaException(file + ": profile error: " + message) {}
+};
+
+// Exception class for project manifest and build state errors
+class BuildException : public ChaException {
+public:
+  BuildException(const std::string &file, const std::string &message)
+      : ChaException(file + ": build error: " + message) {}
+};
+
+// Exception class for malformed language server messages
+class ProtocolException : public ChaException {
+public:
+  explicit ProtocolException(const std::string &message)
+      : ChaException("protocol error: " + message) {}
+};
+
+// Exception class for errors while interpreting bytecode, e.g. division by
+// zero
+class InterpreterException : public ChaException {
+public:
+  explicit InterpreterException(const std::string &message)
+      : ChaException("runtime error: " + message) {}
+
+  InterpreterException(const AstLocation &location, const std::string &message)
+      : ChaException(location.file + ":" +
+                     std::to_string(location.line_begin) + ":" +
+                     std::to_string(location.column_begin) +
+                     ": runtime error: " + message) {}
+};
+
 // Exception class for multiple validation errors
 class MultipleValidationException : public ChaException {
 public:
@@ -0,0 +1,323 @@
+#include "interface.hpp"
+#include "exceptions.hpp"
+#include "log.hpp"
+#include "serialize.hpp"
+#include "validate.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <set>
+#include <sys/stat.h>
+
+namespace cha {
+
+namespace {
+
+bool is_file(const std::string &path) {
+  struct stat st;
+  return stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+}
+
+std::string join(const std::string &directory, const std::string &file) {
+  if (directory.empty()) {
+    return file;
+  }
+  if (directory.back() == '/') {
+    return directory + file;
+  }
+  return directory + "/" + file;
+}
+
+std::string parent_directory(const std::string &file) {
+  size_t slash = file.rfind('/');
+  if (slash == std::string::npos) {
+    return "";
+  }
+  return file.substr(0, slash + 1);
+}
+
+std::string literal_text(const AstNode &node) {
+  if (auto integer = dynamic_cast<const ConstantIntegerNode *>(&node)) {
+    return std::to_string(integer->value());
+  } else if (auto uinteger =
+                 dynamic_cast<const ConstantUnsignedIntegerNode *>(&node)) {
+    return std::to_string(uinteger->value()) + "u";
+  } else if (auto floating = dynamic_cast<const ConstantFloatNode *>(&node)) {
+    // Exact bits, decimal text would round
+    uint64_t bits;
+    double value = floating->value();
+    std::memcpy(&bits, &value, sizeof(bits));
+    return "f" + std::to_string(bits);
+  } else if (auto boolean = dynamic_cast<const ConstantBoolNode *>(&node)) {
+    return boolean->value() ? "true" : "false";
+  }
+  return "?";
+}
+
+} // namespace
+
+bool has_exports(const AstNodeList &ast) {
+  for (const auto &node : ast) {
+    auto func = dynamic_cast<const FunctionDeclarationNode *>(node.get());
+    auto constant = dynamic_cast<const ConstantDeclarationNode *>(node.get());
+    if ((func && func->exported()) || (constant && constant->exported())) {
+      return true;
+    }
+  }
+  return false;
+}
+
+AstNodeList make_interface(const AstNodeList &ast) {
+  AstNodeList interface;
+  for (const auto &node : ast) {
+    if (auto func = dynamic_cast<const FunctionDeclarationNode *>(node.get())) {
+      if (!func->exported()) {
+        continue;
+      }
+      // Importers only check and emit calls, the body stays in the module
+      auto signature = std::make_unique<FunctionDeclarationNode>(
+          func->location(), func->identifier(), func->return_type().clone(),
+          clone_node_list(func->arguments()), AstNodeList{});
+      signature->set_exported(true);
+      if (func->result_type()) {
+        signature->set_result_type(func->result_type()->clone());
+      }
+      interface.push_back(std::move(signature));
+    } else if (auto constant =
+                   dynamic_cast<const ConstantDeclarationNode *>(node.get())) {
+      // Validation already replaced the value by a literal
+      if (constant->exported()) {
+        interface.push_back(constant->clone());
+      }
+    }
+  }
+  return interface;
+}
+
+std::string declaration_signature(const AstNode &node) {
+  std::string signature;
+  if (auto func = dynamic_cast<const FunctionDeclarationNode *>(&node)) {
+    // Exported functions are called with another convention
+    signature += func->exported() ? "export fun " : "fun ";
+    signature += func->identifier() + "(";
+    for (const auto &arg : func->arguments()) {
+      signature += TypeUtils::type_to_string(
+                       &static_cast<const ArgumentNode &>(*arg).type()) +
+                   ",";
+    }
+    signature += ") " + TypeUtils::type_to_string(&func->return_type());
+  } else if (auto constant =
+                 dynamic_cast<const ConstantDeclarationNode *>(&node)) {
+    signature += "const " + constant->identifier() + " " +
+                 TypeUtils::type_to_string(constant->value().result_type()) +
+                 " " + literal_text(constant->value());
+  }
+  return signature;
+}
+
+std::string interface_signature(const AstNodeList &interface) {
+  std::string signature;
+  for (const auto &node : interface) {
+    signature += declaration_signature(*node) + "\n";
+  }
+  return signature;
+}
+
+void write_interface(const AstNodeList &ast, const std::string &file) {
+  // Importers compiled in parallel never see a partially written interface
+  std::string temporary = file + ".tmp";
+  write_ast(make_interface(ast), temporary);
+  if (std::rename(temporary.c_str(), file.c_str()) != 0) {
+    std::remove(temporary.c_str());
+    throw SerializationException(file, "could not write file");
+  }
+}
+
+std::string find_interface(const ImportNode &node,
+                           const std::vector<std::string> &import_paths) {
+  std::string name = node.module() + INTERFACE_EXTENSION;
+
+  std::string path = join(parent_directory(node.location().file), name);
+  if (is_file(path)) {
+    return path;
+  }
+  for (const auto &directory : import_paths) {
+    path = join(directory, name);
+    if (is_file(path)) {
+      return path;
+    }
+  }
+
+  throw ValidationException(node.location(),
+                            "interface '" + name + "' of imported module '" +
+                                node.module() +
+                                "' not found, compile the module first or "
+                                "add its directory with -I");
+}
+
+AstNodeList read_interface(const ImportNode &node,
+                           const std::vector<std::string> &import_paths) {
+  return read_ast(find_interface(node, import_paths));
+}
+
+AstNodeList read_imports(const AstNodeList &ast,
+                         const std::vector<std::string> &import_paths) {
+  AstNodeList interfaces;
+  std::set<std::string> seen;
+  for (const auto &node : ast) {
+    auto import = dynamic_cast<const ImportNode *>(node.get());
+    if (!import || !seen.insert(import->module()).second) {
+      continue;
+    }
+    for (auto &declaration : read_interface(*import, import_paths)) {
+      interfaces.push_back(std::move(declaration));
+    }
+  }
+  return interfaces;
+}
+
+bool sort_imports(const std::vector<std::vector<size_t>> &dependencies,
+                  const std::vector<std::string> &sources,
+                  std::vector<size_t> &order) {
+  enum class State { NEW, VISITING, DONE };
+  std::vector<State> states(dependencies.size(), State::NEW);
+
+  std::function<bool(size_t)> visit = [&](size_t module) {
+    if (states[module] == State::DONE) {
+      return true;
+    }
+    if (states[module] == State::VISITING) {
+      log_error(sources[module] + ": import cycle");
+      return false;
+    }
+    states[module] = State::VISITING;
+    for (size_t dependency : dependencies[module]) {
+      if (!visit(dependency)) {
+        return false;
+      }
+    }
+    states[module] = State::DONE;
+    order.push_back(module);
+    return true;
+  };
+
+  for (size_t module = 0; module < dependencies.size(); ++module) {
+    if (!visit(module)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::string module_name(const std::string &file) {
+  std::string name = file.substr(file.rfind('/') + 1);
+  size_t dot = name.rfind('.');
+  return dot == std::string::npos || dot == 0 ? name : name.substr(0, dot);
+}
+
+bool resolve_program_imports(const std::vector<std::string> &files,
+                             const std::vector<const AstNodeList *> &modules,
+                             const std::vector<std::string> &import_paths,
+                             ProgramImports &imports) {
+  std::map<std::string, size_t> names;
+  for (size_t i = 0; i < files.size(); ++i) {
+    auto inserted = names.emplace(module_name(files[i]), i);
+    if (!inserted.second) {
+      log_error("inputs '" + files[inserted.first->second] + "' and '" +
+                files[i] + "' are both module '" + inserted.first->first +
+                "'");
+      return false;
+    }
+  }
+
+  imports = ProgramImports();
+  imports.dependencies.resize(files.size());
+  imports.interfaces.resize(files.size());
+  for (size_t i = 0; i < files.size(); ++i) {
+    for (const auto &node : *modules[i]) {
+      auto import = dynamic_cast<const ImportNode *>(node.get());
+      if (!import) {
+        continue;
+      }
+      auto input = names.find(import->module());
+      if (input != names.end() && input->second != i) {
+        imports.dependencies[i].push_back(input->second);
+        continue;
+      }
+      try {
+        imports.interface_files.push_back(
+            find_interface(*import, import_paths));
+        for (auto &declaration : read_interface(*import, import_paths)) {
+          imports.interfaces[i].push_back(std::move(declaration));
+        }
+      } catch (const ChaException &e) {
+        log_error(e.message());
+        return false;
+      }
+    }
+  }
+
+  // Constants are folded once the modules exporting them are validated
+  return sort_imports(imports.dependencies, files, imports.order);
+}
+
+bool validate_program(const ProgramImports &imports,
+                      const std::function<bool(size_t)> &validate) {
+  std::vector<bool> valid(imports.dependencies.size(), true);
+  for (size_t i : imports.order) {
+    for (size_t dependency : imports.dependencies[i]) {
+      valid[i] = valid[i] && valid[dependency];
+    }
+    if (valid[i]) {
+      valid[i] = validate(i);
+    }
+  }
+  return std::find(valid.begin(), valid.end(), false) == valid.end();
+}
+
+bool validate_module(Validator &validator, const AstNodeList &ast) {
+  try {
+    validator.validate(ast);
+  } catch (const ValidationException &e) {
+    log_error(e.message());
+    return false;
+  } catch (const MultipleValidationException &e) {
+    for (const auto &error : e.errors()) {
+      log_error(error.message());
+    }
+    return false;
+  }
+  return true;
+}
+
+bool check_function_names(const std::vector<const AstNodeList *> &modules) {
+  // Duplicates within one module are reported by its Validator
+  std::map<std::string, std::pair<size_t, const FunctionDeclarationNode *>>
+      functions;
+  bool unique = true;
+  for (size_t module = 0; module < modules.size(); ++module) {
+    for (const auto &node : *modules[module]) {
+      auto func = dynamic_cast<const FunctionDeclarationNode *>(node.get());
+      if (!func) {
+        continue;
+      }
+      auto inserted =
+          functions.emplace(func->identifier(), std::make_pair(module, func));
+      const auto &first = inserted.first->second;
+      if (!inserted.second && first.first != module) {
+        log_error(ValidationException(func->location(),
+                                      "'" + func->identifier() +
+                                          "' already defined by " +
+                                          first.second->location().file)
+                      .message());
+        unique = false;
+      }
+    }
+  }
+  return unique;
+}
+
+} // namespace cha
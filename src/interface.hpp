@@ -0,0 +1,111 @@
+#pragma once
+
+#include "ast.hpp"
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace cha {
+
+class Validator;
+
+// Extension of the interface file written next to a compiled module
+constexpr const char *INTERFACE_EXTENSION = ".chai";
+
+// Whether a validated module exports any function or constant
+bool has_exports(const AstNodeList &ast);
+
+// Signatures of the exported functions (without bodies) and the folded
+// exported constants of a validated module
+AstNodeList make_interface(const AstNodeList &ast);
+
+// Text of a function signature or of a folded constant, without its source
+// location
+std::string declaration_signature(const AstNode &node);
+
+// Text of the declarations of an interface without their source locations.
+// Importers only have to be compiled again when it changes.
+std::string interface_signature(const AstNodeList &interface);
+
+// Write the interface of a validated module in the binary AST format -
+// throws SerializationException
+void write_interface(const AstNodeList &ast, const std::string &file);
+
+// Path of the interface of an imported module: <module>.chai next to the
+// importing file, then in each of import_paths - throws ValidationException
+// when it cannot be found
+std::string find_interface(const ImportNode &node,
+                           const std::vector<std::string> &import_paths);
+
+// Read the interface of one imported module - throws ValidationException or
+// SerializationException
+AstNodeList read_interface(const ImportNode &node,
+                           const std::vector<std::string> &import_paths);
+
+// Read the interfaces of all modules imported by ast, without parsing or
+// validating their sources - throws ValidationException or
+// SerializationException
+AstNodeList read_imports(const AstNodeList &ast,
+                         const std::vector<std::string> &import_paths);
+
+// Order modules so that each one comes after the modules it imports, false
+// on an import cycle, which is reported with the name in sources
+bool sort_imports(const std::vector<std::vector<size_t>> &dependencies,
+                  const std::vector<std::string> &sources,
+                  std::vector<size_t> &order);
+
+// File name without its directory and extension, the name other modules
+// import it by
+std::string module_name(const std::string &file);
+
+// How the modules of one program import each other
+struct ProgramImports {
+  // Inputs imported by each module
+  std::vector<std::vector<size_t>> dependencies;
+  // Declarations of each module's imports that are not inputs, read from
+  // their interface files
+  std::vector<AstNodeList> interfaces;
+  // Those interface files, e.g. for a watch to follow
+  std::vector<std::string> interface_files;
+  // Each module comes after the modules it imports
+  std::vector<size_t> order;
+};
+
+// Resolve the imports of the modules parsed from files: imports of another
+// input in memory, the others through their interface files. False when two
+// inputs have the same module name, an interface cannot be read or modules
+// import each other, which is reported.
+bool resolve_program_imports(const std::vector<std::string> &files,
+                             const std::vector<const AstNodeList *> &modules,
+                             const std::vector<std::string> &import_paths,
+                             ProgramImports &imports);
+
+// Validate the modules of a program in import order with validate(module).
+// Modules importing an invalid one are skipped, their errors are already
+// reported. False when a module is invalid.
+bool validate_program(const ProgramImports &imports,
+                      const std::function<bool(size_t)> &validate);
+
+// Validate a module whose imports are declared to validator - false on
+// errors, which are reported
+bool validate_module(Validator &validator, const AstNodeList &ast);
+
+// Functions of the modules linked into one program share a single namespace,
+// false when two of them define the same name, which is reported
+bool check_function_names(const std::vector<const AstNodeList *> &modules);
+
+// Make the declarations of imported interfaces usable by a Validator or a
+// CodeGenerator
+template <typename Target>
+void declare_imports(Target &target, const AstNodeList &interfaces) {
+  for (const auto &node : interfaces) {
+    if (auto func = dynamic_cast<const FunctionDeclarationNode *>(node.get())) {
+      target.declare_external(*func);
+    } else if (auto constant = dynamic_cast<const ConstantDeclarationNode *>(
+                   node.get())) {
+      target.declare_external(*constant);
+    }
+  }
+}
+
+} // namespace cha
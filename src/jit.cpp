@@ -0,0 +1,215 @@
+#include "jit.hpp"
+#include "codegen.hpp"
+#include "exceptions.hpp"
+#include "log.hpp"
+
+#include <llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h>
+#include <llvm/ExecutionEngine/SectionMemoryManager.h>
+#include <llvm/Object/SymbolSize.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/Process.h>
+
+#include <fstream>
+
+namespace cha {
+
+namespace {
+
+// Appends the functions of every object the JIT loads to
+// /tmp/perf-<pid>.map, where perf looks up symbols for anonymous executable
+// memory
+class PerfMapListener : public llvm::JITEventListener {
+public:
+  PerfMapListener()
+      : path_("/tmp/perf-" +
+              std::to_string(llvm::sys::Process::getProcessId()) + ".map"),
+        file_(path_, std::ios::app) {
+    if (!file_) {
+      log_warning("Could not open perf map: " + path_);
+    }
+  }
+
+  void notifyObjectLoaded(
+      ObjectKey, const llvm::object::ObjectFile &object,
+      const llvm::RuntimeDyld::LoadedObjectInfo &info) override {
+    // The debug copy of the object has the sections at their load addresses
+    auto debug_object = info.getObjectForDebug(object);
+    if (!file_ || !debug_object.getBinary()) {
+      return;
+    }
+
+    for (const auto &[symbol, size] :
+         llvm::object::computeSymbolSizes(*debug_object.getBinary())) {
+      auto type = symbol.getType();
+      auto name = symbol.getName();
+      auto address = symbol.getAddress();
+      if (!type || !name || !address) {
+        llvm::consumeError(type.takeError());
+        llvm::consumeError(name.takeError());
+        llvm::consumeError(address.takeError());
+        continue;
+      }
+      if (*type != llvm::object::SymbolRef::ST_Function || size == 0) {
+        continue;
+      }
+      file_ << std::hex << *address << " " << size << std::dec << " "
+            << name->str() << "\n";
+    }
+    // perf may read the map while the program still runs
+    file_.flush();
+  }
+
+private:
+  std::string path_;
+  std::ofstream file_;
+};
+
+} // namespace
+
+TieredCompiler::TieredCompiler(const AstNodeList &ast,
+                               const BytecodeProgram &program,
+                               VirtualMachine &vm,
+                               const CompileOptions &options)
+    : ast_(ast), program_(program), vm_(vm), options_(options) {
+  // The JIT has no profile runtime to write counters to
+  options_.profile_generate.clear();
+}
+
+TieredCompiler::~TieredCompiler() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+    queue_.clear();
+  }
+  work_available_.notify_all();
+  if (worker_.joinable()) {
+    worker_.join();
+  }
+}
+
+void TieredCompiler::request(size_t function) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queue_.push_back(function);
+    // Programs that never get hot do not pay for the thread
+    if (!worker_.joinable()) {
+      worker_ = std::thread(&TieredCompiler::run_worker, this);
+    }
+  }
+  work_available_.notify_one();
+}
+
+void TieredCompiler::wait() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  idle_.wait(lock, [this] { return queue_.empty() && !busy_; });
+}
+
+size_t TieredCompiler::compiled() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return compiled_;
+}
+
+void TieredCompiler::run_worker() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    work_available_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+    if (stopping_) {
+      break;
+    }
+
+    size_t function = queue_.front();
+    queue_.pop_front();
+    busy_ = true;
+    lock.unlock();
+    compile_function(function);
+    lock.lock();
+    busy_ = false;
+    idle_.notify_all();
+  }
+  busy_ = false;
+  idle_.notify_all();
+}
+
+llvm::Expected<std::unique_ptr<llvm::orc::LLJIT>>
+TieredCompiler::create_jit() {
+  initialize_native_target();
+
+  llvm::orc::LLJITBuilder builder;
+  if (options_.jit_perf) {
+    perf_map_ = std::make_unique<PerfMapListener>();
+    // Only available when LLVM is built with LLVM_USE_PERF
+    perf_jitdump_ = llvm::JITEventListener::createPerfJITEventListener();
+    if (!perf_jitdump_) {
+      log_warning("LLVM was built without perf support, no jitdump written");
+    }
+
+    // JIT event listeners hook into the RuntimeDyld object layer
+    builder.setObjectLinkingLayerCreator(
+        [this](llvm::orc::ExecutionSession &session)
+            -> llvm::Expected<std::unique_ptr<llvm::orc::ObjectLayer>> {
+          auto layer = std::make_unique<llvm::orc::RTDyldObjectLinkingLayer>(
+              session, [](const llvm::MemoryBuffer &) {
+                return std::make_unique<llvm::SectionMemoryManager>();
+              });
+          layer->registerJITEventListener(*perf_map_);
+          if (perf_jitdump_) {
+            layer->registerJITEventListener(*perf_jitdump_);
+          }
+          return std::move(layer);
+        });
+  }
+  return builder.create();
+}
+
+void TieredCompiler::compile_function(size_t function) {
+  const std::string &name = program_.functions.at(function).name;
+  const FunctionDeclarationNode *declaration = nullptr;
+  for (const auto &node : ast_) {
+    auto candidate = dynamic_cast<const FunctionDeclarationNode *>(node.get());
+    if (candidate && candidate->identifier() == name) {
+      declaration = candidate;
+    }
+  }
+  if (!declaration) {
+    return;
+  }
+
+  if (!jit_) {
+    auto jit = create_jit();
+    if (!jit) {
+      log_warning("JIT unavailable: " + llvm::toString(jit.takeError()));
+      return;
+    }
+    jit_ = std::move(*jit);
+  }
+
+  // Each function gets a module with its own copy of everything it calls,
+  // so only the entry is visible to the JIT's symbol table
+  std::string entry = "__cha_tier_" + name;
+  try {
+    llvm::orc::ThreadSafeModule module =
+        CodeGenerator(name, options_)
+            .generate_jit_module(ast_, *declaration, entry);
+    if (auto error = jit_->addIRModule(std::move(module))) {
+      log_warning("JIT compilation of '" + name +
+                  "' failed: " + llvm::toString(std::move(error)));
+      return;
+    }
+  } catch (const CodeGenerationException &e) {
+    log_warning("JIT compilation of '" + name + "' failed: " + e.message());
+    return;
+  }
+
+  auto address = jit_->lookup(entry);
+  if (!address) {
+    log_warning("JIT compilation of '" + name +
+                "' failed: " + llvm::toString(address.takeError()));
+    return;
+  }
+  vm_.install(function, address->toPtr<NativeFunction>());
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  ++compiled_;
+}
+
+} // namespace cha
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "ast.hpp"
+#include "bytecode.hpp"
+#include "cha/cha.hpp"
+#include "vm.hpp"
+
+#include <llvm/ExecutionEngine/JITEventListener.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace cha {
+
+// Compiles the functions a VirtualMachine reports as hot with LLVM on a
+// background thread and installs the native code in the machine. The
+// interpreter keeps running while a function compiles; a function that
+// fails to compile stays interpreted.
+class TieredCompiler : public TierUp {
+public:
+  TieredCompiler(const AstNodeList &ast, const BytecodeProgram &program,
+                 VirtualMachine &vm,
+                 const CompileOptions &options = CompileOptions());
+  ~TieredCompiler() override;
+
+  TieredCompiler(const TieredCompiler &) = delete;
+  TieredCompiler &operator=(const TieredCompiler &) = delete;
+
+  void request(size_t function) override;
+
+  // Block until every requested function has been compiled or failed
+  void wait();
+
+  // Number of functions installed so far
+  size_t compiled() const;
+
+private:
+  const AstNodeList &ast_;
+  const BytecodeProgram &program_;
+  VirtualMachine &vm_;
+  CompileOptions options_;
+
+  // Listeners of jit_'s object layer, they must outlive it
+  std::unique_ptr<llvm::JITEventListener> perf_map_;
+  llvm::JITEventListener *perf_jitdump_ = nullptr;
+
+  // Created on the worker thread with the first request
+  std::unique_ptr<llvm::orc::LLJIT> jit_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable work_available_;
+  std::condition_variable idle_;
+  std::deque<size_t> queue_;
+  bool busy_ = false;
+  bool stopping_ = false;
+  size_t compiled_ = 0;
+  std::thread worker_;
+
+  void run_worker();
+  llvm::Expected<std::unique_ptr<llvm::orc::LLJIT>> create_jit();
+  void compile_function(size_t function);
+};
+
+} // namespace cha
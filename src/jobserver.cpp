@@ -0,0 +1,140 @@
+#include "jobserver.hpp"
+#include "log.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <poll.h>
+#include <sstream>
+#include <unistd.h>
+
+namespace cha {
+
+namespace {
+
+bool is_open(int fd) { return fd >= 0 && fcntl(fd, F_GETFD) != -1; }
+
+bool parse_fds(const std::string &value, int &read_fd, int &write_fd) {
+  std::istringstream stream(value);
+  char comma = 0;
+  return (stream >> read_fd >> comma >> write_fd) && comma == ',' &&
+         stream.peek() == std::char_traits<char>::eof();
+}
+
+} // namespace
+
+JobServer::JobServer(int read_fd, int write_fd, bool owns_fds)
+    : read_fd_(read_fd), write_fd_(write_fd), owns_fds_(owns_fds) {}
+
+JobServer::~JobServer() {
+  // Tokens still held would be lost to the rest of the build
+  for (char token : tokens_) {
+    while (write(write_fd_, &token, 1) < 0 && errno == EINTR) {
+    }
+  }
+  if (owns_fds_) {
+    close(read_fd_);
+    if (write_fd_ != read_fd_) {
+      close(write_fd_);
+    }
+  }
+}
+
+std::unique_ptr<JobServer>
+JobServer::from_makeflags(const std::string &flags) {
+  // make lists the flags of nested invocations too, the last one applies
+  std::string auth;
+  std::istringstream words(flags);
+  std::string word;
+  while (words >> word) {
+    for (const char *prefix : {"--jobserver-auth=", "--jobserver-fds="}) {
+      std::string option(prefix);
+      if (word.compare(0, option.size(), option) == 0) {
+        auth = word.substr(option.size());
+      }
+    }
+  }
+  if (auth.empty()) {
+    return nullptr;
+  }
+
+  if (auth.compare(0, 5, "fifo:") == 0) {
+    int fd = open(auth.c_str() + 5, O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+      log_warning("Could not open the jobserver " + auth.substr(5));
+      return nullptr;
+    }
+    return std::unique_ptr<JobServer>(new JobServer(fd, fd, true));
+  }
+
+  int read_fd = -1;
+  int write_fd = -1;
+  if (!parse_fds(auth, read_fd, write_fd)) {
+    return nullptr;
+  }
+  // make only passes the pipe to recipes marked with + or using $(MAKE)
+  if (!is_open(read_fd) || !is_open(write_fd)) {
+    log_warning("The jobserver pipe is not available, mark the recipe "
+                "with '+' to share make's job slots");
+    return nullptr;
+  }
+  return std::unique_ptr<JobServer>(new JobServer(read_fd, write_fd, false));
+}
+
+std::unique_ptr<JobServer> JobServer::from_environment() {
+  const char *flags = std::getenv("MAKEFLAGS");
+  return flags ? from_makeflags(flags) : nullptr;
+}
+
+bool JobServer::read_token(char &token) {
+  for (;;) {
+    ssize_t result = read(read_fd_, &token, 1);
+    if (result == 1) {
+      return true;
+    }
+    if (result < 0 && errno == EINTR) {
+      continue;
+    }
+    // GNU make 4.3 and later may hand out a non-blocking pipe or fifo
+    if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      struct pollfd descriptor = {read_fd_, POLLIN, 0};
+      if (poll(&descriptor, 1, -1) >= 0 || errno == EINTR) {
+        continue;
+      }
+    }
+    return false;
+  }
+}
+
+JobSlot JobServer::acquire() {
+  JobSlot slot;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (implicit_slot_free_) {
+      implicit_slot_free_ = false;
+      slot.kind = JobSlot::IMPLICIT;
+      return slot;
+    }
+  }
+
+  if (read_token(slot.token)) {
+    slot.kind = JobSlot::TOKEN;
+    std::lock_guard<std::mutex> lock(mutex_);
+    tokens_.push_back(slot.token);
+  }
+  return slot;
+}
+
+void JobServer::release(const JobSlot &slot) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (slot.kind == JobSlot::IMPLICIT) {
+    implicit_slot_free_ = true;
+  } else if (slot.kind == JobSlot::TOKEN) {
+    tokens_.erase(std::find(tokens_.begin(), tokens_.end(), slot.token));
+    while (write(write_fd_, &slot.token, 1) < 0 && errno == EINTR) {
+    }
+  }
+}
+
+} // namespace cha
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace cha {
+
+// A job slot taken from the jobserver, given back with JobServer::release()
+struct JobSlot {
+  enum Kind {
+    // The slot make gives every recipe
+    IMPLICIT,
+    // A token read from make's pipe
+    TOKEN,
+    // None, make went away and nobody else competes for the cores
+    NONE,
+  };
+
+  Kind kind = NONE;
+  char token = 0;
+};
+
+// Client of the GNU make jobserver. make runs every recipe with one implicit
+// job slot and hands out a token from a shared pipe for each additional one,
+// so parallel work inside a recipe does not oversubscribe the build.
+class JobServer {
+public:
+  // Connect to the jobserver described by MAKEFLAGS (--jobserver-auth=R,W,
+  // --jobserver-auth=fifo:PATH or --jobserver-fds=R,W). Returns nullptr when
+  // there is none or its pipe is not available to this process.
+  static std::unique_ptr<JobServer> from_makeflags(const std::string &flags);
+  static std::unique_ptr<JobServer> from_environment();
+
+  ~JobServer();
+
+  JobServer(const JobServer &) = delete;
+  JobServer &operator=(const JobServer &) = delete;
+
+  // Block until a job slot is available. Thread safe.
+  JobSlot acquire();
+
+  // Give back the slot acquire() returned. Thread safe.
+  void release(const JobSlot &slot);
+
+private:
+  JobServer(int read_fd, int write_fd, bool owns_fds);
+
+  int read_fd_;
+  int write_fd_;
+  bool owns_fds_;
+
+  std::mutex mutex_;
+  bool implicit_slot_free_ = true;
+  // Tokens held by jobs, they must be written back unchanged
+  std::vector<char> tokens_;
+
+  // Read one token, waiting for make when its pipe is non-blocking. False
+  // when make is gone.
+  bool read_token(char &token);
+};
+
+} // namespace cha
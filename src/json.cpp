@@ -0,0 +1,399 @@
+#include "json.hpp"
+#include "exceptions.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+namespace cha {
+
+namespace {
+
+// Deeper nesting is not valid protocol and would overflow the stack
+constexpr int MAX_DEPTH = 512;
+
+class JsonParser {
+public:
+  explicit JsonParser(const std::string &text) : text_(text) {}
+
+  Json parse_document() {
+    Json value = parse_value(0);
+    skip_whitespace();
+    if (position_ != text_.size()) {
+      fail("unexpected text after the value");
+    }
+    return value;
+  }
+
+private:
+  const std::string &text_;
+  size_t position_ = 0;
+
+  [[noreturn]] void fail(const std::string &message) {
+    throw ProtocolException("invalid JSON at offset " +
+                            std::to_string(position_) + ": " + message);
+  }
+
+  void skip_whitespace() {
+    while (position_ < text_.size() &&
+           (text_[position_] == ' ' || text_[position_] == '\t' ||
+            text_[position_] == '\n' || text_[position_] == '\r')) {
+      ++position_;
+    }
+  }
+
+  bool consume(const char *word) {
+    size_t length = std::char_traits<char>::length(word);
+    if (text_.compare(position_, length, word) != 0) {
+      return false;
+    }
+    position_ += length;
+    return true;
+  }
+
+  Json parse_value(int depth) {
+    if (depth > MAX_DEPTH) {
+      fail("nested too deeply");
+    }
+    skip_whitespace();
+    if (position_ >= text_.size()) {
+      fail("unexpected end");
+    }
+
+    char c = text_[position_];
+    if (c == '{') {
+      return parse_object(depth);
+    }
+    if (c == '[') {
+      return parse_array(depth);
+    }
+    if (c == '"') {
+      return Json(parse_string());
+    }
+    if (consume("true")) {
+      return Json(true);
+    }
+    if (consume("false")) {
+      return Json(false);
+    }
+    if (consume("null")) {
+      return Json();
+    }
+    return parse_number();
+  }
+
+  Json parse_object(int depth) {
+    Json::Object object;
+    ++position_;
+    skip_whitespace();
+    if (consume("}")) {
+      return Json(std::move(object));
+    }
+    for (;;) {
+      skip_whitespace();
+      if (position_ >= text_.size() || text_[position_] != '"') {
+        fail("expected a member name");
+      }
+      std::string key = parse_string();
+      skip_whitespace();
+      if (!consume(":")) {
+        fail("expected ':'");
+      }
+      object[key] = parse_value(depth + 1);
+      skip_whitespace();
+      if (consume("}")) {
+        return Json(std::move(object));
+      }
+      if (!consume(",")) {
+        fail("expected ',' or '}'");
+      }
+    }
+  }
+
+  Json parse_array(int depth) {
+    Json::Array array;
+    ++position_;
+    skip_whitespace();
+    if (consume("]")) {
+      return Json(std::move(array));
+    }
+    for (;;) {
+      array.push_back(parse_value(depth + 1));
+      skip_whitespace();
+      if (consume("]")) {
+        return Json(std::move(array));
+      }
+      if (!consume(",")) {
+        fail("expected ',' or ']'");
+      }
+    }
+  }
+
+  Json parse_number() {
+    const char *start = text_.c_str() + position_;
+    char *end = nullptr;
+    double value = std::strtod(start, &end);
+    if (end == start) {
+      fail("unexpected character");
+    }
+    position_ += end - start;
+    return Json(value);
+  }
+
+  unsigned parse_hex4() {
+    if (position_ + 4 > text_.size()) {
+      fail("truncated escape");
+    }
+    unsigned value = 0;
+    for (int i = 0; i < 4; ++i) {
+      char c = text_[position_++];
+      value <<= 4;
+      if (c >= '0' && c <= '9') {
+        value |= c - '0';
+      } else if (c >= 'a' && c <= 'f') {
+        value |= c - 'a' + 10;
+      } else if (c >= 'A' && c <= 'F') {
+        value |= c - 'A' + 10;
+      } else {
+        fail("invalid escape");
+      }
+    }
+    return value;
+  }
+
+  static void append_utf8(std::string &out, unsigned code) {
+    if (code < 0x80) {
+      out += char(code);
+    } else if (code < 0x800) {
+      out += char(0xC0 | (code >> 6));
+      out += char(0x80 | (code & 0x3F));
+    } else if (code < 0x10000) {
+      out += char(0xE0 | (code >> 12));
+      out += char(0x80 | ((code >> 6) & 0x3F));
+      out += char(0x80 | (code & 0x3F));
+    } else {
+      out += char(0xF0 | (code >> 18));
+      out += char(0x80 | ((code >> 12) & 0x3F));
+      out += char(0x80 | ((code >> 6) & 0x3F));
+      out += char(0x80 | (code & 0x3F));
+    }
+  }
+
+  std::string parse_string() {
+    std::string out;
+    ++position_;
+    for (;;) {
+      if (position_ >= text_.size()) {
+        fail("unterminated string");
+      }
+      char c = text_[position_++];
+      if (c == '"') {
+        return out;
+      }
+      if (c != '\\') {
+        out += c;
+        continue;
+      }
+      if (position_ >= text_.size()) {
+        fail("unterminated string");
+      }
+      char escape = text_[position_++];
+      switch (escape) {
+      case '"':
+      case '\\':
+      case '/':
+        out += escape;
+        break;
+      case 'b':
+        out += '\b';
+        break;
+      case 'f':
+        out += '\f';
+        break;
+      case 'n':
+        out += '\n';
+        break;
+      case 'r':
+        out += '\r';
+        break;
+      case 't':
+        out += '\t';
+        break;
+      case 'u': {
+        unsigned code = parse_hex4();
+        // Characters outside the basic plane come as surrogate pairs
+        if (code >= 0xD800 && code < 0xDC00 && consume("\\u")) {
+          unsigned low = parse_hex4();
+          code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+        }
+        append_utf8(out, code);
+        break;
+      }
+      default:
+        fail("invalid escape");
+      }
+    }
+  }
+};
+
+void dump_string(const std::string &value, std::string &out) {
+  out += '"';
+  for (char c : value) {
+    switch (c) {
+    case '"':
+      out += "\\\"";
+      break;
+    case '\\':
+      out += "\\\\";
+      break;
+    case '\n':
+      out += "\\n";
+      break;
+    case '\r':
+      out += "\\r";
+      break;
+    case '\t':
+      out += "\\t";
+      break;
+    default:
+      if (static_cast<unsigned char>(c) < 0x20) {
+        char escape[8];
+        std::snprintf(escape, sizeof(escape), "\\u%04x", c);
+        out += escape;
+      } else {
+        out += c;
+      }
+    }
+  }
+  out += '"';
+}
+
+} // namespace
+
+const std::string &Json::as_string() const {
+  static const std::string empty;
+  return kind_ == Kind::STRING ? string_ : empty;
+}
+
+const Json::Array &Json::as_array() const {
+  static const Array empty;
+  return kind_ == Kind::ARRAY ? array_ : empty;
+}
+
+const Json::Object &Json::as_object() const {
+  static const Object empty;
+  return kind_ == Kind::OBJECT ? object_ : empty;
+}
+
+const Json &Json::operator[](const std::string &key) const {
+  static const Json null;
+  if (kind_ != Kind::OBJECT) {
+    return null;
+  }
+  auto it = object_.find(key);
+  return it == object_.end() ? null : it->second;
+}
+
+Json &Json::operator[](const std::string &key) {
+  if (kind_ != Kind::OBJECT) {
+    *this = Json(Object());
+  }
+  return object_[key];
+}
+
+void Json::push_back(Json value) {
+  if (kind_ != Kind::ARRAY) {
+    *this = Json(Array());
+  }
+  array_.push_back(std::move(value));
+}
+
+bool Json::operator==(const Json &other) const {
+  if (kind_ != other.kind_) {
+    return false;
+  }
+  switch (kind_) {
+  case Kind::NUL:
+    return true;
+  case Kind::BOOL:
+    return bool_ == other.bool_;
+  case Kind::NUMBER:
+    return number_ == other.number_;
+  case Kind::STRING:
+    return string_ == other.string_;
+  case Kind::ARRAY:
+    return array_ == other.array_;
+  case Kind::OBJECT:
+    return object_ == other.object_;
+  }
+  return false;
+}
+
+std::string Json::dump() const {
+  std::string out;
+  dump(out);
+  return out;
+}
+
+void Json::dump(std::string &out) const {
+  switch (kind_) {
+  case Kind::NUL:
+    out += "null";
+    break;
+  case Kind::BOOL:
+    out += bool_ ? "true" : "false";
+    break;
+  case Kind::NUMBER: {
+    // Ids, lines and columns are integers and must print as such
+    if (std::isfinite(number_) && number_ == std::floor(number_) &&
+        std::fabs(number_) < 1e15) {
+      out += std::to_string(static_cast<int64_t>(number_));
+    } else if (std::isfinite(number_)) {
+      char buffer[32];
+      std::snprintf(buffer, sizeof(buffer), "%.17g", number_);
+      out += buffer;
+    } else {
+      out += "null";
+    }
+    break;
+  }
+  case Kind::STRING:
+    dump_string(string_, out);
+    break;
+  case Kind::ARRAY: {
+    out += '[';
+    bool first = true;
+    for (const auto &value : array_) {
+      if (!first) {
+        out += ',';
+      }
+      first = false;
+      value.dump(out);
+    }
+    out += ']';
+    break;
+  }
+  case Kind::OBJECT: {
+    out += '{';
+    bool first = true;
+    for (const auto &member : object_) {
+      if (!first) {
+        out += ',';
+      }
+      first = false;
+      dump_string(member.first, out);
+      out += ':';
+      member.second.dump(out);
+    }
+    out += '}';
+    break;
+  }
+  }
+}
+
+Json Json::parse(const std::string &text) {
+  JsonParser parser(text);
+  return parser.parse_document();
+}
+
+} // namespace cha
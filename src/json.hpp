@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace cha {
+
+// A JSON value, enough for the messages of the language server protocol
+class Json {
+public:
+  enum class Kind { NUL, BOOL, NUMBER, STRING, ARRAY, OBJECT };
+  using Array = std::vector<Json>;
+  using Object = std::map<std::string, Json>;
+
+  Json() = default;
+  Json(std::nullptr_t) {}
+  Json(bool value) : kind_(Kind::BOOL), bool_(value) {}
+  Json(int value) : kind_(Kind::NUMBER), number_(value) {}
+  Json(int64_t value) : kind_(Kind::NUMBER), number_(double(value)) {}
+  Json(size_t value) : kind_(Kind::NUMBER), number_(double(value)) {}
+  Json(double value) : kind_(Kind::NUMBER), number_(value) {}
+  Json(const char *value) : kind_(Kind::STRING), string_(value) {}
+  Json(std::string value) : kind_(Kind::STRING), string_(std::move(value)) {}
+  Json(Array value) : kind_(Kind::ARRAY), array_(std::move(value)) {}
+  Json(Object value) : kind_(Kind::OBJECT), object_(std::move(value)) {}
+
+  Kind kind() const { return kind_; }
+  bool is_null() const { return kind_ == Kind::NUL; }
+  bool is_number() const { return kind_ == Kind::NUMBER; }
+  bool is_string() const { return kind_ == Kind::STRING; }
+  bool is_object() const { return kind_ == Kind::OBJECT; }
+
+  // Accessors return an empty value when the kind does not match
+  bool as_bool() const { return kind_ == Kind::BOOL && bool_; }
+  double as_number() const { return kind_ == Kind::NUMBER ? number_ : 0; }
+  int as_int() const { return static_cast<int>(as_number()); }
+  const std::string &as_string() const;
+  const Array &as_array() const;
+  const Object &as_object() const;
+
+  // Member of an object, null when missing
+  const Json &operator[](const std::string &key) const;
+  // Member of an object, added when missing; null becomes an object
+  Json &operator[](const std::string &key);
+
+  // Append to an array; null becomes an array
+  void push_back(Json value);
+
+  bool operator==(const Json &other) const;
+  bool operator!=(const Json &other) const { return !(*this == other); }
+
+  // Compact text of the value
+  std::string dump() const;
+
+  // Throws ProtocolException when the text is not a single JSON value
+  static Json parse(const std::string &text);
+
+private:
+  Kind kind_ = Kind::NUL;
+  bool bool_ = false;
+  double number_ = 0;
+  std::string string_;
+  Array array_;
+  Object object_;
+
+  void dump(std::string &out) const;
+};
+
+} // namespace cha
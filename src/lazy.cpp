@@ -0,0 +1,75 @@
+#include "lazy.hpp"
+#include "exceptions.hpp"
+#include "parser.hpp"
+#include "stream.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <vector>
+
+namespace cha {
+
+AstNodeList parse_reachable(const std::string &file) {
+  std::ifstream in(file, std::ios::binary);
+  if (!in) {
+    throw ParseException(AstLocation(file, 1, 1, 1, 1),
+                         std::string("Could not open file"));
+  }
+  std::ostringstream text;
+  text << in.rdbuf();
+  return parse_reachable_text(text.str(), file);
+}
+
+AstNodeList parse_reachable_text(const std::string &text,
+                                 const std::string &file) {
+  AstNodeList ast = parse_signatures(text, file);
+
+  // Every function of a name is reached, so duplicates are still reported
+  std::multimap<std::string, FunctionDeclarationNode *> functions;
+  std::set<std::string> reached;
+  std::vector<std::string> pending;
+  auto reach = [&](const std::string &name) {
+    if (reached.insert(name).second) {
+      pending.push_back(name);
+    }
+  };
+  for (const auto &node : ast) {
+    if (auto function = dynamic_cast<FunctionDeclarationNode *>(node.get())) {
+      functions.emplace(function->identifier(), function);
+      if (function->identifier() == "main" || function->exported()) {
+        reach(function->identifier());
+      }
+    } else if (dynamic_cast<const ConstantDeclarationNode *>(node.get())) {
+      for (const auto &name : used_names(*node).functions) {
+        reach(name);
+      }
+    }
+  }
+
+  while (!pending.empty()) {
+    std::string name = std::move(pending.back());
+    pending.pop_back();
+    auto range = functions.equal_range(name);
+    for (auto it = range.first; it != range.second; ++it) {
+      parse_body(*it->second, text);
+      for (const auto &callee : used_names(*it->second).functions) {
+        reach(callee);
+      }
+    }
+  }
+
+  ast.erase(std::remove_if(ast.begin(), ast.end(),
+                           [](const AstNodePtr &node) {
+                             auto function =
+                                 dynamic_cast<const FunctionDeclarationNode *>(
+                                     node.get());
+                             return function && function->body_skipped();
+                           }),
+            ast.end());
+  return ast;
+}
+
+} // namespace cha
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "ast.hpp"
+
+#include <string>
+
+namespace cha {
+
+// Parse a module with parse_signatures(), then only the bodies of the
+// functions reached by calls from main, the exported functions and the
+// constants. Functions nothing reaches are left out of the AST, so their
+// bodies are never parsed nor validated - throws ParseException on error
+AstNodeList parse_reachable(const std::string &file);
+
+// The same for source text held in memory, file only names it in locations
+AstNodeList parse_reachable_text(const std::string &text,
+                                 const std::string &file);
+
+} // namespace cha
@@ -11,6 +11,7 @@ Logger &Logger::instance() {
 
 void Logger::log(LogLevel level, const std::string &message) {
   if (level <= min_level_) {
+    std::lock_guard<std::mutex> lock(mutex_);
     std::cerr << level_to_string(level) << ": " << message << std::endl;
   }
 }
@@ -18,6 +19,7 @@ void Logger::log(LogLevel level, const std::string &message) {
 void Logger::log(LogLevel level, const AstLocation &location,
                  const std::string &message) {
   if (level <= min_level_) {
+    std::lock_guard<std::mutex> lock(mutex_);
     std::cerr << level_to_string(level) << ": " << format_location(location)
               << " " << message << std::endl;
   }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "ast.hpp"
+#include <mutex>
 #include <string>
 
 namespace cha {
@@ -30,6 +31,8 @@ public:
 private:
   Logger() = default;
   LogLevel min_level_ = LogLevel::INFO;
+  // Keeps the lines of concurrent compiles apart
+  std::mutex mutex_;
 
   std::string level_to_string(LogLevel level) const;
   std::string format_location(const AstLocation &location) const;
@@ -0,0 +1,999 @@
+#include "lsp.hpp"
+#include "exceptions.hpp"
+#include "interface.hpp"
+#include "log.hpp"
+#include "parser.hpp"
+#include "stream.hpp"
+#include "validate.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <iterator>
+#include <unistd.h>
+
+namespace cha {
+
+namespace {
+
+// Method not found and internal error codes of JSON-RPC
+constexpr int METHOD_NOT_FOUND = -32601;
+constexpr int PARSE_ERROR = -32700;
+constexpr int INTERNAL_ERROR = -32603;
+
+// Incremental text synchronization of the protocol
+constexpr int SYNC_INCREMENTAL = 2;
+constexpr int SEVERITY_ERROR = 1;
+
+// Whether a line starts a top level declaration. Those keywords cannot
+// start a statement, so a valid source is never split inside a function.
+bool is_declaration_start(const std::string &line) {
+  for (const char *keyword : {"fun", "const", "export", "import"}) {
+    size_t length = std::char_traits<char>::length(keyword);
+    if (line.compare(0, length, keyword) == 0 &&
+        (line.size() == length ||
+         !(std::isalnum(static_cast<unsigned char>(line[length])) ||
+           line[length] == '_'))) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Whether lines only hold whitespace and comments, which do not parse
+bool is_blank(const std::vector<std::string> &lines) {
+  for (const auto &line : lines) {
+    size_t start = line.find_first_not_of(" \t\r");
+    if (start != std::string::npos && line.compare(start, 2, "//") != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::vector<std::string> split_lines(const std::string &text) {
+  std::vector<std::string> lines;
+  size_t start = 0;
+  for (;;) {
+    size_t end = text.find('\n', start);
+    if (end == std::string::npos) {
+      lines.push_back(text.substr(start));
+      return lines;
+    }
+    lines.push_back(text.substr(start, end - start));
+    start = end + 1;
+  }
+}
+
+std::string join_lines(const std::vector<std::string> &lines) {
+  std::string text;
+  for (size_t i = 0; i < lines.size(); ++i) {
+    if (i > 0) {
+      text += '\n';
+    }
+    text += lines[i];
+  }
+  return text;
+}
+
+// Group lines into chunks of declarations. Lines before the first
+// declaration join it; has_declaration tells whether there was one.
+std::vector<std::vector<std::string>>
+split_declarations(const std::vector<std::string> &lines,
+                   bool &has_declaration) {
+  std::vector<std::vector<std::string>> chunks(1);
+  has_declaration = false;
+  for (const auto &line : lines) {
+    if (is_declaration_start(line)) {
+      if (has_declaration) {
+        chunks.emplace_back();
+      }
+      has_declaration = true;
+    }
+    chunks.back().push_back(line);
+  }
+  return chunks;
+}
+
+// Range of a location in a chunk, moved to the document
+TextRange to_range(const AstLocation &location, int first_line) {
+  TextRange range;
+  range.start = {first_line + location.line_begin - 1,
+                 std::max(location.column_begin - 1, 0)};
+  range.end = {first_line + location.line_end - 1,
+               std::max(location.column_end - 1, 0)};
+  if (range.end.line < range.start.line ||
+      (range.end.line == range.start.line &&
+       range.end.character <= range.start.character)) {
+    range.end = {range.start.line, range.start.character + 1};
+  }
+  return range;
+}
+
+bool contains(const AstLocation &location, int line, int column) {
+  if (line < location.line_begin || line > location.line_end) {
+    return false;
+  }
+  if (line == location.line_begin && column < location.column_begin) {
+    return false;
+  }
+  return line != location.line_end || column < location.column_end;
+}
+
+// Names of the module scope a chunk uses
+std::set<std::string> used_names(const AstNodeList &ast) {
+  std::set<std::string> names;
+  for (const auto &node : ast) {
+    UsedNames used = cha::used_names(*node);
+    names.insert(used.functions.begin(), used.functions.end());
+    names.insert(used.values.begin(), used.values.end());
+  }
+  return names;
+}
+
+const AstNode *find_declaration(const AstNodeList &ast,
+                                const std::string &name) {
+  for (const auto &node : ast) {
+    auto func = dynamic_cast<const FunctionDeclarationNode *>(node.get());
+    auto constant = dynamic_cast<const ConstantDeclarationNode *>(node.get());
+    if ((func && func->identifier() == name) ||
+        (constant && constant->identifier() == name)) {
+      return node.get();
+    }
+  }
+  return nullptr;
+}
+
+void add_declared_names(const AstNodeList &ast, std::set<std::string> &names) {
+  for (const auto &node : ast) {
+    if (auto func = dynamic_cast<const FunctionDeclarationNode *>(node.get())) {
+      names.insert(func->identifier());
+    } else if (auto constant = dynamic_cast<const ConstantDeclarationNode *>(
+                   node.get())) {
+      names.insert(constant->identifier());
+    }
+  }
+}
+
+// Nodes from a top level node down to the innermost one at a position of
+// its chunk, in lines and columns counted from 1
+std::vector<const AstNode *> path_to(const AstNodeList &ast, int line,
+                                     int column) {
+  std::vector<const AstNode *> path;
+  std::vector<const AstNode *> candidates;
+  for (const auto &node : ast) {
+    candidates.push_back(node.get());
+  }
+  for (bool found = true; found;) {
+    found = false;
+    for (const AstNode *node : candidates) {
+      if (contains(node->location(), line, column)) {
+        path.push_back(node);
+        candidates = child_nodes(*node);
+        found = true;
+        break;
+      }
+    }
+  }
+  return path;
+}
+
+std::string signature_text(const FunctionDeclarationNode &func) {
+  std::string text = "fun " + func.identifier() + "(";
+  for (size_t i = 0; i < func.arguments().size(); ++i) {
+    const auto &arg = static_cast<const ArgumentNode &>(*func.arguments()[i]);
+    if (i > 0) {
+      text += ", ";
+    }
+    text += arg.identifier() + " " + TypeUtils::type_to_string(&arg.type());
+  }
+  text += ")";
+  const AstType &type = func.return_type();
+  if (!type.is_primitive() ||
+      type.as_primitive().type != PrimitiveType::UNDEF) {
+    text += " " + TypeUtils::type_to_string(&type);
+  }
+  return text;
+}
+
+Json range_json(const TextRange &range) {
+  Json json;
+  json["start"]["line"] = range.start.line;
+  json["start"]["character"] = range.start.character;
+  json["end"]["line"] = range.end.line;
+  json["end"]["character"] = range.end.character;
+  return json;
+}
+
+TextPosition position_of(const Json &json) {
+  return {json["line"].as_int(), json["character"].as_int()};
+}
+
+} // namespace
+
+struct Document::Chunk {
+  // Line of the document the chunk starts at
+  int first_line = 0;
+  std::vector<std::string> lines;
+  // The declarations as parsed, and a copy validated against the other
+  // chunks. Validation folds constants, so it always starts from a copy.
+  AstNodeList parsed;
+  AstNodeList ast;
+  // Declarations of the interfaces of the modules the chunk imports
+  AstNodeList imported;
+  std::set<std::string> declares;
+  std::set<std::string> uses;
+  // Locations are relative to the chunk
+  std::vector<Diagnostic> syntax_errors;
+  std::vector<Diagnostic> errors;
+  // Signature of what the chunk declares when it was last validated, the
+  // chunks using it are validated again when it changes
+  std::string signature;
+};
+
+Document::Document(std::string file, const std::string &text,
+                   std::vector<std::string> import_paths)
+    : file_(std::move(file)), import_paths_(std::move(import_paths)) {
+  replace(text);
+}
+
+Document::~Document() = default;
+
+void Document::replace(const std::string &text) {
+  replace_chunks(0, chunks_.size(), split_lines(text));
+}
+
+void Document::edit(const TextRange &range, const std::string &text) {
+  // The edit may remove the line that starts its chunk, merging what is
+  // left into the chunk before
+  size_t first = chunk_at(range.start.line);
+  size_t last = chunk_at(range.end.line);
+  if (first > 0) {
+    --first;
+  }
+  last = std::max(first, last);
+
+  std::vector<std::string> lines;
+  for (size_t i = first; i <= last; ++i) {
+    lines.insert(lines.end(), chunks_[i]->lines.begin(),
+                 chunks_[i]->lines.end());
+  }
+
+  // Positions past the end of a line or of the document are clamped
+  int region_start = chunks_[first]->first_line;
+  auto locate = [&](const TextPosition &position) {
+    int line = position.line - region_start;
+    if (line >= static_cast<int>(lines.size())) {
+      line = static_cast<int>(lines.size()) - 1;
+      return std::make_pair(size_t(line), lines[line].size());
+    }
+    line = std::max(line, 0);
+    size_t character = std::min(size_t(std::max(position.character, 0)),
+                                lines[line].size());
+    return std::make_pair(size_t(line), character);
+  };
+  auto start = locate(range.start);
+  auto end = std::max(start, locate(range.end));
+
+  std::vector<std::string> inserted =
+      split_lines(lines[start.first].substr(0, start.second) + text +
+                  lines[end.first].substr(end.second));
+  lines.erase(lines.begin() + start.first, lines.begin() + end.first + 1);
+  lines.insert(lines.begin() + start.first,
+               std::make_move_iterator(inserted.begin()),
+               std::make_move_iterator(inserted.end()));
+  replace_chunks(first, last - first + 1, std::move(lines));
+}
+
+std::string Document::text() const {
+  std::vector<std::string> lines;
+  for (const auto &chunk : chunks_) {
+    lines.insert(lines.end(), chunk->lines.begin(), chunk->lines.end());
+  }
+  return join_lines(lines);
+}
+
+size_t Document::chunk_at(int line) const {
+  auto it = std::upper_bound(
+      chunks_.begin(), chunks_.end(), line,
+      [](int line, const std::unique_ptr<Chunk> &chunk) {
+        return line < chunk->first_line;
+      });
+  return it == chunks_.begin() ? 0 : size_t(it - chunks_.begin()) - 1;
+}
+
+void Document::replace_chunks(size_t first, size_t count,
+                              std::vector<std::string> lines) {
+  parsed_ = 0;
+  int first_line = first < chunks_.size() ? chunks_[first]->first_line : 0;
+  size_t old_lines = 0;
+  for (size_t i = first; i < first + count; ++i) {
+    old_lines += chunks_[i]->lines.size();
+  }
+
+  std::vector<std::vector<std::string>> groups;
+  for (;;) {
+    bool has_declaration;
+    groups = split_declarations(lines, has_declaration);
+    if (has_declaration || first + count >= chunks_.size()) {
+      break;
+    }
+    // Only the first chunk can lack a declaration, the next one joins it
+    const auto &next = chunks_[first + count]->lines;
+    old_lines += next.size();
+    lines.insert(lines.end(), next.begin(), next.end());
+    ++count;
+  }
+
+  std::vector<std::unique_ptr<Chunk>> old(
+      std::make_move_iterator(chunks_.begin() + first),
+      std::make_move_iterator(chunks_.begin() + first + count));
+  chunks_.erase(chunks_.begin() + first, chunks_.begin() + first + count);
+
+  // Declarations whose text did not change keep their AST and validation
+  std::vector<std::unique_ptr<Chunk>> replacement(groups.size());
+  for (size_t group = 0; group < groups.size(); ++group) {
+    for (auto &chunk : old) {
+      if (chunk && chunk->lines == groups[group]) {
+        replacement[group] = std::move(chunk);
+        break;
+      }
+    }
+  }
+
+  // The others are reused in order, so an edited declaration keeps what it
+  // declared while it does not parse
+  std::vector<bool> changed(groups.size(), false);
+  size_t next_old = 0;
+  for (size_t group = 0; group < groups.size(); ++group) {
+    if (replacement[group]) {
+      continue;
+    }
+    while (next_old < old.size() && !old[next_old]) {
+      ++next_old;
+    }
+    replacement[group] = next_old < old.size() ? std::move(old[next_old])
+                                               : std::make_unique<Chunk>();
+    replacement[group]->lines = std::move(groups[group]);
+    changed[group] = true;
+  }
+
+  for (auto &chunk : old) {
+    if (chunk) {
+      use(*chunk, {});
+      declare(*chunk, {});
+      stale_.erase(chunk.get());
+    }
+  }
+
+  int line = first_line;
+  for (auto &chunk : replacement) {
+    chunk->first_line = line;
+    line += static_cast<int>(chunk->lines.size());
+  }
+  int delta = line - first_line - static_cast<int>(old_lines);
+  for (size_t i = first; i < chunks_.size(); ++i) {
+    chunks_[i]->first_line += delta;
+  }
+  chunks_.insert(chunks_.begin() + first,
+                 std::make_move_iterator(replacement.begin()),
+                 std::make_move_iterator(replacement.end()));
+
+  for (size_t group = 0; group < groups.size(); ++group) {
+    if (changed[group]) {
+      parse_chunk(*chunks_[first + group]);
+    }
+  }
+  validate_stale();
+}
+
+void Document::parse_chunk(Chunk &chunk) {
+  // A changed chunk is lexed and parsed again as a whole: the parser reduces
+  // whole declarations, and a declaration is the smallest part of the AST
+  // that can be replaced. A chunk holds one declaration, so this costs the
+  // size of the edited declaration, not of the document.
+  ++parsed_;
+  chunk.syntax_errors.clear();
+
+  AstNodeList parsed;
+  if (!is_blank(chunk.lines)) {
+    try {
+      parsed = parse_text(join_lines(chunk.lines), file_);
+    } catch (const ParseException &e) {
+      chunk.syntax_errors.push_back(
+          {to_range(e.location(), 0), bare_message(e.message())});
+      return;
+    }
+  }
+
+  chunk.parsed = std::move(parsed);
+  std::set<std::string> names;
+  add_declared_names(chunk.parsed, names);
+  add_declared_names(chunk.imported, names);
+  use(chunk, used_names(chunk.parsed));
+  declare(chunk, names);
+  stale_.insert(&chunk);
+}
+
+void Document::validate_stale() {
+  validated_ = 0;
+  // Constants make validation order matter: the chunks a chunk uses are
+  // validated before it, and chunks using a chunk whose signature changed
+  // become stale again. Chunks are validated a few times at most, in case
+  // constants depend on each other in a cycle.
+  std::map<Chunk *, int> rounds;
+  std::vector<Chunk *> stack;
+  std::set<Chunk *> expanded;
+  while (!stale_.empty()) {
+    stack.push_back(*stale_.begin());
+    while (!stack.empty()) {
+      Chunk *chunk = stack.back();
+      if (!stale_.count(chunk)) {
+        stack.pop_back();
+        continue;
+      }
+      if (expanded.insert(chunk).second) {
+        bool waiting = false;
+        for (const auto &name : chunk->uses) {
+          Chunk *declarer = owner(name);
+          if (declarer && declarer != chunk && stale_.count(declarer) &&
+              !expanded.count(declarer)) {
+            stack.push_back(declarer);
+            waiting = true;
+          }
+        }
+        if (waiting) {
+          continue;
+        }
+      }
+      stack.pop_back();
+      stale_.erase(chunk);
+      std::string signature = chunk->signature;
+      validate_chunk(*chunk);
+      ++validated_;
+      if (chunk->signature != signature && ++rounds[chunk] < 4) {
+        for (const auto &name : chunk->declares) {
+          for (Chunk *user : users_[name]) {
+            if (user != chunk) {
+              stale_.insert(user);
+              expanded.erase(user);
+            }
+          }
+        }
+      }
+    }
+    expanded.clear();
+  }
+}
+
+void Document::validate_chunk(Chunk &chunk) {
+  chunk.errors.clear();
+  chunk.imported.clear();
+  chunk.ast = clone_node_list(chunk.parsed);
+
+  for (const auto &node : chunk.ast) {
+    auto import = dynamic_cast<const ImportNode *>(node.get());
+    if (!import) {
+      continue;
+    }
+    try {
+      AstNodeList interface = read_interface(*import, import_paths_);
+      chunk.imported.insert(chunk.imported.end(),
+                            std::make_move_iterator(interface.begin()),
+                            std::make_move_iterator(interface.end()));
+    } catch (const ChaException &e) {
+      chunk.errors.push_back(
+          {to_range(import->location(), 0), bare_message(e.message())});
+    }
+  }
+  std::set<std::string> names;
+  add_declared_names(chunk.ast, names);
+  add_declared_names(chunk.imported, names);
+  declare(chunk, names);
+
+  // Everything the chunk uses or declares again is declared by the other
+  // chunks, first declaration wins. Functions the constants may call come
+  // with their body, and so does everything those functions use.
+  bool has_constants =
+      std::any_of(chunk.ast.begin(), chunk.ast.end(), [](const auto &node) {
+        return dynamic_cast<const ConstantDeclarationNode *>(node.get());
+      });
+  Validator validator;
+  std::set<std::string> seen(chunk.uses);
+  seen.insert(chunk.declares.begin(), chunk.declares.end());
+  std::vector<std::string> pending(seen.begin(), seen.end());
+  while (!pending.empty()) {
+    std::string name = std::move(pending.back());
+    pending.pop_back();
+    Chunk *declarer = owner(name);
+    if (!declarer || declarer == &chunk) {
+      continue;
+    }
+    const AstNode *node = declaration(*declarer, name);
+    if (auto func = dynamic_cast<const FunctionDeclarationNode *>(node)) {
+      if (has_constants && !func->body().empty() &&
+          declarer->errors.empty()) {
+        validator.declare_sibling(*func);
+        for (const auto &used : declarer->uses) {
+          if (seen.insert(used).second) {
+            pending.push_back(used);
+          }
+        }
+      } else {
+        validator.declare_external(*func);
+      }
+    } else if (auto constant =
+                   dynamic_cast<const ConstantDeclarationNode *>(node)) {
+      validator.declare_external(*constant);
+    }
+  }
+
+  try {
+    validator.validate(chunk.ast);
+  } catch (const MultipleValidationException &e) {
+    for (const auto &error : e.errors()) {
+      chunk.errors.push_back(
+          {to_range(error.location(), 0), bare_message(error.message())});
+    }
+  } catch (const ValidationException &e) {
+    chunk.errors.push_back(
+        {to_range(e.location(), 0), bare_message(e.message())});
+  }
+
+  AstNodeList declarations;
+  for (const AstNodeList *list : {&chunk.ast, &chunk.imported}) {
+    for (const auto &node : *list) {
+      if (auto func =
+              dynamic_cast<const FunctionDeclarationNode *>(node.get())) {
+        declarations.push_back(std::make_unique<FunctionDeclarationNode>(
+            func->location(), func->identifier(), func->return_type().clone(),
+            clone_node_list(func->arguments()), AstNodeList{}));
+      } else if (dynamic_cast<const ConstantDeclarationNode *>(node.get())) {
+        declarations.push_back(node->clone());
+      }
+    }
+  }
+  chunk.signature = interface_signature(declarations);
+}
+
+void Document::declare(Chunk &chunk, const std::set<std::string> &names) {
+  std::set<std::string> changed;
+  for (const auto &name : chunk.declares) {
+    if (!names.count(name)) {
+      auto &declarers = declarers_[name];
+      declarers.erase(std::remove(declarers.begin(), declarers.end(), &chunk),
+                      declarers.end());
+      if (declarers.empty()) {
+        declarers_.erase(name);
+      }
+      changed.insert(name);
+    }
+  }
+  for (const auto &name : names) {
+    if (!chunk.declares.count(name)) {
+      declarers_[name].push_back(&chunk);
+      changed.insert(name);
+    }
+  }
+  chunk.declares = names;
+
+  // Users may now find the name or another declaration of it, and other
+  // declarations of it may no longer be duplicates
+  for (const auto &name : changed) {
+    auto users = users_.find(name);
+    if (users != users_.end()) {
+      for (Chunk *user : users->second) {
+        if (user != &chunk) {
+          stale_.insert(user);
+        }
+      }
+    }
+    auto declarers = declarers_.find(name);
+    if (declarers != declarers_.end()) {
+      for (Chunk *declarer : declarers->second) {
+        if (declarer != &chunk) {
+          stale_.insert(declarer);
+        }
+      }
+    }
+  }
+}
+
+void Document::use(Chunk &chunk, const std::set<std::string> &names) {
+  for (const auto &name : chunk.uses) {
+    if (!names.count(name)) {
+      auto users = users_.find(name);
+      users->second.erase(&chunk);
+      if (users->second.empty()) {
+        users_.erase(users);
+      }
+    }
+  }
+  for (const auto &name : names) {
+    users_[name].insert(&chunk);
+  }
+  chunk.uses = names;
+}
+
+Document::Chunk *Document::owner(const std::string &name) const {
+  auto declarers = declarers_.find(name);
+  if (declarers == declarers_.end()) {
+    return nullptr;
+  }
+  return *std::min_element(declarers->second.begin(), declarers->second.end(),
+                           [](const Chunk *a, const Chunk *b) {
+                             return a->first_line < b->first_line;
+                           });
+}
+
+const AstNode *Document::declaration(const Chunk &chunk,
+                                     const std::string &name) const {
+  if (const AstNode *node = find_declaration(chunk.ast, name)) {
+    return node;
+  }
+  return find_declaration(chunk.imported, name);
+}
+
+std::vector<Diagnostic> Document::diagnostics() const {
+  std::vector<Diagnostic> diagnostics;
+  for (const auto &chunk : chunks_) {
+    for (const auto *errors : {&chunk->syntax_errors, &chunk->errors}) {
+      for (Diagnostic diagnostic : *errors) {
+        diagnostic.range.start.line += chunk->first_line;
+        diagnostic.range.end.line += chunk->first_line;
+        diagnostics.push_back(std::move(diagnostic));
+      }
+    }
+  }
+  return diagnostics;
+}
+
+std::string Document::hover(const TextPosition &position) const {
+  if (chunks_.empty()) {
+    return "";
+  }
+  const Chunk &chunk = *chunks_[chunk_at(position.line)];
+  auto path = path_to(chunk.ast, position.line - chunk.first_line + 1,
+                      position.character + 1);
+  if (path.empty()) {
+    return "";
+  }
+
+  const AstNode *node = path.back();
+  if (auto func = dynamic_cast<const FunctionDeclarationNode *>(node)) {
+    return signature_text(*func);
+  } else if (auto call = dynamic_cast<const FunctionCallNode *>(node)) {
+    Chunk *declarer = owner(call->identifier());
+    auto callee = declarer ? dynamic_cast<const FunctionDeclarationNode *>(
+                                 declaration(*declarer, call->identifier()))
+                           : nullptr;
+    if (callee) {
+      return signature_text(*callee);
+    }
+  } else if (auto constant =
+                 dynamic_cast<const ConstantDeclarationNode *>(node)) {
+    return "const " + constant->identifier() + " " +
+           TypeUtils::type_to_string(constant->value().result_type());
+  } else if (auto variable =
+                 dynamic_cast<const VariableDeclarationNode *>(node)) {
+    return "var " + variable->identifier() + " " +
+           TypeUtils::type_to_string(&variable->type());
+  } else if (auto arg = dynamic_cast<const ArgumentNode *>(node)) {
+    return arg->identifier() + " " + TypeUtils::type_to_string(&arg->type());
+  } else if (auto lookup = dynamic_cast<const VariableLookupNode *>(node)) {
+    if (lookup->result_type()) {
+      return lookup->identifier() + " " +
+             TypeUtils::type_to_string(lookup->result_type());
+    }
+  } else if (auto import = dynamic_cast<const ImportNode *>(node)) {
+    return "import " + import->module();
+  }
+  return node->result_type() ? TypeUtils::type_to_string(node->result_type())
+                             : "";
+}
+
+std::optional<TextLocation>
+Document::definition(const TextPosition &position) const {
+  if (chunks_.empty()) {
+    return std::nullopt;
+  }
+  const Chunk &chunk = *chunks_[chunk_at(position.line)];
+  int line = position.line - chunk.first_line + 1;
+  int column = position.character + 1;
+  auto path = path_to(chunk.ast, line, column);
+
+  std::string name;
+  bool call = false;
+  for (auto it = path.rbegin(); it != path.rend() && name.empty(); ++it) {
+    if (auto node = dynamic_cast<const FunctionCallNode *>(*it)) {
+      name = node->identifier();
+      call = true;
+    } else if (auto node = dynamic_cast<const VariableLookupNode *>(*it)) {
+      name = node->identifier();
+    } else if (auto node = dynamic_cast<const VariableAssignmentNode *>(*it)) {
+      name = node->identifier();
+    }
+  }
+  if (name.empty()) {
+    return std::nullopt;
+  }
+
+  // Arguments and variables declared before the position in the function
+  auto function = path.empty() ? nullptr
+                               : dynamic_cast<const FunctionDeclarationNode *>(
+                                     path.front());
+  if (function && !call) {
+    const AstNode *local = nullptr;
+    for (const auto &arg : function->arguments()) {
+      if (static_cast<const ArgumentNode &>(*arg).identifier() == name) {
+        local = arg.get();
+      }
+    }
+    std::vector<const AstNode *> pending;
+    for (const auto &statement : function->body()) {
+      pending.push_back(statement.get());
+    }
+    while (!pending.empty()) {
+      const AstNode *node = pending.back();
+      pending.pop_back();
+      auto variable = dynamic_cast<const VariableDeclarationNode *>(node);
+      const AstLocation &location = node->location();
+      if (variable && variable->identifier() == name &&
+          (location.line_begin < line ||
+           (location.line_begin == line && location.column_begin < column)) &&
+          (!local || location.line_begin > local->location().line_begin ||
+           (location.line_begin == local->location().line_begin &&
+            location.column_begin > local->location().column_begin))) {
+        local = node;
+      }
+      for (const AstNode *child : child_nodes(*node)) {
+        pending.push_back(child);
+      }
+    }
+    if (local) {
+      return TextLocation{file_, to_range(local->location(), chunk.first_line)};
+    }
+  }
+
+  Chunk *declarer = owner(name);
+  if (!declarer) {
+    return std::nullopt;
+  }
+  if (const AstNode *node = find_declaration(declarer->ast, name)) {
+    return TextLocation{file_,
+                        to_range(node->location(), declarer->first_line)};
+  }
+  if (const AstNode *node = find_declaration(declarer->imported, name)) {
+    // Declared in the source of the imported module
+    return TextLocation{node->location().file, to_range(node->location(), 0)};
+  }
+  return std::nullopt;
+}
+
+std::string uri_to_path(const std::string &uri) {
+  const std::string scheme = "file://";
+  std::string encoded =
+      uri.compare(0, scheme.size(), scheme) == 0 ? uri.substr(scheme.size())
+                                                 : uri;
+  std::string path;
+  for (size_t i = 0; i < encoded.size(); ++i) {
+    if (encoded[i] == '%' && i + 2 < encoded.size() &&
+        std::isxdigit(static_cast<unsigned char>(encoded[i + 1])) &&
+        std::isxdigit(static_cast<unsigned char>(encoded[i + 2]))) {
+      path += static_cast<char>(
+          std::strtol(encoded.substr(i + 1, 2).c_str(), nullptr, 16));
+      i += 2;
+    } else {
+      path += encoded[i];
+    }
+  }
+  return path;
+}
+
+std::string path_to_uri(const std::string &path) {
+  std::string absolute = path;
+  if (absolute.empty() || absolute[0] != '/') {
+    char directory[4096];
+    if (getcwd(directory, sizeof(directory))) {
+      absolute = std::string(directory) + "/" + absolute;
+    }
+  }
+  static const char hex[] = "0123456789ABCDEF";
+  std::string uri = "file://";
+  for (unsigned char c : absolute) {
+    if (std::isalnum(c) || c == '/' || c == '-' || c == '_' || c == '.' ||
+        c == '~') {
+      uri += static_cast<char>(c);
+    } else {
+      uri += '%';
+      uri += hex[c >> 4];
+      uri += hex[c & 15];
+    }
+  }
+  return uri;
+}
+
+LanguageServer::LanguageServer(std::ostream &out) : out_(out) {}
+
+int LanguageServer::run(std::istream &in) {
+  const std::string content_length = "Content-Length:";
+  for (;;) {
+    // Headers end with an empty line, only the length of the body matters
+    size_t length = 0;
+    bool has_length = false;
+    std::string line;
+    for (;;) {
+      if (!std::getline(in, line)) {
+        return shutdown_ ? 0 : 1;
+      }
+      if (!line.empty() && line.back() == '\r') {
+        line.pop_back();
+      }
+      if (line.empty()) {
+        break;
+      }
+      if (line.compare(0, content_length.size(), content_length) == 0) {
+        length = std::strtoul(line.c_str() + content_length.size(), nullptr,
+                              10);
+        has_length = true;
+      }
+    }
+    if (!has_length) {
+      continue;
+    }
+
+    std::string body(length, '\0');
+    if (!in.read(&body[0], static_cast<std::streamsize>(length))) {
+      return shutdown_ ? 0 : 1;
+    }
+    Json message;
+    try {
+      message = Json::parse(body);
+    } catch (const ProtocolException &e) {
+      respond_error(Json(), PARSE_ERROR, e.message());
+      continue;
+    }
+    if (!handle(message)) {
+      return shutdown_ ? 0 : 1;
+    }
+  }
+}
+
+bool LanguageServer::handle(const Json &message) {
+  const std::string &method = message["method"].as_string();
+  const Json &id = message["id"];
+  const Json &params = message["params"];
+
+  try {
+    if (method == "initialize") {
+      for (const auto &path :
+           params["initializationOptions"]["importPaths"].as_array()) {
+        import_paths_.push_back(path.as_string());
+      }
+      Json result;
+      Json &capabilities = result["capabilities"];
+      capabilities["textDocumentSync"]["openClose"] = true;
+      capabilities["textDocumentSync"]["change"] = SYNC_INCREMENTAL;
+      capabilities["hoverProvider"] = true;
+      capabilities["definitionProvider"] = true;
+      result["serverInfo"]["name"] = "cha-lsp";
+      result["serverInfo"]["version"] = CMAKE_PROJECT_VERSION;
+      respond(id, std::move(result));
+    } else if (method == "shutdown") {
+      shutdown_ = true;
+      respond(id, Json());
+    } else if (method == "exit") {
+      return false;
+    } else if (method == "textDocument/didOpen") {
+      const Json &item = params["textDocument"];
+      const std::string &uri = item["uri"].as_string();
+      documents_[uri] = std::make_unique<Document>(
+          uri_to_path(uri), item["text"].as_string(), import_paths_);
+      publish_diagnostics(uri);
+    } else if (method == "textDocument/didChange") {
+      Document *document = this->document(params);
+      if (!document) {
+        return true;
+      }
+      for (const auto &change : params["contentChanges"].as_array()) {
+        const Json &range = change["range"];
+        if (range.is_null()) {
+          document->replace(change["text"].as_string());
+        } else {
+          document->edit(
+              {position_of(range["start"]), position_of(range["end"])},
+              change["text"].as_string());
+        }
+      }
+      publish_diagnostics(params["textDocument"]["uri"].as_string());
+    } else if (method == "textDocument/didClose") {
+      const std::string &uri = params["textDocument"]["uri"].as_string();
+      documents_.erase(uri);
+      publish_diagnostics(uri);
+    } else if (method == "textDocument/hover") {
+      Document *document = this->document(params);
+      std::string text =
+          document ? document->hover(position_of(params["position"])) : "";
+      Json result;
+      if (!text.empty()) {
+        result["contents"]["kind"] = "plaintext";
+        result["contents"]["value"] = text;
+      }
+      respond(id, std::move(result));
+    } else if (method == "textDocument/definition") {
+      Document *document = this->document(params);
+      std::optional<TextLocation> location;
+      if (document) {
+        location = document->definition(position_of(params["position"]));
+      }
+      Json result;
+      if (location) {
+        result["uri"] = path_to_uri(location->file);
+        result["range"] = range_json(location->range);
+      }
+      respond(id, std::move(result));
+    } else if (!id.is_null()) {
+      respond_error(id, METHOD_NOT_FOUND, "unknown method '" + method + "'");
+    }
+  } catch (const ChaException &e) {
+    log_error(e.message());
+    if (!id.is_null()) {
+      respond_error(id, INTERNAL_ERROR, e.message());
+    }
+  }
+  return true;
+}
+
+void LanguageServer::send(const Json &message) {
+  std::string body = message.dump();
+  out_ << "Content-Length: " << body.size() << "\r\n\r\n" << body;
+  out_.flush();
+}
+
+void LanguageServer::respond(const Json &id, Json result) {
+  Json message;
+  message["jsonrpc"] = "2.0";
+  message["id"] = id;
+  message["result"] = std::move(result);
+  send(message);
+}
+
+void LanguageServer::respond_error(const Json &id, int code,
+                                   const std::string &text) {
+  Json message;
+  message["jsonrpc"] = "2.0";
+  message["id"] = id;
+  message["error"]["code"] = code;
+  message["error"]["message"] = text;
+  send(message);
+}
+
+void LanguageServer::publish_diagnostics(const std::string &uri) {
+  Json params;
+  params["uri"] = uri;
+  params["diagnostics"] = Json(Json::Array());
+  auto document = documents_.find(uri);
+  if (document != documents_.end()) {
+    for (const auto &diagnostic : document->second->diagnostics()) {
+      Json json;
+      json["range"] = range_json(diagnostic.range);
+      json["severity"] = SEVERITY_ERROR;
+      json["source"] = "cha";
+      json["message"] = diagnostic.message;
+      params["diagnostics"].push_back(std::move(json));
+    }
+  }
+
+  Json message;
+  message["jsonrpc"] = "2.0";
+  message["method"] = "textDocument/publishDiagnostics";
+  message["params"] = std::move(params);
+  send(message);
+}
+
+Document *LanguageServer::document(const Json &params) {
+  auto document = documents_.find(params["textDocument"]["uri"].as_string());
+  return document == documents_.end() ? nullptr : document->second.get();
+}
+
+} // namespace cha
@@ -0,0 +1,137 @@
+#pragma once
+
+#include "ast.hpp"
+#include "json.hpp"
+
+#include <istream>
+#include <map>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace cha {
+
+// Zero based line and character in a document, as in the language server
+// protocol. Characters are bytes, cha sources are ASCII.
+struct TextPosition {
+  int line = 0;
+  int character = 0;
+};
+
+struct TextRange {
+  TextPosition start;
+  TextPosition end;
+};
+
+// A range in a file, e.g. of a declaration
+struct TextLocation {
+  std::string file;
+  TextRange range;
+};
+
+struct Diagnostic {
+  TextRange range;
+  std::string message;
+};
+
+// A source file open in an editor. The text is kept in chunks of whole top
+// level declarations, a chunk starting at each line that begins with fun,
+// const, export or import. An edit only splits and parses again the chunks
+// it touches, and only validates again those chunks and the chunks using
+// what they declare when that changed. Locations inside a chunk are
+// relative to its first line, so edits above it do not touch its AST.
+class Document {
+public:
+  // import_paths are searched for the interfaces of imported modules
+  Document(std::string file, const std::string &text,
+           std::vector<std::string> import_paths = {});
+  ~Document();
+
+  Document(const Document &) = delete;
+  Document &operator=(const Document &) = delete;
+
+  // Replace a range of the text
+  void edit(const TextRange &range, const std::string &text);
+
+  // Replace the whole text
+  void replace(const std::string &text);
+
+  std::string text() const;
+
+  // Syntax and validation errors of the whole document
+  std::vector<Diagnostic> diagnostics() const;
+
+  // Type or signature of what is at a position, empty when nothing is
+  std::string hover(const TextPosition &position) const;
+
+  // Declaration of the name at a position
+  std::optional<TextLocation> definition(const TextPosition &position) const;
+
+  // Work done by the last change
+  size_t chunks() const { return chunks_.size(); }
+  size_t parsed() const { return parsed_; }
+  size_t validated() const { return validated_; }
+
+private:
+  struct Chunk;
+
+  std::string file_;
+  std::vector<std::string> import_paths_;
+  // In the order of the text
+  std::vector<std::unique_ptr<Chunk>> chunks_;
+  // Chunks declaring and chunks using each top level name
+  std::unordered_map<std::string, std::vector<Chunk *>> declarers_;
+  std::unordered_map<std::string, std::set<Chunk *>> users_;
+  // Chunks to validate again
+  std::set<Chunk *> stale_;
+  size_t parsed_ = 0;
+  size_t validated_ = 0;
+
+  size_t chunk_at(int line) const;
+  void replace_chunks(size_t first, size_t last,
+                      std::vector<std::string> lines);
+  void parse_chunk(Chunk &chunk);
+  void validate_stale();
+  void validate_chunk(Chunk &chunk);
+  void declare(Chunk &chunk, const std::set<std::string> &names);
+  void use(Chunk &chunk, const std::set<std::string> &names);
+  void invalidate_users(const std::set<std::string> &names);
+  Chunk *owner(const std::string &name) const;
+  const AstNode *declaration(const Chunk &chunk,
+                             const std::string &name) const;
+};
+
+// Serves diagnostics, hover and go to definition for cha sources over the
+// language server protocol (JSON-RPC with Content-Length headers)
+class LanguageServer {
+public:
+  explicit LanguageServer(std::ostream &out);
+
+  // Serve the messages read from in until exit, returns the exit code
+  int run(std::istream &in);
+
+  // Handle one message, returns false once the client asked to exit
+  bool handle(const Json &message);
+
+private:
+  std::ostream &out_;
+  std::map<std::string, std::unique_ptr<Document>> documents_;
+  std::vector<std::string> import_paths_;
+  bool shutdown_ = false;
+
+  void send(const Json &message);
+  void respond(const Json &id, Json result);
+  void respond_error(const Json &id, int code, const std::string &message);
+  void publish_diagnostics(const std::string &uri);
+  Document *document(const Json &params);
+};
+
+// Path of a file:// URI, and the other way around
+std::string uri_to_path(const std::string &uri);
+std::string path_to_uri(const std::string &path);
+
+} // namespace cha
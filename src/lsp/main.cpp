@@ -0,0 +1,23 @@
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "lsp.hpp"
+
+int main(int argc, char *argv[]) {
+  std::vector<std::string> args(argv, argv + argc);
+  if (args.size() == 2 && args[1] == "--version") {
+    std::cerr << "cha-lsp " << CMAKE_PROJECT_VERSION << std::endl;
+    return 0;
+  }
+  if (args.size() != 1 && !(args.size() == 2 && args[1] == "--stdio")) {
+    std::cerr << "Usage: --version | " << args[0] << " [--stdio]"
+              << std::endl;
+    return 1;
+  }
+
+  // Messages go over stdin and stdout, logs to stderr
+  std::ios::sync_with_stdio(false);
+  cha::LanguageServer server(std::cout);
+  return server.run(std::cin);
+}
@@ -0,0 +1,164 @@
+#include "lto.hpp"
+#include "codegen.hpp"
+
+#include <cstdio> // for std::remove
+#include <llvm/LTO/LTO.h>
+#include <llvm/Support/CachePruning.h>
+#include <llvm/Support/Caching.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/Threading.h>
+#include <mutex>
+#include <set>
+
+namespace cha {
+
+void link_thin_lto(
+    const std::vector<std::unique_ptr<llvm::MemoryBuffer>> &modules,
+    const std::string &output_file, const CompileOptions &options) {
+  // Only bitcode inputs may reach the link without generating code first
+  initialize_native_target();
+
+  llvm::lto::Config config;
+  config.CPU = "generic";
+  config.OptLevel = 2;
+  if (options.fast_compile) {
+    config.OptLevel = 0;
+    config.CGOptLevel = llvm::CodeGenOptLevel::None;
+    config.DisableVerify = true;
+  }
+
+  // The backends apply the sample profile through the line tables kept in
+  // the bitcode, profile builds also group hot code at link time
+  config.SampleProfile = options.sample_profile;
+  if (!options.profile_use.empty() || !options.sample_profile.empty()) {
+    config.Options.FunctionSections = true;
+    config.Options.EnableMachineFunctionSplitter = true;
+  }
+
+  // One backend per module, spread over all cores
+  llvm::lto::LTO lto(std::move(config),
+                     llvm::lto::createInProcessThinBackend(
+                         llvm::heavyweight_hardware_concurrency()));
+
+  std::set<std::string> defined;
+  for (const auto &module : modules) {
+    auto input = llvm::lto::InputFile::create(module->getMemBufferRef());
+    if (!input) {
+      throw CodeGenerationException(
+          "Could not read bitcode " + module->getBufferIdentifier().str() +
+          ": " + llvm::toString(input.takeError()));
+    }
+
+    // The whole program is visible here, so only main has to stay external
+    // and everything else can be internalized and inlined across modules
+    std::vector<llvm::lto::SymbolResolution> resolutions;
+    for (const auto &symbol : (*input)->symbols()) {
+      llvm::lto::SymbolResolution resolution;
+      if (!symbol.isUndefined()) {
+        std::string name = symbol.getName().str();
+        if (!defined.insert(name).second) {
+          throw CodeGenerationException("Duplicate symbol '" + name +
+                                        "' in " +
+                                        module->getBufferIdentifier().str());
+        }
+        resolution.Prevailing = true;
+        resolution.FinalDefinitionInLinkageUnit = true;
+      }
+      resolution.VisibleToRegularObj = symbol.getName() == "main";
+      resolutions.push_back(resolution);
+    }
+
+    if (llvm::Error err = lto.add(std::move(*input), resolutions)) {
+      throw CodeGenerationException("ThinLTO failed to add " +
+                                    module->getBufferIdentifier().str() +
+                                    ": " + llvm::toString(std::move(err)));
+    }
+  }
+
+  // Each backend task writes its own object file
+  std::vector<std::string> object_files(lto.getMaxTasks());
+  auto add_stream = [&](unsigned task, const llvm::Twine &)
+      -> llvm::Expected<std::unique_ptr<llvm::CachedFileStream>> {
+    std::string path = output_file + ".lto." + std::to_string(task) + ".o";
+    std::error_code ec;
+    auto stream = std::make_unique<llvm::raw_fd_ostream>(
+        path, ec, llvm::sys::fs::OF_None);
+    if (ec) {
+      return llvm::createStringError(ec, "Could not open file: " + path);
+    }
+    object_files[task] = path;
+    return std::make_unique<llvm::CachedFileStream>(std::move(stream), path);
+  };
+
+  // Cached objects, and new ones once committed to the cache, are handed over
+  // as buffers instead of being written through add_stream. Errors cannot
+  // be returned through the cache, they are checked after the run.
+  std::mutex buffer_error_mutex;
+  std::string buffer_error;
+  auto add_buffer = [&](unsigned task, const llvm::Twine &,
+                        std::unique_ptr<llvm::MemoryBuffer> buffer) {
+    std::string path = output_file + ".lto." + std::to_string(task) + ".o";
+    std::error_code ec;
+    llvm::raw_fd_ostream stream(path, ec, llvm::sys::fs::OF_None);
+    if (ec) {
+      std::lock_guard<std::mutex> lock(buffer_error_mutex);
+      buffer_error = "Could not open file: " + path;
+      return;
+    }
+    stream << buffer->getBuffer();
+    object_files[task] = path;
+  };
+
+  // Entries are per module: the key covers the whole module and everything
+  // it imports, so any change to one of its functions misses the cache
+  llvm::FileCache cache;
+  if (!options.lto_cache.empty()) {
+    auto local_cache =
+        llvm::localCache("ThinLTO", "cha-lto", options.lto_cache, add_buffer);
+    if (!local_cache) {
+      throw CodeGenerationException("Could not use ThinLTO cache " +
+                                    options.lto_cache + ": " +
+                                    llvm::toString(local_cache.takeError()));
+    }
+    cache = std::move(*local_cache);
+  }
+
+  auto cleanup = [&]() {
+    for (const auto &object_file : object_files) {
+      if (!object_file.empty()) {
+        std::remove(object_file.c_str());
+      }
+    }
+  };
+
+  if (llvm::Error err = lto.run(add_stream, cache)) {
+    cleanup();
+    throw CodeGenerationException("ThinLTO failed: " +
+                                  llvm::toString(std::move(err)));
+  }
+  if (!buffer_error.empty()) {
+    cleanup();
+    throw CodeGenerationException(buffer_error);
+  }
+  if (!options.lto_cache.empty()) {
+    // Expire old entries now and then, the default policy rate limits it
+    llvm::pruneCache(options.lto_cache, llvm::CachePruningPolicy());
+  }
+
+  std::vector<std::string> linked_objects;
+  for (const auto &object_file : object_files) {
+    if (!object_file.empty()) {
+      linked_objects.push_back(object_file);
+    }
+  }
+
+  try {
+    link_executable(linked_objects, output_file, options);
+  } catch (...) {
+    cleanup();
+    throw;
+  }
+  cleanup();
+}
+
+} // namespace cha
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "cha/cha.hpp"
+#include "exceptions.hpp"
+
+#include <llvm/Support/MemoryBuffer.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace cha {
+
+// Link bitcode modules into an executable with ThinLTO. Functions are
+// imported across modules for inlining and the backends run in parallel.
+// With CompileOptions::lto_cache, modules whose inputs to the backend did not
+// change reuse their machine code - throws CodeGenerationException on error
+void link_thin_lto(
+    const std::vector<std::unique_ptr<llvm::MemoryBuffer>> &modules,
+    const std::string &output_file,
+    const CompileOptions &options = CompileOptions());
+
+} // namespace cha
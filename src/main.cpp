@@ -1,32 +1,257 @@
+#include <cstdlib>
 #include <iostream>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
+#include "build.hpp"
 #include "cha/cha.hpp"
+#include "server.hpp"
 
-int main(int argc, char *argv[]) {
-  // Convert C-style args to modern C++ vector
-  std::vector<std::string> args(argv, argv + argc);
+namespace {
+
+// Formats of --emit=llvm-ir,asm,obj,exe,bc,ast, false on an unknown one
+bool parse_emit(const std::string &list,
+                std::vector<cha::CompileFormat> &formats) {
+  size_t start = 0;
+  while (start <= list.size()) {
+    size_t end = list.find(',', start);
+    if (end == std::string::npos) {
+      end = list.size();
+    }
+    std::string name = list.substr(start, end - start);
+    if (name == "llvm-ir") {
+      formats.push_back(cha::CompileFormat::LLVM_IR);
+    } else if (name == "asm") {
+      formats.push_back(cha::CompileFormat::ASSEMBLY_FILE);
+    } else if (name == "obj") {
+      formats.push_back(cha::CompileFormat::OBJECT_FILE);
+    } else if (name == "exe") {
+      formats.push_back(cha::CompileFormat::BINARY_FILE);
+    } else if (name == "bc") {
+      formats.push_back(cha::CompileFormat::BITCODE);
+    } else if (name == "ast") {
+      formats.push_back(cha::CompileFormat::AST_FILE);
+    } else {
+      std::cerr << "invalid --emit format: " << name << std::endl;
+      return false;
+    }
+    start = end + 1;
+  }
+  return true;
+}
 
+int run(const std::vector<std::string> &args) {
   if (args.size() == 2 && args[1] == "--version") {
     std::cerr << CMAKE_PROJECT_NAME << " " << CMAKE_PROJECT_VERSION
               << std::endl;
     return 0;
   }
 
-  if (args.size() != 4) {
+  // Split options from the positional arguments
+  cha::CompileOptions options;
+  std::vector<std::string> positional;
+  std::vector<cha::CompileFormat> emit;
+  bool watch = false;
+  bool check = false;
+  for (size_t i = 1; i < args.size(); ++i) {
+    if (args[i] == "--load-ast") {
+      options.load_ast = true;
+    } else if (args[i] == "--profile-generate") {
+      options.profile_generate = "default.profraw";
+    } else if (args[i].rfind("--profile-generate=", 0) == 0) {
+      options.profile_generate = args[i].substr(19);
+    } else if (args[i].rfind("--profile-use=", 0) == 0) {
+      options.profile_use = args[i].substr(14);
+    } else if (args[i].rfind("--sample-profile=", 0) == 0) {
+      options.sample_profile = args[i].substr(17);
+    } else if (args[i] == "-g") {
+      options.debug_info = cha::DebugInfo::FULL;
+    } else if (args[i] == "-gline-tables-only") {
+      options.debug_info = cha::DebugInfo::LINE_TABLES_ONLY;
+    } else if (args[i] == "-fno-omit-frame-pointer") {
+      options.frame_pointers = true;
+    } else if (args[i] == "--fast-compile") {
+      options.fast_compile = true;
+    } else if (args[i] == "--stream") {
+      options.streaming = true;
+    } else if (args[i] == "--lazy-bodies") {
+      options.lazy_bodies = true;
+    } else if (args[i] == "--jit") {
+      options.jit = true;
+    } else if (args[i].rfind("-j", 0) == 0) {
+      // -j<jobs> or -j <jobs>
+      std::string jobs = args[i].substr(2);
+      if (jobs.empty() && i + 1 < args.size()) {
+        jobs = args[++i];
+      }
+      try {
+        options.jobs = std::stoul(jobs);
+      } catch (const std::exception &) {
+        std::cerr << "Invalid number of jobs: " << jobs << std::endl;
+        return 1;
+      }
+    } else if (args[i].rfind("-I", 0) == 0) {
+      // -I<dir> or -I <dir>
+      std::string directory = args[i].substr(2);
+      if (directory.empty() && i + 1 < args.size()) {
+        directory = args[++i];
+      }
+      options.import_paths.push_back(directory);
+    } else if (args[i].rfind("--emit=", 0) == 0) {
+      if (!parse_emit(args[i].substr(7), emit)) {
+        return 1;
+      }
+    } else if (args[i] == "--check") {
+      check = true;
+    } else if (args[i] == "--watch") {
+      watch = true;
+    } else if (args[i].rfind("--lto-cache=", 0) == 0) {
+      options.lto_cache = args[i].substr(12);
+    } else if (args[i] == "--jit-perf") {
+      options.jit = true;
+      options.jit_perf = true;
+    } else if (args[i].rfind("--jit-threshold=", 0) == 0) {
+      options.jit = true;
+      try {
+        options.jit_threshold = std::stoul(args[i].substr(16));
+      } catch (const std::exception &) {
+        std::cerr << "Invalid JIT threshold: " << args[i].substr(16)
+                  << std::endl;
+        return 1;
+      }
+    } else {
+      positional.push_back(args[i]);
+    }
+  }
+
+  // Checked before any command runs, e.g. an --emit compile or a build
+  int profiles = !options.profile_generate.empty() +
+                 !options.profile_use.empty() +
+                 !options.sample_profile.empty();
+  if (profiles > 1) {
+    std::cerr << "--profile-generate, --profile-use and --sample-profile are "
+                 "exclusive"
+              << std::endl;
+    return 1;
+  }
+
+  // Stops after validation, before anything touches LLVM
+  if (check && !positional.empty()) {
+    return cha::check(positional, options);
+  }
+
+  if (positional.size() == 2 && positional[0] == "interp") {
+    return cha::interpret(positional[1], options);
+  }
+
+  if (!positional.empty() && positional.size() <= 2 &&
+      positional[0] == "build") {
+    std::string manifest =
+        positional.size() == 2 ? positional[1] : cha::DEFAULT_MANIFEST;
+    return watch ? cha::watch_build(manifest, options)
+                 : cha::build(manifest, options);
+  }
+
+  if (!emit.empty() && positional.size() == 2 && !watch) {
+    return cha::compile(positional[1], emit, positional[0], options);
+  }
+
+  if (positional.size() < 3) {
     std::cerr << "Usage: --version | " << args[0]
-              << " <format> <outputfile> <inputfile>" << std::endl;
+              << " [options] <format> <outputfile> <inputfile>..."
+              << std::endl;
+    std::cerr << "       " << args[0]
+              << " [options] --emit=<formats> <output> <inputfile>"
+              << std::endl;
+    std::cerr << "       " << args[0]
+              << " [options] <format> <outputdir>/ <inputfile>..."
+              << std::endl;
+    std::cerr << "       " << args[0] << " [options] interp <inputfile>"
+              << std::endl;
+    std::cerr << "       " << args[0] << " [options] --check <inputfile>..."
+              << std::endl;
+    std::cerr << "       " << args[0] << " [options] build [<manifest>]"
+              << std::endl;
+    std::cerr << "       " << args[0] << " --server <socket>" << std::endl;
     std::cerr << "format: -s for Assembly Code" << std::endl;
     std::cerr << "format: -c for Object File" << std::endl;
     std::cerr << "format: -ll for LLVM IR" << std::endl;
-    std::cerr << "format: -o for Binary File" << std::endl;
+    std::cerr << "format: -bc for LLVM Bitcode with ThinLTO summary"
+              << std::endl;
+    std::cerr << "format: -o for Binary File, several .cha/.bc inputs are "
+                 "linked with ThinLTO"
+              << std::endl;
+    std::cerr << "format: --emit-ast for Binary AST" << std::endl;
+    std::cerr << "format: --merge-profile to merge .profraw files into a "
+                 ".profdata file"
+              << std::endl;
+    std::cerr << "interp: run the program with the bytecode interpreter, the "
+                 "exit code is main's result"
+              << std::endl;
+    std::cerr << "build: compile the modules of a project that changed and "
+                 "link them (manifest: cha.build)"
+              << std::endl;
+    std::cerr << "--emit=<formats>: compile once into several of "
+                 "llvm-ir,asm,obj,exe,bc,ast, written to <output> with the "
+                 "format's extension (none for exe)"
+              << std::endl;
+    std::cerr << "--check: only parse and validate the inputs, without "
+                 "generating code"
+              << std::endl;
+    std::cerr << "--load-ast: inputfile is a Binary AST" << std::endl;
+    std::cerr << "--profile-generate[=<file>]: instrument the program to "
+                 "write a profile (default.profraw)"
+              << std::endl;
+    std::cerr << "--profile-use=<file>: optimize with a .profdata profile"
+              << std::endl;
+    std::cerr << "--sample-profile=<file>: optimize with a sample profile "
+                 "(AutoFDO)"
+              << std::endl;
+    std::cerr << "-g: emit DWARF debug info" << std::endl;
+    std::cerr << "-gline-tables-only: emit DWARF line tables" << std::endl;
+    std::cerr << "-fno-omit-frame-pointer: keep frame pointers" << std::endl;
+    std::cerr << "--fast-compile: generate unoptimized code as fast as "
+                 "possible (-O0 backend, no verifier)"
+              << std::endl;
+    std::cerr << "--stream: validate and generate each declaration while the "
+                 "input is parsed, dropping its AST once generated"
+              << std::endl;
+    std::cerr << "--lazy-bodies: only parse the bodies of functions reached "
+                 "from main, exports and constants"
+              << std::endl;
+    std::cerr << "--jit[-threshold=<calls>]: with interp, compile functions "
+                 "to native code once called <calls> times (1000)"
+              << std::endl;
+    std::cerr << "--jit-perf: describe JIT code to perf in "
+                 "/tmp/perf-<pid>.map and a jitdump"
+              << std::endl;
+    std::cerr << "-j <jobs>: with an output directory, compile the inputs "
+                 "separately, <jobs> at a time (one per core)"
+              << std::endl;
+    std::cerr << "--watch: compile again whenever an input changes, keeping "
+                 "the program in memory"
+              << std::endl;
+    std::cerr << "--lto-cache=<dir>: reuse the machine code of modules that "
+                 "did not change when linking"
+              << std::endl;
+    std::cerr << "-I <dir>: look for the .chai interfaces of imported "
+                 "modules in <dir>"
+              << std::endl;
+    std::cerr << "--server: serve compile requests on <socket>, other "
+                 "invocations use it when CHA_SERVER=<socket> is set"
+              << std::endl;
     return 1;
   }
 
-  const std::string &format = args[1];
-  const std::string &outputfile = args[2];
-  const std::string &inputfile = args[3];
+  const std::string &format = positional[0];
+  const std::string &outputfile = positional[1];
+  std::vector<std::string> inputfiles(positional.begin() + 2,
+                                      positional.end());
+
+  if (format == "--merge-profile") {
+    return cha::merge_profiles(inputfiles, outputfile);
+  }
 
   cha::CompileFormat compile_format;
   if (format == "-s") {
@@ -35,12 +260,46 @@ int main(int argc, char *argv[]) {
     compile_format = cha::CompileFormat::OBJECT_FILE;
   } else if (format == "-ll") {
     compile_format = cha::CompileFormat::LLVM_IR;
+  } else if (format == "-bc") {
+    compile_format = cha::CompileFormat::BITCODE;
   } else if (format == "-o") {
     compile_format = cha::CompileFormat::BINARY_FILE;
+  } else if (format == "--emit-ast") {
+    compile_format = cha::CompileFormat::AST_FILE;
   } else {
     std::cerr << "invalid format: " << format << std::endl;
     return 1;
   }
 
-  return cha::compile(inputfile, compile_format, outputfile);
+  if (watch) {
+    return cha::watch(inputfiles, compile_format, outputfile, options);
+  }
+  return cha::compile(inputfiles, compile_format, outputfile, options);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  // Convert C-style args to modern C++ vector
+  std::vector<std::string> args(argv, argv + argc);
+
+  if (args.size() == 3 && args[1] == "--server") {
+    return cha::serve(args[2], [&](const std::vector<std::string> &request) {
+      std::vector<std::string> request_args{args[0]};
+      request_args.insert(request_args.end(), request.begin(), request.end());
+      return run(request_args);
+    });
+  }
+
+  // Skip process and LLVM startup when a warm compile server is running
+  const char *server = std::getenv("CHA_SERVER");
+  int exit_code = 0;
+  if (server && *server &&
+      cha::forward_to_server(
+          server, std::vector<std::string>(args.begin() + 1, args.end()),
+          exit_code)) {
+    return exit_code;
+  }
+
+  return run(args);
 }
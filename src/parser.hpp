@@ -2,9 +2,12 @@
 
 #include "ast.hpp"
 
+#include <functional>
+
 namespace cha {
 
-// Main parser function implemented in parser.y - throws ParseException on error
+// Main parser function implemented in parser.y - throws ParseException on
+// error. Threads may call it concurrently, each parse has its own state.
 AstNodeList parse(const char *file);
 
 // Convenience overload for std::string
@@ -12,4 +15,24 @@ inline AstNodeList parse(const std::string &file) {
   return parse(file.c_str());
 }
 
+// Parse a file handing each top-level declaration to declaration as soon as
+// it is reduced, instead of keeping the whole AST - throws ParseException on
+// error, after the declarations before it were handed over. Exceptions
+// thrown by declaration stop the parse.
+void parse(const char *file,
+           const std::function<void(AstNodePtr)> &declaration);
+
+// Parse source text held in memory, e.g. by an editor. file only names the
+// source in locations.
+AstNodeList parse_text(const std::string &text, const std::string &file);
+
+// Parse source text without the bodies of its functions: the scanner skips
+// their balanced braces without building any node, and each function only
+// gets its signature and the range of its body in text
+AstNodeList parse_signatures(const std::string &text, const std::string &file);
+
+// Parse the body of a function returned by parse_signatures() from the same
+// text, with its locations in that text - throws ParseException on error
+void parse_body(FunctionDeclarationNode &function, const std::string &text);
+
 } // namespace cha
@@ -2,27 +2,83 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <functional>
+#include <new>
 
 #include "ast.hpp"
 #include "parser.hpp" 
 #include "exceptions.hpp"
 
 using namespace cha;
-AstNodeList *parsed_ast;
-const char *current_file = nullptr;
 
-extern "C" {
-    int yylex();
-    extern FILE *yyin;
-}
+// Generated sources nest expressions and blocks arbitrarily deep. The parser
+// stack grows on the heap up to this many entries, the build sets it with
+// CHA_PARSER_MAX_DEPTH.
+#ifndef YYMAXDEPTH
+#define YYMAXDEPTH 100000000
+#endif
 %}
 
+%code requires {
+/* The scanner and the parser keep the state of an input in their own
+   objects, so that threads can parse concurrently. Also read by the C
+   scanner. */
+#ifndef YY_TYPEDEF_YY_SCANNER_T
+#define YY_TYPEDEF_YY_SCANNER_T
+typedef void *yyscan_t;
+#endif
+
+struct ScanState {
+  int column;
+  /* Byte offset of the input after the current token */
+  long offset;
+  /* Token returned before the input, e.g. to parse a function body alone */
+  int start_token;
+  /* Skip function bodies, returning SKIPPED_BODY with their range */
+  int skip_bodies;
+  long body_offset;
+  long body_size;
+  int body_line;
+  int body_column;
+  int body_depth;
+  /* Text of the last token when it is an unknown character */
+  const char *invalid_character;
+};
+
+struct ParseContext;
+}
+
+%define api.pure full
 %locations
+%lex-param {yyscan_t scanner}
+%parse-param {yyscan_t scanner} {struct ParseContext *context}
 
 %code{
 # include "ast.hpp"
-AstLocation convert_location(YYLTYPE start, YYLTYPE end);
-int yyerror(const char *msg);
+
+// One parse: the file named in locations, where each top-level declaration
+// goes as soon as it is reduced, and the range of the body the scanner just
+// skipped, until its function takes it
+struct ParseContext {
+  const char *file;
+  const std::function<void(AstNodePtr)> *declaration;
+  SourceRange skipped_body;
+};
+
+extern "C" {
+    int yylex(YYSTYPE *value, YYLTYPE *location, yyscan_t scanner);
+    int yylex_init_extra(struct ScanState *state, yyscan_t *scanner);
+    int yylex_destroy(yyscan_t scanner);
+    struct ScanState *yyget_extra(yyscan_t scanner);
+    void yyrestart(FILE *file, yyscan_t scanner);
+    void yyset_lineno(int line, yyscan_t scanner);
+}
+
+AstLocation convert_location(const ParseContext *context, YYLTYPE start,
+                             YYLTYPE end);
+void take_skipped_body(ParseContext *context, AstNode &function);
+int yyerror(YYLTYPE *location, yyscan_t scanner, ParseContext *context,
+            const char *msg);
 }
 
 %union {
@@ -33,10 +89,11 @@ int yyerror(const char *msg);
 }
 
 %token OPEN_PAR CLOSE_PAR OPEN_CUR CLOSE_CUR COMMA EQUALS PLUS MINUS STAR SLASH EXCLAMATION
-%token KEYWORD_FUN KEYWORD_VAR KEYWORD_RET KEYWORD_INT8 KEYWORD_UINT8 KEYWORD_INT16 KEYWORD_UINT16 KEYWORD_INT32 KEYWORD_UINT32 KEYWORD_INT64 KEYWORD_UINT64 KEYWORD_INT KEYWORD_UINT KEYWORD_FLOAT16 KEYWORD_FLOAT32 KEYWORD_FLOAT64 KEYWORD_BOOL BOOL_TRUE BOOL_FALSE EQUALS_EQUALS NOT_EQUALS GREATER_THAN GREATER_THAN_OR_EQUALS LESS_THAN LESS_THAN_OR_EQUALS AND OR KEYWORD_CONST KEYWORD_IF KEYWORD_ELSE
-%token <str> IDENTIFIER INTEGER UINTEGER FLOAT
+%token KEYWORD_FUN KEYWORD_VAR KEYWORD_RET KEYWORD_INT8 KEYWORD_UINT8 KEYWORD_INT16 KEYWORD_UINT16 KEYWORD_INT32 KEYWORD_UINT32 KEYWORD_INT64 KEYWORD_UINT64 KEYWORD_INT KEYWORD_UINT KEYWORD_FLOAT16 KEYWORD_FLOAT32 KEYWORD_FLOAT64 KEYWORD_BOOL BOOL_TRUE BOOL_FALSE EQUALS_EQUALS NOT_EQUALS GREATER_THAN GREATER_THAN_OR_EQUALS LESS_THAN LESS_THAN_OR_EQUALS AND OR KEYWORD_CONST KEYWORD_IF KEYWORD_ELSE KEYWORD_EXPORT KEYWORD_IMPORT
+%token <str> IDENTIFIER INTEGER UINTEGER FLOAT INVALID_CHARACTER
+%token SKIPPED_BODY BODY_START
 
-%nterm <list> top_level block def_args call_args statements
+%nterm <list> block function_body def_args call_args statements
 %nterm <node> instruction const_definition function statement arg expr const_value
 %nterm <type> reftype
 
@@ -53,53 +110,70 @@ int yyerror(const char *msg);
 %%
 
 parse :
-	top_level																		{ *parsed_ast = std::move(*$1); delete $1; }
+	top_level
+	| BODY_START block																{ for (auto &statement : *$2) { (*context->declaration)(std::move(statement)); } delete $2; }
 	;
 
 top_level :
-	instruction																		{ $$ = new AstNodeList(); $$->push_back(std::move(*$1)); delete $1; }
-	| top_level instruction															{ $$ = $1; $$->push_back(std::move(*$2)); delete $2; }
+	instruction																		{ AstNodePtr node = std::move(*$1); delete $1; (*context->declaration)(std::move(node)); }
+	| top_level instruction															{ AstNodePtr node = std::move(*$2); delete $2; (*context->declaration)(std::move(node)); }
 	;
 
 instruction :
 	const_definition																{ $$ = $1; }
 	| function																		{ $$ = $1; }
+	| KEYWORD_EXPORT function														{ $$ = $2; static_cast<FunctionDeclarationNode &>(**$2).set_exported(true); }
+	| KEYWORD_EXPORT const_definition												{ $$ = $2; static_cast<ConstantDeclarationNode &>(**$2).set_exported(true); }
+	| KEYWORD_IMPORT IDENTIFIER														{ $$ = new AstNodePtr(std::make_unique<ImportNode>(convert_location(context, @1, @2), std::string($2))); }
 	;
 
 const_definition :
-	KEYWORD_CONST IDENTIFIER EQUALS const_value										{ $$ = new AstNodePtr(std::make_unique<ConstantDeclarationNode>(convert_location(@1, @4), std::string($2), std::move(*$4))); delete $4; }
+	KEYWORD_CONST IDENTIFIER EQUALS expr											{ $$ = new AstNodePtr(std::make_unique<ConstantDeclarationNode>(convert_location(context, @1, @4), std::string($2), std::move(*$4))); delete $4; }
 	;
 
 function :
-	KEYWORD_FUN IDENTIFIER OPEN_PAR CLOSE_PAR block									{ 
-		auto void_type = std::make_unique<AstType>(convert_location(@1, @5), AstType::Primitive{PrimitiveType::UNDEF});
+	KEYWORD_FUN IDENTIFIER OPEN_PAR CLOSE_PAR function_body							{ 
+		auto void_type = std::make_unique<AstType>(convert_location(context, @1, @5), AstType::Primitive{PrimitiveType::UNDEF});
 		AstNodeList args;
-		$$ = new AstNodePtr(std::make_unique<FunctionDeclarationNode>(convert_location(@1, @5), std::string($2), std::move(void_type), std::move(args), std::move(*$5))); 
+		$$ = new AstNodePtr(std::make_unique<FunctionDeclarationNode>(convert_location(context, @1, @5), std::string($2), std::move(void_type), std::move(args), std::move(*$5))); 
+		take_skipped_body(context, **$$);
 		delete $5; 
 	}
-	| KEYWORD_FUN IDENTIFIER OPEN_PAR def_args CLOSE_PAR block						{ 
-		auto void_type = std::make_unique<AstType>(convert_location(@1, @6), AstType::Primitive{PrimitiveType::UNDEF});
-		$$ = new AstNodePtr(std::make_unique<FunctionDeclarationNode>(convert_location(@1, @6), std::string($2), std::move(void_type), std::move(*$4), std::move(*$6))); 
+	| KEYWORD_FUN IDENTIFIER OPEN_PAR def_args CLOSE_PAR function_body				{ 
+		auto void_type = std::make_unique<AstType>(convert_location(context, @1, @6), AstType::Primitive{PrimitiveType::UNDEF});
+		$$ = new AstNodePtr(std::make_unique<FunctionDeclarationNode>(convert_location(context, @1, @6), std::string($2), std::move(void_type), std::move(*$4), std::move(*$6))); 
+		take_skipped_body(context, **$$);
 		delete $4; delete $6; 
 	}
-	| KEYWORD_FUN IDENTIFIER OPEN_PAR CLOSE_PAR reftype block						{ 
+	| KEYWORD_FUN IDENTIFIER OPEN_PAR CLOSE_PAR reftype function_body				{ 
 		AstNodeList args;
-		$$ = new AstNodePtr(std::make_unique<FunctionDeclarationNode>(convert_location(@1, @6), std::string($2), std::move(*$5), std::move(args), std::move(*$6))); 
+		$$ = new AstNodePtr(std::make_unique<FunctionDeclarationNode>(convert_location(context, @1, @6), std::string($2), std::move(*$5), std::move(args), std::move(*$6))); 
+		take_skipped_body(context, **$$);
 		delete $5; delete $6; 
 	}
-	| KEYWORD_FUN IDENTIFIER OPEN_PAR def_args CLOSE_PAR reftype block				{ 
-		$$ = new AstNodePtr(std::make_unique<FunctionDeclarationNode>(convert_location(@1, @7), std::string($2), std::move(*$6), std::move(*$4), std::move(*$7))); 
+	| KEYWORD_FUN IDENTIFIER OPEN_PAR def_args CLOSE_PAR reftype function_body		{ 
+		$$ = new AstNodePtr(std::make_unique<FunctionDeclarationNode>(convert_location(context, @1, @7), std::string($2), std::move(*$6), std::move(*$4), std::move(*$7))); 
+		take_skipped_body(context, **$$);
 		delete $4; delete $6; delete $7; 
 	}
 	;
 
+function_body :
+	block																			{ $$ = $1; }
+	| SKIPPED_BODY																	{ 
+		$$ = new AstNodeList();
+		const ScanState *scan = yyget_extra(scanner);
+		context->skipped_body = SourceRange{static_cast<size_t>(scan->body_offset), static_cast<size_t>(scan->body_size), scan->body_line, scan->body_column};
+	}
+	;
+
 block :
 	OPEN_CUR statements CLOSE_CUR													{ $$ = $2; }
 	| OPEN_CUR CLOSE_CUR															{ $$ = new AstNodeList(); }
 	;
 
 arg :
-	IDENTIFIER reftype																{ $$ = new AstNodePtr(std::make_unique<ArgumentNode>(convert_location(@1, @2), std::string($1), std::move(*$2))); delete $2; }
+	IDENTIFIER reftype																{ $$ = new AstNodePtr(std::make_unique<ArgumentNode>(convert_location(context, @1, @2), std::string($1), std::move(*$2))); delete $2; }
 	;
 
 def_args :
@@ -118,60 +192,60 @@ statements :
 	;
 
 statement :
-	KEYWORD_VAR IDENTIFIER reftype													{ $$ = new AstNodePtr(std::make_unique<VariableDeclarationNode>(convert_location(@1, @3), std::string($2), std::move(*$3), nullptr)); delete $3; }
-	| KEYWORD_VAR IDENTIFIER reftype EQUALS expr									{ $$ = new AstNodePtr(std::make_unique<VariableDeclarationNode>(convert_location(@1, @5), std::string($2), std::move(*$3), std::move(*$5))); delete $3; delete $5; }
-	| IDENTIFIER EQUALS expr														{ $$ = new AstNodePtr(std::make_unique<VariableAssignmentNode>(convert_location(@1, @3), std::string($1), std::move(*$3))); delete $3; }
+	KEYWORD_VAR IDENTIFIER reftype													{ $$ = new AstNodePtr(std::make_unique<VariableDeclarationNode>(convert_location(context, @1, @3), std::string($2), std::move(*$3), nullptr)); delete $3; }
+	| KEYWORD_VAR IDENTIFIER reftype EQUALS expr									{ $$ = new AstNodePtr(std::make_unique<VariableDeclarationNode>(convert_location(context, @1, @5), std::string($2), std::move(*$3), std::move(*$5))); delete $3; delete $5; }
+	| IDENTIFIER EQUALS expr														{ $$ = new AstNodePtr(std::make_unique<VariableAssignmentNode>(convert_location(context, @1, @3), std::string($1), std::move(*$3))); delete $3; }
 	| expr																			{ $$ = $1; }
-	| KEYWORD_RET expr																{ $$ = new AstNodePtr(std::make_unique<FunctionReturnNode>(convert_location(@1, @2), std::move(*$2))); delete $2; }
-	| KEYWORD_RET 																	{ $$ = new AstNodePtr(std::make_unique<FunctionReturnNode>(convert_location(@1, @1), nullptr)); }
+	| KEYWORD_RET expr																{ $$ = new AstNodePtr(std::make_unique<FunctionReturnNode>(convert_location(context, @1, @2), std::move(*$2))); delete $2; }
+	| KEYWORD_RET 																	{ $$ = new AstNodePtr(std::make_unique<FunctionReturnNode>(convert_location(context, @1, @1), nullptr)); }
 	| KEYWORD_IF expr block															{ 
 		AstNodeList empty_else;
-		$$ = new AstNodePtr(std::make_unique<IfNode>(convert_location(@1, @3), std::move(*$2), std::move(*$3), std::move(empty_else))); 
+		$$ = new AstNodePtr(std::make_unique<IfNode>(convert_location(context, @1, @3), std::move(*$2), std::move(*$3), std::move(empty_else))); 
 		delete $2; delete $3; 
 	}
-	| KEYWORD_IF expr block KEYWORD_ELSE block										{ $$ = new AstNodePtr(std::make_unique<IfNode>(convert_location(@1, @5), std::move(*$2), std::move(*$3), std::move(*$5))); delete $2; delete $3; delete $5; }
+	| KEYWORD_IF expr block KEYWORD_ELSE block										{ $$ = new AstNodePtr(std::make_unique<IfNode>(convert_location(context, @1, @5), std::move(*$2), std::move(*$3), std::move(*$5))); delete $2; delete $3; delete $5; }
 	;
 
 expr :
 	const_value																		{ $$ = $1; }
-	| IDENTIFIER																	{ $$ = new AstNodePtr(std::make_unique<VariableLookupNode>(convert_location(@1, @1), std::string($1))); }
+	| IDENTIFIER																	{ $$ = new AstNodePtr(std::make_unique<VariableLookupNode>(convert_location(context, @1, @1), std::string($1))); }
 	| IDENTIFIER OPEN_PAR CLOSE_PAR													{ 
 		AstNodeList empty_args;
-		$$ = new AstNodePtr(std::make_unique<FunctionCallNode>(convert_location(@1, @3), std::string($1), std::move(empty_args))); 
+		$$ = new AstNodePtr(std::make_unique<FunctionCallNode>(convert_location(context, @1, @3), std::string($1), std::move(empty_args))); 
 	}
-	| IDENTIFIER OPEN_PAR call_args CLOSE_PAR										{ $$ = new AstNodePtr(std::make_unique<FunctionCallNode>(convert_location(@1, @4), std::string($1), std::move(*$3))); delete $3; }
-	| expr PLUS expr																{ $$ = new AstNodePtr(std::make_unique<BinaryOpNode>(convert_location(@1, @3), BinaryOperator::PLUS, std::move(*$1), std::move(*$3))); delete $1; delete $3; }
-	| expr MINUS expr																{ $$ = new AstNodePtr(std::make_unique<BinaryOpNode>(convert_location(@1, @3), BinaryOperator::MINUS, std::move(*$1), std::move(*$3))); delete $1; delete $3; }
-	| expr STAR expr																{ $$ = new AstNodePtr(std::make_unique<BinaryOpNode>(convert_location(@1, @3), BinaryOperator::STAR, std::move(*$1), std::move(*$3))); delete $1; delete $3; }
-	| expr SLASH expr																{ $$ = new AstNodePtr(std::make_unique<BinaryOpNode>(convert_location(@1, @3), BinaryOperator::SLASH, std::move(*$1), std::move(*$3))); delete $1; delete $3; }
-	| expr EQUALS_EQUALS expr														{ $$ = new AstNodePtr(std::make_unique<BinaryOpNode>(convert_location(@1, @3), BinaryOperator::EQUALS_EQUALS, std::move(*$1), std::move(*$3))); delete $1; delete $3; }
-	| expr NOT_EQUALS expr															{ $$ = new AstNodePtr(std::make_unique<BinaryOpNode>(convert_location(@1, @3), BinaryOperator::NOT_EQUALS, std::move(*$1), std::move(*$3))); delete $1; delete $3; }
-	| expr GREATER_THAN expr														{ $$ = new AstNodePtr(std::make_unique<BinaryOpNode>(convert_location(@1, @3), BinaryOperator::GREATER_THAN, std::move(*$1), std::move(*$3))); delete $1; delete $3; }
-	| expr GREATER_THAN_OR_EQUALS expr												{ $$ = new AstNodePtr(std::make_unique<BinaryOpNode>(convert_location(@1, @3), BinaryOperator::GREATER_THAN_OR_EQUALS, std::move(*$1), std::move(*$3))); delete $1; delete $3; }
-	| expr LESS_THAN expr															{ $$ = new AstNodePtr(std::make_unique<BinaryOpNode>(convert_location(@1, @3), BinaryOperator::LESS_THAN, std::move(*$1), std::move(*$3))); delete $1; delete $3; }
-	| expr LESS_THAN_OR_EQUALS expr													{ $$ = new AstNodePtr(std::make_unique<BinaryOpNode>(convert_location(@1, @3), BinaryOperator::LESS_THAN_OR_EQUALS, std::move(*$1), std::move(*$3))); delete $1; delete $3; }
-	| expr AND expr																	{ $$ = new AstNodePtr(std::make_unique<BinaryOpNode>(convert_location(@1, @3), BinaryOperator::AND, std::move(*$1), std::move(*$3))); delete $1; delete $3; }
-	| expr OR expr																	{ $$ = new AstNodePtr(std::make_unique<BinaryOpNode>(convert_location(@1, @3), BinaryOperator::OR, std::move(*$1), std::move(*$3))); delete $1; delete $3; }
-	| EXCLAMATION expr %prec UNOT															{ $$ = new AstNodePtr(std::make_unique<UnaryOpNode>(convert_location(@1, @2), UnaryOperator::NOT, std::move(*$2))); delete $2; }
-	| MINUS expr %prec UMINUS															{ $$ = new AstNodePtr(std::make_unique<UnaryOpNode>(convert_location(@1, @2), UnaryOperator::NEGATE, std::move(*$2))); delete $2; }
+	| IDENTIFIER OPEN_PAR call_args CLOSE_PAR										{ $$ = new AstNodePtr(std::make_unique<FunctionCallNode>(convert_location(context, @1, @4), std::string($1), std::move(*$3))); delete $3; }
+	| expr PLUS expr																{ $$ = new AstNodePtr(std::make_unique<BinaryOpNode>(convert_location(context, @1, @3), BinaryOperator::PLUS, std::move(*$1), std::move(*$3))); delete $1; delete $3; }
+	| expr MINUS expr																{ $$ = new AstNodePtr(std::make_unique<BinaryOpNode>(convert_location(context, @1, @3), BinaryOperator::MINUS, std::move(*$1), std::move(*$3))); delete $1; delete $3; }
+	| expr STAR expr																{ $$ = new AstNodePtr(std::make_unique<BinaryOpNode>(convert_location(context, @1, @3), BinaryOperator::STAR, std::move(*$1), std::move(*$3))); delete $1; delete $3; }
+	| expr SLASH expr																{ $$ = new AstNodePtr(std::make_unique<BinaryOpNode>(convert_location(context, @1, @3), BinaryOperator::SLASH, std::move(*$1), std::move(*$3))); delete $1; delete $3; }
+	| expr EQUALS_EQUALS expr														{ $$ = new AstNodePtr(std::make_unique<BinaryOpNode>(convert_location(context, @1, @3), BinaryOperator::EQUALS_EQUALS, std::move(*$1), std::move(*$3))); delete $1; delete $3; }
+	| expr NOT_EQUALS expr															{ $$ = new AstNodePtr(std::make_unique<BinaryOpNode>(convert_location(context, @1, @3), BinaryOperator::NOT_EQUALS, std::move(*$1), std::move(*$3))); delete $1; delete $3; }
+	| expr GREATER_THAN expr														{ $$ = new AstNodePtr(std::make_unique<BinaryOpNode>(convert_location(context, @1, @3), BinaryOperator::GREATER_THAN, std::move(*$1), std::move(*$3))); delete $1; delete $3; }
+	| expr GREATER_THAN_OR_EQUALS expr												{ $$ = new AstNodePtr(std::make_unique<BinaryOpNode>(convert_location(context, @1, @3), BinaryOperator::GREATER_THAN_OR_EQUALS, std::move(*$1), std::move(*$3))); delete $1; delete $3; }
+	| expr LESS_THAN expr															{ $$ = new AstNodePtr(std::make_unique<BinaryOpNode>(convert_location(context, @1, @3), BinaryOperator::LESS_THAN, std::move(*$1), std::move(*$3))); delete $1; delete $3; }
+	| expr LESS_THAN_OR_EQUALS expr													{ $$ = new AstNodePtr(std::make_unique<BinaryOpNode>(convert_location(context, @1, @3), BinaryOperator::LESS_THAN_OR_EQUALS, std::move(*$1), std::move(*$3))); delete $1; delete $3; }
+	| expr AND expr																	{ $$ = new AstNodePtr(std::make_unique<BinaryOpNode>(convert_location(context, @1, @3), BinaryOperator::AND, std::move(*$1), std::move(*$3))); delete $1; delete $3; }
+	| expr OR expr																	{ $$ = new AstNodePtr(std::make_unique<BinaryOpNode>(convert_location(context, @1, @3), BinaryOperator::OR, std::move(*$1), std::move(*$3))); delete $1; delete $3; }
+	| EXCLAMATION expr %prec UNOT															{ $$ = new AstNodePtr(std::make_unique<UnaryOpNode>(convert_location(context, @1, @2), UnaryOperator::NOT, std::move(*$2))); delete $2; }
+	| MINUS expr %prec UMINUS															{ $$ = new AstNodePtr(std::make_unique<UnaryOpNode>(convert_location(context, @1, @2), UnaryOperator::NEGATE, std::move(*$2))); delete $2; }
 	| OPEN_PAR expr CLOSE_PAR														{ $$ = $2; }
 	;
 
 reftype :
-	KEYWORD_INT																		{ $$ = new AstTypePtr(std::make_unique<AstType>(convert_location(@1, @1), AstType::Primitive{PrimitiveType::INT})); }
-	| KEYWORD_UINT																	{ $$ = new AstTypePtr(std::make_unique<AstType>(convert_location(@1, @1), AstType::Primitive{PrimitiveType::UINT})); }
-	| KEYWORD_INT8																	{ $$ = new AstTypePtr(std::make_unique<AstType>(convert_location(@1, @1), AstType::Primitive{PrimitiveType::INT8})); }
-	| KEYWORD_UINT8																	{ $$ = new AstTypePtr(std::make_unique<AstType>(convert_location(@1, @1), AstType::Primitive{PrimitiveType::UINT8})); }
-	| KEYWORD_INT16																	{ $$ = new AstTypePtr(std::make_unique<AstType>(convert_location(@1, @1), AstType::Primitive{PrimitiveType::INT16})); }
-	| KEYWORD_UINT16																{ $$ = new AstTypePtr(std::make_unique<AstType>(convert_location(@1, @1), AstType::Primitive{PrimitiveType::UINT16})); }
-	| KEYWORD_INT32																	{ $$ = new AstTypePtr(std::make_unique<AstType>(convert_location(@1, @1), AstType::Primitive{PrimitiveType::INT32})); }
-	| KEYWORD_UINT32																{ $$ = new AstTypePtr(std::make_unique<AstType>(convert_location(@1, @1), AstType::Primitive{PrimitiveType::UINT32})); }
-	| KEYWORD_INT64																	{ $$ = new AstTypePtr(std::make_unique<AstType>(convert_location(@1, @1), AstType::Primitive{PrimitiveType::INT64})); }
-	| KEYWORD_UINT64																{ $$ = new AstTypePtr(std::make_unique<AstType>(convert_location(@1, @1), AstType::Primitive{PrimitiveType::UINT64})); }
-	| KEYWORD_FLOAT16																{ $$ = new AstTypePtr(std::make_unique<AstType>(convert_location(@1, @1), AstType::Primitive{PrimitiveType::FLOAT16})); }
-	| KEYWORD_FLOAT32																{ $$ = new AstTypePtr(std::make_unique<AstType>(convert_location(@1, @1), AstType::Primitive{PrimitiveType::FLOAT32})); }
-	| KEYWORD_FLOAT64																{ $$ = new AstTypePtr(std::make_unique<AstType>(convert_location(@1, @1), AstType::Primitive{PrimitiveType::FLOAT64})); }
-	| KEYWORD_BOOL																	{ $$ = new AstTypePtr(std::make_unique<AstType>(convert_location(@1, @1), AstType::Primitive{PrimitiveType::BOOL})); }
+	KEYWORD_INT																		{ $$ = new AstTypePtr(std::make_unique<AstType>(convert_location(context, @1, @1), AstType::Primitive{PrimitiveType::INT})); }
+	| KEYWORD_UINT																	{ $$ = new AstTypePtr(std::make_unique<AstType>(convert_location(context, @1, @1), AstType::Primitive{PrimitiveType::UINT})); }
+	| KEYWORD_INT8																	{ $$ = new AstTypePtr(std::make_unique<AstType>(convert_location(context, @1, @1), AstType::Primitive{PrimitiveType::INT8})); }
+	| KEYWORD_UINT8																	{ $$ = new AstTypePtr(std::make_unique<AstType>(convert_location(context, @1, @1), AstType::Primitive{PrimitiveType::UINT8})); }
+	| KEYWORD_INT16																	{ $$ = new AstTypePtr(std::make_unique<AstType>(convert_location(context, @1, @1), AstType::Primitive{PrimitiveType::INT16})); }
+	| KEYWORD_UINT16																{ $$ = new AstTypePtr(std::make_unique<AstType>(convert_location(context, @1, @1), AstType::Primitive{PrimitiveType::UINT16})); }
+	| KEYWORD_INT32																	{ $$ = new AstTypePtr(std::make_unique<AstType>(convert_location(context, @1, @1), AstType::Primitive{PrimitiveType::INT32})); }
+	| KEYWORD_UINT32																{ $$ = new AstTypePtr(std::make_unique<AstType>(convert_location(context, @1, @1), AstType::Primitive{PrimitiveType::UINT32})); }
+	| KEYWORD_INT64																	{ $$ = new AstTypePtr(std::make_unique<AstType>(convert_location(context, @1, @1), AstType::Primitive{PrimitiveType::INT64})); }
+	| KEYWORD_UINT64																{ $$ = new AstTypePtr(std::make_unique<AstType>(convert_location(context, @1, @1), AstType::Primitive{PrimitiveType::UINT64})); }
+	| KEYWORD_FLOAT16																{ $$ = new AstTypePtr(std::make_unique<AstType>(convert_location(context, @1, @1), AstType::Primitive{PrimitiveType::FLOAT16})); }
+	| KEYWORD_FLOAT32																{ $$ = new AstTypePtr(std::make_unique<AstType>(convert_location(context, @1, @1), AstType::Primitive{PrimitiveType::FLOAT32})); }
+	| KEYWORD_FLOAT64																{ $$ = new AstTypePtr(std::make_unique<AstType>(convert_location(context, @1, @1), AstType::Primitive{PrimitiveType::FLOAT64})); }
+	| KEYWORD_BOOL																	{ $$ = new AstTypePtr(std::make_unique<AstType>(convert_location(context, @1, @1), AstType::Primitive{PrimitiveType::BOOL})); }
 	;
 
 const_value :
@@ -179,9 +253,9 @@ const_value :
 		char *endptr;
 		long long value = strtoll($1, &endptr, 0);
 		if (*endptr != '\0' || endptr == $1) {
-			throw ParseException(convert_location(@1, @1), "Invalid integer literal: " + std::string($1));
+			throw ParseException(convert_location(context, @1, @1), "Invalid integer literal: " + std::string($1));
 		}
-		$$ = new AstNodePtr(std::make_unique<ConstantIntegerNode>(convert_location(@1, @1), value)); 
+		$$ = new AstNodePtr(std::make_unique<ConstantIntegerNode>(convert_location(context, @1, @1), value)); 
 	}
 	| UINTEGER																		{ 
 		// Remove the 'u' suffix before parsing
@@ -193,29 +267,28 @@ const_value :
 		char *endptr;
 		unsigned long long value = strtoull(str_value.c_str(), &endptr, 0);
 		if (*endptr != '\0' || endptr == str_value.c_str()) {
-			throw ParseException(convert_location(@1, @1), "Invalid unsigned integer literal: " + std::string($1));
+			throw ParseException(convert_location(context, @1, @1), "Invalid unsigned integer literal: " + std::string($1));
 		}
-		$$ = new AstNodePtr(std::make_unique<ConstantUnsignedIntegerNode>(convert_location(@1, @1), value)); 
+		$$ = new AstNodePtr(std::make_unique<ConstantUnsignedIntegerNode>(convert_location(context, @1, @1), value)); 
 	}
 	| FLOAT																			{ 
 		char *endptr;
 		double value = strtod($1, &endptr);
 		if (*endptr != '\0' || endptr == $1) {
-			throw ParseException(convert_location(@1, @1), "Invalid float literal: " + std::string($1));
+			throw ParseException(convert_location(context, @1, @1), "Invalid float literal: " + std::string($1));
 		}
-		$$ = new AstNodePtr(std::make_unique<ConstantFloatNode>(convert_location(@1, @1), value)); 
+		$$ = new AstNodePtr(std::make_unique<ConstantFloatNode>(convert_location(context, @1, @1), value)); 
 	}
-	| BOOL_TRUE																		{ $$ = new AstNodePtr(std::make_unique<ConstantBoolNode>(convert_location(@1, @1), true)); }
-	| BOOL_FALSE																	{ $$ = new AstNodePtr(std::make_unique<ConstantBoolNode>(convert_location(@1, @1), false)); }
+	| BOOL_TRUE																		{ $$ = new AstNodePtr(std::make_unique<ConstantBoolNode>(convert_location(context, @1, @1), true)); }
+	| BOOL_FALSE																	{ $$ = new AstNodePtr(std::make_unique<ConstantBoolNode>(convert_location(context, @1, @1), false)); }
 	;
 
 %%
 
-// yyerror is already defined in the header section above
-
-AstLocation convert_location(YYLTYPE start, YYLTYPE end) {
+AstLocation convert_location(const ParseContext *context, YYLTYPE start,
+                             YYLTYPE end) {
   return AstLocation(
-    current_file ? std::string(current_file) : std::string(""),
+    context->file ? std::string(context->file) : std::string(""),
     start.first_line,
     start.first_column,
     end.last_line,
@@ -223,16 +296,111 @@ AstLocation convert_location(YYLTYPE start, YYLTYPE end) {
   );
 }
 
-int yyerror(const char *msg) {
-  AstLocation location = convert_location(yylloc, yylloc);
-  throw ParseException(location, std::string(msg));
+void take_skipped_body(ParseContext *context, AstNode &function) {
+  static_cast<FunctionDeclarationNode &>(function).skip_body(
+      context->skipped_body);
+  context->skipped_body = SourceRange();
+}
+
+int yyerror(YYLTYPE *location, yyscan_t scanner, ParseContext *context,
+            const char *msg) {
+  AstLocation where = convert_location(context, *location, *location);
+  if (const char *invalid = yyget_extra(scanner)->invalid_character) {
+    throw ParseException(where, std::string("unexpected character '") +
+                                    invalid + "'");
+  }
+  throw ParseException(where, std::string(msg));
 }
 
 // Main parser function (C++ interface)
 namespace cha {
 
+namespace {
+
+// Scanner of one input, destroyed however its parse ends
+class Scanner {
+public:
+  explicit Scanner(ScanState &state) {
+    if (yylex_init_extra(&state, &scanner_) != 0) {
+      throw std::bad_alloc();
+    }
+  }
+  ~Scanner() { yylex_destroy(scanner_); }
+
+  Scanner(const Scanner &) = delete;
+  Scanner &operator=(const Scanner &) = delete;
+
+  operator yyscan_t() const { return scanner_; }
+
+private:
+  yyscan_t scanner_ = nullptr;
+};
+
+// Parse an open file or memory stream, which is closed afterwards. With
+// skip the function bodies are skipped, with body the stream only holds the
+// body skipped at that range, whose statements are handed to declaration.
+void parse_stream(FILE *f, const char *file,
+                  const std::function<void(AstNodePtr)> &declaration,
+                  bool skip = false, const SourceRange *body = nullptr) {
+  // Each parse has its own scanner and parser state, so that threads do not
+  // wait for each other, e.g. while a stream waits for its consumer
+  ScanState state = {};
+  state.column = body ? body->column : 1;
+  state.offset = body ? static_cast<long>(body->offset) : 0;
+  state.start_token = body ? BODY_START : 0;
+  state.skip_bodies = skip;
+  ParseContext context{file, &declaration, SourceRange()};
+
+  int ret;
+  try {
+    Scanner scanner(state);
+    yyrestart(f, scanner);
+    yyset_lineno(body ? body->line : 1, scanner);
+    ret = yyparse(scanner, &context);
+  } catch (...) {
+    // Clean up and re-throw
+    fclose(f);
+    throw;
+  }
+  fclose(f);
+  if (ret != 0) {
+    throw ParseException(
+      AstLocation(std::string(file), 1, 1, 1, 1),
+      "Parse failed"
+    );
+  }
+}
+
+// Collects the declarations of a whole source
+struct AstCollector {
+  AstNodeList &ast;
+  void operator()(AstNodePtr node) { ast.push_back(std::move(node)); }
+};
+
+// Open source text as a stream for parse_stream()
+FILE *open_text(const std::string &text, const std::string &file) {
+  // fmemopen rejects empty buffers, a lone newline parses the same
+  static const char empty[] = "\n";
+  FILE *f = text.empty()
+                ? fmemopen(const_cast<char *>(empty), 1, "r")
+                : fmemopen(const_cast<char *>(text.data()), text.size(), "r");
+  if (f == NULL) {
+    throw ParseException(AstLocation(file, 1, 1, 1, 1),
+                         std::string("Could not read source text"));
+  }
+  return f;
+}
+
+} // namespace
+
 AstNodeList parse(const char *file) {
-  current_file = file;
+  AstNodeList ast;
+  parse(file, AstCollector{ast});
+  return ast;
+}
+
+void parse(const char *file,
+           const std::function<void(AstNodePtr)> &declaration) {
   FILE *f = fopen(file, "r");
   if (f == NULL) {
     throw ParseException(
@@ -240,33 +408,42 @@ AstNodeList parse(const char *file) {
       std::string("Could not open file")
     );
   }
+  parse_stream(f, file, declaration);
+}
 
-  AstNodeList result;
-  yyin = f;
-  parsed_ast = &result;
-  
-  try {
-    int ret = yyparse();
-    fclose(f);
-    
-    current_file = nullptr;
-    parsed_ast = nullptr;
-    
-    if (ret != 0) {
-      throw ParseException(
-        AstLocation(std::string(file), 1, 1, 1, 1),
-        "Parse failed"
-      );
-    }
-    
-    return result;
-  } catch (...) {
-    // Clean up and re-throw
-    fclose(f);
-    current_file = nullptr;
-    parsed_ast = nullptr;
-    throw;
+AstNodeList parse_text(const std::string &text, const std::string &file) {
+  AstNodeList ast;
+  parse_stream(open_text(text, file), file.c_str(), AstCollector{ast});
+  return ast;
+}
+
+AstNodeList parse_signatures(const std::string &text,
+                             const std::string &file) {
+  AstNodeList ast;
+  parse_stream(open_text(text, file), file.c_str(), AstCollector{ast}, true);
+  return ast;
+}
+
+void parse_body(FunctionDeclarationNode &function, const std::string &text) {
+  if (!function.body_skipped()) {
+    return;
+  }
+  SourceRange range = function.skipped_body();
+  const std::string &file = function.location().file;
+  if (range.offset + range.size > text.size()) {
+    throw ParseException(function.location(),
+                         "body of '" + function.identifier() +
+                             "' is past the end of the source text");
+  }
+  FILE *f = fmemopen(const_cast<char *>(text.data() + range.offset),
+                     range.size, "r");
+  if (f == NULL) {
+    throw ParseException(function.location(),
+                         std::string("Could not read source text"));
   }
+  AstNodeList body;
+  parse_stream(f, file.c_str(), AstCollector{body}, false, &range);
+  function.set_body(std::move(body));
 }
 
 } // namespace cha
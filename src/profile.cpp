@@ -0,0 +1,56 @@
+#include "profile.hpp"
+
+#include <llvm/ProfileData/InstrProfReader.h>
+#include <llvm/ProfileData/InstrProfWriter.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/VirtualFileSystem.h>
+#include <llvm/Support/raw_ostream.h>
+
+namespace cha {
+
+void write_indexed_profile(const std::vector<std::string> &input_files,
+                           const std::string &output_file) {
+  auto fs = llvm::vfs::getRealFileSystem();
+  llvm::InstrProfWriter writer;
+
+  for (const auto &file : input_files) {
+    auto reader = llvm::InstrProfReader::create(file, *fs);
+    if (!reader) {
+      throw ProfileException(file, llvm::toString(reader.takeError()));
+    }
+
+    // Raw profiles of one program all have the same kind, mixing frontend
+    // and IR profiles is an error
+    llvm::Error kind_error =
+        writer.mergeProfileKind((*reader)->getProfileKind());
+    if (kind_error) {
+      throw ProfileException(file, llvm::toString(std::move(kind_error)));
+    }
+
+    std::string merge_error;
+    for (auto &record : **reader) {
+      writer.addRecord(std::move(record), 1, [&](llvm::Error err) {
+        merge_error = llvm::toString(std::move(err));
+      });
+      if (!merge_error.empty()) {
+        throw ProfileException(file, merge_error);
+      }
+    }
+
+    if ((*reader)->hasError()) {
+      throw ProfileException(file, llvm::toString((*reader)->getError()));
+    }
+  }
+
+  std::error_code ec;
+  llvm::raw_fd_ostream dest(output_file, ec, llvm::sys::fs::OF_None);
+  if (ec) {
+    throw ProfileException(output_file, "could not open file: " + ec.message());
+  }
+  if (llvm::Error err = writer.write(dest)) {
+    throw ProfileException(output_file, llvm::toString(std::move(err)));
+  }
+}
+
+} // namespace cha
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "exceptions.hpp"
+
+#include <string>
+#include <vector>
+
+namespace cha {
+
+// Merge raw (.profraw) or indexed (.profdata) instrumentation profiles into a
+// single indexed profile usable with --profile-use - throws ProfileException
+// on error
+void write_indexed_profile(const std::vector<std::string> &input_files,
+                           const std::string &output_file);
+
+} // namespace cha
@@ -0,0 +1,780 @@
+#include "serialize.hpp"
+#include "exceptions.hpp"
+
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+
+namespace cha {
+
+namespace {
+
+// File layout:
+//   FileHeader | NodeRecord[node_count] | TypeRecord[type_count] | strings
+//
+// Every record has a fixed size and natural alignment so a mapped file can be
+// walked in place. Nodes are stored in pre-order, each one followed by the
+// children of its lists. Multi-byte fields use host byte order, which is
+// checked through the byte order marker in the header.
+constexpr char AST_MAGIC[4] = {'C', 'H', 'A', 'A'};
+constexpr uint32_t AST_BYTE_ORDER = 0x01020304;
+constexpr uint32_t NONE = 0xFFFFFFFF;
+
+enum class NodeKind : uint8_t {
+  CONSTANT_INTEGER,
+  CONSTANT_UNSIGNED_INTEGER,
+  CONSTANT_FLOAT,
+  CONSTANT_BOOL,
+  BINARY_OP,
+  UNARY_OP,
+  VARIABLE_DECLARATION,
+  VARIABLE_ASSIGNMENT,
+  VARIABLE_LOOKUP,
+  ARGUMENT,
+  BLOCK,
+  FUNCTION_DECLARATION,
+  FUNCTION_CALL,
+  FUNCTION_RETURN,
+  IF,
+  CONSTANT_DECLARATION,
+  IMPORT
+};
+
+enum class TypeKind : uint8_t { PRIMITIVE, ARRAY, IDENTIFIER };
+
+struct FileHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t root_count;
+  uint32_t node_count;
+  uint32_t type_count;
+  uint32_t string_size;
+  uint32_t reserved;
+};
+
+struct LocationRecord {
+  uint32_t file;
+  int32_t line_begin;
+  int32_t column_begin;
+  int32_t line_end;
+  int32_t column_end;
+};
+
+struct NodeRecord {
+  uint8_t kind;
+  uint8_t op;
+  uint16_t reserved;
+  uint32_t name;
+  uint32_t result_type;
+  uint32_t declared_type;
+  uint32_t list_sizes[3];
+  LocationRecord location;
+  uint64_t value;
+};
+
+struct TypeRecord {
+  uint8_t kind;
+  int8_t primitive;
+  uint16_t reserved;
+  uint32_t name;
+  uint32_t element_type;
+  int32_t size;
+  LocationRecord location;
+};
+
+static_assert(sizeof(FileHeader) == 32, "unexpected FileHeader layout");
+static_assert(sizeof(NodeRecord) == 56, "unexpected NodeRecord layout");
+static_assert(sizeof(TypeRecord) == 36, "unexpected TypeRecord layout");
+
+// Serializer walks the AST with the visitor pattern and appends one record
+// per node. Generated sources nest arbitrarily deep, so visits only collect
+// the children of a node and the walk keeps its own stack of pending nodes.
+class AstSerializer : public AstVisitor {
+public:
+  std::vector<char> serialize(const AstNodeList &ast);
+
+  void visit(const ConstantIntegerNode &node) override;
+  void visit(const ConstantUnsignedIntegerNode &node) override;
+  void visit(const ConstantFloatNode &node) override;
+  void visit(const ConstantBoolNode &node) override;
+  void visit(const BinaryOpNode &node) override;
+  void visit(const UnaryOpNode &node) override;
+  void visit(const VariableDeclarationNode &node) override;
+  void visit(const VariableAssignmentNode &node) override;
+  void visit(const VariableLookupNode &node) override;
+  void visit(const ArgumentNode &node) override;
+  void visit(const BlockNode &node) override;
+  void visit(const FunctionDeclarationNode &node) override;
+  void visit(const FunctionCallNode &node) override;
+  void visit(const FunctionReturnNode &node) override;
+  void visit(const IfNode &node) override;
+  void visit(const ConstantDeclarationNode &node) override;
+  void visit(const ImportNode &node) override;
+
+private:
+  std::vector<NodeRecord> nodes_;
+  std::vector<TypeRecord> types_;
+  std::string strings_;
+  std::unordered_map<std::string, uint32_t> string_offsets_;
+  // Nodes waiting to be written, and the children of the node being visited
+  std::vector<const AstNode *> pending_;
+  std::vector<const AstNode *> children_;
+
+  void walk(const AstNode &root);
+  size_t add_node(const AstNode &node, NodeKind kind);
+  void add_list(size_t index, int slot, const AstNodeList &list);
+  void add_child(size_t index, int slot, const AstNode *child);
+  uint32_t add_type(const AstType *type);
+  uint32_t add_string(const std::string &value);
+  LocationRecord make_location(const AstLocation &location);
+};
+
+std::vector<char> AstSerializer::serialize(const AstNodeList &ast) {
+  for (const auto &node : ast) {
+    walk(*node);
+  }
+
+  FileHeader header{};
+  std::memcpy(header.magic, AST_MAGIC, sizeof(header.magic));
+  header.version = AST_FORMAT_VERSION;
+  header.byte_order = AST_BYTE_ORDER;
+  header.root_count = static_cast<uint32_t>(ast.size());
+  header.node_count = static_cast<uint32_t>(nodes_.size());
+  header.type_count = static_cast<uint32_t>(types_.size());
+  header.string_size = static_cast<uint32_t>(strings_.size());
+
+  size_t nodes_size = nodes_.size() * sizeof(NodeRecord);
+  size_t types_size = types_.size() * sizeof(TypeRecord);
+  std::vector<char> buffer(sizeof(FileHeader) + nodes_size + types_size +
+                           strings_.size());
+
+  char *out = buffer.data();
+  std::memcpy(out, &header, sizeof(FileHeader));
+  out += sizeof(FileHeader);
+  if (nodes_size) {
+    std::memcpy(out, nodes_.data(), nodes_size);
+    out += nodes_size;
+  }
+  if (types_size) {
+    std::memcpy(out, types_.data(), types_size);
+    out += types_size;
+  }
+  if (!strings_.empty()) {
+    std::memcpy(out, strings_.data(), strings_.size());
+  }
+  return buffer;
+}
+
+void AstSerializer::walk(const AstNode &root) {
+  // Children go on the stack last first, so they are written in pre-order
+  pending_.push_back(&root);
+  while (!pending_.empty()) {
+    const AstNode *node = pending_.back();
+    pending_.pop_back();
+    node->accept(*this);
+    pending_.insert(pending_.end(), children_.rbegin(), children_.rend());
+    children_.clear();
+  }
+}
+
+size_t AstSerializer::add_node(const AstNode &node, NodeKind kind) {
+  NodeRecord record{};
+  record.kind = static_cast<uint8_t>(kind);
+  record.name = NONE;
+  record.declared_type = NONE;
+  record.result_type = add_type(node.result_type());
+  record.location = make_location(node.location());
+  nodes_.push_back(record);
+  return nodes_.size() - 1;
+}
+
+void AstSerializer::add_list(size_t index, int slot, const AstNodeList &list) {
+  nodes_[index].list_sizes[slot] = static_cast<uint32_t>(list.size());
+  for (const auto &child : list) {
+    children_.push_back(child.get());
+  }
+}
+
+void AstSerializer::add_child(size_t index, int slot, const AstNode *child) {
+  if (child) {
+    nodes_[index].list_sizes[slot] = 1;
+    children_.push_back(child);
+  }
+}
+
+uint32_t AstSerializer::add_type(const AstType *type) {
+  if (!type) {
+    return NONE;
+  }
+
+  TypeRecord record{};
+  record.name = NONE;
+  record.element_type = NONE;
+  record.location = make_location(type->location());
+
+  if (type->is_primitive()) {
+    record.kind = static_cast<uint8_t>(TypeKind::PRIMITIVE);
+    record.primitive = static_cast<int8_t>(type->as_primitive().type);
+  } else if (type->is_array()) {
+    // Element types are written first so indices always point backwards
+    record.kind = static_cast<uint8_t>(TypeKind::ARRAY);
+    record.element_type = add_type(type->as_array().element_type.get());
+    record.size = type->as_array().size;
+  } else {
+    record.kind = static_cast<uint8_t>(TypeKind::IDENTIFIER);
+    record.name = add_string(type->as_identifier().name);
+  }
+
+  types_.push_back(record);
+  return static_cast<uint32_t>(types_.size() - 1);
+}
+
+uint32_t AstSerializer::add_string(const std::string &value) {
+  auto it = string_offsets_.find(value);
+  if (it != string_offsets_.end()) {
+    return it->second;
+  }
+
+  // Strings are stored as a 32-bit length followed by the characters
+  uint32_t offset = static_cast<uint32_t>(strings_.size());
+  uint32_t length = static_cast<uint32_t>(value.size());
+  strings_.append(reinterpret_cast<const char *>(&length), sizeof(length));
+  strings_.append(value);
+  string_offsets_.emplace(value, offset);
+  return offset;
+}
+
+LocationRecord AstSerializer::make_location(const AstLocation &location) {
+  LocationRecord record;
+  record.file = add_string(location.file);
+  record.line_begin = location.line_begin;
+  record.column_begin = location.column_begin;
+  record.line_end = location.line_end;
+  record.column_end = location.column_end;
+  return record;
+}
+
+void AstSerializer::visit(const ConstantIntegerNode &node) {
+  size_t index = add_node(node, NodeKind::CONSTANT_INTEGER);
+  long long value = node.value();
+  std::memcpy(&nodes_[index].value, &value, sizeof(value));
+}
+
+void AstSerializer::visit(const ConstantUnsignedIntegerNode &node) {
+  size_t index = add_node(node, NodeKind::CONSTANT_UNSIGNED_INTEGER);
+  nodes_[index].value = node.value();
+}
+
+void AstSerializer::visit(const ConstantFloatNode &node) {
+  size_t index = add_node(node, NodeKind::CONSTANT_FLOAT);
+  double value = node.value();
+  std::memcpy(&nodes_[index].value, &value, sizeof(value));
+}
+
+void AstSerializer::visit(const ConstantBoolNode &node) {
+  size_t index = add_node(node, NodeKind::CONSTANT_BOOL);
+  nodes_[index].value = node.value() ? 1 : 0;
+}
+
+void AstSerializer::visit(const BinaryOpNode &node) {
+  size_t index = add_node(node, NodeKind::BINARY_OP);
+  nodes_[index].op = static_cast<uint8_t>(node.op());
+  nodes_[index].list_sizes[0] = 2;
+  children_.push_back(&node.left());
+  children_.push_back(&node.right());
+}
+
+void AstSerializer::visit(const UnaryOpNode &node) {
+  size_t index = add_node(node, NodeKind::UNARY_OP);
+  nodes_[index].op = static_cast<uint8_t>(node.op());
+  add_child(index, 0, &node.operand());
+}
+
+void AstSerializer::visit(const VariableDeclarationNode &node) {
+  size_t index = add_node(node, NodeKind::VARIABLE_DECLARATION);
+  nodes_[index].name = add_string(node.identifier());
+  nodes_[index].declared_type = add_type(&node.type());
+  add_child(index, 0, node.value());
+}
+
+void AstSerializer::visit(const VariableAssignmentNode &node) {
+  size_t index = add_node(node, NodeKind::VARIABLE_ASSIGNMENT);
+  nodes_[index].name = add_string(node.identifier());
+  add_child(index, 0, &node.value());
+}
+
+void AstSerializer::visit(const VariableLookupNode &node) {
+  size_t index = add_node(node, NodeKind::VARIABLE_LOOKUP);
+  nodes_[index].name = add_string(node.identifier());
+}
+
+void AstSerializer::visit(const ArgumentNode &node) {
+  size_t index = add_node(node, NodeKind::ARGUMENT);
+  nodes_[index].name = add_string(node.identifier());
+  nodes_[index].declared_type = add_type(&node.type());
+}
+
+void AstSerializer::visit(const BlockNode &node) {
+  size_t index = add_node(node, NodeKind::BLOCK);
+  add_list(index, 0, node.statements());
+}
+
+void AstSerializer::visit(const FunctionDeclarationNode &node) {
+  size_t index = add_node(node, NodeKind::FUNCTION_DECLARATION);
+  // Functions have no operator, the field holds the exported flag
+  nodes_[index].op = node.exported();
+  nodes_[index].name = add_string(node.identifier());
+  nodes_[index].declared_type = add_type(&node.return_type());
+  add_list(index, 0, node.arguments());
+  add_list(index, 1, node.body());
+}
+
+void AstSerializer::visit(const FunctionCallNode &node) {
+  size_t index = add_node(node, NodeKind::FUNCTION_CALL);
+  nodes_[index].name = add_string(node.identifier());
+  add_list(index, 0, node.arguments());
+}
+
+void AstSerializer::visit(const FunctionReturnNode &node) {
+  size_t index = add_node(node, NodeKind::FUNCTION_RETURN);
+  add_child(index, 0, node.value());
+}
+
+void AstSerializer::visit(const IfNode &node) {
+  size_t index = add_node(node, NodeKind::IF);
+  add_child(index, 0, &node.condition());
+  add_list(index, 1, node.then_block());
+  add_list(index, 2, node.else_block());
+}
+
+void AstSerializer::visit(const ConstantDeclarationNode &node) {
+  size_t index = add_node(node, NodeKind::CONSTANT_DECLARATION);
+  nodes_[index].op = node.exported();
+  nodes_[index].name = add_string(node.identifier());
+  add_child(index, 0, &node.value());
+}
+
+void AstSerializer::visit(const ImportNode &node) {
+  size_t index = add_node(node, NodeKind::IMPORT);
+  nodes_[index].name = add_string(node.module());
+}
+
+// Deserializer rebuilds nodes straight from the mapped records. The records
+// of a node's children follow it, so the nodes still waiting for children
+// are kept on a stack and each node is built once its lists are complete.
+class AstDeserializer {
+public:
+  AstDeserializer(const char *data, size_t size, const std::string &file)
+      : data_(data), size_(size), file_(file) {}
+
+  AstNodeList deserialize();
+
+private:
+  const char *data_;
+  size_t size_;
+  std::string file_;
+  FileHeader header_{};
+  const char *nodes_ = nullptr;
+  const char *types_ = nullptr;
+  const char *strings_ = nullptr;
+  uint32_t cursor_ = 0;
+
+  // A node read from its record, waiting for the children of its lists
+  struct OpenNode {
+    NodeRecord record;
+    uint32_t remaining[3] = {0, 0, 0};
+    AstNodeList lists[3];
+    // List the next child belongs to
+    int slot = 0;
+  };
+
+  AstNodeList read_list(uint32_t size);
+  OpenNode open_node();
+  void expect_list(OpenNode &node, int slot);
+  void expect_single(OpenNode &node, int slot);
+  AstNodePtr build_node(OpenNode &open);
+  AstTypePtr read_type(uint32_t index);
+  AstTypePtr read_required_type(uint32_t index);
+  std::string read_string(uint32_t offset);
+  AstLocation read_location(const LocationRecord &record);
+  [[noreturn]] void fail(const std::string &message) const;
+};
+
+AstNodeList AstDeserializer::deserialize() {
+  if (size_ < sizeof(AST_MAGIC) ||
+      std::memcmp(data_, AST_MAGIC, sizeof(AST_MAGIC)) != 0) {
+    fail("not a binary AST file");
+  }
+  if (size_ < sizeof(FileHeader)) {
+    fail("file too small");
+  }
+  std::memcpy(&header_, data_, sizeof(FileHeader));
+
+  if (header_.byte_order != AST_BYTE_ORDER) {
+    fail("byte order mismatch");
+  }
+  if (header_.version != AST_FORMAT_VERSION) {
+    fail("unsupported version " + std::to_string(header_.version) +
+         ", expected " + std::to_string(AST_FORMAT_VERSION));
+  }
+
+  uint64_t expected_size =
+      sizeof(FileHeader) +
+      static_cast<uint64_t>(header_.node_count) * sizeof(NodeRecord) +
+      static_cast<uint64_t>(header_.type_count) * sizeof(TypeRecord) +
+      header_.string_size;
+  if (expected_size != size_) {
+    fail("section sizes do not match file size");
+  }
+
+  nodes_ = data_ + sizeof(FileHeader);
+  types_ = nodes_ + header_.node_count * sizeof(NodeRecord);
+  strings_ = types_ + header_.type_count * sizeof(TypeRecord);
+
+  AstNodeList result = read_list(header_.root_count);
+  if (cursor_ != header_.node_count) {
+    fail("trailing nodes after the last declaration");
+  }
+  return result;
+}
+
+AstNodeList AstDeserializer::read_list(uint32_t size) {
+  if (size > header_.node_count - cursor_) {
+    fail("node table truncated");
+  }
+
+  AstNodeList list;
+  list.reserve(size);
+  std::vector<OpenNode> open;
+  while (list.size() < size || !open.empty()) {
+    if (open.empty()) {
+      open.push_back(open_node());
+      continue;
+    }
+
+    OpenNode &node = open.back();
+    while (node.slot < 3 && node.remaining[node.slot] == 0) {
+      ++node.slot;
+    }
+    if (node.slot < 3) {
+      open.push_back(open_node());
+      continue;
+    }
+
+    AstNodePtr built = build_node(node);
+    open.pop_back();
+    if (open.empty()) {
+      list.push_back(std::move(built));
+    } else {
+      OpenNode &parent = open.back();
+      parent.lists[parent.slot].push_back(std::move(built));
+      --parent.remaining[parent.slot];
+    }
+  }
+  return list;
+}
+
+AstDeserializer::OpenNode AstDeserializer::open_node() {
+  if (cursor_ >= header_.node_count) {
+    fail("node table truncated");
+  }
+
+  OpenNode node;
+  std::memcpy(&node.record, nodes_ + cursor_ * sizeof(NodeRecord),
+              sizeof(NodeRecord));
+  cursor_++;
+
+  const NodeRecord &record = node.record;
+  switch (static_cast<NodeKind>(record.kind)) {
+  case NodeKind::CONSTANT_INTEGER:
+  case NodeKind::CONSTANT_UNSIGNED_INTEGER:
+  case NodeKind::CONSTANT_FLOAT:
+  case NodeKind::CONSTANT_BOOL:
+  case NodeKind::VARIABLE_LOOKUP:
+  case NodeKind::ARGUMENT:
+  case NodeKind::IMPORT:
+    break;
+  case NodeKind::BINARY_OP:
+    if (record.op > static_cast<uint8_t>(BinaryOperator::OR) ||
+        record.list_sizes[0] != 2) {
+      fail("malformed binary operation");
+    }
+    expect_list(node, 0);
+    break;
+  case NodeKind::UNARY_OP:
+    if (record.op > static_cast<uint8_t>(UnaryOperator::NOT)) {
+      fail("malformed unary operation");
+    }
+    expect_single(node, 0);
+    break;
+  case NodeKind::VARIABLE_DECLARATION:
+  case NodeKind::FUNCTION_RETURN:
+    // The value is optional
+    if (record.list_sizes[0]) {
+      expect_single(node, 0);
+    }
+    break;
+  case NodeKind::VARIABLE_ASSIGNMENT:
+  case NodeKind::CONSTANT_DECLARATION:
+    expect_single(node, 0);
+    break;
+  case NodeKind::BLOCK:
+  case NodeKind::FUNCTION_CALL:
+    expect_list(node, 0);
+    break;
+  case NodeKind::FUNCTION_DECLARATION:
+    expect_list(node, 0);
+    expect_list(node, 1);
+    break;
+  case NodeKind::IF:
+    expect_single(node, 0);
+    expect_list(node, 1);
+    expect_list(node, 2);
+    break;
+  default:
+    fail("unknown node kind " + std::to_string(record.kind));
+  }
+  return node;
+}
+
+void AstDeserializer::expect_list(OpenNode &node, int slot) {
+  uint32_t size = node.record.list_sizes[slot];
+  if (size > header_.node_count - cursor_) {
+    fail("node table truncated");
+  }
+  node.remaining[slot] = size;
+  node.lists[slot].reserve(size);
+}
+
+void AstDeserializer::expect_single(OpenNode &node, int slot) {
+  if (node.record.list_sizes[slot] != 1) {
+    fail("expected exactly one child node");
+  }
+  node.remaining[slot] = 1;
+}
+
+AstNodePtr AstDeserializer::build_node(OpenNode &open) {
+  const NodeRecord &record = open.record;
+  AstLocation location = read_location(record.location);
+  auto single = [&open](int slot) {
+    return open.lists[slot].empty() ? nullptr : std::move(open.lists[slot][0]);
+  };
+  AstNodePtr node;
+
+  switch (static_cast<NodeKind>(record.kind)) {
+  case NodeKind::CONSTANT_INTEGER: {
+    long long value;
+    std::memcpy(&value, &record.value, sizeof(value));
+    node = std::make_unique<ConstantIntegerNode>(location, value);
+    break;
+  }
+  case NodeKind::CONSTANT_UNSIGNED_INTEGER:
+    node = std::make_unique<ConstantUnsignedIntegerNode>(location,
+                                                         record.value);
+    break;
+  case NodeKind::CONSTANT_FLOAT: {
+    double value;
+    std::memcpy(&value, &record.value, sizeof(value));
+    node = std::make_unique<ConstantFloatNode>(location, value);
+    break;
+  }
+  case NodeKind::CONSTANT_BOOL:
+    node = std::make_unique<ConstantBoolNode>(location, record.value != 0);
+    break;
+  case NodeKind::BINARY_OP:
+    node = std::make_unique<BinaryOpNode>(
+        location, static_cast<BinaryOperator>(record.op),
+        std::move(open.lists[0][0]), std::move(open.lists[0][1]));
+    break;
+  case NodeKind::UNARY_OP:
+    node = std::make_unique<UnaryOpNode>(
+        location, static_cast<UnaryOperator>(record.op), single(0));
+    break;
+  case NodeKind::VARIABLE_DECLARATION:
+    node = std::make_unique<VariableDeclarationNode>(
+        location, read_string(record.name),
+        read_required_type(record.declared_type), single(0));
+    break;
+  case NodeKind::VARIABLE_ASSIGNMENT:
+    node = std::make_unique<VariableAssignmentNode>(
+        location, read_string(record.name), single(0));
+    break;
+  case NodeKind::VARIABLE_LOOKUP:
+    node = std::make_unique<VariableLookupNode>(location,
+                                                read_string(record.name));
+    break;
+  case NodeKind::ARGUMENT:
+    node = std::make_unique<ArgumentNode>(
+        location, read_string(record.name),
+        read_required_type(record.declared_type));
+    break;
+  case NodeKind::BLOCK:
+    node = std::make_unique<BlockNode>(location, std::move(open.lists[0]));
+    break;
+  case NodeKind::FUNCTION_DECLARATION: {
+    auto function = std::make_unique<FunctionDeclarationNode>(
+        location, read_string(record.name),
+        read_required_type(record.declared_type), std::move(open.lists[0]),
+        std::move(open.lists[1]));
+    function->set_exported(record.op != 0);
+    node = std::move(function);
+    break;
+  }
+  case NodeKind::FUNCTION_CALL:
+    node = std::make_unique<FunctionCallNode>(
+        location, read_string(record.name), std::move(open.lists[0]));
+    break;
+  case NodeKind::FUNCTION_RETURN:
+    node = std::make_unique<FunctionReturnNode>(location, single(0));
+    break;
+  case NodeKind::IF:
+    node = std::make_unique<IfNode>(location, single(0),
+                                    std::move(open.lists[1]),
+                                    std::move(open.lists[2]));
+    break;
+  case NodeKind::CONSTANT_DECLARATION: {
+    auto constant = std::make_unique<ConstantDeclarationNode>(
+        location, read_string(record.name), single(0));
+    constant->set_exported(record.op != 0);
+    node = std::move(constant);
+    break;
+  }
+  case NodeKind::IMPORT:
+    node = std::make_unique<ImportNode>(location, read_string(record.name));
+    break;
+  }
+
+  // Restore the inferred type, overriding the defaults set by constructors
+  node->set_result_type(read_type(record.result_type));
+  return node;
+}
+
+AstTypePtr AstDeserializer::read_type(uint32_t index) {
+  if (index == NONE) {
+    return nullptr;
+  }
+  if (index >= header_.type_count) {
+    fail("type index out of range");
+  }
+
+  TypeRecord record;
+  std::memcpy(&record, types_ + index * sizeof(TypeRecord),
+              sizeof(TypeRecord));
+  AstLocation location = read_location(record.location);
+
+  switch (static_cast<TypeKind>(record.kind)) {
+  case TypeKind::PRIMITIVE:
+    if (record.primitive < static_cast<int8_t>(PrimitiveType::UNDEF) ||
+        record.primitive > static_cast<int8_t>(PrimitiveType::BOOL)) {
+      fail("unknown primitive type");
+    }
+    return std::make_unique<AstType>(
+        location,
+        AstType::Primitive(static_cast<PrimitiveType>(record.primitive)));
+  case TypeKind::ARRAY:
+    // Element types always precede their array, which rules out cycles
+    if (record.element_type >= index) {
+      fail("malformed array type");
+    }
+    return std::make_unique<AstType>(
+        location,
+        AstType::Array(read_type(record.element_type), record.size));
+  case TypeKind::IDENTIFIER:
+    return std::make_unique<AstType>(
+        location, AstType::Identifier(read_string(record.name)));
+  }
+  fail("unknown type kind " + std::to_string(record.kind));
+}
+
+AstTypePtr AstDeserializer::read_required_type(uint32_t index) {
+  AstTypePtr type = read_type(index);
+  if (!type) {
+    fail("missing declared type");
+  }
+  return type;
+}
+
+std::string AstDeserializer::read_string(uint32_t offset) {
+  uint32_t length;
+  if (offset == NONE || header_.string_size < sizeof(length) ||
+      offset > header_.string_size - sizeof(length)) {
+    fail("string offset out of range");
+  }
+  std::memcpy(&length, strings_ + offset, sizeof(length));
+  if (length > header_.string_size - sizeof(length) - offset) {
+    fail("string length out of range");
+  }
+  return std::string(strings_ + offset + sizeof(length), length);
+}
+
+AstLocation AstDeserializer::read_location(const LocationRecord &record) {
+  return AstLocation(read_string(record.file), record.line_begin,
+                     record.column_begin, record.line_end, record.column_end);
+}
+
+void AstDeserializer::fail(const std::string &message) const {
+  throw SerializationException(file_, message);
+}
+
+} // namespace
+
+std::vector<char> serialize_ast(const AstNodeList &ast) {
+  AstSerializer serializer;
+  return serializer.serialize(ast);
+}
+
+AstNodeList deserialize_ast(const char *data, size_t size,
+                            const std::string &file) {
+  AstDeserializer deserializer(data, size, file);
+  return deserializer.deserialize();
+}
+
+void write_ast(const AstNodeList &ast, const std::string &file) {
+  std::vector<char> buffer = serialize_ast(ast);
+
+  std::ofstream out(file, std::ios::binary | std::ios::trunc);
+  if (!out) {
+    throw SerializationException(file, "could not open file for writing");
+  }
+  out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+  if (!out) {
+    throw SerializationException(file, "could not write file");
+  }
+}
+
+AstNodeList read_ast(const std::string &file) {
+  int fd = open(file.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw SerializationException(file, "could not open file");
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+    close(fd);
+    throw SerializationException(file, "could not read file");
+  }
+
+  size_t size = static_cast<size_t>(st.st_size);
+  void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    throw SerializationException(file, "could not map file");
+  }
+
+  try {
+    AstNodeList result =
+        deserialize_ast(static_cast<const char *>(data), size, file);
+    munmap(data, size);
+    return result;
+  } catch (...) {
+    munmap(data, size);
+    throw;
+  }
+}
+
+} // namespace cha
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "ast.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace cha {
+
+// Version of the binary AST format, bump whenever the record layout or the
+// meaning of a field changes
+constexpr uint32_t AST_FORMAT_VERSION = 3;
+
+// Serialize a validated AST, including the inferred result types, into the
+// binary AST format
+std::vector<char> serialize_ast(const AstNodeList &ast);
+
+// Rebuild an AST from a binary AST buffer - throws SerializationException
+AstNodeList deserialize_ast(const char *data, size_t size,
+                            const std::string &file = "");
+
+// Write a validated AST to a binary AST file - throws SerializationException
+void write_ast(const AstNodeList &ast, const std::string &file);
+
+// Memory map a binary AST file and rebuild the AST without parsing or
+// validating it again - throws SerializationException
+AstNodeList read_ast(const std::string &file);
+
+} // namespace cha
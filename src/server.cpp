@@ -0,0 +1,394 @@
+#include "server.hpp"
+#include "codegen.hpp"
+#include "exceptions.hpp"
+#include "log.hpp"
+
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <limits.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+extern char **environ;
+
+namespace cha {
+
+namespace {
+
+// Requests are the working directory and the arguments, then the client's
+// environment, each list preceded by its size and each string by its
+// length. The reply is the exit code.
+constexpr uint32_t MAX_REQUEST_STRINGS = 65536;
+constexpr uint32_t MAX_STRING_LENGTH = 1 << 20;
+
+// Linux stops SIGPIPE per send, macOS and the BSDs per socket
+#ifdef MSG_NOSIGNAL
+constexpr int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+constexpr int SEND_FLAGS = 0;
+#endif
+
+// Sockets are not inherited by the linker the workers spawn, and a peer
+// that went away must not kill us with SIGPIPE
+bool prepare_socket(int connection) {
+#ifdef SO_NOSIGPIPE
+  int on = 1;
+  if (setsockopt(connection, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on)) !=
+      0) {
+    return false;
+  }
+#endif
+  return fcntl(connection, F_SETFD, FD_CLOEXEC) == 0;
+}
+
+int open_socket() {
+  int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (connection >= 0 && !prepare_socket(connection)) {
+    close(connection);
+    return -1;
+  }
+  return connection;
+}
+
+bool make_address(const std::string &path, sockaddr_un &address) {
+  std::memset(&address, 0, sizeof(address));
+  if (path.size() >= sizeof(address.sun_path)) {
+    return false;
+  }
+  address.sun_family = AF_UNIX;
+  std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+  return true;
+}
+
+bool connect_to(int connection, const sockaddr_un &address) {
+  return connect(connection, reinterpret_cast<const sockaddr *>(&address),
+                 sizeof(address)) == 0;
+}
+
+bool write_all(int connection, const void *data, size_t size) {
+  const char *bytes = static_cast<const char *>(data);
+  while (size > 0) {
+    ssize_t written = send(connection, bytes, size, SEND_FLAGS);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (written <= 0) {
+      return false;
+    }
+    bytes += written;
+    size -= written;
+  }
+  return true;
+}
+
+bool read_all(int connection, void *data, size_t size) {
+  char *bytes = static_cast<char *>(data);
+  while (size > 0) {
+    ssize_t received = recv(connection, bytes, size, 0);
+    if (received < 0 && errno == EINTR) {
+      continue;
+    }
+    if (received <= 0) {
+      return false;
+    }
+    bytes += received;
+    size -= received;
+  }
+  return true;
+}
+
+bool write_string(int connection, const std::string &value) {
+  uint32_t length = value.size();
+  return write_all(connection, &length, sizeof(length)) &&
+         write_all(connection, value.data(), value.size());
+}
+
+bool read_string(int connection, std::string &value) {
+  uint32_t length = 0;
+  if (!read_all(connection, &length, sizeof(length)) ||
+      length > MAX_STRING_LENGTH) {
+    return false;
+  }
+  value.resize(length);
+  return read_all(connection, &value[0], length);
+}
+
+// The client's stdout and stderr travel along the first byte, so workers
+// write straight to its terminal or pipes
+bool send_output(int connection) {
+  int fds[2] = {STDOUT_FILENO, STDERR_FILENO};
+  char byte = 0;
+  iovec data{&byte, 1};
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fds))];
+
+  msghdr message{};
+  message.msg_iov = &data;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+  cmsghdr *header = CMSG_FIRSTHDR(&message);
+  header->cmsg_level = SOL_SOCKET;
+  header->cmsg_type = SCM_RIGHTS;
+  header->cmsg_len = CMSG_LEN(sizeof(fds));
+  std::memcpy(CMSG_DATA(header), fds, sizeof(fds));
+  return sendmsg(connection, &message, SEND_FLAGS) == 1;
+}
+
+bool receive_output(int connection, int (&fds)[2]) {
+  char byte = 0;
+  iovec data{&byte, 1};
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fds))];
+
+  msghdr message{};
+  message.msg_iov = &data;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+  if (recvmsg(connection, &message, 0) != 1) {
+    return false;
+  }
+  cmsghdr *header = CMSG_FIRSTHDR(&message);
+  if (!header || header->cmsg_type != SCM_RIGHTS ||
+      header->cmsg_len != CMSG_LEN(sizeof(fds))) {
+    return false;
+  }
+  std::memcpy(fds, CMSG_DATA(header), sizeof(fds));
+  return fcntl(fds[0], F_SETFD, FD_CLOEXEC) == 0 &&
+         fcntl(fds[1], F_SETFD, FD_CLOEXEC) == 0;
+}
+
+bool write_strings(int connection, const std::vector<std::string> &values) {
+  uint32_t count = values.size();
+  bool sent = write_all(connection, &count, sizeof(count));
+  for (size_t i = 0; sent && i < values.size(); ++i) {
+    sent = write_string(connection, values[i]);
+  }
+  return sent;
+}
+
+bool read_strings(int connection, std::vector<std::string> &values) {
+  uint32_t count = 0;
+  if (!read_all(connection, &count, sizeof(count)) ||
+      count > MAX_REQUEST_STRINGS) {
+    return false;
+  }
+  values.resize(count);
+  for (auto &value : values) {
+    if (!read_string(connection, value)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Only processes of the user running the server may use its privileges
+bool same_user(int connection) {
+#ifdef SO_PEERCRED
+  ucred peer{};
+  socklen_t size = sizeof(peer);
+  return getsockopt(connection, SOL_SOCKET, SO_PEERCRED, &peer, &size) == 0 &&
+         peer.uid == getuid();
+#else
+  uid_t user;
+  gid_t group;
+  return getpeereid(connection, &user, &group) == 0 && user == getuid();
+#endif
+}
+
+// clearenv() is Linux only, the server's variables are removed one by one
+bool replace_environment(const std::vector<std::string> &environment) {
+  std::vector<std::string> names;
+  for (char **variable = environ; *variable; ++variable) {
+    const char *equals = std::strchr(*variable, '=');
+    if (equals) {
+      names.emplace_back(*variable, equals - *variable);
+    }
+  }
+  for (const auto &name : names) {
+    if (unsetenv(name.c_str()) != 0) {
+      return false;
+    }
+  }
+  for (const auto &variable : environment) {
+    size_t equals = variable.find('=');
+    if (equals != std::string::npos && equals > 0) {
+      setenv(variable.substr(0, equals).c_str(),
+             variable.c_str() + equals + 1, 1);
+    }
+  }
+  return true;
+}
+
+// Runs a request in a forked worker, with the client's working directory
+// and environment, e.g. its PATH and TMPDIR
+[[noreturn]] void handle_request(int connection,
+                                 const RequestHandler &handler) {
+  int fds[2];
+  std::vector<std::string> args;
+  std::vector<std::string> environment;
+  bool valid = receive_output(connection, fds) &&
+               read_strings(connection, args) && !args.empty() &&
+               read_strings(connection, environment);
+  if (!valid || chdir(args.front().c_str()) != 0 ||
+      !replace_environment(environment)) {
+    _exit(1);
+  }
+  args.erase(args.begin());
+  dup2(fds[0], STDOUT_FILENO);
+  dup2(fds[1], STDERR_FILENO);
+  close(fds[0]);
+  close(fds[1]);
+
+  int32_t exit_code = 1;
+  try {
+    exit_code = handler(args);
+  } catch (const std::exception &e) {
+    log_error(e.what());
+  }
+  std::cout.flush();
+  std::cerr.flush();
+  write_all(connection, &exit_code, sizeof(exit_code));
+  _exit(0);
+}
+
+} // namespace
+
+int serve(const std::string &socket_path, const RequestHandler &handler) {
+  sockaddr_un address;
+  if (!make_address(socket_path, address)) {
+    log_error("Socket path is too long: " + socket_path);
+    return 1;
+  }
+
+  int listener = open_socket();
+  if (listener < 0) {
+    log_error(std::string("Could not create socket: ") + strerror(errno));
+    return 1;
+  }
+
+  // A server that was killed leaves its socket behind, a running one keeps
+  // it
+  if (connect_to(listener, address)) {
+    log_error("A compile server is already listening on " + socket_path);
+    close(listener);
+    return 1;
+  }
+  close(listener);
+  unlink(socket_path.c_str());
+
+  // Only the owner may connect, the socket never exists with wider
+  // permissions
+  listener = open_socket();
+  mode_t mask = umask(0177);
+  bool bound = listener >= 0 &&
+               bind(listener, reinterpret_cast<const sockaddr *>(&address),
+                    sizeof(address)) == 0;
+  umask(mask);
+  if (!bound || chmod(socket_path.c_str(), 0600) != 0 ||
+      listen(listener, SOMAXCONN) != 0) {
+    log_error("Could not listen on " + socket_path + ": " + strerror(errno));
+    if (listener >= 0) {
+      close(listener);
+    }
+    return 1;
+  }
+
+  // Everything the workers inherit is paid for only once
+  try {
+    warm_up_code_generator();
+  } catch (const CodeGenerationException &e) {
+    log_error(e.message());
+    close(listener);
+    unlink(socket_path.c_str());
+    return 1;
+  }
+
+  // Clients receive the exit codes, workers are reaped automatically
+  signal(SIGCHLD, SIG_IGN);
+  log_info("Compile server listening on " + socket_path);
+
+  for (;;) {
+    int connection = accept(listener, nullptr, nullptr);
+    if (connection >= 0 && !prepare_socket(connection)) {
+      close(connection);
+      continue;
+    }
+    if (connection < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      log_error(std::string("Could not accept a request: ") +
+                strerror(errno));
+      break;
+    }
+    if (!same_user(connection)) {
+      log_warning("Refused a request from another user");
+      close(connection);
+      continue;
+    }
+
+    pid_t worker = fork();
+    if (worker == 0) {
+      close(listener);
+      // Workers wait for the linker they spawn
+      signal(SIGCHLD, SIG_DFL);
+      handle_request(connection, handler);
+    }
+    if (worker < 0) {
+      log_error(std::string("Could not start a worker: ") + strerror(errno));
+    }
+    close(connection);
+  }
+
+  close(listener);
+  unlink(socket_path.c_str());
+  return 1;
+}
+
+bool forward_to_server(const std::string &socket_path,
+                       const std::vector<std::string> &args, int &exit_code) {
+  sockaddr_un address;
+  if (!make_address(socket_path, address)) {
+    return false;
+  }
+  int connection = open_socket();
+  if (connection < 0) {
+    return false;
+  }
+
+  char directory[PATH_MAX];
+  std::vector<std::string> request;
+  std::vector<std::string> environment;
+  if (getcwd(directory, sizeof(directory))) {
+    request.push_back(directory);
+    request.insert(request.end(), args.begin(), args.end());
+  }
+  for (char **variable = environ; *variable; ++variable) {
+    environment.push_back(*variable);
+  }
+  bool sent = !request.empty() && connect_to(connection, address) &&
+              send_output(connection) && write_strings(connection, request) &&
+              write_strings(connection, environment);
+  if (!sent) {
+    // Nothing ran yet, the request can be handled locally
+    close(connection);
+    return false;
+  }
+
+  int32_t result = 1;
+  if (!read_all(connection, &result, sizeof(result))) {
+    log_error("Compile server at " + socket_path + " did not finish the "
+              "request");
+  }
+  close(connection);
+  exit_code = result;
+  return true;
+}
+
+} // namespace cha
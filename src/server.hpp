@@ -0,0 +1,26 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace cha {
+
+// Runs one request: the arguments of a cha command line without the program
+// name, returning its exit code
+using RequestHandler = std::function<int(const std::vector<std::string> &)>;
+
+// Serve compile requests on a Unix socket until killed. LLVM is initialized
+// once up front; every request runs in a worker forked from the warm server,
+// in the client's working directory and environment and writing to the
+// client's stdout and stderr. Only the user running the server can connect:
+// the socket is created with mode 0600 and other peers are refused. Returns
+// 1 when the socket cannot be set up.
+int serve(const std::string &socket_path, const RequestHandler &handler);
+
+// Run a request on the server listening at socket_path. Returns false when
+// no server is listening, so the caller can handle it locally.
+bool forward_to_server(const std::string &socket_path,
+                       const std::vector<std::string> &args, int &exit_code);
+
+} // namespace cha
@@ -0,0 +1,228 @@
+#include "stream.hpp"
+#include "parser.hpp"
+
+#include <map>
+#include <vector>
+
+namespace cha {
+
+namespace {
+
+// Thrown into the parser to stop it once nobody takes its declarations
+struct Stopped {};
+
+// Collects the names a declaration takes from the module scope, with the
+// same scopes as the validator: arguments and the function body share one,
+// each block of an if has its own. Generated sources nest arbitrarily deep,
+// so nodes are walked with an explicit stack like in the validator.
+class NameCollector : public AstVisitor {
+public:
+  UsedNames names;
+
+  void collect(const AstNode &declaration) {
+    schedule(Step::ENTER, declaration);
+    while (!steps_.empty()) {
+      Step step = steps_.back();
+      steps_.pop_back();
+      switch (step.kind) {
+      case Step::ENTER:
+        step.node->accept(*this);
+        break;
+      case Step::DECLARE:
+        declare(static_cast<const VariableDeclarationNode &>(*step.node)
+                    .identifier());
+        break;
+      case Step::OPEN_SCOPE:
+        scopes_.emplace_back();
+        break;
+      case Step::CLOSE_SCOPE:
+        close_scope();
+        break;
+      }
+    }
+  }
+
+  void visit(const ConstantIntegerNode &) override {}
+  void visit(const ConstantUnsignedIntegerNode &) override {}
+  void visit(const ConstantFloatNode &) override {}
+  void visit(const ConstantBoolNode &) override {}
+
+  void visit(const BinaryOpNode &node) override {
+    schedule(Step::ENTER, node.right());
+    schedule(Step::ENTER, node.left());
+  }
+
+  void visit(const UnaryOpNode &node) override {
+    schedule(Step::ENTER, node.operand());
+  }
+
+  void visit(const VariableDeclarationNode &node) override {
+    // The name is declared once its value is walked
+    schedule(Step::DECLARE, node);
+    if (node.value()) {
+      schedule(Step::ENTER, *node.value());
+    }
+  }
+
+  void visit(const VariableAssignmentNode &node) override {
+    use(node.identifier());
+    schedule(Step::ENTER, node.value());
+  }
+
+  void visit(const VariableLookupNode &node) override {
+    use(node.identifier());
+  }
+
+  void visit(const ArgumentNode &node) override { declare(node.identifier()); }
+
+  void visit(const BlockNode &node) override {
+    schedule_list(node.statements());
+  }
+
+  void visit(const FunctionDeclarationNode &node) override {
+    schedule(Step::CLOSE_SCOPE, node);
+    schedule_list(node.body());
+    schedule_list(node.arguments());
+    schedule(Step::OPEN_SCOPE, node);
+  }
+
+  void visit(const FunctionCallNode &node) override {
+    names.functions.insert(node.identifier());
+    schedule_list(node.arguments());
+  }
+
+  void visit(const FunctionReturnNode &node) override {
+    if (node.value()) {
+      schedule(Step::ENTER, *node.value());
+    }
+  }
+
+  void visit(const IfNode &node) override {
+    schedule_block(node, node.else_block());
+    schedule_block(node, node.then_block());
+    schedule(Step::ENTER, node.condition());
+  }
+
+  void visit(const ConstantDeclarationNode &node) override {
+    schedule(Step::ENTER, node.value());
+  }
+
+  void visit(const ImportNode &) override {}
+
+private:
+  struct Step {
+    enum Kind { ENTER, DECLARE, OPEN_SCOPE, CLOSE_SCOPE };
+    Kind kind;
+    const AstNode *node;
+  };
+
+  std::vector<Step> steps_;
+  std::vector<std::set<std::string>> scopes_;
+  // Number of open scopes declaring each name, so that a use is not checked
+  // against every scope of deeply nested blocks
+  std::map<std::string, size_t> declared_;
+
+  void declare(const std::string &name) {
+    if (scopes_.back().insert(name).second) {
+      ++declared_[name];
+    }
+  }
+
+  void close_scope() {
+    for (const auto &name : scopes_.back()) {
+      auto it = declared_.find(name);
+      if (--it->second == 0) {
+        declared_.erase(it);
+      }
+    }
+    scopes_.pop_back();
+  }
+
+  void use(const std::string &name) {
+    if (!declared_.count(name)) {
+      names.values.insert(name);
+    }
+  }
+
+  void schedule(Step::Kind kind, const AstNode &node) {
+    steps_.push_back(Step{kind, &node});
+  }
+
+  void schedule_list(const AstNodeList &nodes) {
+    // The last step scheduled runs first
+    for (auto it = nodes.rbegin(); it != nodes.rend(); ++it) {
+      schedule(Step::ENTER, **it);
+    }
+  }
+
+  void schedule_block(const AstNode &node, const AstNodeList &nodes) {
+    schedule(Step::CLOSE_SCOPE, node);
+    schedule_list(nodes);
+    schedule(Step::OPEN_SCOPE, node);
+  }
+};
+
+} // namespace
+
+DeclarationStream::DeclarationStream(const std::string &file,
+                                     size_t capacity)
+    : capacity_(capacity) {
+  parser_ = std::thread([this, file] {
+    std::exception_ptr error;
+    try {
+      parse(file.c_str(),
+            [this](AstNodePtr declaration) { push(std::move(declaration)); });
+    } catch (const Stopped &) {
+    } catch (...) {
+      error = std::current_exception();
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    finished_ = true;
+    error_ = error;
+    changed_.notify_all();
+  });
+}
+
+DeclarationStream::~DeclarationStream() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopped_ = true;
+    changed_.notify_all();
+  }
+  parser_.join();
+}
+
+AstNodePtr DeclarationStream::next() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  changed_.wait(lock, [this] { return !declarations_.empty() || finished_; });
+  if (declarations_.empty()) {
+    if (error_) {
+      std::rethrow_exception(error_);
+    }
+    return nullptr;
+  }
+  AstNodePtr declaration = std::move(declarations_.front());
+  declarations_.pop_front();
+  changed_.notify_all();
+  return declaration;
+}
+
+void DeclarationStream::push(AstNodePtr declaration) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  changed_.wait(lock, [this] {
+    return declarations_.size() < capacity_ || stopped_;
+  });
+  if (stopped_) {
+    throw Stopped();
+  }
+  declarations_.push_back(std::move(declaration));
+  changed_.notify_all();
+}
+
+UsedNames used_names(const AstNode &declaration) {
+  NameCollector collector;
+  collector.collect(declaration);
+  return std::move(collector.names);
+}
+
+} // namespace cha
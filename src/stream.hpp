@@ -0,0 +1,54 @@
+#pragma once
+
+#include "ast.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+
+namespace cha {
+
+// Parses a file on its own thread and hands its top-level declarations over
+// one at a time, as soon as they are reduced. At most capacity declarations
+// wait to be taken, so the parser never runs far ahead of their consumer.
+class DeclarationStream {
+public:
+  explicit DeclarationStream(const std::string &file, size_t capacity = 64);
+  // Stops the parser when the stream is left before its end
+  ~DeclarationStream();
+
+  DeclarationStream(const DeclarationStream &) = delete;
+  DeclarationStream &operator=(const DeclarationStream &) = delete;
+
+  // Next declaration, nullptr at the end of the file - throws
+  // ParseException once the declarations before a syntax error are taken
+  AstNodePtr next();
+
+private:
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  std::deque<AstNodePtr> declarations_;
+  size_t capacity_;
+  bool finished_ = false;
+  bool stopped_ = false;
+  std::exception_ptr error_;
+  std::thread parser_;
+
+  void push(AstNodePtr declaration);
+};
+
+// Names of the module scope used by a top-level declaration: the functions
+// it calls and the other names it reads or assigns, e.g. constants, leaving
+// out its arguments and local variables
+struct UsedNames {
+  std::set<std::string> functions;
+  std::set<std::string> values;
+};
+
+UsedNames used_names(const AstNode &declaration);
+
+} // namespace cha
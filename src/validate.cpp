@@ -1,4 +1,5 @@
 #include "validate.hpp"
+#include "consteval.hpp"
 #include "exceptions.hpp"
 #include <cassert>
 #include <sstream>
@@ -210,15 +211,50 @@ void TypeUtils::set_type_on_const(AstNode &node, PrimitiveType type) {
   }
 }
 
+namespace {
+
+// A function without its body, enough to check calls to it
+AstNodePtr signature(const FunctionDeclarationNode &node) {
+  auto function = std::make_unique<FunctionDeclarationNode>(
+      node.location(), node.identifier(), node.return_type().clone(),
+      clone_node_list(node.arguments()), AstNodeList{});
+  function->set_exported(node.exported());
+  return function;
+}
+
+} // namespace
+
 // Validator implementation
 Validator::Validator()
     : symbol_table_(std::make_shared<SymbolTable>()),
       current_function_(nullptr) {}
 
+void Validator::declare_external(const FunctionDeclarationNode &node) {
+  // Only the signature is needed to check calls from this module
+  externals_.push_back(signature(node));
+  if (declaring_) {
+    symbol_table_->insert(node.identifier(), externals_.back()->clone());
+  }
+}
+
+void Validator::declare_external(const ConstantDeclarationNode &node) {
+  externals_.push_back(node.clone());
+  if (declaring_) {
+    symbol_table_->insert(node.identifier(), externals_.back()->clone());
+    evaluator_->declare(
+        static_cast<const ConstantDeclarationNode &>(*externals_.back()));
+  }
+}
+
+void Validator::declare_sibling(const FunctionDeclarationNode &node) {
+  externals_.push_back(node.clone());
+}
+
 void Validator::validate(const AstNodeList &ast) {
   errors_.clear();
-  symbol_table_ = std::make_shared<SymbolTable>();
+  reset_symbol_table();
   current_function_ = nullptr;
+  declaring_ = false;
 
   try {
     validate_top_level(ast);
@@ -233,21 +269,108 @@ void Validator::validate(const AstNodeList &ast) {
   }
 }
 
+void Validator::declare_function(const FunctionDeclarationNode &node) {
+  start_declarations();
+  if (!symbol_table_->insert(node.identifier(), signature(node))) {
+    throw ValidationException(node.location(),
+                              "'" + node.identifier() + "' already defined");
+  }
+}
+
+void Validator::validate_declaration(AstNode &node) {
+  start_declarations();
+  errors_.clear();
+  current_function_ = nullptr;
+
+  if (auto constant = dynamic_cast<ConstantDeclarationNode *>(&node)) {
+    validate_node(*constant);
+    if (errors_.empty()) {
+      evaluator_->declare(*constant);
+      fold_constant(*evaluator_, *constant);
+    }
+  } else {
+    validate_node(node);
+  }
+
+  if (!errors_.empty()) {
+    throw MultipleValidationException(errors_);
+  }
+}
+
+void Validator::reset_symbol_table() {
+  symbol_table_ = std::make_shared<SymbolTable>();
+  for (const auto &external : externals_) {
+    if (auto function =
+            dynamic_cast<const FunctionDeclarationNode *>(external.get())) {
+      symbol_table_->insert(function->identifier(), signature(*function));
+    } else if (auto constant = dynamic_cast<const ConstantDeclarationNode *>(
+                   external.get())) {
+      symbol_table_->insert(constant->identifier(), external->clone());
+    }
+  }
+}
+
+void Validator::start_declarations() {
+  if (declaring_) {
+    return;
+  }
+  declaring_ = true;
+  reset_symbol_table();
+  evaluator_ = std::make_shared<ConstEvaluator>(AstNodeList(), externals_);
+}
+
 void Validator::validate_top_level(const AstNodeList &nodes) {
-  // First pass: register all function declarations
+  // First pass: register all function declarations, calls only need their
+  // signatures
   for (const auto &node : nodes) {
     if (auto func_decl =
             dynamic_cast<const FunctionDeclarationNode *>(node.get())) {
-      if (!symbol_table_->insert(func_decl->identifier(), node->clone())) {
+      if (!symbol_table_->insert(func_decl->identifier(),
+                                 signature(*func_decl))) {
         add_error(node->location(),
                   "'" + func_decl->identifier() + "' already defined");
       }
     }
   }
 
-  // Second pass: validate all nodes
+  // Second pass: constants, so function bodies can use any of them
   for (const auto &node : nodes) {
-    validate_node(*node);
+    if (dynamic_cast<const ConstantDeclarationNode *>(node.get())) {
+      validate_node(*node);
+    }
+  }
+
+  // Third pass: validate all other nodes
+  for (const auto &node : nodes) {
+    if (!dynamic_cast<const ConstantDeclarationNode *>(node.get())) {
+      validate_node(*node);
+    }
+  }
+
+  if (errors_.empty()) {
+    fold_constants(nodes);
+  }
+}
+
+void Validator::fold_constants(const AstNodeList &nodes) {
+  // Replace every constant by the literal it evaluates to, so code generation
+  // only ever sees immediates
+  ConstEvaluator evaluator(nodes, externals_);
+  for (const auto &node : nodes) {
+    if (auto const_decl = dynamic_cast<ConstantDeclarationNode *>(node.get())) {
+      fold_constant(evaluator, *const_decl);
+    }
+  }
+}
+
+void Validator::fold_constant(ConstEvaluator &evaluator,
+                              ConstantDeclarationNode &node) {
+  try {
+    ConstValue value = evaluator.evaluate_constant(node.identifier());
+    node.set_value(
+        ConstEvaluator::make_literal(value, node.value().location()));
+  } catch (const ValidationException &e) {
+    errors_.push_back(e);
   }
 }
 
@@ -258,6 +381,67 @@ void Validator::validate_node_list(const AstNodeList &nodes) {
 }
 
 void Validator::validate_node(const AstNode &node) {
+  // Steps left by an enclosing call, e.g. for a function body, stay below
+  size_t base = steps_.size();
+  schedule(Step::ENTER, node);
+  while (steps_.size() > base) {
+    Step step = steps_.back();
+    steps_.pop_back();
+    run_step(step);
+  }
+}
+
+void Validator::schedule(Step::Kind kind, const AstNode &node, size_t index) {
+  steps_.push_back(Step{kind, &node, index});
+}
+
+void Validator::schedule_list(const AstNodeList &nodes) {
+  // The last step scheduled runs first
+  for (auto it = nodes.rbegin(); it != nodes.rend(); ++it) {
+    schedule(Step::ENTER, **it);
+  }
+}
+
+void Validator::run_step(const Step &step) {
+  AstNode &node = const_cast<AstNode &>(*step.node);
+  switch (step.kind) {
+  case Step::ENTER:
+    enter_node(node);
+    break;
+  case Step::DECLARE_CONSTANT:
+    declare_constant(static_cast<const ConstantDeclarationNode &>(node));
+    break;
+  case Step::DECLARE_VARIABLE:
+    declare_variable(static_cast<const VariableDeclarationNode &>(node));
+    break;
+  case Step::CHECK_ASSIGNMENT:
+    check_assignment(static_cast<const VariableAssignmentNode &>(node));
+    break;
+  case Step::CHECK_BINARY_OP:
+    check_binary_op(static_cast<BinaryOpNode &>(node));
+    break;
+  case Step::CHECK_UNARY_OP:
+    check_unary_op(static_cast<UnaryOpNode &>(node));
+    break;
+  case Step::CHECK_CALL_ARGUMENT:
+    check_call_argument(static_cast<FunctionCallNode &>(node), step.index);
+    break;
+  case Step::CHECK_RETURN:
+    check_return(static_cast<const FunctionReturnNode &>(node));
+    break;
+  case Step::CHECK_CONDITION:
+    check_condition(static_cast<const IfNode &>(node));
+    break;
+  case Step::OPEN_SCOPE:
+    create_stack_frame();
+    break;
+  case Step::CLOSE_SCOPE:
+    release_stack_frame();
+    break;
+  }
+}
+
+void Validator::enter_node(const AstNode &node) {
   if (auto func_decl = dynamic_cast<const FunctionDeclarationNode *>(&node)) {
     validate_function_declaration(*func_decl);
   } else if (auto const_decl =
@@ -311,6 +495,18 @@ void Validator::validate_function_declaration(
 
 void Validator::validate_constant_declaration(
     const ConstantDeclarationNode &node) {
+  schedule(Step::DECLARE_CONSTANT, node);
+  schedule(Step::ENTER, node.value());
+}
+
+void Validator::declare_constant(const ConstantDeclarationNode &node) {
+  const AstType *type = node.value().result_type();
+  if (type && (!type->is_primitive() ||
+               type->as_primitive().type == PrimitiveType::UNDEF)) {
+    add_error(node.location(),
+              "constant '" + node.identifier() + "' has no value");
+  }
+
   if (!symbol_table_->insert(node.identifier(), node.clone())) {
     add_error(node.location(),
               "constant '" + node.identifier() + "' already defined");
@@ -319,11 +515,17 @@ void Validator::validate_constant_declaration(
 
 void Validator::validate_variable_declaration(
     const VariableDeclarationNode &node) {
+  schedule(Step::DECLARE_VARIABLE, node);
   if (node.value()) {
-    validate_node(*node.value());
+    schedule(Step::ENTER, *node.value());
   }
+}
 
-  if (!symbol_table_->insert(node.identifier(), node.clone())) {
+void Validator::declare_variable(const VariableDeclarationNode &node) {
+  // Lookups only need the type, the value may be a huge expression
+  auto declaration = std::make_unique<VariableDeclarationNode>(
+      node.location(), node.identifier(), node.type().clone());
+  if (!symbol_table_->insert(node.identifier(), std::move(declaration))) {
     add_error(node.location(),
               "variable '" + node.identifier() + "' already defined");
   }
@@ -345,8 +547,12 @@ void Validator::validate_variable_assignment(
     return;
   }
 
-  validate_node(node.value());
+  schedule(Step::CHECK_ASSIGNMENT, node);
+  schedule(Step::ENTER, node.value());
+}
 
+void Validator::check_assignment(const VariableAssignmentNode &node) {
+  const SymbolEntry *entry = symbol_table_->lookup(node.identifier());
   if (auto var_decl =
           dynamic_cast<const VariableDeclarationNode *>(entry->node.get())) {
     if (!check_type_assignment(const_cast<AstNode &>(node.value()),
@@ -387,9 +593,12 @@ void Validator::validate_variable_lookup(VariableLookupNode &node) {
 }
 
 void Validator::validate_binary_op(BinaryOpNode &node) {
-  validate_node(node.left());
-  validate_node(node.right());
+  schedule(Step::CHECK_BINARY_OP, node);
+  schedule(Step::ENTER, node.right());
+  schedule(Step::ENTER, node.left());
+}
 
+void Validator::check_binary_op(BinaryOpNode &node) {
   const AstType *left_type = node.left().result_type();
   const AstType *right_type = node.right().result_type();
 
@@ -477,8 +686,11 @@ void Validator::validate_binary_op(BinaryOpNode &node) {
 }
 
 void Validator::validate_unary_op(UnaryOpNode &node) {
-  validate_node(node.operand());
+  schedule(Step::CHECK_UNARY_OP, node);
+  schedule(Step::ENTER, node.operand());
+}
 
+void Validator::check_unary_op(UnaryOpNode &node) {
   const AstType *operand_type = node.operand().result_type();
 
   if (!operand_type || !operand_type->is_primitive()) {
@@ -551,29 +763,36 @@ void Validator::validate_function_call(FunctionCallNode &node) {
     return;
   }
 
-  // Validate arguments
-  for (size_t i = 0; i < node.arguments().size(); ++i) {
-    validate_node(*node.arguments()[i]);
+  // Validate each argument, then check it against the declaration
+  for (size_t i = node.arguments().size(); i-- > 0;) {
+    schedule(Step::CHECK_CALL_ARGUMENT, node, i);
+    schedule(Step::ENTER, *node.arguments()[i]);
+  }
+}
 
-    auto arg_decl =
-        dynamic_cast<const ArgumentNode *>(func_decl->arguments()[i].get());
-    if (arg_decl &&
-        !check_type_assignment(*node.arguments()[i], arg_decl->type())) {
-      add_error(
-          node.arguments()[i]->location(),
-          "type mismatch expects '" +
-              TypeUtils::type_to_string(&arg_decl->type()) + "' passed '" +
-              TypeUtils::type_to_string(node.arguments()[i]->result_type()) +
-              "'");
-    }
+void Validator::check_call_argument(FunctionCallNode &node, size_t index) {
+  auto func_decl = static_cast<const FunctionDeclarationNode *>(
+      symbol_table_->lookup(node.identifier())->node.get());
+  AstNode &argument = *node.arguments()[index];
+  auto arg_decl = dynamic_cast<const ArgumentNode *>(
+      func_decl->arguments()[index].get());
+  if (arg_decl && !check_type_assignment(argument, arg_decl->type())) {
+    add_error(argument.location(),
+              "type mismatch expects '" +
+                  TypeUtils::type_to_string(&arg_decl->type()) +
+                  "' passed '" +
+                  TypeUtils::type_to_string(argument.result_type()) + "'");
   }
 }
 
 void Validator::validate_function_return(const FunctionReturnNode &node) {
+  schedule(Step::CHECK_RETURN, node);
   if (node.value()) {
-    validate_node(*node.value());
+    schedule(Step::ENTER, *node.value());
   }
+}
 
+void Validator::check_return(const FunctionReturnNode &node) {
   if (!current_function_) {
     add_error(node.location(), "return statement outside function");
     return;
@@ -606,8 +825,20 @@ void Validator::validate_function_return(const FunctionReturnNode &node) {
 }
 
 void Validator::validate_if(const IfNode &node) {
-  validate_node(node.condition());
+  // Each branch has its own scope
+  if (node.has_else()) {
+    schedule(Step::CLOSE_SCOPE, node);
+    schedule_list(node.else_block());
+    schedule(Step::OPEN_SCOPE, node);
+  }
+  schedule(Step::CLOSE_SCOPE, node);
+  schedule_list(node.then_block());
+  schedule(Step::OPEN_SCOPE, node);
+  schedule(Step::CHECK_CONDITION, node);
+  schedule(Step::ENTER, node.condition());
+}
 
+void Validator::check_condition(const IfNode &node) {
   if (node.condition().result_type() &&
       node.condition().result_type()->is_primitive()) {
     if (node.condition().result_type()->as_primitive().type !=
@@ -615,20 +846,10 @@ void Validator::validate_if(const IfNode &node) {
       add_error(node.condition().location(), "condition should return bool");
     }
   }
-
-  create_stack_frame();
-  validate_node_list(node.then_block());
-  release_stack_frame();
-
-  if (node.has_else()) {
-    create_stack_frame();
-    validate_node_list(node.else_block());
-    release_stack_frame();
-  }
 }
 
 void Validator::validate_block(const BlockNode &node) {
-  validate_node_list(node.statements());
+  schedule_list(node.statements());
 }
 
 bool Validator::check_type_assignment(AstNode &value_node,
@@ -10,6 +10,7 @@
 namespace cha {
 
 // Forward declarations
+class ConstEvaluator;
 class SymbolTable;
 class Validator;
 
@@ -84,15 +85,65 @@ class Validator {
 public:
   Validator();
 
+  // Make a function defined in another module of the same program callable
+  void declare_external(const FunctionDeclarationNode &node);
+
+  // Make a folded constant of another module usable
+  void declare_external(const ConstantDeclarationNode &node);
+
+  // Make a validated function of the same module, checked separately,
+  // callable. Its body comes along so constants can call it too.
+  void declare_sibling(const FunctionDeclarationNode &node);
+
   // Main validation entry point - throws ValidationException or
   // MultipleValidationException
   void validate(const AstNodeList &ast);
 
+  // Validate a module one top-level declaration at a time instead, e.g.
+  // while it is parsed. Declarations only see the externals and what was
+  // declared before them: a function is declared before the functions
+  // calling it are validated, a constant as it is validated. Constants are
+  // folded right away and must outlive the validator. Both throw like
+  // validate(), the next declaration can be validated after an error.
+  void declare_function(const FunctionDeclarationNode &node);
+  void validate_declaration(AstNode &node);
+
 private:
+  // A step of validate_node(). Generated sources nest expressions and ifs
+  // arbitrarily deep, so nodes are walked with an explicit stack: entering a
+  // node schedules its children, then the checks needing their types.
+  struct Step {
+    enum Kind {
+      ENTER,
+      DECLARE_CONSTANT,
+      DECLARE_VARIABLE,
+      CHECK_ASSIGNMENT,
+      CHECK_BINARY_OP,
+      CHECK_UNARY_OP,
+      CHECK_CALL_ARGUMENT,
+      CHECK_RETURN,
+      CHECK_CONDITION,
+      OPEN_SCOPE,
+      CLOSE_SCOPE,
+    };
+    Kind kind;
+    const AstNode *node;
+    // Argument checked by CHECK_CALL_ARGUMENT
+    size_t index;
+  };
+
   // Validation methods for different node types
   void validate_top_level(const AstNodeList &nodes);
   void validate_node_list(const AstNodeList &nodes);
   void validate_node(const AstNode &node);
+  void enter_node(const AstNode &node);
+  void run_step(const Step &step);
+  void schedule(Step::Kind kind, const AstNode &node, size_t index = 0);
+  void schedule_list(const AstNodeList &nodes);
+  void fold_constants(const AstNodeList &nodes);
+  void fold_constant(ConstEvaluator &evaluator, ConstantDeclarationNode &node);
+  void reset_symbol_table();
+  void start_declarations();
 
   void validate_function_declaration(const FunctionDeclarationNode &node);
   void validate_constant_declaration(const ConstantDeclarationNode &node);
@@ -109,6 +160,16 @@ private:
   void validate_if(const IfNode &node);
   void validate_block(const BlockNode &node);
 
+  // Checks run once the children of a node are validated
+  void declare_constant(const ConstantDeclarationNode &node);
+  void declare_variable(const VariableDeclarationNode &node);
+  void check_assignment(const VariableAssignmentNode &node);
+  void check_binary_op(BinaryOpNode &node);
+  void check_unary_op(UnaryOpNode &node);
+  void check_call_argument(FunctionCallNode &node, size_t index);
+  void check_return(const FunctionReturnNode &node);
+  void check_condition(const IfNode &node);
+
   // Helper methods
   bool check_type_assignment(AstNode &value_node, const AstType &expected_type);
   void create_stack_frame();
@@ -116,9 +177,16 @@ private:
   void add_error(const AstLocation &location, const std::string &message);
 
   // State
+  AstNodeList externals_;
   std::shared_ptr<SymbolTable> symbol_table_;
   std::vector<ValidationException> errors_;
   const FunctionDeclarationNode *current_function_;
+  std::vector<Step> steps_;
+
+  // Set while validating one declaration at a time, the evaluator keeps the
+  // values of the constants folded so far
+  bool declaring_ = false;
+  std::shared_ptr<ConstEvaluator> evaluator_;
 };
 
 } // namespace cha
@@ -0,0 +1,384 @@
+#include "vm.hpp"
+
+#include <algorithm>
+#include <limits>
+
+// Threaded dispatch jumps straight from one handler to the next instead of
+// going back through a switch
+#if defined(__GNUC__) || defined(__clang__)
+#define CHA_VM_COMPUTED_GOTO 1
+#endif
+
+namespace cha {
+
+namespace {
+
+inline int64_t sign_extend(uint64_t value, unsigned shift) {
+  return static_cast<int64_t>(value << shift) >> shift;
+}
+
+inline uint64_t zero_extend(uint64_t value, unsigned shift) {
+  return (value << shift) >> shift;
+}
+
+// Same messages as the traps of the interpreted instructions
+const char *trap_message(uint32_t trap) {
+  switch (trap) {
+  case NativeCall::DIVISION_BY_ZERO:
+    return "division by zero";
+  case NativeCall::DIVISION_OVERFLOW:
+    return "integer overflow in division";
+  default:
+    return "call stack overflow";
+  }
+}
+
+} // namespace
+
+VirtualMachine::VirtualMachine(const BytecodeProgram &program)
+    : program_(program), native_(program.functions.size()),
+      calls_(program.functions.size(), 0) {
+  for (auto &native : native_) {
+    native.store(nullptr, std::memory_order_relaxed);
+  }
+}
+
+void VirtualMachine::set_tier_up(TierUp *tier_up, uint32_t threshold) {
+  tier_up_ = tier_up;
+  tier_up_threshold_ = threshold;
+}
+
+void VirtualMachine::install(size_t function, NativeFunction code) {
+  native_.at(function).store(code, std::memory_order_release);
+}
+
+bool VirtualMachine::is_native(size_t function) const {
+  return native_.at(function).load(std::memory_order_acquire) != nullptr;
+}
+
+void VirtualMachine::trap(const BytecodeFunction &function,
+                          const Instruction *pc, const std::string &message) {
+  auto location =
+      function.trap_locations.find(pc - function.code.data());
+  if (location != function.trap_locations.end()) {
+    throw InterpreterException(location->second, message);
+  }
+  throw InterpreterException(message + " in '" + function.name + "'");
+}
+
+Value VirtualMachine::run(size_t function_index) {
+  const BytecodeFunction *function = &program_.functions.at(function_index);
+  const Value *constants = program_.constants.data();
+
+  registers_.assign(std::max<size_t>(function->registers, 256), Value{});
+  frames_.clear();
+
+  size_t base = 0;
+  Value *regs = registers_.data();
+  const Instruction *pc = function->code.data();
+
+#define R(operand) regs[pc->operand]
+#define NEXT()                                                                 \
+  ++pc;                                                                        \
+  DISPATCH()
+
+#ifdef CHA_VM_COMPUTED_GOTO
+  // Same order as Opcode
+  static const void *const dispatch_table[] = {
+      &&op_LOAD_CONST, &&op_MOVE,     &&op_SEXT,     &&op_ZEXT,
+      &&op_FTRUNC,     &&op_SITOF,    &&op_UITOF,    &&op_ADD,
+      &&op_SUB,        &&op_MUL,      &&op_SDIV,     &&op_UADD,
+      &&op_USUB,       &&op_UMUL,     &&op_UDIV,     &&op_NEG,
+      &&op_UNEG,       &&op_FADD,     &&op_FSUB,     &&op_FMUL,
+      &&op_FDIV,       &&op_FNEG,     &&op_EQ,       &&op_NE,
+      &&op_SLT,        &&op_SLE,      &&op_SGT,      &&op_SGE,
+      &&op_ULT,        &&op_ULE,      &&op_UGT,      &&op_UGE,
+      &&op_FEQ,        &&op_FNE,      &&op_FLT,      &&op_FLE,
+      &&op_FGT,        &&op_FGE,      &&op_AND,      &&op_OR,
+      &&op_NOT,        &&op_JUMP,     &&op_JUMP_IF_FALSE,
+      &&op_CALL,       &&op_RET,      &&op_RET_VOID,
+  };
+  static_assert(sizeof(dispatch_table) / sizeof(dispatch_table[0]) ==
+                    static_cast<size_t>(Opcode::RET_VOID) + 1,
+                "dispatch table does not match Opcode");
+
+#define TARGET(name) op_##name:
+#define DISPATCH() goto *dispatch_table[static_cast<uint8_t>(pc->op)]
+
+  DISPATCH();
+#else
+#define TARGET(name) case Opcode::name:
+#define DISPATCH() continue
+
+  for (;;) {
+    switch (pc->op) {
+#endif
+
+  TARGET(LOAD_CONST) {
+    R(a) = constants[pc->b];
+    NEXT();
+  }
+  TARGET(MOVE) {
+    R(a) = R(b);
+    NEXT();
+  }
+  TARGET(SEXT) {
+    R(a).i = sign_extend(R(b).u, pc->shift);
+    NEXT();
+  }
+  TARGET(ZEXT) {
+    R(a).u = zero_extend(R(b).u, pc->shift);
+    NEXT();
+  }
+  TARGET(FTRUNC) {
+    R(a).f = static_cast<float>(R(b).f);
+    NEXT();
+  }
+  TARGET(SITOF) {
+    R(a).f = static_cast<double>(R(b).i);
+    NEXT();
+  }
+  TARGET(UITOF) {
+    R(a).f = static_cast<double>(R(b).u);
+    NEXT();
+  }
+
+  // Integer arithmetic wraps around like the generated code
+  TARGET(ADD) {
+    R(a).i = sign_extend(R(b).u + R(c).u, pc->shift);
+    NEXT();
+  }
+  TARGET(SUB) {
+    R(a).i = sign_extend(R(b).u - R(c).u, pc->shift);
+    NEXT();
+  }
+  TARGET(MUL) {
+    R(a).i = sign_extend(R(b).u * R(c).u, pc->shift);
+    NEXT();
+  }
+  TARGET(SDIV) {
+    if (R(c).i == 0) {
+      trap(*function, pc, "division by zero");
+    }
+    if (R(b).i == std::numeric_limits<int64_t>::min() && R(c).i == -1) {
+      trap(*function, pc, "integer overflow in division");
+    }
+    R(a).i = sign_extend(static_cast<uint64_t>(R(b).i / R(c).i), pc->shift);
+    NEXT();
+  }
+  TARGET(UADD) {
+    R(a).u = zero_extend(R(b).u + R(c).u, pc->shift);
+    NEXT();
+  }
+  TARGET(USUB) {
+    R(a).u = zero_extend(R(b).u - R(c).u, pc->shift);
+    NEXT();
+  }
+  TARGET(UMUL) {
+    R(a).u = zero_extend(R(b).u * R(c).u, pc->shift);
+    NEXT();
+  }
+  TARGET(UDIV) {
+    if (R(c).u == 0) {
+      trap(*function, pc, "division by zero");
+    }
+    R(a).u = R(b).u / R(c).u;
+    NEXT();
+  }
+  TARGET(NEG) {
+    R(a).i = sign_extend(0 - R(b).u, pc->shift);
+    NEXT();
+  }
+  TARGET(UNEG) {
+    R(a).u = zero_extend(0 - R(b).u, pc->shift);
+    NEXT();
+  }
+  TARGET(FADD) {
+    R(a).f = R(b).f + R(c).f;
+    NEXT();
+  }
+  TARGET(FSUB) {
+    R(a).f = R(b).f - R(c).f;
+    NEXT();
+  }
+  TARGET(FMUL) {
+    R(a).f = R(b).f * R(c).f;
+    NEXT();
+  }
+  TARGET(FDIV) {
+    R(a).f = R(b).f / R(c).f;
+    NEXT();
+  }
+  TARGET(FNEG) {
+    R(a).f = -R(b).f;
+    NEXT();
+  }
+
+  TARGET(EQ) {
+    R(a).i = R(b).i == R(c).i;
+    NEXT();
+  }
+  TARGET(NE) {
+    R(a).i = R(b).i != R(c).i;
+    NEXT();
+  }
+  TARGET(SLT) {
+    R(a).i = R(b).i < R(c).i;
+    NEXT();
+  }
+  TARGET(SLE) {
+    R(a).i = R(b).i <= R(c).i;
+    NEXT();
+  }
+  TARGET(SGT) {
+    R(a).i = R(b).i > R(c).i;
+    NEXT();
+  }
+  TARGET(SGE) {
+    R(a).i = R(b).i >= R(c).i;
+    NEXT();
+  }
+  TARGET(ULT) {
+    R(a).i = R(b).u < R(c).u;
+    NEXT();
+  }
+  TARGET(ULE) {
+    R(a).i = R(b).u <= R(c).u;
+    NEXT();
+  }
+  TARGET(UGT) {
+    R(a).i = R(b).u > R(c).u;
+    NEXT();
+  }
+  TARGET(UGE) {
+    R(a).i = R(b).u >= R(c).u;
+    NEXT();
+  }
+  TARGET(FEQ) {
+    R(a).i = R(b).f == R(c).f;
+    NEXT();
+  }
+  TARGET(FNE) {
+    // Ordered comparison, like the generated code
+    R(a).i = R(b).f < R(c).f || R(b).f > R(c).f;
+    NEXT();
+  }
+  TARGET(FLT) {
+    R(a).i = R(b).f < R(c).f;
+    NEXT();
+  }
+  TARGET(FLE) {
+    R(a).i = R(b).f <= R(c).f;
+    NEXT();
+  }
+  TARGET(FGT) {
+    R(a).i = R(b).f > R(c).f;
+    NEXT();
+  }
+  TARGET(FGE) {
+    R(a).i = R(b).f >= R(c).f;
+    NEXT();
+  }
+  TARGET(AND) {
+    R(a).i = R(b).i & R(c).i;
+    NEXT();
+  }
+  TARGET(OR) {
+    R(a).i = R(b).i | R(c).i;
+    NEXT();
+  }
+  TARGET(NOT) {
+    R(a).i = !R(b).i;
+    NEXT();
+  }
+
+  TARGET(JUMP) {
+    pc = function->code.data() + pc->b;
+    DISPATCH();
+  }
+  TARGET(JUMP_IF_FALSE) {
+    if (R(a).i) {
+      ++pc;
+    } else {
+      pc = function->code.data() + pc->b;
+    }
+    DISPATCH();
+  }
+  TARGET(CALL) {
+    // Hot functions continue in native code once it is installed
+    NativeFunction native = native_[pc->b].load(std::memory_order_acquire);
+    if (native) {
+      NativeCall call{frames_.size(), NativeCall::NONE};
+      R(a).u = native(regs + pc->c, &call);
+      if (call.trap != NativeCall::NONE) {
+        trap(*function, pc, trap_message(call.trap));
+      }
+      NEXT();
+    }
+    if (tier_up_ && ++calls_[pc->b] == tier_up_threshold_) {
+      tier_up_->request(pc->b);
+    }
+
+    const BytecodeFunction *callee = &program_.functions[pc->b];
+    if (frames_.size() >= VM_MAX_CALL_DEPTH) {
+      trap(*function, pc, "call stack overflow");
+    }
+
+    // The callee's registers start after the caller's
+    size_t callee_base = base + function->registers;
+    size_t needed = callee_base + callee->registers;
+    if (needed > registers_.size()) {
+      registers_.resize(std::max(needed, registers_.size() * 2));
+      regs = registers_.data() + base;
+    }
+    Value *callee_regs = registers_.data() + callee_base;
+    std::copy(regs + pc->c, regs + pc->c + callee->arguments, callee_regs);
+
+    frames_.push_back(Frame{function, pc + 1, base, pc->a});
+    function = callee;
+    base = callee_base;
+    regs = callee_regs;
+    pc = callee->code.data();
+    DISPATCH();
+  }
+  TARGET(RET) {
+    Value result = R(a);
+    if (frames_.empty()) {
+      return result;
+    }
+
+    const Frame &frame = frames_.back();
+    function = frame.function;
+    base = frame.base;
+    regs = registers_.data() + base;
+    regs[frame.result] = result;
+    pc = frame.return_pc;
+    frames_.pop_back();
+    DISPATCH();
+  }
+  TARGET(RET_VOID) {
+    if (frames_.empty()) {
+      return Value{};
+    }
+
+    const Frame &frame = frames_.back();
+    function = frame.function;
+    base = frame.base;
+    regs = registers_.data() + base;
+    pc = frame.return_pc;
+    frames_.pop_back();
+    DISPATCH();
+  }
+
+#ifndef CHA_VM_COMPUTED_GOTO
+    }
+  }
+#endif
+
+#undef R
+#undef NEXT
+#undef TARGET
+#undef DISPATCH
+}
+
+} // namespace cha
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "bytecode.hpp"
+#include "exceptions.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace cha {
+
+// Calls deeper than this fail instead of exhausting memory
+constexpr size_t VM_MAX_CALL_DEPTH = 100000;
+
+// State the interpreter shares with a call to native code. The native calls
+// continue the interpreter's call depth, and a trap in native code returns
+// to the interpreter with its kind set instead of crashing the process.
+struct NativeCall {
+  enum Trap : uint32_t {
+    NONE,
+    DIVISION_BY_ZERO,
+    DIVISION_OVERFLOW,
+    STACK_OVERFLOW,
+  };
+  uint64_t depth;
+  uint32_t trap;
+};
+
+// Native code for a function: takes the arguments as an array of registers
+// and returns the result in the representation of a register
+using NativeFunction = uint64_t (*)(const Value *arguments, NativeCall *call);
+
+// Receives the functions that became hot in a VirtualMachine
+class TierUp {
+public:
+  virtual ~TierUp() = default;
+
+  // Called on the interpreter's thread, must not block it
+  virtual void request(size_t function) = 0;
+};
+
+// Interprets a BytecodeProgram. Frames share one register stack and calls
+// do not recurse on the native stack.
+class VirtualMachine {
+public:
+  explicit VirtualMachine(const BytecodeProgram &program);
+
+  // Run a function with all arguments zero and return its result - throws
+  // InterpreterException on division by zero or call stack overflow
+  Value run(size_t function);
+
+  // Report each function to tier_up once it has been called threshold times
+  void set_tier_up(TierUp *tier_up, uint32_t threshold);
+
+  // Make calls to a function run native code from now on. Safe to call from
+  // any thread while the machine runs.
+  void install(size_t function, NativeFunction code);
+  bool is_native(size_t function) const;
+
+private:
+  struct Frame {
+    const BytecodeFunction *function;
+    const Instruction *return_pc;
+    size_t base;
+    uint32_t result;
+  };
+
+  const BytecodeProgram &program_;
+  std::vector<Value> registers_;
+  std::vector<Frame> frames_;
+
+  std::vector<std::atomic<NativeFunction>> native_;
+  std::vector<uint32_t> calls_;
+  TierUp *tier_up_ = nullptr;
+  uint32_t tier_up_threshold_ = 0;
+
+  [[noreturn]] void trap(const BytecodeFunction &function,
+                         const Instruction *pc, const std::string &message);
+};
+
+} // namespace cha
@@ -0,0 +1,182 @@
+#include "watch.hpp"
+#include "exceptions.hpp"
+
+#include <cerrno>
+#include <cstring>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#else
+#include <chrono>
+#include <thread>
+#endif
+
+namespace cha {
+
+#ifdef __linux__
+
+namespace {
+
+constexpr uint32_t WATCH_EVENTS =
+    IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_MODIFY;
+
+} // namespace
+
+FileWatcher::FileWatcher(const std::vector<std::string> &files)
+    : fd_(inotify_init1(IN_CLOEXEC)) {
+  if (fd_ < 0) {
+    throw ChaException(std::string("could not start watching files: ") +
+                       std::strerror(errno));
+  }
+
+  try {
+    add(files);
+  } catch (...) {
+    close(fd_);
+    throw;
+  }
+}
+
+void FileWatcher::add(const std::vector<std::string> &files) {
+  for (const auto &file : files) {
+    size_t slash = file.rfind('/');
+    std::string directory =
+        slash == std::string::npos ? "." : file.substr(0, slash + 1);
+    std::string name =
+        slash == std::string::npos ? file : file.substr(slash + 1);
+
+    auto watch = watches_.find(directory);
+    if (watch == watches_.end()) {
+      int wd = inotify_add_watch(fd_, directory.c_str(), WATCH_EVENTS);
+      if (wd < 0) {
+        throw ChaException("could not watch " + directory + ": " +
+                           std::strerror(errno));
+      }
+      watch = watches_.emplace(directory, wd).first;
+    }
+    directories_[watch->second].insert(name);
+  }
+}
+
+FileWatcher::~FileWatcher() { close(fd_); }
+
+bool FileWatcher::read_events() {
+  alignas(struct inotify_event) char buffer[16384];
+  ssize_t size = read(fd_, buffer, sizeof(buffer));
+  if (size <= 0) {
+    return false;
+  }
+
+  bool relevant = false;
+  for (char *position = buffer; position < buffer + size;) {
+    auto event = reinterpret_cast<const struct inotify_event *>(position);
+    auto directory = directories_.find(event->wd);
+    if (event->len > 0 && directory != directories_.end() &&
+        directory->second.count(event->name)) {
+      relevant = true;
+    }
+    position += sizeof(struct inotify_event) + event->len;
+  }
+  return relevant;
+}
+
+bool FileWatcher::wait(int settle_ms) {
+  for (;;) {
+    struct pollfd descriptor = {fd_, POLLIN, 0};
+    if (poll(&descriptor, 1, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    if (read_events()) {
+      break;
+    }
+  }
+
+  // Saving a file often takes several writes and renames
+  for (;;) {
+    struct pollfd descriptor = {fd_, POLLIN, 0};
+    int ready = poll(&descriptor, 1, settle_ms);
+    if (ready == 0) {
+      return true;
+    }
+    if (ready < 0 && errno != EINTR) {
+      return false;
+    }
+    if (ready > 0) {
+      read_events();
+    }
+  }
+}
+
+#else
+
+namespace {
+
+constexpr auto POLL_INTERVAL = std::chrono::milliseconds(20);
+
+} // namespace
+
+FileWatcher::FileWatcher(const std::vector<std::string> &files) {
+  add(files);
+}
+
+FileWatcher::~FileWatcher() = default;
+
+FileWatcher::Stamp FileWatcher::stamp(const std::string &file) {
+  std::error_code error;
+  auto time = std::filesystem::last_write_time(file, error);
+  if (error) {
+    return Stamp();
+  }
+  return Stamp(time, std::filesystem::file_size(file, error));
+}
+
+void FileWatcher::add(const std::vector<std::string> &files) {
+  for (const auto &file : files) {
+    if (files_.count(file)) {
+      continue;
+    }
+    // Like inotify, files may come and go but their directory must exist
+    size_t slash = file.rfind('/');
+    std::string directory =
+        slash == std::string::npos ? "." : file.substr(0, slash + 1);
+    std::error_code error;
+    if (!std::filesystem::is_directory(directory, error)) {
+      throw ChaException("could not watch " + directory + ": " +
+                         std::strerror(ENOENT));
+    }
+    files_.emplace(file, stamp(file));
+  }
+}
+
+bool FileWatcher::poll_files() {
+  bool changed = false;
+  for (auto &file : files_) {
+    Stamp current = stamp(file.first);
+    if (current != file.second) {
+      file.second = current;
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+bool FileWatcher::wait(int settle_ms) {
+  while (!poll_files()) {
+    std::this_thread::sleep_for(POLL_INTERVAL);
+  }
+
+  // Saving a file often takes several writes and renames
+  do {
+    std::this_thread::sleep_for(std::chrono::milliseconds(settle_ms));
+  } while (poll_files());
+  return true;
+}
+
+#endif
+
+} // namespace cha
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#ifndef __linux__
+#include <cstdint>
+#include <filesystem>
+#endif
+
+namespace cha {
+
+// Waits for changes to a set of files. On Linux, the directories of the
+// files are watched with inotify rather than the files themselves, so files
+// that editors replace by renaming a new version over them keep being
+// watched. Elsewhere the modification time and size of the files are polled.
+class FileWatcher {
+public:
+  // Throws ChaException when the files cannot be watched
+  explicit FileWatcher(const std::vector<std::string> &files);
+  ~FileWatcher();
+
+  FileWatcher(const FileWatcher &) = delete;
+  FileWatcher &operator=(const FileWatcher &) = delete;
+
+  // Also watch files found while building, e.g. imported interfaces. Files
+  // already watched are ignored - throws ChaException
+  void add(const std::vector<std::string> &files);
+
+  // Block until one of the files is written, created or renamed over, then
+  // until the burst of events that usually follows has settled for
+  // settle_ms. Returns false when watching failed.
+  bool wait(int settle_ms = 50);
+
+private:
+#ifdef __linux__
+  int fd_;
+  // Watch of each watched directory
+  std::map<std::string, int> watches_;
+  // Names of the watched files in each watched directory
+  std::map<int, std::set<std::string>> directories_;
+
+  // Read the pending events, true when one of them is about a watched file
+  bool read_events();
+#else
+  // Modification time and size of a file, missing files have neither
+  using Stamp = std::pair<std::filesystem::file_time_type, uintmax_t>;
+  std::map<std::string, Stamp> files_;
+
+  static Stamp stamp(const std::string &file);
+  // Stamp the files again, true when one of them changed
+  bool poll_files();
+#endif
+};
+
+} // namespace cha
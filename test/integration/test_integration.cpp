@@ -1,7 +1,9 @@
+#include <chrono>
 #include <cstdlib>
 #include <filesystem>
 #include <fstream>
 #include <gtest/gtest.h>
+#include <iterator>
 #include <memory>
 #include <string>
 #include <sys/wait.h>
@@ -23,6 +25,13 @@ protected:
   void cleanup() {
     std::remove("out.ll");
     std::remove("out");
+    std::remove("out.chast");
+    std::remove("out.chai");
+    std::remove("out.bc");
+    std::remove("out.s");
+    std::remove("out.o");
+    std::remove("out.profraw");
+    std::remove("out.profdata");
   }
 
   // Helper to run a command and capture its output
@@ -174,6 +183,19 @@ TEST_F(IntegrationTest, ValidationFunctionNotFound) {
                            "function 'test' not found");
 }
 
+TEST_F(IntegrationTest, CheckOnlyValidates) {
+  auto result =
+      runCommand("./build/cha --check test/integration/import_main.cha "
+                 "test/integration/import_lib.cha");
+  EXPECT_EQ(result.exit_code, 0) << "Output: " << result.output;
+
+  result = runCommand(
+      "./build/cha --check test/integration/validation_function_not_found.cha");
+  EXPECT_NE(result.exit_code, 0);
+  EXPECT_NE(result.output.find("function 'test' not found"), std::string::npos)
+      << "Actual output: '" << result.output << "'";
+}
+
 TEST_F(IntegrationTest, ValidationRetMismatch) {
   expectCompilationFailure("validation_ret_mismatch.cha",
                            "return type mismatch expects 'int' passed 'uint8'");
@@ -228,6 +250,767 @@ TEST_F(IntegrationTest, TestBin) {
   outFile.close();
 }
 
+// Binary AST Tests
+TEST_F(IntegrationTest, EmitAndLoadAst) {
+  auto emitResult = runCommand(
+      "./build/cha --emit-ast out.chast test/integration/validation_passes.cha");
+  EXPECT_EQ(emitResult.exit_code, 0) << "Output: " << emitResult.output;
+
+  auto loadResult = runCommand("./build/cha --load-ast -ll out.ll out.chast");
+  EXPECT_EQ(loadResult.exit_code, 0) << "Output: " << loadResult.output;
+
+  std::ifstream outFile("out.ll");
+  EXPECT_TRUE(outFile.good()) << "Output file should be created";
+}
+
+TEST_F(IntegrationTest, LoadAstRejectsSource) {
+  auto result = runCommand(
+      "./build/cha --load-ast -ll out.ll test/integration/parse_passes.cha");
+  EXPECT_NE(result.exit_code, 0);
+  EXPECT_TRUE(result.output.find("not a binary AST file") != std::string::npos)
+      << "Actual output: '" << result.output << "'";
+}
+
+// Bitcode and ThinLTO Tests
+TEST_F(IntegrationTest, EmitBitcode) {
+  auto result = runCommand(
+      "./build/cha -bc out.bc test/integration/validation_passes.cha");
+  EXPECT_EQ(result.exit_code, 0) << "Output: " << result.output;
+
+  std::ifstream outFile("out.bc", std::ios::binary);
+  char magic[2] = {};
+  outFile.read(magic, sizeof(magic));
+  EXPECT_TRUE(outFile.good()) << "Output file should be created";
+  EXPECT_EQ(std::string(magic, 2), "BC");
+}
+
+TEST_F(IntegrationTest, EmitSeveralFormats) {
+  auto result =
+      runCommand("./build/cha --emit=llvm-ir,asm,obj,exe,bc out "
+                 "test/integration/export_function.cha");
+  ASSERT_EQ(result.exit_code, 0) << "Output: " << result.output;
+  for (const char *file : {"out.ll", "out.s", "out.o", "out", "out.bc"}) {
+    EXPECT_TRUE(fs::exists(file)) << file;
+  }
+  // The module has exports, its interface is written too
+  EXPECT_TRUE(fs::exists("out.chai"));
+
+  std::ifstream ir("out.ll");
+  std::string text((std::istreambuf_iterator<char>(ir)),
+                   std::istreambuf_iterator<char>());
+  EXPECT_NE(text.find("@area("), std::string::npos);
+
+  // main returns half(area(2, 3))
+  auto runResult = runCommand("./out");
+  EXPECT_EQ(WEXITSTATUS(runResult.exit_code), 3);
+
+  result = runCommand("./build/cha --emit=llvm-ir,wasm out "
+                      "test/integration/export_function.cha");
+  EXPECT_NE(result.exit_code, 0);
+  EXPECT_NE(result.output.find("invalid --emit format: wasm"),
+            std::string::npos)
+      << "Actual output: '" << result.output << "'";
+}
+
+TEST_F(IntegrationTest, FastCompileBinary) {
+  auto result = runCommand("./build/cha --fast-compile -o out "
+                           "test/integration/export_function.cha");
+  ASSERT_EQ(result.exit_code, 0) << "Output: " << result.output;
+
+  // Unoptimized code computes the same half(area(2, 3))
+  auto runResult = runCommand("./out");
+  EXPECT_EQ(WEXITSTATUS(runResult.exit_code), 3);
+}
+
+TEST_F(IntegrationTest, StreamingCompile) {
+  // main waits for OFFSET, declared after it, until the end of the file
+  for (const std::string options : {"", "--stream "}) {
+    auto result = runCommand("./build/cha " + options +
+                             "-o out test/integration/stream_forward.cha");
+    ASSERT_EQ(result.exit_code, 0) << "Output: " << result.output;
+    EXPECT_EQ(WEXITSTATUS(runCommand("./out").exit_code), 22) << options;
+  }
+
+  // Constants calling functions are compiled with the whole module
+  auto result =
+      runCommand("./build/cha --stream -o out test/integration/const_eval.cha");
+  ASSERT_EQ(result.exit_code, 0) << "Output: " << result.output;
+  EXPECT_EQ(WEXITSTATUS(runCommand("./out").exit_code), 11);
+
+  result = runCommand("./build/cha --stream -ll out.ll "
+                      "test/integration/validation_var_not_found.cha");
+  EXPECT_NE(result.exit_code, 0);
+  EXPECT_NE(result.output.find("'a' not found"), std::string::npos)
+      << "Output: " << result.output;
+
+  result = runCommand("./build/cha --stream -ll out.ll "
+                      "test/integration/parse_failure.cha");
+  EXPECT_NE(result.exit_code, 0);
+  EXPECT_NE(result.output.find("unexpected character"), std::string::npos)
+      << "Output: " << result.output;
+}
+
+TEST_F(IntegrationTest, LazyBodies) {
+  // The body of unused does not parse, and nothing calls it
+  auto result = runCommand("./build/cha -ll out.ll "
+                           "test/integration/lazy_unused.cha");
+  EXPECT_NE(result.exit_code, 0);
+
+  result = runCommand("./build/cha --lazy-bodies -o out "
+                      "test/integration/lazy_unused.cha");
+  ASSERT_EQ(result.exit_code, 0) << "Output: " << result.output;
+  EXPECT_EQ(WEXITSTATUS(runCommand("./out").exit_code), 16);
+
+  // Reached bodies are validated as usual
+  result = runCommand("./build/cha --lazy-bodies -ll out.ll "
+                      "test/integration/validation_var_not_found.cha");
+  EXPECT_NE(result.exit_code, 0);
+  EXPECT_NE(result.output.find("'a' not found"), std::string::npos)
+      << "Output: " << result.output;
+}
+
+TEST_F(IntegrationTest, ThinLtoLinksModules) {
+  auto compileResult = runCommand("./build/cha -o out "
+                                  "test/integration/lto_main.cha "
+                                  "test/integration/lto_lib.cha");
+  ASSERT_EQ(compileResult.exit_code, 0) << "Output: " << compileResult.output;
+
+  // main returns square(5) - 20
+  auto runResult = runCommand("./out");
+  EXPECT_EQ(WEXITSTATUS(runResult.exit_code), 5);
+}
+
+TEST_F(IntegrationTest, ThinLtoLinksBitcode) {
+  auto emitResult =
+      runCommand("./build/cha -bc out.bc test/integration/lto_lib.cha");
+  ASSERT_EQ(emitResult.exit_code, 0) << "Output: " << emitResult.output;
+
+  // Bitcode inputs are link-only, so main cannot call into them yet
+  auto linkResult =
+      runCommand("./build/cha -o out out.bc test/integration/test_bin.cha");
+  EXPECT_EQ(linkResult.exit_code, 0) << "Output: " << linkResult.output;
+
+  std::ifstream outFile("out");
+  EXPECT_TRUE(outFile.good()) << "Output file should be created";
+}
+
+TEST_F(IntegrationTest, MultipleInputsRequireBinary) {
+  auto result = runCommand("./build/cha -ll out.ll "
+                           "test/integration/lto_main.cha "
+                           "test/integration/lto_lib.cha");
+  EXPECT_NE(result.exit_code, 0);
+  EXPECT_TRUE(result.output.find("require binary output") != std::string::npos)
+      << "Actual output: '" << result.output << "'";
+}
+
+// Profile Guided Optimization Tests
+TEST_F(IntegrationTest, ProfileGenerateAndUse) {
+  auto instrumentResult =
+      runCommand("./build/cha --profile-generate=out.profraw -o out "
+                 "test/integration/pgo_branch.cha");
+  ASSERT_EQ(instrumentResult.exit_code, 0)
+      << "Output: " << instrumentResult.output;
+
+  // main returns count(100) - 97, the profile is written on exit
+  auto trainResult = runCommand("./out");
+  EXPECT_EQ(WEXITSTATUS(trainResult.exit_code), 3);
+  ASSERT_TRUE(fs::exists("out.profraw")) << "Profile should be written";
+
+  auto mergeResult =
+      runCommand("./build/cha --merge-profile out.profdata out.profraw");
+  ASSERT_EQ(mergeResult.exit_code, 0) << "Output: " << mergeResult.output;
+
+  auto optimizeResult =
+      runCommand("./build/cha --profile-use=out.profdata -o out "
+                 "test/integration/pgo_branch.cha");
+  ASSERT_EQ(optimizeResult.exit_code, 0)
+      << "Output: " << optimizeResult.output;
+
+  auto runResult = runCommand("./out");
+  EXPECT_EQ(WEXITSTATUS(runResult.exit_code), 3);
+}
+
+TEST_F(IntegrationTest, ProfileUseMissingProfile) {
+  auto result = runCommand("./build/cha --profile-use=out.profdata -o out "
+                           "test/integration/pgo_branch.cha");
+  EXPECT_NE(result.exit_code, 0);
+  EXPECT_TRUE(result.output.find("Could not open profile") !=
+              std::string::npos)
+      << "Actual output: '" << result.output << "'";
+}
+
+TEST_F(IntegrationTest, SampleProfileUse) {
+  auto compileResult = runCommand(
+      "./build/cha --sample-profile=test/integration/pgo_branch.prof -o out "
+      "test/integration/pgo_branch.cha");
+  ASSERT_EQ(compileResult.exit_code, 0) << "Output: " << compileResult.output;
+
+  auto runResult = runCommand("./out");
+  EXPECT_EQ(WEXITSTATUS(runResult.exit_code), 3);
+}
+
+TEST_F(IntegrationTest, ProfilesAreExclusive) {
+  // Every command rejects them, not only the single output one
+  for (const char *command :
+       {"-o out test/integration/pgo_branch.cha",
+        "--emit=llvm-ir,obj out test/integration/pgo_branch.cha",
+        "build test/integration/missing.build"}) {
+    auto result = runCommand(
+        std::string("./build/cha --profile-generate "
+                    "--sample-profile=test/integration/pgo_branch.prof ") +
+        command);
+    EXPECT_NE(result.exit_code, 0) << command;
+    EXPECT_NE(result.output.find("are exclusive"), std::string::npos)
+        << command << ": " << result.output;
+  }
+  EXPECT_FALSE(std::ifstream("out.ll").good());
+}
+
+TEST_F(IntegrationTest, LineTablesOnly) {
+  auto result = runCommand("./build/cha -gline-tables-only -ll out.ll "
+                           "test/integration/pgo_branch.cha");
+  ASSERT_EQ(result.exit_code, 0) << "Output: " << result.output;
+
+  std::ifstream outFile("out.ll");
+  std::string ir((std::istreambuf_iterator<char>(outFile)),
+                 std::istreambuf_iterator<char>());
+  EXPECT_NE(ir.find("emissionKind: LineTablesOnly"), std::string::npos);
+  EXPECT_NE(ir.find("DISubprogram(name: \"count\""), std::string::npos);
+}
+
+TEST_F(IntegrationTest, FullDebugInfoAndFramePointers) {
+  auto result = runCommand("./build/cha -g -fno-omit-frame-pointer -ll out.ll "
+                           "test/integration/pgo_branch.cha");
+  ASSERT_EQ(result.exit_code, 0) << "Output: " << result.output;
+
+  std::ifstream outFile("out.ll");
+  std::string ir((std::istreambuf_iterator<char>(outFile)),
+                 std::istreambuf_iterator<char>());
+  EXPECT_NE(ir.find("emissionKind: FullDebug"), std::string::npos);
+  EXPECT_NE(ir.find("DILocalVariable(name: \"n\", arg: 1"), std::string::npos);
+  EXPECT_NE(ir.find("\"frame-pointer\"=\"all\""), std::string::npos);
+}
+
+TEST_F(IntegrationTest, DebugInfoBinary) {
+  auto result = runCommand("./build/cha -g -fno-omit-frame-pointer -o out "
+                           "test/integration/pgo_branch.cha");
+  ASSERT_EQ(result.exit_code, 0) << "Output: " << result.output;
+
+  auto runResult = runCommand("./out");
+  EXPECT_EQ(WEXITSTATUS(runResult.exit_code), 3);
+}
+
+// Linkage and Attribute Tests
+TEST_F(IntegrationTest, InternalFastccFunctions) {
+  auto result = runCommand(
+      "./build/cha -ll out.ll test/integration/export_function.cha");
+  ASSERT_EQ(result.exit_code, 0) << "Output: " << result.output;
+
+  std::ifstream outFile("out.ll");
+  std::string ir((std::istreambuf_iterator<char>(outFile)),
+                 std::istreambuf_iterator<char>());
+  EXPECT_NE(ir.find("define internal fastcc i32 @half("), std::string::npos);
+  EXPECT_NE(ir.find("call fastcc i32 @half("), std::string::npos);
+  EXPECT_NE(ir.find("define i32 @area("), std::string::npos);
+  EXPECT_NE(ir.find("define i32 @main("), std::string::npos);
+  EXPECT_NE(ir.find("memory(none)"), std::string::npos);
+  EXPECT_NE(ir.find("speculatable"), std::string::npos);
+}
+
+TEST_F(IntegrationTest, DeadFunctionsAreNotGenerated) {
+  // Without optimizations, only the generator can leave unused out
+  auto result = runCommand("./build/cha --fast-compile -ll out.ll "
+                           "test/integration/dead_function.cha");
+  ASSERT_EQ(result.exit_code, 0) << "Output: " << result.output;
+
+  std::ifstream outFile("out.ll");
+  std::string ir((std::istreambuf_iterator<char>(outFile)),
+                 std::istreambuf_iterator<char>());
+  EXPECT_EQ(ir.find("@unused("), std::string::npos);
+  EXPECT_NE(ir.find("@helper("), std::string::npos);
+  EXPECT_NE(ir.find("define i32 @api("), std::string::npos);
+
+  result = runCommand("./build/cha -o out test/integration/dead_function.cha");
+  ASSERT_EQ(result.exit_code, 0) << "Output: " << result.output;
+  EXPECT_EQ(WEXITSTATUS(runCommand("./out").exit_code), 4);
+}
+
+TEST_F(IntegrationTest, DeeplyNestedSources) {
+  // Generated sources a million nodes deep, far beyond what recursion on the
+  // native stack allows
+  const int depth = 1000000;
+  fs::remove_all("out_dir");
+  fs::create_directories("out_dir");
+  {
+    std::ofstream source("out_dir/deep_sum.cha");
+    source << "fun main() int {\n    var x int = 1\n    ret x";
+    for (int i = 0; i < depth; ++i) {
+      source << " + x";
+    }
+    source << "\n}\n";
+  }
+  // 1000001 truncated to the exit status, whichever way the source gets
+  // to the generator
+  for (const std::string options : {"", "--stream ", "--lazy-bodies "}) {
+    auto result = runCommand("./build/cha --fast-compile " + options +
+                             "-o out out_dir/deep_sum.cha");
+    ASSERT_EQ(result.exit_code, 0) << options << "Output: " << result.output;
+    EXPECT_EQ(WEXITSTATUS(runCommand("./out").exit_code), 65) << options;
+  }
+  auto result = runCommand(
+      "./build/cha --emit-ast out_dir/deep_sum.chast out_dir/deep_sum.cha");
+  ASSERT_EQ(result.exit_code, 0) << "Output: " << result.output;
+  result = runCommand("./build/cha --fast-compile --load-ast -o out "
+                      "out_dir/deep_sum.chast");
+  ASSERT_EQ(result.exit_code, 0) << "Output: " << result.output;
+  EXPECT_EQ(WEXITSTATUS(runCommand("./out").exit_code), 65);
+  result = runCommand("./build/cha interp out_dir/deep_sum.cha");
+  EXPECT_EQ(WEXITSTATUS(result.exit_code), 65) << "Output: " << result.output;
+
+  {
+    std::ofstream source("out_dir/deep_if.cha");
+    source << "fun main() int {\n";
+    for (int i = 0; i < depth; ++i) {
+      source << "if true {\n";
+    }
+    source << "ret -" << std::string(depth, '-') << "1\n"
+           << std::string(depth, '}') << "\nret 0\n}\n";
+  }
+  result = runCommand("./build/cha --check out_dir/deep_if.cha");
+  EXPECT_EQ(result.exit_code, 0) << "Output: " << result.output;
+  // ret of -1 gives the exit status 255
+  result = runCommand("./build/cha interp out_dir/deep_if.cha");
+  EXPECT_EQ(WEXITSTATUS(result.exit_code), 255) << "Output: " << result.output;
+  result = runCommand("./build/cha --lazy-bodies --emit-ast "
+                      "out_dir/deep_if.chast out_dir/deep_if.cha");
+  EXPECT_EQ(result.exit_code, 0) << "Output: " << result.output;
+  fs::remove_all("out_dir");
+}
+
+TEST_F(IntegrationTest, ExportedFunctionBinary) {
+  auto compileResult = runCommand(
+      "./build/cha -o out test/integration/export_function.cha");
+  ASSERT_EQ(compileResult.exit_code, 0) << "Output: " << compileResult.output;
+
+  // main returns half(area(2, 3))
+  auto runResult = runCommand("./out");
+  EXPECT_EQ(WEXITSTATUS(runResult.exit_code), 3);
+}
+
+TEST_F(IntegrationTest, ConstantsFoldFunctionCalls) {
+  auto compileResult =
+      runCommand("./build/cha -ll out.ll test/integration/const_eval.cha");
+  ASSERT_EQ(compileResult.exit_code, 0) << "Output: " << compileResult.output;
+
+  // Constants are emitted as immediates, not globals
+  std::ifstream outFile("out.ll");
+  std::string ir((std::istreambuf_iterator<char>(outFile)),
+                 std::istreambuf_iterator<char>());
+  EXPECT_EQ(ir.find("@LIMIT"), std::string::npos);
+  EXPECT_NE(ir.find("ret i32 11"), std::string::npos);
+
+  compileResult =
+      runCommand("./build/cha -o out test/integration/const_eval.cha");
+  ASSERT_EQ(compileResult.exit_code, 0) << "Output: " << compileResult.output;
+
+  // LIMIT is fib(10) * 2 + 1
+  auto runResult = runCommand("./out");
+  EXPECT_EQ(WEXITSTATUS(runResult.exit_code), 11);
+}
+
+TEST_F(IntegrationTest, ConstantsMatchRunTimeInShadowingBlocks) {
+  auto compileResult =
+      runCommand("./build/cha -o out test/integration/const_eval_shadow.cha");
+  ASSERT_EQ(compileResult.exit_code, 0) << "Output: " << compileResult.output;
+
+  // main returns the folded SHADOWED minus shadow() computed at run time
+  auto runResult = runCommand("./out");
+  EXPECT_EQ(WEXITSTATUS(runResult.exit_code), 0);
+}
+
+TEST_F(IntegrationTest, ConstantOverflowError) {
+  expectCompilationFailure("const_eval_overflow.cha",
+                           "overflow in constant evaluation");
+}
+
+TEST_F(IntegrationTest, InterpretMatchesBinary) {
+  for (const std::string file :
+       {"pgo_branch.cha", "export_function.cha", "const_eval.cha",
+        "vm_operators.cha"}) {
+    auto compileResult =
+        runCommand("./build/cha -o out test/integration/" + file);
+    ASSERT_EQ(compileResult.exit_code, 0) << "Output: " << compileResult.output;
+    auto binaryResult = runCommand("./out");
+
+    auto interpResult =
+        runCommand("./build/cha interp test/integration/" + file);
+    EXPECT_EQ(WEXITSTATUS(interpResult.exit_code),
+              WEXITSTATUS(binaryResult.exit_code))
+        << file << ": " << interpResult.output;
+  }
+}
+
+TEST_F(IntegrationTest, InterpretWithJit) {
+  for (const std::string file :
+       {"pgo_branch.cha", "export_function.cha", "vm_operators.cha"}) {
+    auto result = runCommand("./build/cha interp --jit-threshold=1 "
+                             "test/integration/" +
+                             file);
+    auto interpResult =
+        runCommand("./build/cha interp test/integration/" + file);
+    EXPECT_EQ(WEXITSTATUS(result.exit_code),
+              WEXITSTATUS(interpResult.exit_code))
+        << file << ": " << result.output;
+    EXPECT_EQ(result.output.find("JIT"), std::string::npos) << result.output;
+  }
+}
+
+TEST_F(IntegrationTest, InterpretWithJitTraps) {
+  // Native code reports the interpreter's traps instead of crashing
+  for (const auto &[file, message] :
+       {std::pair<std::string, std::string>{"vm_div_zero.cha",
+                                            "division by zero"},
+        {"jit_div_zero.cha", "division by zero"},
+        {"vm_stack_overflow.cha", "call stack overflow"}}) {
+    auto result = runCommand("./build/cha interp --jit-threshold=1 "
+                             "test/integration/" +
+                             file);
+    EXPECT_TRUE(WIFEXITED(result.exit_code)) << file;
+    EXPECT_EQ(WEXITSTATUS(result.exit_code), 1) << file;
+    EXPECT_NE(result.output.find("runtime error: " + message),
+              std::string::npos)
+        << file << ": " << result.output;
+  }
+}
+
+TEST_F(IntegrationTest, CompileEachIntoDirectory) {
+  fs::remove_all("out_dir");
+  auto result = runCommand("./build/cha -j2 -ll out_dir/ "
+                           "test/integration/pgo_branch.cha "
+                           "test/integration/export_function.cha "
+                           "test/integration/const_eval.cha");
+  EXPECT_EQ(result.exit_code, 0) << "Output: " << result.output;
+  EXPECT_TRUE(fs::exists("out_dir/pgo_branch.ll"));
+  EXPECT_TRUE(fs::exists("out_dir/export_function.ll"));
+  EXPECT_TRUE(fs::exists("out_dir/const_eval.ll"));
+
+  // A failing input does not stop the others
+  fs::remove_all("out_dir");
+  result = runCommand("./build/cha -c out_dir/ "
+                      "test/integration/validation_var_not_found.cha "
+                      "test/integration/pgo_branch.cha");
+  EXPECT_NE(result.exit_code, 0);
+  EXPECT_TRUE(fs::exists("out_dir/pgo_branch.o"));
+  fs::remove_all("out_dir");
+}
+
+TEST_F(IntegrationTest, ImportCompiledModule) {
+  fs::remove_all("out_dir");
+
+  // Compiling a module with exports writes its interface next to the output
+  auto result = runCommand("./build/cha -bc out_dir/ "
+                           "test/integration/import_lib.cha");
+  ASSERT_EQ(result.exit_code, 0) << "Output: " << result.output;
+  EXPECT_TRUE(fs::exists("out_dir/import_lib.chai"));
+
+  // The importer only reads the interface, the bitcode provides the code
+  result = runCommand("./build/cha -o out -I out_dir "
+                      "test/integration/import_main.cha "
+                      "out_dir/import_lib.bc");
+  ASSERT_EQ(result.exit_code, 0) << "Output: " << result.output;
+  // main returns area(6, 12) - 60
+  EXPECT_EQ(WEXITSTATUS(runCommand("./out").exit_code), 12);
+
+  result = runCommand("./build/cha -ll out.ll "
+                      "test/integration/import_main.cha");
+  EXPECT_NE(result.exit_code, 0);
+  EXPECT_NE(result.output.find("import_lib.chai"), std::string::npos)
+      << result.output;
+
+  result = runCommand("./build/cha interp -I out_dir "
+                      "test/integration/import_main.cha");
+  EXPECT_NE(result.exit_code, 0);
+  EXPECT_NE(result.output.find("cannot interpret"), std::string::npos)
+      << result.output;
+  fs::remove_all("out_dir");
+}
+
+TEST_F(IntegrationTest, ImportBetweenInputs) {
+  // Modules linked together resolve their imports without interface files
+  auto result = runCommand("./build/cha -o out "
+                           "test/integration/import_main.cha "
+                           "test/integration/import_lib.cha");
+  ASSERT_EQ(result.exit_code, 0) << "Output: " << result.output;
+  EXPECT_EQ(WEXITSTATUS(runCommand("./out").exit_code), 12);
+  EXPECT_FALSE(fs::exists("test/integration/import_lib.chai"));
+
+  // Only the exported functions of an imported input can be called
+  for (const char *mode : {"-o out", "--check"}) {
+    result = runCommand(std::string("./build/cha ") + mode +
+                        " test/integration/import_private.cha "
+                        "test/integration/import_lib.cha");
+    EXPECT_NE(result.exit_code, 0) << mode;
+    EXPECT_NE(result.output.find("function 'twice' not found"),
+              std::string::npos)
+        << mode << ": " << result.output;
+  }
+}
+
+TEST_F(IntegrationTest, InputsWithTheSameModuleName) {
+  fs::remove_all("out_dir");
+  fs::create_directories("out_dir/a");
+  fs::create_directories("out_dir/b");
+  fs::copy("test/integration/lto_lib.cha", "out_dir/a/util.cha");
+  std::ofstream("out_dir/b/util.cha") << "fun cube(a int) int {\n"
+                                      << "    ret a * a * a\n"
+                                      << "}\n";
+
+  for (const char *mode : {"-o out", "--check"}) {
+    auto result = runCommand(std::string("./build/cha ") + mode +
+                             " test/integration/lto_main.cha "
+                             "out_dir/a/util.cha out_dir/b/util.cha");
+    EXPECT_NE(result.exit_code, 0) << mode;
+    EXPECT_NE(result.output.find("are both module 'util'"),
+              std::string::npos)
+        << mode << ": " << result.output;
+  }
+  fs::remove_all("out_dir");
+}
+
+TEST_F(IntegrationTest, BuildProject) {
+  fs::remove_all("out_dir");
+  fs::create_directories("out_dir");
+  std::ofstream("out_dir/cha.build")
+      << "output = app\n"
+      << "sources = ../test/integration/import_main.cha\n"
+      << "sources = ../test/integration/import_lib.cha\n";
+
+  auto result = runCommand("./build/cha build out_dir/cha.build");
+  ASSERT_EQ(result.exit_code, 0) << "Output: " << result.output;
+  EXPECT_TRUE(fs::exists("out_dir/build/import_lib.chai"));
+  EXPECT_EQ(WEXITSTATUS(runCommand("./out_dir/app").exit_code), 12);
+
+  // Nothing changed, nothing is compiled or linked again
+  result = runCommand("./build/cha build out_dir/cha.build");
+  EXPECT_EQ(result.exit_code, 0) << "Output: " << result.output;
+  EXPECT_NE(result.output.find("0 compiled, 2 up to date"), std::string::npos)
+      << result.output;
+  EXPECT_EQ(result.output.find("linked"), std::string::npos)
+      << result.output;
+  fs::remove_all("out_dir");
+}
+
+TEST_F(IntegrationTest, WatchRebuildsChangedModules) {
+  fs::remove_all("out_dir");
+  fs::create_directories("out_dir");
+  fs::copy("test/integration/import_main.cha", "out_dir/import_main.cha");
+  fs::copy("test/integration/import_lib.cha", "out_dir/import_lib.cha");
+
+  runCommand("./build/cha --watch -o out_dir/app out_dir/import_main.cha "
+             "out_dir/import_lib.cha > out_dir/watch.log 2>&1 & "
+             "echo $! > out_dir/watch.pid");
+  auto wait_for_exit_code = [&](int expected) {
+    for (int i = 0; i < 200; ++i) {
+      if (fs::exists("out_dir/app") &&
+          WEXITSTATUS(runCommand("./out_dir/app").exit_code) == expected) {
+        return true;
+      }
+      runCommand("sleep 0.05");
+    }
+    return false;
+  };
+  EXPECT_TRUE(wait_for_exit_code(12));
+
+  // A body change only checks and compiles that function again
+  std::ifstream lib_in("test/integration/import_lib.cha");
+  std::string lib((std::istreambuf_iterator<char>(lib_in)),
+                  std::istreambuf_iterator<char>());
+  lib.replace(lib.rfind("ret w * h"), 9, "ret w * h + 1");
+  std::ofstream("out_dir/import_lib.cha") << lib;
+  EXPECT_TRUE(wait_for_exit_code(13));
+
+  runCommand("kill $(cat out_dir/watch.pid)");
+  std::ifstream log("out_dir/watch.log");
+  std::string output((std::istreambuf_iterator<char>(log)),
+                     std::istreambuf_iterator<char>());
+  EXPECT_NE(output.find("validated 3 and compiled 3 of 3 functions"),
+            std::string::npos)
+      << output;
+  EXPECT_NE(output.find("validated 1 and compiled 1 of 3 functions"),
+            std::string::npos)
+      << output;
+  fs::remove_all("out_dir");
+}
+
+TEST_F(IntegrationTest, WatchBuildRebuildsChangedFunctions) {
+  fs::remove_all("out_dir");
+  fs::create_directories("out_dir");
+  fs::copy("test/integration/import_main.cha", "out_dir/import_main.cha");
+  fs::copy("test/integration/import_lib.cha", "out_dir/import_lib.cha");
+  std::ofstream("out_dir/cha.build") << "output = app\n"
+                                     << "sources = import_main.cha\n"
+                                     << "sources = import_lib.cha\n";
+
+  runCommand("./build/cha --watch build out_dir/cha.build > out_dir/watch.log "
+             "2>&1 & echo $! > out_dir/watch.pid");
+  auto wait_for_exit_code = [&](int expected) {
+    for (int i = 0; i < 200; ++i) {
+      if (fs::exists("out_dir/app") &&
+          WEXITSTATUS(runCommand("./out_dir/app").exit_code) == expected) {
+        return true;
+      }
+      runCommand("sleep 0.05");
+    }
+    return false;
+  };
+  EXPECT_TRUE(wait_for_exit_code(12));
+
+  // Only main uses the constant that changed
+  std::ifstream main_in("test/integration/import_main.cha");
+  std::string main((std::istreambuf_iterator<char>(main_in)),
+                   std::istreambuf_iterator<char>());
+  main.replace(main.find("SIDE * 2"), 8, "SIDE * 2 + 1");
+  std::ofstream("out_dir/import_main.cha") << main;
+  EXPECT_TRUE(wait_for_exit_code(18));
+
+  runCommand("kill $(cat out_dir/watch.pid)");
+  std::ifstream log("out_dir/watch.log");
+  std::string output((std::istreambuf_iterator<char>(log)),
+                     std::istreambuf_iterator<char>());
+  EXPECT_NE(output.find("validated 1 and compiled 1 of 3 functions"),
+            std::string::npos)
+      << output;
+  EXPECT_TRUE(fs::exists("out_dir/build/lto-cache")) << output;
+  fs::remove_all("out_dir");
+}
+
+TEST_F(IntegrationTest, WatchFollowsImportedInterfaces) {
+  fs::remove_all("out_dir");
+  fs::create_directories("out_dir");
+  std::ifstream lib_in("test/integration/import_lib.cha");
+  std::string lib((std::istreambuf_iterator<char>(lib_in)),
+                  std::istreambuf_iterator<char>());
+  std::ofstream("out_dir/import_lib.cha") << lib;
+  ASSERT_EQ(runCommand("./build/cha -bc out_dir/lib/ out_dir/import_lib.cha")
+                .exit_code,
+            0);
+
+  auto read = [](const std::string &file) {
+    std::ifstream in(file);
+    return std::string((std::istreambuf_iterator<char>(in)),
+                       std::istreambuf_iterator<char>());
+  };
+  auto wait_for_builds = [&](size_t expected) {
+    for (int i = 0; i < 200; ++i) {
+      std::string log = read("out_dir/watch.log");
+      size_t builds = 0;
+      for (size_t at = log.find("Built "); at != std::string::npos;
+           at = log.find("Built ", at + 1)) {
+        ++builds;
+      }
+      if (builds >= expected) {
+        return true;
+      }
+      runCommand("sleep 0.05");
+    }
+    return false;
+  };
+
+  // Only the interface of import_lib is read, its source is not an input
+  runCommand("./build/cha --watch -ll out_dir/main.ll -I out_dir/lib "
+             "test/integration/import_main.cha > out_dir/watch.log 2>&1 & "
+             "echo $! > out_dir/watch.pid");
+  ASSERT_TRUE(wait_for_builds(1)) << read("out_dir/watch.log");
+  std::string before = read("out_dir/main.ll");
+
+  // SIDE is folded into main, so a new interface changes its code
+  lib.replace(lib.find("twice(3)"), 8, "twice(4)");
+  std::ofstream("out_dir/import_lib.cha") << lib;
+  EXPECT_EQ(runCommand("./build/cha -bc out_dir/lib/ out_dir/import_lib.cha")
+                .exit_code,
+            0);
+  EXPECT_TRUE(wait_for_builds(2)) << read("out_dir/watch.log");
+  EXPECT_NE(read("out_dir/main.ll"), before);
+
+  runCommand("kill $(cat out_dir/watch.pid)");
+  fs::remove_all("out_dir");
+}
+
+TEST_F(IntegrationTest, CompileServer) {
+  const std::string socket = "cha_test_server.sock";
+  std::remove(socket.c_str());
+  runCommand("./build/cha --server " + socket + " > /dev/null 2>&1 &");
+  for (int i = 0; i < 100 && !fs::exists(socket); ++i) {
+    runCommand("sleep 0.05");
+  }
+  ASSERT_TRUE(fs::exists(socket));
+  EXPECT_EQ(fs::status(socket).permissions() & fs::perms::all,
+            fs::perms::owner_read | fs::perms::owner_write);
+
+  // Paths are resolved in the client's working directory
+  auto result = runCommand("CHA_SERVER=" + socket +
+                           " ./build/cha -o out "
+                           "test/integration/pgo_branch.cha");
+  EXPECT_EQ(result.exit_code, 0) << "Output: " << result.output;
+  EXPECT_EQ(WEXITSTATUS(runCommand("./out").exit_code), 3);
+
+  // Diagnostics reach the client's stderr
+  result = runCommand("CHA_SERVER=" + socket +
+                      " ./build/cha -ll out.ll "
+                      "test/integration/validation_var_not_found.cha");
+  EXPECT_NE(result.exit_code, 0);
+  EXPECT_NE(result.output.find("'a' not found"), std::string::npos)
+      << "Output: " << result.output;
+
+  // The worker links with the client's environment
+  result = runCommand("CHA_SERVER=" + socket +
+                      " PATH=/nonexistent ./build/cha -o out "
+                      "test/integration/pgo_branch.cha");
+  EXPECT_NE(result.exit_code, 0);
+  EXPECT_NE(result.output.find("Linking failed"), std::string::npos)
+      << "Output: " << result.output;
+
+  runCommand("pkill -f 'cha --server " + socket + "'");
+  std::remove(socket.c_str());
+}
+
+// Tracks how long the driver takes to report an error in a tiny file, where
+// process startup is most of the cost. Only reported, machines vary too much
+// for a threshold.
+TEST_F(IntegrationTest, StartupTimeToFirstDiagnostic) {
+  const int runs = 20;
+  const std::pair<std::string, std::string> commands[] = {
+      {"version", "./build/cha --version"},
+      {"compile_error", "./build/cha -ll out.ll "
+                        "test/integration/validation_var_not_found.cha"},
+      {"check_error",
+       "./build/cha --check test/integration/validation_var_not_found.cha"},
+  };
+  for (const auto &[name, command] : commands) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < runs; ++i) {
+      auto result = runCommand(command);
+      if (name != "version") {
+        ASSERT_NE(result.output.find("'a' not found"), std::string::npos)
+            << "Output: " << result.output;
+      }
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    auto average =
+        std::chrono::duration_cast<std::chrono::microseconds>(elapsed) / runs;
+    RecordProperty("startup_us_" + name, std::to_string(average.count()));
+  }
+}
+
+TEST_F(IntegrationTest, InterpretDivisionByZero) {
+  auto result =
+      runCommand("./build/cha interp test/integration/vm_div_zero.cha");
+  EXPECT_NE(result.exit_code, 0);
+  EXPECT_NE(result.output.find("runtime error: division by zero"),
+            std::string::npos)
+      << "Output: " << result.output;
+}
+
 TEST_F(IntegrationTest, UnaryNegate) {
   expectCompilationSuccess("unary_negate.cha");
 }
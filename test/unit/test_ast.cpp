@@ -155,6 +155,29 @@ TEST(AstTest, NodeCloning) {
   EXPECT_NE(orig_const, clone_const); // Different objects
 }
 
+TEST(AstTest, CloningDeeplyNestedNodes) {
+  // Generated sources nest far deeper than recursion on the native stack
+  // allows
+  AstLocation loc("test.cha", 1, 1, 1, 1);
+  const int depth = 1000000;
+  AstNodePtr sum = std::make_unique<ConstantIntegerNode>(loc, 0);
+  for (int i = 0; i < depth; ++i) {
+    sum = std::make_unique<BinaryOpNode>(
+        loc, BinaryOperator::PLUS, std::move(sum),
+        std::make_unique<ConstantIntegerNode>(loc, 1));
+  }
+
+  AstNodePtr cloned = sum->clone();
+  int operations = 0;
+  const AstNode *node = cloned.get();
+  while (auto binary = dynamic_cast<const BinaryOpNode *>(node)) {
+    ++operations;
+    node = &binary->left();
+  }
+  EXPECT_EQ(operations, depth);
+  EXPECT_NE(dynamic_cast<const ConstantIntegerNode *>(node), nullptr);
+}
+
 TEST(AstTest, TypeSystem) {
   AstLocation loc("test.cha", 6, 1, 6, 10);
 
@@ -0,0 +1,169 @@
+#include "ast.hpp"
+#include "build.hpp"
+#include "exceptions.hpp"
+#include "serialize.hpp"
+#include "test_util.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <map>
+#include <mutex>
+
+using namespace cha;
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Builds a project of fake modules: the first line of a source is the value
+// of the constant its interface exports, the rest stands for its body
+class FakeProject {
+public:
+  explicit FakeProject(const std::string &directory) {
+    fs::remove_all(directory);
+    fs::create_directories(directory);
+    manifest_.output = directory + "/app";
+    manifest_.build_directory = directory + "/build";
+
+    actions_.imports = [this](const std::string &source) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      ++parsed;
+      return imports_[source];
+    };
+    actions_.compile = [this](const BuildModule &module) {
+      std::ifstream in(module.source);
+      int64_t value = 0;
+      in >> value;
+
+      AstLocation location(module.source, 1, 1, 1, 1);
+      auto literal = std::make_unique<ConstantIntegerNode>(location, value);
+      literal->set_result_type(std::make_unique<AstType>(
+          location, AstType::Primitive(PrimitiveType::INT)));
+      AstNodeList interface;
+      interface.push_back(std::make_unique<ConstantDeclarationNode>(
+          location, module.name, std::move(literal)));
+      write_ast(interface, module.interface);
+      write_file(module.bitcode, module.source);
+
+      std::lock_guard<std::mutex> lock(mutex_);
+      compiled.push_back(module.name);
+      return true;
+    };
+    actions_.link = [this](const std::vector<std::string> &bitcode) {
+      write_file(manifest_.output, std::to_string(bitcode.size()));
+      return true;
+    };
+  }
+
+  void add(const std::string &name, const std::string &contents,
+           std::vector<std::string> imports = {}) {
+    std::string source = fs::path(manifest_.output).parent_path().string() +
+                         "/" + name + ".cha";
+    write_file(source, contents);
+    if (std::find(manifest_.sources.begin(), manifest_.sources.end(),
+                  source) == manifest_.sources.end()) {
+      manifest_.sources.push_back(source);
+    }
+    imports_[source] = std::move(imports);
+  }
+
+  BuildResult build(const std::string &fingerprint = "options") {
+    compiled.clear();
+    parsed = 0;
+    return run_build(manifest_, fingerprint, 4, actions_);
+  }
+
+  std::vector<std::string> compiled;
+  size_t parsed = 0;
+
+private:
+  BuildManifest manifest_;
+  BuildActions actions_;
+  std::map<std::string, std::vector<std::string>> imports_;
+  std::mutex mutex_;
+};
+
+size_t position(const std::vector<std::string> &order,
+                const std::string &name) {
+  return std::find(order.begin(), order.end(), name) - order.begin();
+}
+
+} // namespace
+
+TEST(BuildTest, ReadsManifest) {
+  fs::create_directories("test_build_manifest");
+  write_file("test_build_manifest/cha.build",
+             "# project\n"
+             "output = bin/app\n"
+             "sources = main.cha geometry.cha  # two modules\n"
+             "sources = /abs/util.cha\n");
+  BuildManifest manifest = read_manifest("test_build_manifest/cha.build");
+  EXPECT_EQ(manifest.output, "test_build_manifest/bin/app");
+  EXPECT_EQ(manifest.build_directory, "test_build_manifest/build");
+  ASSERT_EQ(manifest.sources.size(), 3u);
+  EXPECT_EQ(manifest.sources[0], "test_build_manifest/main.cha");
+  EXPECT_EQ(manifest.sources[2], "/abs/util.cha");
+
+  write_file("test_build_manifest/cha.build", "output = app\nflags = -g\n");
+  EXPECT_THROW(read_manifest("test_build_manifest/cha.build"),
+               BuildException);
+  write_file("test_build_manifest/cha.build", "output = app\n");
+  EXPECT_THROW(read_manifest("test_build_manifest/cha.build"),
+               BuildException);
+  fs::remove_all("test_build_manifest");
+}
+
+TEST(BuildTest, CompilesInImportOrderAndOnlyWhatChanged) {
+  FakeProject project("test_build_project");
+  project.add("base", "1\nbody");
+  project.add("middle", "2\nbody", {"base"});
+  project.add("top", "3\nbody", {"middle", "base"});
+
+  BuildResult result = project.build();
+  ASSERT_TRUE(result.success);
+  EXPECT_EQ(result.compiled, 3u);
+  EXPECT_TRUE(result.linked);
+  EXPECT_LT(position(project.compiled, "base"),
+            position(project.compiled, "middle"));
+  EXPECT_LT(position(project.compiled, "middle"),
+            position(project.compiled, "top"));
+
+  // Nothing changed, the sources are not even parsed
+  result = project.build();
+  ASSERT_TRUE(result.success);
+  EXPECT_EQ(result.compiled, 0u);
+  EXPECT_EQ(result.up_to_date, 3u);
+  EXPECT_EQ(project.parsed, 0u);
+  EXPECT_FALSE(result.linked);
+
+  // A body change keeps the interface, importers are up to date
+  project.add("base", "1\nnew body");
+  result = project.build();
+  ASSERT_TRUE(result.success);
+  EXPECT_EQ(project.compiled, std::vector<std::string>{"base"});
+  EXPECT_TRUE(result.linked);
+
+  // An interface change rebuilds the direct importers only
+  project.add("middle", "20\nbody", {"base"});
+  result = project.build();
+  ASSERT_TRUE(result.success);
+  EXPECT_EQ(project.compiled, (std::vector<std::string>{"middle", "top"}));
+
+  // Other compile options rebuild everything
+  result = project.build("other options");
+  EXPECT_EQ(result.compiled, 3u);
+  fs::remove_all("test_build_project");
+}
+
+TEST(BuildTest, ReportsImportErrors) {
+  FakeProject project("test_build_cycle");
+  project.add("a", "1", {"b"});
+  project.add("b", "2", {"a"});
+  EXPECT_FALSE(project.build().success);
+  EXPECT_TRUE(project.compiled.empty());
+
+  project.add("b", "2", {"missing"});
+  EXPECT_FALSE(project.build().success);
+  fs::remove_all("test_build_cycle");
+}
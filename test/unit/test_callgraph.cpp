@@ -0,0 +1,94 @@
+#include "ast.hpp"
+#include "callgraph.hpp"
+#include "parser.hpp"
+#include "test_util.hpp"
+#include "validate.hpp"
+#include <gtest/gtest.h>
+
+using namespace cha;
+
+TEST(CallGraphTest, CollectsCallees) {
+  AstNodeList ast = parse_and_validate("test/integration/export_function.cha");
+  CallGraph graph(ast);
+
+  EXPECT_TRUE(graph.contains("main"));
+  EXPECT_FALSE(graph.contains("missing"));
+  EXPECT_EQ(graph.callees("main"), (std::set<std::string>{"area", "half"}));
+  EXPECT_TRUE(graph.callees("area").empty());
+  EXPECT_TRUE(graph.callees("missing").empty());
+}
+
+TEST(CallGraphTest, IntegerDivisionMayTrap) {
+  AstNodeList ast = parse_and_validate("test/integration/export_function.cha");
+  CallGraph graph(ast);
+
+  EXPECT_FALSE(graph.may_trap("area"));
+  EXPECT_TRUE(graph.may_trap("half"));
+  // Traps through the call to half
+  EXPECT_TRUE(graph.may_trap("main"));
+
+  EXPECT_FALSE(graph.may_not_return("main"));
+  EXPECT_FALSE(graph.is_recursive("main"));
+}
+
+TEST(CallGraphTest, DetectsRecursion) {
+  AstNodeList ast = parse_and_validate("test/integration/pgo_branch.cha");
+  CallGraph graph(ast);
+
+  EXPECT_TRUE(graph.is_recursive("count"));
+  EXPECT_FALSE(graph.is_recursive("main"));
+  EXPECT_TRUE(graph.may_not_return("count"));
+  // Calls a function that may not return
+  EXPECT_TRUE(graph.may_not_return("main"));
+}
+
+TEST(CallGraphTest, AddsFunctionsInBatches) {
+  AstNodeList first = parse_text("fun leaf() int {\n"
+                                 "    ret 1\n"
+                                 "}\n",
+                                 "test.cha");
+  AstNodeList second = parse_text("fun even(n int) bool {\n"
+                                  "    ret odd(n)\n"
+                                  "}\n"
+                                  "fun odd(n int) bool {\n"
+                                  "    ret even(n)\n"
+                                  "}\n"
+                                  "fun main() int {\n"
+                                  "    ret leaf()\n"
+                                  "}\n",
+                                  "test.cha");
+  CallGraph graph(first);
+  graph.add(second);
+
+  EXPECT_TRUE(graph.contains("leaf"));
+  EXPECT_TRUE(graph.contains("main"));
+  // A cycle within a batch
+  EXPECT_TRUE(graph.is_recursive("even"));
+  EXPECT_TRUE(graph.is_recursive("odd"));
+  EXPECT_FALSE(graph.is_recursive("leaf"));
+  EXPECT_FALSE(graph.is_recursive("main"));
+  EXPECT_FALSE(graph.may_not_return("main"));
+}
+
+TEST(CallGraphTest, ReachableFromRoots) {
+  AstNodeList ast = parse_text("fun leaf() int {\n"
+                               "    ret 1\n"
+                               "}\n"
+                               "fun unused() int {\n"
+                               "    ret leaf()\n"
+                               "}\n"
+                               "export fun api() int {\n"
+                               "    ret 2\n"
+                               "}\n"
+                               "fun main() int {\n"
+                               "    ret leaf()\n"
+                               "}\n",
+                               "test.cha");
+  CallGraph graph(ast);
+
+  EXPECT_EQ(graph.roots(), (std::set<std::string>{"api", "main"}));
+  EXPECT_EQ(graph.reachable_from(graph.roots()),
+            (std::set<std::string>{"api", "leaf", "main"}));
+  EXPECT_EQ(graph.reachable_from({"unused"}),
+            (std::set<std::string>{"leaf", "unused"}));
+}
@@ -0,0 +1,35 @@
+#include "cha/cha.hpp"
+#include <gtest/gtest.h>
+
+using namespace cha;
+
+TEST(CheckTest, AcceptsValidModules) {
+  EXPECT_EQ(check({"test/integration/validation_passes.cha"}), 0);
+  EXPECT_EQ(check({"test/integration/const_eval.cha"}), 0);
+}
+
+TEST(CheckTest, ReportsErrors) {
+  EXPECT_EQ(check({"test/integration/parse_failure.cha"}), 1);
+  EXPECT_EQ(check({"test/integration/validation_var_not_found.cha"}), 1);
+  EXPECT_EQ(check({"test/integration/missing.cha"}), 1);
+
+  // The inputs are one program, which only has one main
+  EXPECT_EQ(check({"test/integration/validation_passes.cha",
+                   "test/integration/parse_passes.cha"}),
+            1);
+}
+
+TEST(CheckTest, ResolvesImportsBetweenInputs) {
+  // import_main uses a function and a constant exported by import_lib
+  EXPECT_EQ(check({"test/integration/import_main.cha",
+                   "test/integration/import_lib.cha"}),
+            0);
+
+  // On its own the interface of import_lib is missing
+  EXPECT_EQ(check({"test/integration/import_main.cha"}), 1);
+
+  // twice is not exported by import_lib
+  EXPECT_EQ(check({"test/integration/import_private.cha",
+                   "test/integration/import_lib.cha"}),
+            1);
+}
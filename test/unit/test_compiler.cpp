@@ -0,0 +1,225 @@
+#include "cha/cha.h"
+#include "cha/cha.hpp"
+#include <chrono>
+#include <gtest/gtest.h>
+#include <string>
+
+using namespace cha;
+
+namespace {
+
+const char *SOURCE = "export fun area(w int, h int) int {\n"
+                     "    ret w * h\n"
+                     "}\n"
+                     "\n"
+                     "fun main() int {\n"
+                     "    ret area(2, 3)\n"
+                     "}\n";
+
+const char *INVALID = "fun main() int {\n"
+                      "    ret volume(2, 3)\n"
+                      "}\n";
+
+} // namespace
+
+TEST(CompilerTest, CompilesToMemory) {
+  Compiler compiler;
+
+  CompileResult ir = compiler.compile(SOURCE, CompileFormat::LLVM_IR,
+                                      "kernel.cha");
+  ASSERT_TRUE(ir.success);
+  EXPECT_TRUE(ir.diagnostics.empty());
+  EXPECT_NE(ir.output.find("@area("), std::string::npos);
+
+  CompileResult bitcode = compiler.compile(SOURCE, CompileFormat::BITCODE);
+  ASSERT_TRUE(bitcode.success);
+  EXPECT_EQ(bitcode.output.compare(0, 2, "BC"), 0);
+
+  CompileResult assembly =
+      compiler.compile(SOURCE, CompileFormat::ASSEMBLY_FILE);
+  ASSERT_TRUE(assembly.success);
+  EXPECT_NE(assembly.output.find("area"), std::string::npos);
+
+  CompileResult object = compiler.compile(SOURCE, CompileFormat::OBJECT_FILE);
+  ASSERT_TRUE(object.success);
+  EXPECT_FALSE(object.output.empty());
+
+  // A binary AST compiles again without parsing
+  CompileResult ast = compiler.compile(SOURCE, CompileFormat::AST_FILE);
+  ASSERT_TRUE(ast.success);
+  compiler.options().load_ast = true;
+  CompileResult loaded = compiler.compile(ast.output, CompileFormat::LLVM_IR);
+  ASSERT_TRUE(loaded.success);
+  EXPECT_NE(loaded.output.find("@area("), std::string::npos);
+}
+
+TEST(CompilerTest, LongSessionsCompileTheSame) {
+  // The session replaces its LLVM context every few dozen compiles
+  Compiler compiler;
+  CompileResult first = compiler.compile(SOURCE, CompileFormat::LLVM_IR);
+  ASSERT_TRUE(first.success);
+  for (int i = 0; i < 200; ++i) {
+    CompileResult result = compiler.compile(SOURCE, CompileFormat::LLVM_IR);
+    ASSERT_TRUE(result.success) << "compile " << i;
+    EXPECT_EQ(result.output, first.output) << "compile " << i;
+  }
+}
+
+TEST(CompilerTest, ReportsDiagnostics) {
+  Compiler compiler;
+
+  CompileResult result =
+      compiler.compile(INVALID, CompileFormat::OBJECT_FILE, "kernel.cha");
+  EXPECT_FALSE(result.success);
+  EXPECT_TRUE(result.output.empty());
+  ASSERT_FALSE(result.diagnostics.empty());
+  EXPECT_EQ(result.diagnostics[0].file, "kernel.cha");
+  EXPECT_EQ(result.diagnostics[0].line, 2);
+  EXPECT_EQ(result.diagnostics[0].message, "function 'volume' not found");
+
+  result = compiler.compile("fun main() int {\n    ret 1 $\n}\n",
+                            CompileFormat::LLVM_IR, "kernel.cha");
+  EXPECT_FALSE(result.success);
+  ASSERT_EQ(result.diagnostics.size(), 1u);
+  EXPECT_EQ(result.diagnostics[0].message, "unexpected character '$'");
+
+  // Executables need a linker and are only written to files
+  result = compiler.compile(SOURCE, CompileFormat::BINARY_FILE);
+  EXPECT_FALSE(result.success);
+  ASSERT_EQ(result.diagnostics.size(), 1u);
+  EXPECT_EQ(result.diagnostics[0].line, 0);
+
+  // Errors do not break the session
+  EXPECT_TRUE(compiler.compile(SOURCE, CompileFormat::LLVM_IR).success);
+}
+
+TEST(CompilerTest, FastCompile) {
+  CompileOptions options;
+  options.fast_compile = true;
+  Compiler compiler(options);
+
+  // Value names are discarded
+  CompileResult ir = compiler.compile(SOURCE, CompileFormat::LLVM_IR);
+  ASSERT_TRUE(ir.success);
+  EXPECT_EQ(ir.output.find("multmp"), std::string::npos);
+
+  CompileResult object = compiler.compile(SOURCE, CompileFormat::OBJECT_FILE);
+  ASSERT_TRUE(object.success);
+  EXPECT_FALSE(object.output.empty());
+
+  // The shared context keeps names again for the default path
+  compiler.options().fast_compile = false;
+  ir = compiler.compile(SOURCE, CompileFormat::LLVM_IR);
+  ASSERT_TRUE(ir.success);
+  EXPECT_NE(ir.output.find("multmp"), std::string::npos);
+}
+
+TEST(CompilerTest, FastCompileTime) {
+  // 500 functions with arithmetic and branches, each calling the one before
+  std::string source = "fun f0(a int, b int) int {\n    ret a + b\n}\n";
+  const int functions = 500;
+  for (int i = 1; i < functions; ++i) {
+    std::string name = "f" + std::to_string(i);
+    source += "fun " + name + "(a int, b int) int {\n"
+              "    var x int = a * 3 + b\n"
+              "    if x > 100 {\n"
+              "        x = x - f" + std::to_string(i - 1) + "(b, a) / 2\n"
+              "    } else {\n"
+              "        x = x * 2 + 7\n"
+              "    }\n"
+              "    ret x\n"
+              "}\n";
+  }
+  source += "fun main() int {\n    ret f" + std::to_string(functions - 1) +
+            "(1, 2)\n}\n";
+
+  // Both paths compile the same input to an object file a few times, the
+  // first compile of each session also creates its target machine
+  const int runs = 3;
+  for (bool fast : {false, true}) {
+    CompileOptions options;
+    options.fast_compile = fast;
+    Compiler compiler(options);
+    ASSERT_TRUE(compiler.compile(source, CompileFormat::OBJECT_FILE).success);
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < runs; ++i) {
+      ASSERT_TRUE(
+          compiler.compile(source, CompileFormat::OBJECT_FILE).success);
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    auto average =
+        std::chrono::duration_cast<std::chrono::microseconds>(elapsed) / runs;
+    RecordProperty(fast ? "fast_compile_us" : "default_compile_us",
+                   std::to_string(average.count()));
+  }
+}
+
+TEST(CompilerTest, DeeplyNestedSources) {
+  // The generator walks nodes with its own stack, like the validator
+  const int depth = 1000000;
+  std::string sum = "fun main() int {\n    var x int = 1\n    ret x";
+  for (int i = 0; i < depth; ++i) {
+    sum += " + x";
+  }
+  sum += "\n}\n";
+  std::string ifs = "fun main() int {\n";
+  for (int i = 0; i < depth / 10; ++i) {
+    ifs += "if true {\n";
+  }
+  ifs += "ret 1\n" + std::string(depth / 10, '}') + "\nret 0\n}\n";
+
+  CompileOptions options;
+  options.fast_compile = true;
+  Compiler compiler(options);
+  for (const std::string &source : {sum, ifs}) {
+    CompileResult result = compiler.compile(source, CompileFormat::LLVM_IR);
+    ASSERT_TRUE(result.success);
+    EXPECT_TRUE(result.diagnostics.empty());
+
+    // So do the binary AST and the collection of the names bodies use
+    CompileResult ast = compiler.compile(source, CompileFormat::AST_FILE);
+    ASSERT_TRUE(ast.success);
+    compiler.options().load_ast = true;
+    result = compiler.compile(ast.output, CompileFormat::LLVM_IR);
+    compiler.options().load_ast = false;
+    ASSERT_TRUE(result.success);
+
+    compiler.options().lazy_bodies = true;
+    result = compiler.compile(source, CompileFormat::LLVM_IR);
+    compiler.options().lazy_bodies = false;
+    ASSERT_TRUE(result.success);
+  }
+}
+
+TEST(CompilerTest, CInterface) {
+  cha_compiler *compiler = cha_compiler_create();
+  ASSERT_NE(compiler, nullptr);
+  cha_compiler_add_import_path(compiler, "test/integration");
+
+  std::string source = SOURCE;
+  cha_result *result = cha_compile(compiler, source.data(), source.size(),
+                                   "kernel.cha", CHA_FORMAT_LLVM_IR);
+  ASSERT_NE(result, nullptr);
+  EXPECT_EQ(cha_result_success(result), 1);
+  size_t size = 0;
+  const char *output = cha_result_output(result, &size);
+  EXPECT_NE(std::string(output, size).find("@area"), std::string::npos);
+  EXPECT_EQ(cha_result_diagnostic_count(result), 0u);
+  cha_result_destroy(result);
+
+  source = INVALID;
+  result = cha_compile(compiler, source.data(), source.size(), nullptr,
+                       CHA_FORMAT_OBJECT);
+  ASSERT_NE(result, nullptr);
+  EXPECT_EQ(cha_result_success(result), 0);
+  ASSERT_GE(cha_result_diagnostic_count(result), 1u);
+  EXPECT_STREQ(cha_result_diagnostic_file(result, 0), "input.cha");
+  EXPECT_EQ(cha_result_diagnostic_line(result, 0), 2);
+  EXPECT_STREQ(cha_result_diagnostic_message(result, 0),
+               "function 'volume' not found");
+  EXPECT_EQ(cha_result_diagnostic_message(result, 99), nullptr);
+  cha_result_destroy(result);
+
+  cha_compiler_destroy(compiler);
+}
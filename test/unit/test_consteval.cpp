@@ -0,0 +1,188 @@
+#include "ast.hpp"
+#include "bytecode.hpp"
+#include "consteval.hpp"
+#include "exceptions.hpp"
+#include "parser.hpp"
+#include "validate.hpp"
+#include "vm.hpp"
+#include <gtest/gtest.h>
+
+using namespace cha;
+
+namespace {
+
+// Message of the first error reported while folding the file's constants
+std::string validation_error(const std::string &file) {
+  AstNodeList ast = cha::parse(file);
+  Validator validator;
+  try {
+    validator.validate(ast);
+  } catch (const ValidationException &e) {
+    return e.message();
+  } catch (const MultipleValidationException &e) {
+    return e.errors().front().message();
+  }
+  return "";
+}
+
+} // namespace
+
+TEST(ConstEvalTest, FoldsFunctionCalls) {
+  AstNodeList ast = cha::parse("test/integration/const_eval.cha");
+  Validator validator;
+  validator.validate(ast);
+
+  auto table_size = dynamic_cast<const ConstantDeclarationNode *>(ast[0].get());
+  ASSERT_NE(table_size, nullptr);
+  auto literal =
+      dynamic_cast<const ConstantIntegerNode *>(&table_size->value());
+  ASSERT_NE(literal, nullptr);
+  EXPECT_EQ(literal->value(), 55);
+  EXPECT_EQ(literal->result_type()->as_primitive().type, PrimitiveType::INT);
+
+  auto limit = dynamic_cast<const ConstantDeclarationNode *>(ast[1].get());
+  ASSERT_NE(limit, nullptr);
+  literal = dynamic_cast<const ConstantIntegerNode *>(&limit->value());
+  ASSERT_NE(literal, nullptr);
+  EXPECT_EQ(literal->value(), 111);
+}
+
+TEST(ConstEvalTest, BlocksRestoreShadowedVariables) {
+  AstNodeList ast = cha::parse("test/integration/const_eval_shadow.cha");
+  Validator validator;
+  validator.validate(ast);
+
+  // The if declares its own x, the outer x stays 1 while y is assigned
+  auto shadowed = static_cast<const ConstantDeclarationNode *>(ast[0].get());
+  auto literal = dynamic_cast<const ConstantIntegerNode *>(&shadowed->value());
+  ASSERT_NE(literal, nullptr);
+  EXPECT_EQ(literal->value(), 112);
+
+  // main returns the folded value minus the one computed at run time
+  BytecodeProgram program = BytecodeCompiler().compile(ast);
+  VirtualMachine vm(program);
+  EXPECT_EQ(vm.run(program.main).i, 0);
+}
+
+TEST(ConstEvalTest, ReportsOverflow) {
+  EXPECT_NE(validation_error("test/integration/const_eval_overflow.cha")
+                .find("overflow in constant evaluation of 'int'"),
+            std::string::npos);
+}
+
+TEST(ConstEvalTest, ReportsDivisionByZero) {
+  EXPECT_NE(validation_error("test/integration/const_eval_div_zero.cha")
+                .find("division by zero in constant evaluation"),
+            std::string::npos);
+}
+
+TEST(ConstEvalTest, LimitsRecursionDepth) {
+  EXPECT_NE(validation_error("test/integration/const_eval_recursion.cha")
+                .find("call depth limit of 512"),
+            std::string::npos);
+}
+
+TEST(ConstEvalTest, LimitsSteps) {
+  EXPECT_NE(validation_error("test/integration/const_eval_steps.cha")
+                .find("exceeded 1000000 steps"),
+            std::string::npos);
+}
+
+TEST(ConstEvalTest, DeeplyNestedSources) {
+  // Generated sources nest far deeper than recursion on the native stack
+  // allows, within the step limit
+  const int depth = 300000;
+  std::string source = "const SUM = 0";
+  for (int i = 0; i < depth; ++i) {
+    source += " + 1";
+  }
+  source += "\nconst NEGATED = " + std::string(depth, '-') + "5\n" +
+            "fun nested() int {\n";
+  for (int i = 0; i < depth; ++i) {
+    source += "if true {\n";
+  }
+  source += "ret 9\n" + std::string(depth, '}') + "\nret 0\n}\n" +
+            "const NESTED = nested()\n";
+
+  AstNodeList ast = parse_text(source, "deep.cha");
+  Validator validator;
+  validator.validate(ast);
+
+  const size_t constants[] = {0, 1, 3};
+  const long long expected[] = {depth, 5, 9};
+  for (int i = 0; i < 3; ++i) {
+    auto constant =
+        static_cast<const ConstantDeclarationNode *>(ast[constants[i]].get());
+    auto literal =
+        dynamic_cast<const ConstantIntegerNode *>(&constant->value());
+    ASSERT_NE(literal, nullptr);
+    EXPECT_EQ(literal->value(), expected[i]);
+  }
+}
+
+TEST(ConstEvalTest, FailedConstantDoesNotAffectOthers) {
+  // DEEP fails at the depth limit, SHALLOW starts from a clean slate
+  const std::string source = "fun down(n int) int {\n"
+                             "    if n == 0 {\n"
+                             "        ret 0\n"
+                             "    }\n"
+                             "    ret down(n - 1)\n"
+                             "}\n"
+                             "const DEEP = down(1000)\n"
+                             "const SHALLOW = down(10)\n"
+                             "const AGAIN = DEEP\n";
+
+  AstNodeList ast = parse_text(source, "test.cha");
+  Validator validator;
+  try {
+    validator.validate(ast);
+    FAIL() << "DEEP should not fold";
+  } catch (const MultipleValidationException &e) {
+    // AGAIN reports DEEP's own error, not a dependency on itself
+    ASSERT_EQ(e.errors().size(), 2u);
+    for (const auto &error : e.errors()) {
+      EXPECT_NE(error.message().find("call depth limit of 512"),
+                std::string::npos)
+          << error.message();
+    }
+  }
+  auto shallow = static_cast<const ConstantDeclarationNode *>(ast[2].get());
+  EXPECT_NE(dynamic_cast<const ConstantIntegerNode *>(&shallow->value()),
+            nullptr);
+
+  // Declarations validated one at a time share the evaluator
+  AstNodeList declarations = parse_text("const ZERO = 0\n"
+                                        "const BAD = 1 / ZERO\n"
+                                        "const GOOD = 2\n"
+                                        "const AGAIN = BAD\n",
+                                        "test.cha");
+  Validator streaming;
+  EXPECT_NO_THROW(streaming.validate_declaration(*declarations[0]));
+  EXPECT_THROW(streaming.validate_declaration(*declarations[1]),
+               ChaException);
+  EXPECT_NO_THROW(streaming.validate_declaration(*declarations[2]));
+  try {
+    streaming.validate_declaration(*declarations[3]);
+    FAIL() << "AGAIN should not fold";
+  } catch (const ChaException &e) {
+    EXPECT_NE(std::string(e.what()).find("division by zero"),
+              std::string::npos)
+        << e.what();
+  }
+}
+
+TEST(ConstEvalTest, ConvertChecksRange) {
+  AstLocation location("test.cha", 1, 1, 1, 10);
+  ConstValue value;
+  value.type = PrimitiveType::CONST_INT;
+  value.int_value = 200;
+
+  EXPECT_EQ(convert_const(value, PrimitiveType::UINT8, location).uint_value,
+            200u);
+  EXPECT_THROW(convert_const(value, PrimitiveType::INT8, location),
+               ValidationException);
+
+  value.int_value = -1;
+  EXPECT_THROW(convert_const(value, PrimitiveType::UINT64, location),
+               ValidationException);
+}
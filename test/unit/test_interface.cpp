@@ -0,0 +1,104 @@
+#include "ast.hpp"
+#include "exceptions.hpp"
+#include "interface.hpp"
+#include "parser.hpp"
+#include "test_util.hpp"
+#include "validate.hpp"
+#include <cstdio>
+#include <gtest/gtest.h>
+
+using namespace cha;
+
+TEST(InterfaceTest, ContainsOnlyExports) {
+  AstNodeList ast = parse_and_validate("test/integration/import_lib.cha");
+  EXPECT_TRUE(has_exports(ast));
+
+  AstNodeList interface = make_interface(ast);
+  ASSERT_EQ(interface.size(), 2u);
+
+  // The constant is folded, the function keeps its signature only
+  auto side = dynamic_cast<const ConstantDeclarationNode *>(interface[0].get());
+  ASSERT_NE(side, nullptr);
+  EXPECT_EQ(side->identifier(), "SIDE");
+  auto literal = dynamic_cast<const ConstantIntegerNode *>(&side->value());
+  ASSERT_NE(literal, nullptr);
+  EXPECT_EQ(literal->value(), 6);
+
+  auto area = dynamic_cast<const FunctionDeclarationNode *>(interface[1].get());
+  ASSERT_NE(area, nullptr);
+  EXPECT_EQ(area->identifier(), "area");
+  EXPECT_EQ(area->arguments().size(), 2u);
+  EXPECT_TRUE(area->body().empty());
+
+  EXPECT_FALSE(has_exports(parse_and_validate("examples/test.cha")));
+}
+
+TEST(InterfaceTest, ImportsValidateAgainstInterface) {
+  std::string file = std::string("import_lib") + INTERFACE_EXTENSION;
+  write_interface(parse_and_validate("test/integration/import_lib.cha"), file);
+
+  AstNodeList ast = cha::parse("test/integration/import_main.cha");
+  AstNodeList interfaces;
+  EXPECT_NO_THROW(interfaces = read_imports(ast, {"."}));
+  std::remove(file.c_str());
+  ASSERT_EQ(interfaces.size(), 2u);
+
+  Validator validator;
+  validator.declare_external(
+      static_cast<const ConstantDeclarationNode &>(*interfaces[0]));
+  validator.declare_external(
+      static_cast<const FunctionDeclarationNode &>(*interfaces[1]));
+  EXPECT_NO_THROW(validator.validate(ast));
+
+  // Imported constants fold into the importer's constants
+  auto doubled = dynamic_cast<const ConstantDeclarationNode *>(ast[1].get());
+  ASSERT_NE(doubled, nullptr);
+  auto literal = dynamic_cast<const ConstantIntegerNode *>(&doubled->value());
+  ASSERT_NE(literal, nullptr);
+  EXPECT_EQ(literal->value(), 12);
+}
+
+TEST(InterfaceTest, ReportsMissingInterface) {
+  AstNodeList ast = cha::parse("test/integration/import_main.cha");
+  try {
+    read_imports(ast, {});
+    FAIL() << "expected a ValidationException";
+  } catch (const ValidationException &e) {
+    EXPECT_NE(e.message().find("'import_lib.chai'"), std::string::npos)
+        << e.message();
+    EXPECT_EQ(e.location().line_begin, 1);
+  }
+}
+
+TEST(InterfaceTest, ModuleName) {
+  EXPECT_EQ(module_name("src/geometry.cha"), "geometry");
+  EXPECT_EQ(module_name("geometry.cha"), "geometry");
+  EXPECT_EQ(module_name("src/.hidden"), ".hidden");
+  EXPECT_EQ(module_name("src/geometry"), "geometry");
+}
+
+TEST(InterfaceTest, ResolvesProgramImports) {
+  std::vector<std::string> files = {"test/integration/import_main.cha",
+                                    "test/integration/import_lib.cha"};
+  AstNodeList main = cha::parse(files[0]);
+  AstNodeList lib = cha::parse(files[1]);
+
+  ProgramImports imports;
+  ASSERT_TRUE(resolve_program_imports(files, {&main, &lib}, {}, imports));
+  EXPECT_EQ(imports.dependencies,
+            (std::vector<std::vector<size_t>>{{1}, {}}));
+  EXPECT_EQ(imports.order, (std::vector<size_t>{1, 0}));
+  EXPECT_TRUE(imports.interface_files.empty());
+
+  // The importer is skipped once the module it imports is invalid
+  std::vector<size_t> validated;
+  EXPECT_FALSE(validate_program(imports, [&](size_t module) {
+    validated.push_back(module);
+    return false;
+  }));
+  EXPECT_EQ(validated, (std::vector<size_t>{1}));
+
+  // Both inputs would be module import_lib
+  EXPECT_FALSE(resolve_program_imports(
+      {"a/import_lib.cha", "b/import_lib.cha"}, {&lib, &lib}, {}, imports));
+}
@@ -0,0 +1,133 @@
+#include "ast.hpp"
+#include "bytecode.hpp"
+#include "jit.hpp"
+#include "parser.hpp"
+#include "validate.hpp"
+#include "vm.hpp"
+#include <cstdio>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <sstream>
+#include <unistd.h>
+
+using namespace cha;
+
+namespace {
+
+// Run main twice with every function tiered up on its first call, once while
+// the functions compile and once with the native code installed
+void expect_tiered_result(const std::string &file, int64_t expected) {
+  AstNodeList ast = cha::parse(file);
+  Validator validator;
+  validator.validate(ast);
+  BytecodeProgram program = BytecodeCompiler().compile(ast);
+  ASSERT_GE(program.main, 0);
+
+  VirtualMachine vm(program);
+  TieredCompiler tiered(ast, program, vm);
+  vm.set_tier_up(&tiered, 1);
+
+  EXPECT_EQ(vm.run(program.main).i, expected) << file;
+  tiered.wait();
+  EXPECT_GT(tiered.compiled(), 0u) << file;
+  EXPECT_EQ(vm.run(program.main).i, expected) << file;
+}
+
+} // namespace
+
+TEST(JitTest, InstallsHotFunctions) {
+  AstNodeList ast = cha::parse("test/integration/pgo_branch.cha");
+  Validator validator;
+  validator.validate(ast);
+  BytecodeProgram program = BytecodeCompiler().compile(ast);
+
+  VirtualMachine vm(program);
+  TieredCompiler tiered(ast, program, vm);
+  vm.set_tier_up(&tiered, 50);
+
+  // count(100) - 97, count gets hot halfway through the recursion
+  EXPECT_EQ(vm.run(program.main).i, 3);
+  tiered.wait();
+  EXPECT_TRUE(vm.is_native(0));
+  EXPECT_FALSE(vm.is_native(program.main));
+  EXPECT_EQ(tiered.compiled(), 1u);
+}
+
+TEST(JitTest, ColdFunctionsStayInterpreted) {
+  AstNodeList ast = cha::parse("test/integration/export_function.cha");
+  Validator validator;
+  validator.validate(ast);
+  BytecodeProgram program = BytecodeCompiler().compile(ast);
+
+  VirtualMachine vm(program);
+  TieredCompiler tiered(ast, program, vm);
+  vm.set_tier_up(&tiered, 1000);
+
+  EXPECT_EQ(vm.run(program.main).i, 3);
+  tiered.wait();
+  EXPECT_EQ(tiered.compiled(), 0u);
+  EXPECT_FALSE(vm.is_native(0));
+}
+
+TEST(JitTest, NativeCodeMatchesInterpreter) {
+  expect_tiered_result("test/integration/pgo_branch.cha", 3);
+  expect_tiered_result("test/integration/export_function.cha", 3);
+  expect_tiered_result("test/integration/vm_operators.cha", 42);
+}
+
+TEST(JitTest, NativeCodeTrapsLikeInterpreter) {
+  for (const auto &[file, message] :
+       {std::pair<std::string, std::string>{
+            "test/integration/vm_div_zero.cha", "division by zero"},
+        {"test/integration/vm_stack_overflow.cha", "call stack overflow"}}) {
+    AstNodeList ast = cha::parse(file);
+    Validator validator;
+    validator.validate(ast);
+    BytecodeProgram program = BytecodeCompiler().compile(ast);
+
+    VirtualMachine vm(program);
+    TieredCompiler tiered(ast, program, vm);
+    vm.set_tier_up(&tiered, 1);
+    EXPECT_THROW(vm.run(program.main), InterpreterException) << file;
+    tiered.wait();
+    ASSERT_GT(tiered.compiled(), 0u) << file;
+
+    // The second run calls the native code, which traps at the same limits
+    try {
+      vm.run(program.main);
+      FAIL() << file << ": expected a runtime error";
+    } catch (const InterpreterException &e) {
+      EXPECT_NE(e.message().find(message), std::string::npos) << e.message();
+    }
+  }
+}
+
+TEST(JitTest, WritesPerfMap) {
+  AstNodeList ast = cha::parse("test/integration/pgo_branch.cha");
+  Validator validator;
+  validator.validate(ast);
+  BytecodeProgram program = BytecodeCompiler().compile(ast);
+
+  std::string path = "/tmp/perf-" + std::to_string(getpid()) + ".map";
+  std::remove(path.c_str());
+
+  CompileOptions options;
+  options.jit_perf = true;
+  VirtualMachine vm(program);
+  {
+    TieredCompiler tiered(ast, program, vm, options);
+    vm.set_tier_up(&tiered, 1);
+    EXPECT_EQ(vm.run(program.main).i, 3);
+    tiered.wait();
+    ASSERT_EQ(tiered.compiled(), 1u);
+  }
+
+  // <start> <size> <name>, addresses in hex
+  std::ifstream file(path);
+  ASSERT_TRUE(file.good()) << path;
+  std::stringstream contents;
+  contents << file.rdbuf();
+  EXPECT_NE(contents.str().find(" __cha_tier_count\n"), std::string::npos)
+      << contents.str();
+  std::remove(path.c_str());
+}
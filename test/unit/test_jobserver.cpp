@@ -0,0 +1,143 @@
+#include "jobserver.hpp"
+#include <chrono>
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace cha;
+
+namespace {
+
+size_t pending_tokens(int fd) {
+  int flags = fcntl(fd, F_GETFL);
+  fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+  char buffer[64];
+  ssize_t count = read(fd, buffer, sizeof(buffer));
+  fcntl(fd, F_SETFL, flags);
+  return count > 0 ? count : 0;
+}
+
+} // namespace
+
+TEST(JobServerTest, NoJobServer) {
+  EXPECT_EQ(JobServer::from_makeflags(""), nullptr);
+  EXPECT_EQ(JobServer::from_makeflags("-j4 -k"), nullptr);
+  EXPECT_EQ(JobServer::from_makeflags(" --jobserver-auth=bogus"), nullptr);
+}
+
+TEST(JobServerTest, ClosedPipeIsIgnored) {
+  int fds[2];
+  ASSERT_EQ(pipe(fds), 0);
+  close(fds[0]);
+  close(fds[1]);
+  std::string flags = " -j4 --jobserver-auth=" + std::to_string(fds[0]) +
+                      "," + std::to_string(fds[1]);
+  EXPECT_EQ(JobServer::from_makeflags(flags), nullptr);
+}
+
+TEST(JobServerTest, TakesTokensBeyondImplicitSlot) {
+  int fds[2];
+  ASSERT_EQ(pipe(fds), 0);
+  ASSERT_EQ(write(fds[1], "ab", 2), 2);
+
+  std::string flags = " -j3 --jobserver-auth=" + std::to_string(fds[0]) +
+                      "," + std::to_string(fds[1]);
+  auto jobserver = JobServer::from_makeflags(flags);
+  ASSERT_NE(jobserver, nullptr);
+
+  // One job runs in the implicit slot, two more take both tokens
+  JobSlot implicit = jobserver->acquire();
+  JobSlot a = jobserver->acquire();
+  JobSlot b = jobserver->acquire();
+  EXPECT_EQ(implicit.kind, JobSlot::IMPLICIT);
+  EXPECT_EQ(a.kind, JobSlot::TOKEN);
+  EXPECT_EQ(b.kind, JobSlot::TOKEN);
+  EXPECT_EQ(pending_tokens(fds[0]), 0u);
+
+  jobserver->release(a);
+  jobserver->release(implicit);
+  jobserver->release(b);
+  EXPECT_EQ(pending_tokens(fds[0]), 2u);
+
+  jobserver.reset();
+  close(fds[0]);
+  close(fds[1]);
+}
+
+TEST(JobServerTest, WaitsOnNonBlockingPipes) {
+  int fds[2];
+  ASSERT_EQ(pipe(fds), 0);
+  fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+
+  std::string flags = " -j2 --jobserver-auth=" + std::to_string(fds[0]) +
+                      "," + std::to_string(fds[1]);
+  auto jobserver = JobServer::from_makeflags(flags);
+  ASSERT_NE(jobserver, nullptr);
+  JobSlot implicit = jobserver->acquire();
+
+  // make frees a slot a moment after the second job asks for one
+  std::thread make([&] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    ASSERT_EQ(write(fds[1], "t", 1), 1);
+  });
+  JobSlot slot = jobserver->acquire();
+  make.join();
+  EXPECT_EQ(slot.kind, JobSlot::TOKEN);
+  EXPECT_EQ(slot.token, 't');
+
+  jobserver->release(slot);
+  jobserver->release(implicit);
+  EXPECT_EQ(pending_tokens(fds[0]), 1u);
+
+  jobserver.reset();
+  close(fds[0]);
+  close(fds[1]);
+}
+
+TEST(JobServerTest, JobsWithoutTokenDoNotFreeTheImplicitSlot) {
+  int fds[2];
+  ASSERT_EQ(pipe(fds), 0);
+  int null = open("/dev/null", O_WRONLY);
+  ASSERT_GE(null, 0);
+  // make is gone, its pipe is at end of file
+  close(fds[1]);
+
+  auto jobserver = JobServer::from_makeflags(
+      "--jobserver-auth=" + std::to_string(fds[0]) + "," +
+      std::to_string(null));
+  ASSERT_NE(jobserver, nullptr);
+  JobSlot implicit = jobserver->acquire();
+  JobSlot untracked = jobserver->acquire();
+  EXPECT_EQ(implicit.kind, JobSlot::IMPLICIT);
+  EXPECT_EQ(untracked.kind, JobSlot::NONE);
+
+  // The first job still holds the implicit slot
+  jobserver->release(untracked);
+  EXPECT_NE(jobserver->acquire().kind, JobSlot::IMPLICIT);
+
+  jobserver->release(implicit);
+  EXPECT_EQ(jobserver->acquire().kind, JobSlot::IMPLICIT);
+
+  jobserver.reset();
+  close(fds[0]);
+  close(null);
+}
+
+TEST(JobServerTest, ReturnsHeldTokensOnDestruction) {
+  int fds[2];
+  ASSERT_EQ(pipe(fds), 0);
+  ASSERT_EQ(write(fds[1], "a", 1), 1);
+
+  auto jobserver = JobServer::from_makeflags(
+      "--jobserver-fds=" + std::to_string(fds[0]) + "," +
+      std::to_string(fds[1]));
+  ASSERT_NE(jobserver, nullptr);
+  jobserver->acquire();
+  jobserver->acquire();
+  jobserver.reset();
+  EXPECT_EQ(pending_tokens(fds[0]), 1u);
+
+  close(fds[0]);
+  close(fds[1]);
+}
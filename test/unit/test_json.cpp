@@ -0,0 +1,37 @@
+#include "exceptions.hpp"
+#include "json.hpp"
+#include <gtest/gtest.h>
+
+using namespace cha;
+
+TEST(JsonTest, ParsesAndDumps) {
+  Json value = Json::parse(
+      R"( {"id": 3, "params": {"text": "a\n\"b\"é😀",
+           "list": [true, false, null, -1.5e1]}} )");
+  EXPECT_EQ(value["id"].as_int(), 3);
+  EXPECT_EQ(value["params"]["text"].as_string(),
+            "a\n\"b\"\xc3\xa9\xf0\x9f\x98\x80");
+  const auto &list = value["params"]["list"].as_array();
+  ASSERT_EQ(list.size(), 4u);
+  EXPECT_TRUE(list[0].as_bool());
+  EXPECT_TRUE(list[2].is_null());
+  EXPECT_EQ(list[3].as_number(), -15);
+  EXPECT_TRUE(value["missing"]["deeper"].is_null());
+
+  // Dumping and parsing again gives the same value
+  EXPECT_EQ(Json::parse(value.dump()), value);
+
+  Json built;
+  built["line"] = 2;
+  built["name"] = "tab\there";
+  built["items"].push_back(Json(1.5));
+  EXPECT_EQ(built.dump(), R"({"items":[1.5],"line":2,"name":"tab\there"})");
+}
+
+TEST(JsonTest, RejectsMalformedText) {
+  EXPECT_THROW(Json::parse("{\"a\": }"), ProtocolException);
+  EXPECT_THROW(Json::parse("[1, 2"), ProtocolException);
+  EXPECT_THROW(Json::parse("\"open"), ProtocolException);
+  EXPECT_THROW(Json::parse("1 2"), ProtocolException);
+  EXPECT_THROW(Json::parse(std::string(1000, '[')), ProtocolException);
+}
@@ -0,0 +1,50 @@
+#include "ast.hpp"
+#include "exceptions.hpp"
+#include "lazy.hpp"
+#include <gtest/gtest.h>
+#include <set>
+#include <string>
+
+using namespace cha;
+
+namespace {
+
+std::set<std::string> function_names(const AstNodeList &ast) {
+  std::set<std::string> names;
+  for (const auto &node : ast) {
+    if (auto function =
+            dynamic_cast<const FunctionDeclarationNode *>(node.get())) {
+      EXPECT_FALSE(function->body_skipped());
+      names.insert(function->identifier());
+    }
+  }
+  return names;
+}
+
+} // namespace
+
+TEST(LazyTest, ParsesReachableBodies) {
+  AstNodeList ast = parse_reachable_text("const K = twice(2)\n"
+                                         "fun twice(a int) int { ret a * 2 }\n"
+                                         "fun unused() int { ret missing() }\n"
+                                         "fun helper() int { ret K }\n"
+                                         "export fun api() int { ret 1 }\n"
+                                         "fun main() int { ret helper() }\n",
+                                         "lazy.cha");
+  EXPECT_EQ(ast.size(), 5u);
+  EXPECT_EQ(function_names(ast),
+            (std::set<std::string>{"twice", "helper", "api", "main"}));
+}
+
+TEST(LazyTest, NeverParsesUnreachableBodies) {
+  // The body of unused does not even parse
+  AstNodeList ast = parse_reachable_text("fun unused() { ret 1 + }\n"
+                                         "fun main() int { ret 0 }\n",
+                                         "lazy.cha");
+  EXPECT_EQ(function_names(ast), (std::set<std::string>{"main"}));
+
+  EXPECT_THROW(parse_reachable_text("fun used() { ret 1 + }\n"
+                                    "fun main() { used() }\n",
+                                    "lazy.cha"),
+               ParseException);
+}
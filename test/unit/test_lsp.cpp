@@ -0,0 +1,188 @@
+#include "lsp.hpp"
+#include <chrono>
+#include <gtest/gtest.h>
+#include <sstream>
+
+using namespace cha;
+
+namespace {
+
+const char *SOURCE = "// geometry\n"
+                     "const SIDE = twice(3)\n"
+                     "\n"
+                     "fun twice(x int) int {\n"
+                     "    ret x * 2\n"
+                     "}\n"
+                     "\n"
+                     "fun area(w int, h int) int {\n"
+                     "    var a int = w * h\n"
+                     "    ret a\n"
+                     "}\n"
+                     "\n"
+                     "fun main() int {\n"
+                     "    ret area(SIDE, 2)\n"
+                     "}\n";
+
+TextRange range(int line, int character, int end_line, int end_character) {
+  return {{line, character}, {end_line, end_character}};
+}
+
+std::string frame(const std::string &body) {
+  return "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+}
+
+} // namespace
+
+TEST(LspTest, ValidatesAcrossDeclarations) {
+  Document document("geometry.cha", SOURCE);
+  EXPECT_EQ(document.chunks(), 4u);
+  EXPECT_TRUE(document.diagnostics().empty());
+  EXPECT_EQ(document.text(), SOURCE);
+
+  // Constants fold through functions of other declarations
+  EXPECT_EQ(document.hover({1, 7}), "const SIDE int");
+  EXPECT_EQ(document.hover({13, 9}), "fun area(w int, h int) int");
+  EXPECT_EQ(document.hover({8, 16}), "w int");
+}
+
+TEST(LspTest, EditsOnlyParseAndValidateWhatChanged) {
+  Document document("geometry.cha", SOURCE);
+
+  // A body edit keeps the signature, the callers stay as they are
+  document.edit(range(9, 8, 9, 9), "a + 1");
+  EXPECT_EQ(document.parsed(), 1u);
+  EXPECT_EQ(document.validated(), 1u);
+  EXPECT_TRUE(document.diagnostics().empty());
+
+  // A signature change validates the callers again
+  document.edit(range(7, 23, 7, 26), "bool");
+  EXPECT_EQ(document.parsed(), 1u);
+  EXPECT_EQ(document.validated(), 2u);
+  auto diagnostics = document.diagnostics();
+  ASSERT_FALSE(diagnostics.empty());
+  EXPECT_EQ(diagnostics[0].range.start.line, 9);
+
+  document.edit(range(7, 23, 7, 27), "int");
+  EXPECT_TRUE(document.diagnostics().empty());
+}
+
+TEST(LspTest, ReportsErrorsOfEachDeclaration) {
+  Document document("geometry.cha", SOURCE);
+
+  // Half typed code only breaks its own declaration
+  document.edit(range(4, 13, 4, 13), " $");
+  auto diagnostics = document.diagnostics();
+  ASSERT_EQ(diagnostics.size(), 1u);
+  EXPECT_EQ(diagnostics[0].range.start.line, 4);
+  EXPECT_EQ(diagnostics[0].message, "unexpected character '$'");
+  EXPECT_EQ(document.validated(), 0u);
+
+  document.edit(range(4, 13, 4, 15), "");
+  document.edit(range(13, 8, 13, 12), "volume");
+  diagnostics = document.diagnostics();
+  ASSERT_FALSE(diagnostics.empty());
+  EXPECT_EQ(diagnostics[0].range.start.line, 13);
+  EXPECT_EQ(diagnostics[0].message, "function 'volume' not found");
+
+  // Adding the missing function fixes its caller
+  document.edit(range(12, 0, 12, 0), "fun volume(a int, b int) int {\n"
+                                     "    ret a * b\n"
+                                     "}\n");
+  EXPECT_EQ(document.chunks(), 5u);
+  EXPECT_TRUE(document.diagnostics().empty());
+
+  // Lines after the edit moved, their declarations did not change
+  auto definition = document.definition({16, 10});
+  ASSERT_TRUE(definition.has_value());
+  EXPECT_EQ(definition->file, "geometry.cha");
+  EXPECT_EQ(definition->range.start.line, 12);
+}
+
+TEST(LspTest, FindsDefinitions) {
+  Document document("geometry.cha", SOURCE);
+
+  auto call = document.definition({13, 9});
+  ASSERT_TRUE(call.has_value());
+  EXPECT_EQ(call->range.start.line, 7);
+
+  auto constant = document.definition({13, 14});
+  ASSERT_TRUE(constant.has_value());
+  EXPECT_EQ(constant->range.start.line, 1);
+
+  auto local = document.definition({9, 8});
+  ASSERT_TRUE(local.has_value());
+  EXPECT_EQ(local->range.start.line, 8);
+  EXPECT_EQ(local->range.start.character, 4);
+
+  auto argument = document.definition({8, 16});
+  ASSERT_TRUE(argument.has_value());
+  EXPECT_EQ(argument->range.start.line, 7);
+  EXPECT_EQ(argument->range.start.character, 9);
+
+  EXPECT_FALSE(document.definition({0, 3}).has_value());
+}
+
+TEST(LspTest, LargeDocumentsOnlyRevisitTheEditedDeclaration) {
+  // 100k lines in 10k functions, each calling the one before
+  std::string text = "fun f0(x int) int {\n";
+  for (int line = 0; line < 8; ++line) {
+    text += "    x = x + 1\n";
+  }
+  text += "    ret x\n";
+  for (int i = 1; i < 10000; ++i) {
+    text += "}\nfun f" + std::to_string(i) + "(x int) int {\n";
+    for (int line = 0; line < 7; ++line) {
+      text += "    x = x + 1\n";
+    }
+    text += "    ret f" + std::to_string(i - 1) + "(x)\n";
+  }
+  text += "}\n";
+  Document document("large.cha", text);
+  ASSERT_EQ(document.chunks(), 10000u);
+  EXPECT_TRUE(document.diagnostics().empty());
+
+  auto start = std::chrono::steady_clock::now();
+  document.edit(range(50002, 8, 50002, 9), "2 * x");
+  auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start);
+  RecordProperty("edit_us", std::to_string(elapsed.count()));
+  EXPECT_EQ(document.parsed(), 1u);
+  EXPECT_EQ(document.validated(), 1u);
+  EXPECT_TRUE(document.diagnostics().empty());
+  EXPECT_EQ(document.hover({50002, 12}), "x int");
+}
+
+TEST(LspTest, ServesTheProtocol) {
+  std::string uri = "file:///tmp/my%20project/geometry.cha";
+  Json open;
+  open["jsonrpc"] = "2.0";
+  open["method"] = "textDocument/didOpen";
+  open["params"]["textDocument"]["uri"] = uri;
+  open["params"]["textDocument"]["text"] = SOURCE;
+
+  Json hover;
+  hover["jsonrpc"] = "2.0";
+  hover["id"] = 2;
+  hover["method"] = "textDocument/hover";
+  hover["params"]["textDocument"]["uri"] = uri;
+  hover["params"]["position"]["line"] = 13;
+  hover["params"]["position"]["character"] = 9;
+
+  std::istringstream in(
+      frame(R"({"jsonrpc":"2.0","id":1,"method":"initialize","params":{}})") +
+      frame(open.dump()) + frame(hover.dump()) +
+      frame(R"({"jsonrpc":"2.0","id":3,"method":"shutdown"})") +
+      frame(R"({"jsonrpc":"2.0","method":"exit"})"));
+  std::ostringstream out;
+  LanguageServer server(out);
+  EXPECT_EQ(server.run(in), 0);
+
+  std::string output = out.str();
+  EXPECT_NE(output.find(R"("definitionProvider":true)"), std::string::npos);
+  EXPECT_NE(output.find(R"("method":"textDocument/publishDiagnostics")"),
+            std::string::npos);
+  EXPECT_NE(output.find(R"("value":"fun area(w int, h int) int")"),
+            std::string::npos);
+  EXPECT_EQ(uri_to_path(uri), "/tmp/my project/geometry.cha");
+  EXPECT_EQ(path_to_uri("/tmp/my project/geometry.cha"), uri);
+}
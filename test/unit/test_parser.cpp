@@ -163,3 +163,85 @@ fun test() int {
       << "Should find NEGATE unary operation in parsed AST";
   EXPECT_TRUE(found_not) << "Should find NOT unary operation in parsed AST";
 }
+
+TEST(ParserTest, ExportedFunction) {
+  AstNodeList ast = cha::parse("test/integration/export_function.cha");
+  ASSERT_EQ(ast.size(), 3u);
+
+  auto area = dynamic_cast<const FunctionDeclarationNode *>(ast[0].get());
+  auto half = dynamic_cast<const FunctionDeclarationNode *>(ast[1].get());
+  ASSERT_NE(area, nullptr);
+  ASSERT_NE(half, nullptr);
+  EXPECT_TRUE(area->exported());
+  EXPECT_FALSE(half->exported());
+
+  // Clones keep the flag
+  AstNodePtr clone = area->clone();
+  EXPECT_TRUE(static_cast<FunctionDeclarationNode &>(*clone).exported());
+}
+
+TEST(ParserTest, ParsesTextAndRecoversFromErrors) {
+  AstNodeList ast = cha::parse_text("fun f() int {\n  ret 1\n}\n", "mem.cha");
+  ASSERT_EQ(ast.size(), 1u);
+  EXPECT_EQ(ast[0]->location().file, "mem.cha");
+
+  // Unknown characters are syntax errors, and the next parse starts afresh
+  try {
+    cha::parse_text("fun f$() {}\nfun g() {}\n", "bad.cha");
+    FAIL() << "expected a ParseException";
+  } catch (const ParseException &e) {
+    EXPECT_EQ(e.location().line_begin, 1);
+    EXPECT_EQ(e.location().column_begin, 6);
+    EXPECT_NE(e.message().find("unexpected character '$'"), std::string::npos);
+  }
+  EXPECT_EQ(cha::parse_text("fun h() {}", "mem.cha").size(), 1u);
+}
+
+TEST(ParserTest, SkipsFunctionBodies) {
+  const std::string text = "const K = 2\n"
+                           "fun f(a int) int {\n"
+                           "  // braces in comments: }\n"
+                           "  if a > 0 { ret a * K }\n"
+                           "  ret 0\n"
+                           "}\n"
+                           "fun g() {}\n";
+  AstNodeList ast = cha::parse_signatures(text, "lazy.cha");
+  ASSERT_EQ(ast.size(), 3u);
+
+  auto &f = static_cast<FunctionDeclarationNode &>(*ast[1]);
+  ASSERT_TRUE(f.body_skipped());
+  EXPECT_TRUE(f.body().empty());
+  EXPECT_EQ(f.arguments().size(), 1u);
+  EXPECT_EQ(f.location().line_begin, 2);
+  EXPECT_EQ(f.location().line_end, 6);
+  const SourceRange &range = f.skipped_body();
+  EXPECT_EQ(text.substr(range.offset, 1), "{");
+  EXPECT_EQ(text.substr(range.offset + range.size - 2, 2), "\n}");
+  EXPECT_EQ(range.line, 2);
+  EXPECT_EQ(range.column, 18);
+
+  // Bodies are parsed later with their locations in the whole text
+  cha::parse_body(f, text);
+  EXPECT_FALSE(f.body_skipped());
+  ASSERT_EQ(f.body().size(), 2u);
+  EXPECT_EQ(f.body()[0]->location().line_begin, 4);
+  EXPECT_EQ(f.body()[0]->location().column_begin, 3);
+  EXPECT_EQ(f.body()[1]->location().line_begin, 5);
+
+  auto &g = static_cast<FunctionDeclarationNode &>(*ast[2]);
+  ASSERT_TRUE(g.body_skipped());
+  cha::parse_body(g, text);
+  EXPECT_FALSE(g.body_skipped());
+  EXPECT_TRUE(g.body().empty());
+
+  // Syntax errors in a body are only found when it is parsed
+  const std::string broken = "fun f() {\n  ret 1 +\n}\n";
+  ast = cha::parse_signatures(broken, "lazy.cha");
+  ASSERT_EQ(ast.size(), 1u);
+  try {
+    cha::parse_body(static_cast<FunctionDeclarationNode &>(*ast[0]), broken);
+    FAIL() << "expected a ParseException";
+  } catch (const ParseException &e) {
+    EXPECT_EQ(e.location().line_begin, 3);
+  }
+}
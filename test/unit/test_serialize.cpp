@@ -0,0 +1,135 @@
+#include "ast.hpp"
+#include "exceptions.hpp"
+#include "parser.hpp"
+#include "serialize.hpp"
+#include "test_util.hpp"
+#include "validate.hpp"
+#include <cstdio>
+#include <gtest/gtest.h>
+
+using namespace cha;
+
+TEST(SerializeTest, RoundTripPreservesStructure) {
+  AstNodeList ast = parse_and_validate("examples/unary_demo.cha");
+
+  std::vector<char> buffer = serialize_ast(ast);
+  AstNodeList loaded = deserialize_ast(buffer.data(), buffer.size());
+
+  ASSERT_EQ(loaded.size(), ast.size());
+
+  // Serializing the loaded tree again must give identical bytes
+  EXPECT_EQ(serialize_ast(loaded), buffer);
+
+  auto func = dynamic_cast<const FunctionDeclarationNode *>(loaded[0].get());
+  ASSERT_NE(func, nullptr);
+  EXPECT_EQ(func->identifier(), "absoluteValue");
+  ASSERT_EQ(func->arguments().size(), 1u);
+  EXPECT_EQ(func->location().file, "examples/unary_demo.cha");
+  EXPECT_EQ(func->location().line_begin, ast[0]->location().line_begin);
+}
+
+TEST(SerializeTest, RoundTripPreservesResultTypes) {
+  AstNodeList ast;
+  AstNodeList body;
+  AstLocation loc("types.cha", 1, 1, 1, 10);
+
+  // Validation narrows the returned literal from c_int to int8
+  body.push_back(std::make_unique<FunctionReturnNode>(
+      loc, std::make_unique<ConstantIntegerNode>(loc, 7)));
+  ast.push_back(std::make_unique<FunctionDeclarationNode>(
+      loc, "f",
+      std::make_unique<AstType>(loc, AstType::Primitive(PrimitiveType::INT8)),
+      AstNodeList{}, std::move(body)));
+
+  Validator validator;
+  validator.validate(ast);
+
+  std::vector<char> buffer = serialize_ast(ast);
+  AstNodeList loaded = deserialize_ast(buffer.data(), buffer.size());
+
+  auto func = dynamic_cast<const FunctionDeclarationNode *>(loaded[0].get());
+  ASSERT_NE(func, nullptr);
+  auto ret = dynamic_cast<const FunctionReturnNode *>(func->body()[0].get());
+  ASSERT_NE(ret, nullptr);
+  auto literal = dynamic_cast<const ConstantIntegerNode *>(ret->value());
+  ASSERT_NE(literal, nullptr);
+  EXPECT_EQ(literal->value(), 7);
+  ASSERT_NE(literal->result_type(), nullptr);
+  EXPECT_EQ(literal->result_type()->as_primitive().type, PrimitiveType::INT8);
+}
+
+TEST(SerializeTest, RoundTripPreservesExport) {
+  AstNodeList ast = parse_and_validate("test/integration/export_function.cha");
+
+  std::vector<char> buffer = serialize_ast(ast);
+  AstNodeList loaded = deserialize_ast(buffer.data(), buffer.size());
+
+  auto area = dynamic_cast<const FunctionDeclarationNode *>(loaded[0].get());
+  auto half = dynamic_cast<const FunctionDeclarationNode *>(loaded[1].get());
+  ASSERT_NE(area, nullptr);
+  ASSERT_NE(half, nullptr);
+  EXPECT_TRUE(area->exported());
+  EXPECT_FALSE(half->exported());
+}
+
+TEST(SerializeTest, FileRoundTrip) {
+  AstNodeList ast = parse_and_validate("examples/test.cha");
+  std::string file = "test_serialize.chast";
+
+  write_ast(ast, file);
+  AstNodeList loaded;
+  EXPECT_NO_THROW(loaded = read_ast(file));
+  std::remove(file.c_str());
+
+  EXPECT_EQ(serialize_ast(loaded), serialize_ast(ast));
+}
+
+TEST(SerializeTest, DeeplyNestedSources) {
+  // Generated sources nest far deeper than recursion on the native stack
+  // allows
+  const int depth = 1000000;
+  std::string sum = "fun main() int {\n    ret 0";
+  for (int i = 0; i < depth; ++i) {
+    sum += " + 1";
+  }
+  sum += "\n}\n";
+  std::string ifs = "fun main() int {\n";
+  for (int i = 0; i < depth; ++i) {
+    ifs += "if true {\n";
+  }
+  ifs += "ret -" + std::string(depth, '-') + "1\n" +
+         std::string(depth, '}') + "\nret 0\n}\n";
+
+  for (const std::string &source : {sum, ifs}) {
+    AstNodeList ast = parse_text(source, "deep.cha");
+    Validator validator;
+    validator.validate(ast);
+
+    std::vector<char> buffer = serialize_ast(ast);
+    AstNodeList loaded = deserialize_ast(buffer.data(), buffer.size());
+    EXPECT_EQ(serialize_ast(loaded), buffer);
+  }
+}
+
+TEST(SerializeTest, RejectsInvalidInput) {
+  AstNodeList ast = parse_and_validate("examples/test.cha");
+  std::vector<char> buffer = serialize_ast(ast);
+
+  // Wrong magic
+  std::vector<char> bad_magic = buffer;
+  bad_magic[0] = 'X';
+  EXPECT_THROW(deserialize_ast(bad_magic.data(), bad_magic.size()),
+               SerializationException);
+
+  // Unsupported version
+  std::vector<char> bad_version = buffer;
+  bad_version[4] = static_cast<char>(AST_FORMAT_VERSION + 1);
+  EXPECT_THROW(deserialize_ast(bad_version.data(), bad_version.size()),
+               SerializationException);
+
+  // Truncated file
+  EXPECT_THROW(deserialize_ast(buffer.data(), buffer.size() - 1),
+               SerializationException);
+
+  EXPECT_THROW(read_ast("does_not_exist.chast"), SerializationException);
+}
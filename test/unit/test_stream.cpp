@@ -0,0 +1,97 @@
+#include "exceptions.hpp"
+#include "parser.hpp"
+#include "stream.hpp"
+#include <gtest/gtest.h>
+
+using namespace cha;
+
+TEST(StreamTest, HandsOverDeclarationsInOrder) {
+  DeclarationStream stream("test/integration/export_function.cha");
+  std::vector<std::string> names;
+  while (AstNodePtr node = stream.next()) {
+    names.push_back(
+        static_cast<const FunctionDeclarationNode &>(*node).identifier());
+  }
+  EXPECT_EQ(names, (std::vector<std::string>{"area", "half", "main"}));
+  EXPECT_EQ(stream.next(), nullptr);
+}
+
+TEST(StreamTest, ReportsParseErrors) {
+  DeclarationStream missing("test/integration/missing.cha");
+  EXPECT_THROW(missing.next(), ParseException);
+
+  DeclarationStream invalid("test/integration/parse_failure.cha");
+  EXPECT_THROW(invalid.next(), ParseException);
+}
+
+TEST(StreamTest, StopsTheParserWhenLeftEarly) {
+  {
+    // The parser waits for room in the stream when it is destroyed
+    DeclarationStream stream("test/integration/export_function.cha", 1);
+    ASSERT_NE(stream.next(), nullptr);
+  }
+
+  // Files parse again afterwards
+  EXPECT_EQ(parse("test/integration/export_function.cha").size(), 3u);
+}
+
+TEST(StreamTest, FullStreamDoesNotBlockOtherParses) {
+  // The parser of stream waits for room with its file half parsed
+  DeclarationStream stream("test/integration/export_function.cha", 1);
+  AstNodePtr first = stream.next();
+  ASSERT_NE(first, nullptr);
+
+  EXPECT_EQ(parse("test/integration/export_function.cha").size(), 3u);
+  AstNodeList text = parse_text("fun f() int {\n ret 1\n}\n", "text.cha");
+  ASSERT_EQ(text.size(), 1u);
+  EXPECT_EQ(text[0]->location().line_begin, 1);
+
+  // Its own parse goes on where it waited
+  std::vector<std::string> names;
+  while (AstNodePtr node = stream.next()) {
+    names.push_back(
+        static_cast<const FunctionDeclarationNode &>(*node).identifier());
+  }
+  EXPECT_EQ(names, (std::vector<std::string>{"half", "main"}));
+}
+
+TEST(StreamTest, UsedNames) {
+  AstNodeList ast = parse_text("const C = A + 1\n"
+                               "fun f(x int) int {\n"
+                               "    var y int = x + A\n"
+                               "    if y > 0 {\n"
+                               "        var z int = g(y)\n"
+                               "        ret z\n"
+                               "    }\n"
+                               "    y = B\n"
+                               "    ret z\n"
+                               "}\n",
+                               "test.cha");
+  ASSERT_EQ(ast.size(), 2u);
+
+  UsedNames constant = used_names(*ast[0]);
+  EXPECT_TRUE(constant.functions.empty());
+  EXPECT_EQ(constant.values, (std::set<std::string>{"A"}));
+
+  // z is only declared in the block of the if
+  UsedNames function = used_names(*ast[1]);
+  EXPECT_EQ(function.functions, (std::set<std::string>{"g"}));
+  EXPECT_EQ(function.values, (std::set<std::string>{"A", "B", "z"}));
+}
+
+TEST(StreamTest, UsedNamesOfDeeplyNestedSources) {
+  // Generated sources nest far deeper than recursion on the native stack
+  // allows
+  const int depth = 1000000;
+  std::string source = "fun f() int {\n";
+  for (int i = 0; i < depth; ++i) {
+    source += "if A {\n";
+  }
+  source += "ret g(" + std::string(depth, '-') + "B)\n" +
+            std::string(depth, '}') + "\nret 0\n}\n";
+  AstNodeList ast = parse_text(source, "deep.cha");
+
+  UsedNames names = used_names(*ast[0]);
+  EXPECT_EQ(names.functions, (std::set<std::string>{"g"}));
+  EXPECT_EQ(names.values, (std::set<std::string>{"A", "B"}));
+}
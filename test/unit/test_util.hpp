@@ -0,0 +1,26 @@
+#pragma once
+
+#include "ast.hpp"
+#include "parser.hpp"
+#include "validate.hpp"
+
+#include <fstream>
+#include <string>
+
+namespace cha {
+
+// AST of a source file, validated like the compiler does
+inline AstNodeList parse_and_validate(const std::string &file) {
+  AstNodeList ast = parse(file);
+  Validator validator;
+  validator.validate(ast);
+  return ast;
+}
+
+// Replace the contents of a file, creating it when missing
+inline void write_file(const std::string &file, const std::string &contents) {
+  std::ofstream out(file, std::ios::trunc);
+  out << contents;
+}
+
+} // namespace cha
@@ -5,6 +5,7 @@
 
 #include "../src/ast.hpp"
 #include "../src/exceptions.hpp"
+#include "../src/parser.hpp"
 #include "../src/validate.hpp"
 
 using namespace cha;
@@ -493,3 +494,114 @@ TEST(ValidateTest, InvalidIfCondition) {
   // Should throw exception for invalid condition type
   EXPECT_THROW(validator.validate(ast), ChaException);
 }
+
+// Test calling a function declared by another module
+TEST(ValidateTest, ExternalFunctionCall) {
+  auto make_caller = []() {
+    AstNodeList ast;
+    AstNodeList body;
+    body.push_back(std::make_unique<FunctionReturnNode>(
+        make_test_location(),
+        std::make_unique<FunctionCallNode>(make_test_location(), "helper",
+                                           AstNodeList{})));
+    ast.push_back(std::make_unique<FunctionDeclarationNode>(
+        make_test_location(), "caller", make_int_type(), AstNodeList{},
+        std::move(body)));
+    return ast;
+  };
+
+  // Without the declaration the call is unresolved
+  Validator plain;
+  AstNodeList unresolved = make_caller();
+  EXPECT_THROW(plain.validate(unresolved), ChaException);
+
+  AstNodeList helper_body;
+  helper_body.push_back(std::make_unique<FunctionReturnNode>(
+      make_test_location(),
+      std::make_unique<ConstantIntegerNode>(make_test_location(), 1)));
+  FunctionDeclarationNode helper(make_test_location(), "helper",
+                                 make_int_type(), AstNodeList{},
+                                 std::move(helper_body));
+
+  Validator validator;
+  validator.declare_external(helper);
+  AstNodeList resolved = make_caller();
+  EXPECT_NO_THROW(validator.validate(resolved));
+}
+
+TEST(ValidateTest, OneDeclarationAtATime) {
+  AstNodeList ast = parse_text("const A = 2\n"
+                               "fun f(x int) int {\n"
+                               "    ret x * A\n"
+                               "}\n"
+                               "const B = A * 3\n"
+                               "fun main() int {\n"
+                               "    ret f(B)\n"
+                               "}\n",
+                               "test.cha");
+  Validator validator;
+  for (auto &node : ast) {
+    if (auto func = dynamic_cast<FunctionDeclarationNode *>(node.get())) {
+      validator.declare_function(*func);
+    }
+    EXPECT_NO_THROW(validator.validate_declaration(*node));
+  }
+
+  // Constants are folded as soon as they are validated
+  auto &b = static_cast<ConstantDeclarationNode &>(*ast[2]);
+  auto value = dynamic_cast<const ConstantIntegerNode *>(&b.value());
+  ASSERT_NE(value, nullptr);
+  EXPECT_EQ(value->value(), 6);
+
+  // Only functions declared before are known, errors leave the validator
+  // usable
+  AstNodeList later = parse_text("fun g() int {\n"
+                                 "    ret h()\n"
+                                 "}\n"
+                                 "fun h() int {\n"
+                                 "    ret 1\n"
+                                 "}\n",
+                                 "test.cha");
+  validator.declare_function(
+      static_cast<const FunctionDeclarationNode &>(*later[0]));
+  EXPECT_THROW(validator.validate_declaration(*later[0]),
+               MultipleValidationException);
+  validator.declare_function(
+      static_cast<const FunctionDeclarationNode &>(*later[1]));
+  EXPECT_NO_THROW(validator.validate_declaration(*later[1]));
+
+  EXPECT_THROW(validator.declare_function(
+                   static_cast<const FunctionDeclarationNode &>(*ast[1])),
+               ValidationException);
+}
+
+TEST(ValidateTest, DeeplyNestedSources) {
+  // Generated sources nest far deeper than recursion on the native stack
+  // allows
+  const int depth = 1000000;
+  std::string sum = "fun main() int {\n    ret 0";
+  for (int i = 0; i < depth; ++i) {
+    sum += " + 1";
+  }
+  sum += "\n}\n";
+  std::string negation =
+      "fun main() int {\n    ret " + std::string(depth, '-') + "1\n}\n";
+  std::string ifs = "fun main() int {\n";
+  for (int i = 0; i < depth; ++i) {
+    ifs += "if true {\n";
+  }
+  ifs += "ret 1\n" + std::string(depth, '}') + "\nret 0\n}\n";
+
+  for (const std::string &source : {sum, negation, ifs}) {
+    AstNodeList ast = parse_text(source, "deep.cha");
+    Validator validator;
+    EXPECT_NO_THROW(validator.validate(ast));
+  }
+
+  // Errors deep down are still reported
+  std::string mismatch =
+      "fun main() int {\n    ret " + std::string(depth, '-') + "true\n}\n";
+  AstNodeList ast = parse_text(mismatch, "deep.cha");
+  Validator validator;
+  EXPECT_THROW(validator.validate(ast), ChaException);
+}
@@ -0,0 +1,104 @@
+#include "ast.hpp"
+#include "bytecode.hpp"
+#include "exceptions.hpp"
+#include "parser.hpp"
+#include "validate.hpp"
+#include "vm.hpp"
+#include <gtest/gtest.h>
+
+using namespace cha;
+
+namespace {
+
+BytecodeProgram compile_file(const std::string &file) {
+  AstNodeList ast = cha::parse(file);
+  Validator validator;
+  validator.validate(ast);
+  return BytecodeCompiler().compile(ast);
+}
+
+int64_t run_main(const std::string &file) {
+  BytecodeProgram program = compile_file(file);
+  EXPECT_GE(program.main, 0);
+  VirtualMachine vm(program);
+  return vm.run(program.main).i;
+}
+
+} // namespace
+
+TEST(VmTest, RunsRecursion) {
+  // count(100) - 97
+  EXPECT_EQ(run_main("test/integration/pgo_branch.cha"), 3);
+}
+
+TEST(VmTest, RunsCallsAndDivision) {
+  // half(area(2, 3))
+  EXPECT_EQ(run_main("test/integration/export_function.cha"), 3);
+}
+
+TEST(VmTest, UsesFoldedConstants) {
+  // fib(10) * 2 + 1 - 100
+  EXPECT_EQ(run_main("test/integration/const_eval.cha"), 11);
+}
+
+TEST(VmTest, RunsIfElseAndOperators) {
+  EXPECT_EQ(run_main("test/integration/vm_operators.cha"), 42);
+}
+
+TEST(VmTest, ArgumentsUseRegistersInOrder) {
+  BytecodeProgram program =
+      compile_file("test/integration/export_function.cha");
+  ASSERT_EQ(program.functions.size(), 3u);
+  EXPECT_EQ(program.functions[0].name, "area");
+  EXPECT_EQ(program.functions[0].arguments, 2u);
+  EXPECT_GE(program.functions[0].registers, 3u);
+  EXPECT_EQ(program.main, 2);
+}
+
+TEST(VmTest, DivisionByZeroTraps) {
+  BytecodeProgram program = compile_file("test/integration/vm_div_zero.cha");
+  VirtualMachine vm(program);
+  try {
+    vm.run(program.main);
+    FAIL() << "expected a runtime error";
+  } catch (const InterpreterException &e) {
+    EXPECT_NE(e.message().find("vm_div_zero.cha:2:"), std::string::npos);
+    EXPECT_NE(e.message().find("runtime error: division by zero"),
+              std::string::npos);
+  }
+}
+
+TEST(VmTest, DeepRecursionTraps) {
+  BytecodeProgram program =
+      compile_file("test/integration/vm_stack_overflow.cha");
+  VirtualMachine vm(program);
+  EXPECT_THROW(vm.run(program.main), InterpreterException);
+}
+
+TEST(VmTest, DeeplyNestedSources) {
+  // Generated sources nest far deeper than recursion on the native stack
+  // allows
+  const int depth = 1000000;
+  std::string sum = "fun main() int {\n    var x int = 1\n    ret x";
+  for (int i = 0; i < depth; ++i) {
+    sum += " + x";
+  }
+  sum += "\n}\n";
+  std::string ifs = "fun main() int {\n";
+  for (int i = 0; i < depth / 10; ++i) {
+    ifs += "if true {\n";
+  }
+  ifs += "ret " + std::string(depth, '-') + "7\n" +
+         std::string(depth / 10, '}') + "\nret 0\n}\n";
+
+  const int64_t expected[] = {depth + 1, 7};
+  const std::string sources[] = {sum, ifs};
+  for (int i = 0; i < 2; ++i) {
+    AstNodeList ast = parse_text(sources[i], "deep.cha");
+    Validator validator;
+    validator.validate(ast);
+    BytecodeProgram program = BytecodeCompiler().compile(ast);
+    VirtualMachine vm(program);
+    EXPECT_EQ(vm.run(program.main).i, expected[i]);
+  }
+}
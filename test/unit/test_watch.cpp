@@ -0,0 +1,64 @@
+#include "exceptions.hpp"
+#include "test_util.hpp"
+#include "watch.hpp"
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <functional>
+#include <gtest/gtest.h>
+#include <thread>
+
+using namespace cha;
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Change the files a moment after the watcher starts waiting
+void later(std::function<void()> change) {
+  std::thread([change] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    change();
+  }).detach();
+}
+
+} // namespace
+
+TEST(WatchTest, SeesWritesAndReplacements) {
+  fs::remove_all("test_watch");
+  fs::create_directories("test_watch");
+  write_file("test_watch/a.cha", "1");
+  write_file("test_watch/b.cha", "2");
+
+  FileWatcher watcher({"test_watch/a.cha", "test_watch/b.cha"});
+
+  later([] { write_file("test_watch/a.cha", "3"); });
+  EXPECT_TRUE(watcher.wait());
+
+  // Editors save by renaming a new file over the old one
+  later([] {
+    write_file("test_watch/b.cha.swp", "4");
+    std::rename("test_watch/b.cha.swp", "test_watch/b.cha");
+  });
+  EXPECT_TRUE(watcher.wait());
+  fs::remove_all("test_watch");
+}
+
+TEST(WatchTest, WatchesAddedFiles) {
+  fs::remove_all("test_watch");
+  fs::create_directories("test_watch/lib");
+  write_file("test_watch/a.cha", "1");
+  write_file("test_watch/lib/a.chai", "2");
+
+  FileWatcher watcher({"test_watch/a.cha"});
+  watcher.add({"test_watch/lib/a.chai", "test_watch/a.cha"});
+
+  later([] { write_file("test_watch/lib/a.chai", "3"); });
+  EXPECT_TRUE(watcher.wait());
+  EXPECT_THROW(watcher.add({"test_watch_missing/a.chai"}), ChaException);
+  fs::remove_all("test_watch");
+}
+
+TEST(WatchTest, RejectsMissingDirectories) {
+  EXPECT_THROW(FileWatcher({"test_watch_missing/a.cha"}), ChaException);
+}